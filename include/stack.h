@@ -36,7 +36,9 @@
 #define __STACK_H__
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /**
  * Stack operation return codes.
@@ -74,6 +76,14 @@ typedef enum {
      * Cannot increase reference count of stack any further. 
      */
     STACK_E_MAX_REFCOUNT,
+    /**
+     * Gave up waiting for an entry or for room in the stack.
+     */
+    STACK_E_TIMEOUT,
+    /**
+     * A file could not be read or written, or its contents are damaged.
+     */
+    STACK_E_IO,
     /**
      * Number of error codes.
      *
@@ -222,6 +232,164 @@ static inline stack_t* stack_alloc (void)
                                STACK_MAX_SIZE_NONE));
 }
 
+/**
+ * Stack behavior flags. Combine with bitwise OR.
+ */
+typedef unsigned int stack_flags_t;
+
+/**
+ * No special behavior.
+ */
+#define STACK_FLAG_NONE 0U
+
+/**
+ * When the stack reaches its maximum number of entries or runs out of
+ * space, stack_push() evicts the bottom-most entries to make room instead
+ * of returning STACK_E_FULL. The stack's memory use stays fixed no matter
+ * how many entries are pushed, which suits history and undo buffers.
+ *
+ * Each entry costs an extra size_t of bookkeeping so that eviction takes
+ * constant time.
+ */
+#define STACK_FLAG_DROP_OLDEST (1U << 0)
+
+/**
+ * The stack may be used by several threads at once. Every operation takes
+ * a lock on the stack, and threads can sleep in stack_pop_wait() and
+ * stack_push_wait() until an entry or free space appears. Stacks in shared
+ * memory always behave this way.
+ */
+#define STACK_FLAG_SYNC (1U << 1)
+
+/**
+ * Lock-free multi-producer, single-consumer stack. Any number of threads
+ * may call stack_push() at once; each push allocates a node and links it
+ * in with a single compare-and-swap. One consumer thread detaches all
+ * entries at once with stack_take_all(), or removes them one at a time
+ * with stack_pop(). stack_peek(), stack_get_num_entries() and
+ * stack_free() also work; other operations return STACK_E_INVALID.
+ *
+ * The stack's limits other than the maximum entry size are not enforced.
+ * Cannot be combined with other flags, and is not available for shared
+ * memory stacks.
+ */
+#define STACK_FLAG_MPSC (1U << 2)
+
+/**
+ * Other threads may take consistent snapshots of the stack with
+ * stack_snapshot_take() and walk them while the stack keeps changing.
+ * Taking a snapshot never blocks operations on the stack, and operations
+ * never wait for snapshots to be freed; an operation that would rewrite
+ * entries a snapshot still covers copies the stack's buffer instead.
+ * stack_top_view() is not supported.
+ *
+ * Cannot be combined with #STACK_FLAG_DROP_OLDEST or #STACK_FLAG_MPSC, and
+ * is not available for shared memory stacks.
+ */
+#define STACK_FLAG_SNAPSHOT (1U << 3)
+
+/**
+ * The stack has one writer thread, and any thread may call stack_peek(),
+ * stack_get_num_entries() and stack_is_empty() on it at any time without
+ * a lock. Such readers retry if an operation of the writer overlapped
+ * them, so they always see the stack between two operations; the writer
+ * only pays for two increments of a counter per operation. All other
+ * operations must be called from the writer thread.
+ *
+ * Suits metrics threads that poll the depth or top entry of a stack at
+ * high frequency. Cannot be combined with #STACK_FLAG_SYNC,
+ * #STACK_FLAG_MPSC or #STACK_FLAG_SNAPSHOT, and is not available for
+ * shared memory stacks.
+ */
+#define STACK_FLAG_SINGLE_WRITER (1U << 4)
+
+/**
+ * The stack's buffer starts small and doubles whenever an entry does not
+ * fit, up to the stack's maximum size, or without limit if it has none.
+ * Only the bytes in use are moved when the buffer grows. Suits stacks
+ * whose entries can be of any size.
+ *
+ * Cannot be combined with #STACK_FLAG_DROP_OLDEST, #STACK_FLAG_MPSC,
+ * #STACK_FLAG_SNAPSHOT or #STACK_FLAG_SINGLE_WRITER, and is not available
+ * for shared memory stacks.
+ */
+#define STACK_FLAG_GROW (1U << 5)
+
+/**
+ * The stack counts its operations, the bytes it copies and the sizes of
+ * the entries pushed onto it, and tracks the most entries and bytes it
+ * has held. Read the counters with stack_get_stats(). Costs a few
+ * additions per operation.
+ *
+ * Cannot be combined with #STACK_FLAG_MPSC, and is not available for
+ * shared memory stacks.
+ */
+#define STACK_FLAG_STATS (1U << 6)
+
+/**
+ * All valid stack behavior flags.
+ */
+#define STACK_FLAGS_ALL (STACK_FLAG_DROP_OLDEST | STACK_FLAG_SYNC | \
+                         STACK_FLAG_MPSC | STACK_FLAG_SNAPSHOT | \
+                         STACK_FLAG_SINGLE_WRITER | STACK_FLAG_GROW | \
+                         STACK_FLAG_STATS)
+
+/**
+ * Allocate a new stack with behavior flags.
+ *
+ * @param[in] max_entries
+ *     Maximum number of entries in the stack. Pass
+ *     #STACK_MAX_ENTRIES_NONE to create a stack with no such limit.
+ * @param[in] max_entry_size
+ *     Maximum size of an entry in the stack, in bytes. Pass
+ *     #STACK_MAX_ENTRY_SIZE_NONE to create a stack with no such limit.
+ * @param[in] default_entry_size
+ *     Default size of an entry in the stack. Pass
+ *     #STACK_DEFAULT_ENTRY_SIZE to create a stack with no such limit. 
+ * @param[in] max_size
+ *     Maximum size of the stack in bytes. Pass #STACK_MAX_SIZE_NONE to
+ *     create a stack with no such limit.
+ * @param[in] flags
+ *     Combination of STACK_FLAG_* values.
+ * @returns
+ *     Newly allocated stack on success, NULL on failure. Caller is
+ *     responsible for freeing newly allocating object using stack_free().
+ * @see
+ *     stack_alloc_custom(), stack_free()
+ * @post
+ *     Newly created stacks have a reference count of 1.
+ */
+extern stack_t* stack_alloc_flags(size_t max_entries,
+                                  size_t max_entry_size,
+                                  size_t default_entry_size,
+                                  size_t max_size,
+                                  stack_flags_t flags);
+
+/**
+ * Allocate a new fixed-size stack that drops its oldest entries when full.
+ *
+ * @param[in] max_entries
+ *     Maximum number of entries to keep. Pass #STACK_MAX_ENTRIES_NONE to
+ *     be limited only by max_size.
+ * @param[in] max_size
+ *     Size of the stack in bytes. Pass #STACK_MAX_SIZE_NONE for the
+ *     default size.
+ * @returns
+ *     Newly allocated stack on success, NULL on failure. Caller is
+ *     responsible for freeing newly allocating object using stack_free().
+ * @see
+ *     #STACK_FLAG_DROP_OLDEST
+ */
+static inline stack_t* stack_alloc_bounded (size_t max_entries,
+                                            size_t max_size)
+{
+    return (stack_alloc_flags(max_entries,
+                              STACK_MAX_ENTRY_SIZE_NONE,
+                              STACK_DEFAULT_ENTRY_SIZE,
+                              max_size,
+                              STACK_FLAG_DROP_OLDEST));
+}
+
 /**
  * Get number of entries in a stack.
  *
@@ -253,11 +421,14 @@ static inline bool stack_is_empty(stack_t *stack_p)
  * @param[in] entry_size
  *     Size of entry in bytes. 
  * @retval STACK_E_OK
- *     Successfully added entry.
+ *     Successfully added entry. For #STACK_FLAG_DROP_OLDEST stacks, the
+ *     bottom-most entries may have been evicted to make room.
  * @retval STACK_E_FULL
- *     Stack already holds maximum number of entries.
+ *     Stack already holds maximum number of entries, or has no room for
+ *     the entry.
  * @retval STACK_E_INVALID
- *     Invalid parameter.
+ *     Invalid parameter, or entry is larger than the stack's maximum
+ *     entry size.
  * @retval STACK_E_NOMEM
  *     Out of memory.
  * @retval STACK_E_INTERNAL
@@ -269,6 +440,83 @@ extern stack_err_e stack_push(stack_t *stack_p,
                               const void *entry_p,
                               size_t entry_size);
 
+/**
+ * Push a new entry onto a stack and return a pointer to its data, for the
+ * caller to fill in place. This avoids building the entry in a separate
+ * buffer when it is produced piece by piece, e.g., decoded from text.
+ *
+ * The entry is part of the stack as soon as this returns, so the caller
+ * must fill it before anything else can read the stack. Stacks that can
+ * be read by others while the caller fills the entry are not supported:
+ * #STACK_FLAG_SINGLE_WRITER stacks, whose readers don't lock,
+ * #STACK_FLAG_SYNC stacks, whose waiters are woken, #STACK_FLAG_SNAPSHOT
+ * stacks, whose snapshots include the entry, shared memory stacks, and
+ * #STACK_FLAG_MPSC stacks.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @param[in] entry_size
+ *     Size of entry in bytes.
+ * @param[out] entry_pp
+ *     On success, will be updated with a pointer to the entry_size bytes
+ *     of entry data, whose contents are undefined. The pointer is valid
+ *     only until the next operation that modifies the stack.
+ * @retval STACK_E_OK
+ *     Successfully added entry. For #STACK_FLAG_DROP_OLDEST stacks, the
+ *     bottom-most entries may have been evicted to make room.
+ * @retval STACK_E_FULL
+ *     Stack already holds maximum number of entries, or has no room for
+ *     the entry.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter, entry is larger than the stack's maximum entry
+ *     size, or the stack is of a kind that isn't supported.
+ * @retval STACK_E_INTERNAL
+ *     Another error occurred.
+ * @see
+ *     stack_push(), stack_top_view()
+ */
+extern stack_err_e stack_push_reserve(stack_t *stack_p,
+                                      size_t entry_size,
+                                      void **entry_pp);
+
+/**
+ * Push copies of several entries onto a stack in one operation.
+ *
+ * The entries are pushed in array order, so the last one ends up on top.
+ * The stack is locked once and, unless it is a #STACK_FLAG_DROP_OLDEST
+ * stack, makes room for all of the entries at once. Either every entry is
+ * pushed or none is, except for #STACK_FLAG_MPSC stacks, whose entries are
+ * pushed one at a time.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @param[in] entries_pp
+ *     Array of num_entries pointers to entries to copy onto the stack.
+ *     The same entry may appear several times.
+ * @param[in] entry_sizes_p
+ *     Array of num_entries entry sizes in bytes.
+ * @param[in] num_entries
+ *     Number of entries to push.
+ * @retval STACK_E_OK
+ *     Successfully added entries. For #STACK_FLAG_DROP_OLDEST stacks, the
+ *     bottom-most entries may have been evicted to make room.
+ * @retval STACK_E_FULL
+ *     Stack has no room for all of the entries. The stack is unchanged.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter, or an entry is larger than the stack's maximum
+ *     entry size. The stack is unchanged.
+ * @retval STACK_E_NOMEM
+ *     Out of memory.
+ * @retval STACK_E_INTERNAL
+ *     Another error occurred.
+ * @see
+ *     stack_push(), stack_drain()
+ */
+extern stack_err_e stack_push_multi(stack_t *stack_p,
+                                    const void *const *entries_pp,
+                                    const size_t *entry_sizes_p,
+                                    size_t num_entries);
+
 /**
  * Remove the top entry from a stack and return a copy of it.
  *
@@ -297,6 +545,82 @@ extern stack_err_e stack_pop(stack_t *stack_p,
                              void *entry_p,
                              size_t *entry_size_p);
 
+/**
+ * Special timeout value for stack_pop_wait() and stack_push_wait()
+ * indicating that the caller is willing to wait indefinitely.
+ */
+#define STACK_WAIT_FOREVER (-1)
+
+/**
+ * Remove the top entry from a stack and return a copy of it, waiting for
+ * an entry if the stack is empty.
+ *
+ * The calling thread sleeps until another thread or process pushes an
+ * entry; it does not poll.
+ *
+ * @param[in] stack_p
+ *     Stack to update. Must have been created with #STACK_FLAG_SYNC or
+ *     opened with stack_open_shm().
+ * @param[in] entry_p
+ *     On success, if not NULL, entry will be copied to this buffer.
+ * @param[in,out] entry_size_p
+ *     As for stack_pop().
+ * @param[in] timeout_ms
+ *     Longest time to wait, in milliseconds. Pass 0 to not wait at all, or
+ *     #STACK_WAIT_FOREVER to wait as long as it takes.
+ * @retval STACK_E_OK
+ *     Successfully removed top entry from stack.
+ * @retval STACK_E_TIMEOUT
+ *     Stack stayed empty for timeout_ms milliseconds.
+ * @retval STACK_E_BUF_OVERFLOW
+ *     entry_p buffer is too small to hold full value of top entry. The
+ *     entry is left on the stack.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter, or the stack does not support waiting.
+ * @retval STACK_E_INTERNAL
+ *     Another error occurred.
+ * @see
+ *     stack_pop(), stack_push_wait()
+ */
+extern stack_err_e stack_pop_wait(stack_t *stack_p,
+                                  void *entry_p,
+                                  size_t *entry_size_p,
+                                  int timeout_ms);
+
+/**
+ * Push copy of given entry onto a stack, waiting for room if the stack is
+ * full.
+ *
+ * The calling thread sleeps until another thread or process removes
+ * entries; it does not poll.
+ *
+ * @param[in] stack_p
+ *     Stack to update. Must have been created with #STACK_FLAG_SYNC or
+ *     opened with stack_open_shm().
+ * @param[in] entry_p
+ *     Entry to copy to top of stack.
+ * @param[in] entry_size
+ *     Size of entry in bytes.
+ * @param[in] timeout_ms
+ *     Longest time to wait, in milliseconds. Pass 0 to not wait at all, or
+ *     #STACK_WAIT_FOREVER to wait as long as it takes.
+ * @retval STACK_E_OK
+ *     Successfully added entry.
+ * @retval STACK_E_TIMEOUT
+ *     No room appeared within timeout_ms milliseconds.
+ * @retval STACK_E_FULL
+ *     Entry would not fit even in an empty stack.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter, entry larger than the stack's maximum entry size,
+ *     or the stack does not support waiting.
+ * @see
+ *     stack_push(), stack_pop_wait()
+ */
+extern stack_err_e stack_push_wait(stack_t *stack_p,
+                                   const void *entry_p,
+                                   size_t entry_size,
+                                   int timeout_ms);
+
 /**
  * Look at top entry of stack.
  *
@@ -325,71 +649,1005 @@ extern stack_err_e stack_peek(const stack_t *stack_p,
                               size_t *entry_size_p);
 
 /**
- * Increment reference count of stack.
+ * Copy a byte range out of an entry without removing it.
  *
- * The reference count of a stack should be incremented whenever its
- * pointer is copied. This will prevent one part of the system from
- * releasing the stack's memory while it is still in use elsewhere.
+ * Unlike stack_peek(), the caller's buffer only needs to be large enough
+ * for the requested slice, so a small header can be inspected without
+ * copying a large entry in full.
  *
  * @param[in] stack_p
- *     Stack to update.
+ *     Stack to query.
+ * @param[in] depth
+ *     Entry to query, counted from the top of the stack. Pass 0 for the
+ *     top entry, 1 for the entry below it, and so on.
+ * @param[in] offset
+ *     Offset, in bytes, of the first byte to copy from the entry's data.
+ *     May be equal to the entry size, in which case nothing is copied.
+ * @param[out] entry_p
+ *     Buffer to copy the range to.
+ * @param[in,out] entry_size_p
+ *     Initially, must be set to the number of bytes to copy. On success,
+ *     will be updated with the number of bytes actually copied, which is
+ *     smaller than requested if the range extends past the end of the entry.
  * @retval STACK_E_OK
- *     Successfully incremented reference count. Caller is responsible
- *     for decrementing the reference count using stack_free().
+ *     Successfully copied range.
+ * @retval STACK_E_EMPTY
+ *     Stack has fewer than depth + 1 entries.
  * @retval STACK_E_INVALID
- *     Invalid stack.
- * @retval STACK_E_MAX_REFCOUNT
- *     Stack already has the maximum number of references. 
+ *     Invalid parameter, or offset is beyond the end of the entry.
  * @see
- *     stack_alloc(), stack_get_refcount(), stack_free(),
+ *     stack_peek()
  */
-extern stack_err_e stack_incr_refcount(stack_t *stack_p);
+extern stack_err_e stack_peek_range(const stack_t *stack_p,
+                                    size_t depth,
+                                    size_t offset,
+                                    void *entry_p,
+                                    size_t *entry_size_p);
 
 /**
- * Get number of explicit references to the stack.
+ * Get direct access to the top entry of a stack.
+ *
+ * The entry may be read and modified in place, which avoids copying it
+ * out and pushing it back for read-modify-write updates. Its size cannot
+ * be changed this way; use stack_replace_top() for that. Changes made this
+ * way to a journaled stack are not journaled.
  *
  * @param[in] stack_p
- *     Stack to query. Invalid stacks are considered to have 0 references.
- * @returns
- *     Number of references.
+ *     Stack to query.
+ * @param[out] entry_pp
+ *     On success, will be updated with a pointer to the data of the top
+ *     entry. The pointer is valid only until the next operation that
+ *     modifies the stack.
+ * @param[out] entry_size_p
+ *     On success, will be updated with the size, in bytes, of the top entry.
+ * @retval STACK_E_OK
+ *     Successfully located top entry.
+ * @retval STACK_E_EMPTY
+ *     No entries in stack.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
  * @see
- *     stack_alloc(), stack_incr_refcount(), stack_free()
+ *     stack_peek(), stack_replace_top()
  */
-extern unsigned int stack_get_refcount(stack_t *stack_p);
+extern stack_err_e stack_top_view(stack_t *stack_p,
+                                  void **entry_pp,
+                                  size_t *entry_size_p);
 
 /**
- * Decrement a stack's reference count and free its memory if there
- * are no more references to it.
+ * Replace the top entry of a stack with a copy of the given entry.
+ *
+ * This is equivalent to a stack_pop() followed by a stack_push(), but the
+ * old entry is not copied out.
  *
  * @param[in] stack_p
- *     Stack to free. Invalid stacks are considered to already be
- *     freed, so nothign will happen in such cases. 
+ *     Stack to update.
+ * @param[in] entry_p
+ *     Entry to copy to top of stack. Must not point into the stack itself.
+ * @param[in] entry_size
+ *     Size of entry in bytes.
+ * @retval STACK_E_OK
+ *     Successfully replaced entry.
+ * @retval STACK_E_EMPTY
+ *     No entries in stack.
+ * @retval STACK_E_FULL
+ *     Not enough space in stack for new entry. The stack is unchanged.
+ * @retval STACK_E_NOMEM
+ *     Out of memory. The stack is unchanged.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
  * @see
- *     stack_alloc(), stack_incr_refcount()
+ *     stack_top_view()
  */
-extern void stack_free(stack_t *stack_p);
+extern stack_err_e stack_replace_top(stack_t *stack_p,
+                                     const void *entry_p,
+                                     size_t entry_size);
 
 /**
- * Decrement a stack's reference count and free its memory if there
- * are no more references to it. Set pointer to NULL for safety.
- *  
- * @param[in,out] stack_pp
- *     Initially, points to stack to free. *stack_pp will be set to point
- *     to NULL at end of operation. Does nothing if stack_pp is NULL or
- *     points to an invalid stack. 
- * @see
- *     stack_free()
+ * Push a copy of the top entry onto a stack.
+ *
+ * Stack effect: ( a -- a a )
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @retval STACK_E_OK
+ *     Successfully duplicated entry.
+ * @retval STACK_E_EMPTY
+ *     No entries in stack.
+ * @retval STACK_E_FULL
+ *     Not enough space in stack for the copy.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
  */
-static inline void stack_free_and_clear(stack_t **stack_pp)
-{
-    if (NULL != stack_pp) {
-        stack_free(*stack_pp);
-        *stack_pp = NULL;
-    }
-}
+extern stack_err_e stack_dup(stack_t *stack_p);
 
 /**
- * Print contents of stack to STDOUT.
+ * Push a copy of the second entry onto a stack.
+ *
+ * Stack effect: ( a b -- a b a )
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @retval STACK_E_OK
+ *     Successfully copied entry.
+ * @retval STACK_E_EMPTY
+ *     Fewer than two entries in stack.
+ * @retval STACK_E_FULL
+ *     Not enough space in stack for the copy.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
+ */
+extern stack_err_e stack_over(stack_t *stack_p);
+
+/**
+ * Exchange the top two entries of a stack in place.
+ *
+ * Stack effect: ( a b -- b a )
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @retval STACK_E_OK
+ *     Successfully exchanged entries.
+ * @retval STACK_E_EMPTY
+ *     Fewer than two entries in stack.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
+ */
+extern stack_err_e stack_swap(stack_t *stack_p);
+
+/**
+ * Move the third entry of a stack to the top in place.
+ *
+ * Stack effect: ( a b c -- b c a )
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @retval STACK_E_OK
+ *     Successfully rotated entries.
+ * @retval STACK_E_EMPTY
+ *     Fewer than three entries in stack.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
+ */
+extern stack_err_e stack_rot(stack_t *stack_p);
+
+/**
+ * Remove the top entries from a stack without copying them.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @param[in] num_entries
+ *     Number of entries to remove.
+ * @retval STACK_E_OK
+ *     Successfully removed entries.
+ * @retval STACK_E_EMPTY
+ *     Fewer than num_entries entries in stack. The stack is unchanged.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
+ */
+extern stack_err_e stack_drop(stack_t *stack_p, size_t num_entries);
+
+/**
+ * Move the top entries of one stack onto another stack.
+ *
+ * The moved entries keep their relative order, so the top entry of the
+ * source becomes the top entry of the destination. The entries are moved
+ * with a single copy rather than one pop and push per entry.
+ *
+ * @param[in] src_stack_p
+ *     Stack to take entries from.
+ * @param[in] dst_stack_p
+ *     Stack to add entries to. Must be a different stack than src_stack_p.
+ * @param[in] num_entries
+ *     Number of entries to move.
+ * @retval STACK_E_OK
+ *     Successfully moved entries.
+ * @retval STACK_E_EMPTY
+ *     Source stack has fewer than num_entries entries. Neither stack
+ *     is changed.
+ * @retval STACK_E_FULL
+ *     Not enough space in destination stack. Neither stack is changed.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
+ * @see
+ *     stack_concat()
+ */
+extern stack_err_e stack_transfer(stack_t *src_stack_p,
+                                  stack_t *dst_stack_p,
+                                  size_t num_entries);
+
+/**
+ * Move all entries of one stack onto another stack.
+ *
+ * The source stack is left empty. The bottom entry of the source ends up
+ * directly above the previous top entry of the destination.
+ *
+ * @param[in] dst_stack_p
+ *     Stack to add entries to.
+ * @param[in] src_stack_p
+ *     Stack to take entries from. Must be a different stack than
+ *     dst_stack_p.
+ * @retval STACK_E_OK
+ *     Successfully moved entries.
+ * @retval STACK_E_FULL
+ *     Not enough space in destination stack. Neither stack is changed.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
+ * @see
+ *     stack_transfer()
+ */
+extern stack_err_e stack_concat(stack_t *dst_stack_p, stack_t *src_stack_p);
+
+/**
+ * Order in which stack_drain() exports entries.
+ */
+typedef enum {
+    /**
+     * Top entry first, i.e., the order in which stack_pop() would return
+     * the entries.
+     */
+    STACK_ORDER_TOP_FIRST = 0,
+    /**
+     * Bottom entry first, i.e., the order in which the entries were pushed.
+     */
+    STACK_ORDER_BOTTOM_FIRST,
+} stack_order_e;
+
+/**
+ * Remove every entry from a stack and export them into a single buffer.
+ *
+ * The buffer is filled with one record per entry. Each record is a size_t
+ * 'size' field followed by 'size' bytes of entry data. Records are packed
+ * without padding, so the 'size' fields may be unaligned; use
+ * stack_drain_next() to walk them.
+ *
+ * With #STACK_ORDER_TOP_FIRST the records already match the internal
+ * layout of the stack and are exported with a single copy. In either order
+ * the stack is emptied without visiting its entries again.
+ *
+ * @param[in] stack_p
+ *     Stack to drain.
+ * @param[out] buf_p
+ *     Buffer to export records to. If NULL, the stack is left unchanged
+ *     and only the required buffer size is reported.
+ * @param[in,out] buf_size_p
+ *     Initially, must be set to size, in bytes, of buf_p buffer. The
+ *     initial value is ignored if buf_p is NULL. On success, or if the
+ *     buffer is too small, will be updated with the number of bytes the
+ *     records occupy.
+ * @param[in] order
+ *     Order in which to export the entries.
+ * @retval STACK_E_OK
+ *     Successfully drained stack.
+ * @retval STACK_E_BUF_OVERFLOW
+ *     buf_p buffer is too small to hold all records. The stack is unchanged.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
+ * @see
+ *     stack_drain_next()
+ */
+extern stack_err_e stack_drain(stack_t *stack_p,
+                               void *buf_p,
+                               size_t *buf_size_p,
+                               stack_order_e order);
+
+/**
+ * Walk the records exported by stack_drain().
+ *
+ * @param[in] buf_p
+ *     Buffer filled in by stack_drain().
+ * @param[in] buf_size
+ *     Number of bytes of records in buf_p, as reported by stack_drain().
+ * @param[in,out] pos_p
+ *     Offset of the next record in buf_p. Must be set to 0 before the
+ *     first call; updated to point past the returned record.
+ * @param[out] entry_pp
+ *     On success, will be updated with a pointer to the record's data.
+ * @param[out] entry_size_p
+ *     On success, will be updated with the size, in bytes, of the record's
+ *     data.
+ * @retval true
+ *     Successfully retrieved record.
+ * @retval false
+ *     No more records, or the next record is truncated.
+ */
+static inline bool stack_drain_next (const void *buf_p,
+                                     size_t buf_size,
+                                     size_t *pos_p,
+                                     const void **entry_pp,
+                                     size_t *entry_size_p)
+{
+    const unsigned char *record_p = (const unsigned char *)buf_p + *pos_p;
+    size_t               size     = 0;
+
+    if ((*pos_p > buf_size) || ((buf_size - *pos_p) < sizeof(size_t))) {
+        return (false);
+    }
+    memcpy(&size, record_p, sizeof(size_t));
+    if ((buf_size - *pos_p - sizeof(size_t)) < size) {
+        return (false);
+    }
+
+    *entry_pp = record_p + sizeof(size_t);
+    *entry_size_p = size;
+    *pos_p += sizeof(size_t) + size;
+
+    return (true);
+}
+
+/**
+ * Entries detached from a #STACK_FLAG_MPSC stack with stack_take_all().
+ */
+typedef struct stack_batch_ stack_batch_t;
+
+/**
+ * Detach every entry from a #STACK_FLAG_MPSC stack.
+ *
+ * The entries are taken with one atomic exchange, so producers are never
+ * blocked. Must only be called from the stack's consumer thread.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @returns
+ *     The entries, top entry first, or NULL if the stack was empty or is
+ *     not a #STACK_FLAG_MPSC stack. Walk them with stack_batch_iter_init()
+ *     and stack_iter_next(). Caller is responsible for freeing them using
+ *     stack_batch_free().
+ */
+extern stack_batch_t* stack_take_all(stack_t *stack_p);
+
+/**
+ * Free a batch of entries returned by stack_take_all().
+ *
+ * @param[in] batch_p
+ *     Entries to free. Does nothing if NULL.
+ */
+extern void stack_batch_free(stack_batch_t *batch_p);
+
+/**
+ * State of a walk over the entries of a stack or a batch.
+ *
+ * @note
+ *     The fields are private; use stack_iter_init() or
+ *     stack_batch_iter_init() and stack_iter_next().
+ */
+typedef struct {
+    /**
+     * Stack being walked, or NULL when walking a batch or a snapshot.
+     */
+    const stack_t *stack_p;
+    /**
+     * Next entry to return, or NULL at the end of the walk.
+     */
+    const void *next_p;
+    /**
+     * Number of entries left when walking a stack or a snapshot.
+     */
+    size_t remaining;
+} stack_iter_t;
+
+/**
+ * Start walking the entries of a stack from the top down.
+ *
+ * The walk reads the entries in place. It must not overlap any operation
+ * that changes the stack. Walks over #STACK_FLAG_MPSC stacks are always
+ * empty; walk the batch returned by stack_take_all() instead.
+ *
+ * @param[out] iter_p
+ *     Walk to start.
+ * @param[in] stack_p
+ *     Stack to walk. Invalid stacks are treated as empty.
+ * @see
+ *     stack_iter_next()
+ */
+extern void stack_iter_init(stack_iter_t *iter_p, const stack_t *stack_p);
+
+/**
+ * Start walking a batch of entries from the top down.
+ *
+ * @param[out] iter_p
+ *     Walk to start.
+ * @param[in] batch_p
+ *     Batch returned by stack_take_all(). NULL is an empty batch.
+ * @see
+ *     stack_iter_next()
+ */
+extern void stack_batch_iter_init(stack_iter_t *iter_p,
+                                  const stack_batch_t *batch_p);
+
+/**
+ * Get the next entry of a walk.
+ *
+ * @param[in,out] iter_p
+ *     Walk started with stack_iter_init(), stack_batch_iter_init() or
+ *     stack_snapshot_iter_init().
+ * @param[out] entry_pp
+ *     On success, will be updated with a pointer to the entry's data. The
+ *     pointer stays valid until the stack is changed or the batch or
+ *     snapshot freed.
+ * @param[out] entry_size_p
+ *     On success, will be updated with the size, in bytes, of the entry.
+ * @retval true
+ *     Successfully retrieved entry.
+ * @retval false
+ *     No more entries.
+ */
+extern bool stack_iter_next(stack_iter_t *iter_p,
+                            const void **entry_pp,
+                            size_t *entry_size_p);
+
+/**
+ * Consistent view of the entries of a #STACK_FLAG_SNAPSHOT stack.
+ */
+typedef struct stack_snapshot_ stack_snapshot_t;
+
+/**
+ * Take a consistent snapshot of a stack without blocking its owner.
+ *
+ * May be called from any thread while another thread uses the stack, for
+ * example to monitor or print it. The snapshot shows the stack as it was
+ * after some complete operation, and it does not change while the stack
+ * does. Taking it costs a few atomic operations and a small allocation;
+ * the entries are not copied.
+ *
+ * @param[in] stack_p
+ *     Stack to capture. Must not be freed while the call is in progress.
+ * @returns
+ *     Snapshot on success, NULL if the stack is invalid, was not created
+ *     with #STACK_FLAG_SNAPSHOT, or memory ran out. Walk it with
+ *     stack_snapshot_iter_init() and stack_iter_next(). Caller is
+ *     responsible for freeing it using stack_snapshot_free(); it remains
+ *     usable after the stack itself is freed.
+ */
+extern stack_snapshot_t* stack_snapshot_take(const stack_t *stack_p);
+
+/**
+ * Free a snapshot taken with stack_snapshot_take().
+ *
+ * @param[in] snapshot_p
+ *     Snapshot to free. Does nothing if NULL.
+ */
+extern void stack_snapshot_free(stack_snapshot_t *snapshot_p);
+
+/**
+ * Get number of entries in a snapshot.
+ *
+ * @param[in] snapshot_p
+ *     Snapshot to query. NULL is an empty snapshot.
+ * @returns
+ *     Number of entries the stack had when the snapshot was taken.
+ */
+extern size_t stack_snapshot_get_num_entries(
+    const stack_snapshot_t *snapshot_p);
+
+/**
+ * Start walking the entries of a snapshot from the top down.
+ *
+ * @param[out] iter_p
+ *     Walk to start.
+ * @param[in] snapshot_p
+ *     Snapshot returned by stack_snapshot_take(). NULL is an empty
+ *     snapshot.
+ * @see
+ *     stack_iter_next()
+ */
+extern void stack_snapshot_iter_init(stack_iter_t *iter_p,
+                                     const stack_snapshot_t *snapshot_p);
+
+/**
+ * Number of entries at which the descriptor from stack_get_event_fd()
+ * becomes readable, such that it signals any non-empty stack.
+ */
+#define STACK_EVENT_NOT_EMPTY 1
+
+/**
+ * Get a descriptor that is readable while a stack has enough entries.
+ *
+ * The descriptor is an eventfd that becomes readable when an operation
+ * brings the stack up to threshold entries and stops being readable when
+ * an operation takes it below the threshold. It can be added to an epoll,
+ * poll or select set so that an event loop consumes the stack only when
+ * there is work to do, instead of polling stack_get_num_entries(). The
+ * descriptor is level-triggered and is managed by the stack: callers must
+ * not read from it, write to it or close it.
+ *
+ * @param[in] stack_p
+ *     Stack to watch. Shared memory stacks are not supported, since other
+ *     processes could not signal the descriptor.
+ * @param[in] threshold
+ *     Number of entries at which the descriptor becomes readable. Pass
+ *     #STACK_EVENT_NOT_EMPTY to watch for a non-empty stack, or a higher
+ *     value for a high-watermark. Calling again replaces the threshold.
+ * @returns
+ *     Descriptor on success, or -1 on failure. The same descriptor is
+ *     returned every time; it is closed when the stack is freed.
+ */
+extern int stack_get_event_fd(stack_t *stack_p, size_t threshold);
+
+/**
+ * Number of buckets in the entry size histogram of #stack_stats_t.
+ */
+#define STACK_STATS_NUM_SIZES 24
+
+/**
+ * Counters of a #STACK_FLAG_STATS stack.
+ */
+typedef struct {
+    /**
+     * Number of entries pushed.
+     */
+    size_t num_pushes;
+    /**
+     * Number of entries removed from the top, by stack_pop(), stack_drop()
+     * or any other operation.
+     */
+    size_t num_pops;
+    /**
+     * Number of successful stack_peek() and stack_top_view() calls.
+     */
+    size_t num_peeks;
+    /**
+     * Most entries the stack has held at once.
+     */
+    size_t max_entries;
+    /**
+     * Most bytes the stack's entries have used at once, including the
+     * bookkeeping stored with each entry.
+     */
+    size_t max_used_size;
+    /**
+     * Bytes of entry data copied into and out of the stack, plus bytes
+     * moved when the buffer of a #STACK_FLAG_GROW stack grew. Entries
+     * that the caller fills after stack_push_reserve() are not counted.
+     */
+    size_t bytes_copied;
+    /**
+     * Number of entries pushed, by size. Bucket 0 counts empty entries,
+     * and bucket i counts entries of at least 2^(i-1) and less than 2^i
+     * bytes. The last bucket also counts all larger entries.
+     */
+    size_t sizes[STACK_STATS_NUM_SIZES];
+} stack_stats_t;
+
+/**
+ * Get the counters of a #STACK_FLAG_STATS stack.
+ *
+ * Like any other operation on a #STACK_FLAG_SINGLE_WRITER stack, this
+ * must be called by the writer.
+ *
+ * @param[in] stack_p
+ *     Stack to query.
+ * @param[out] stats_p
+ *     Updated with the counters.
+ * @retval STACK_E_OK
+ *     Successfully retrieved counters.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter, or the stack doesn't have #STACK_FLAG_STATS.
+ * @retval STACK_E_INTERNAL
+ *     Another error occurred.
+ * @see
+ *     stack_reset_stats()
+ */
+extern stack_err_e stack_get_stats(stack_t *stack_p, stack_stats_t *stats_p);
+
+/**
+ * Set the counters of a #STACK_FLAG_STATS stack back to zero. The
+ * high-water marks restart from the stack's current contents.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @retval STACK_E_OK
+ *     Successfully reset counters.
+ * @retval STACK_E_INVALID
+ *     Invalid stack, or the stack doesn't have #STACK_FLAG_STATS.
+ * @retval STACK_E_INTERNAL
+ *     Another error occurred.
+ * @see
+ *     stack_get_stats()
+ */
+extern stack_err_e stack_reset_stats(stack_t *stack_p);
+
+/**
+ * Make a stack durable by keeping a journal of its changes in a file.
+ *
+ * Each operation that changes the stack is recorded in an append-only
+ * journal at <path>.journal. Records are collected in memory, then
+ * written and flushed to disk with one fdatasync() once sync_ops
+ * operations are waiting or the oldest waiting operation is
+ * sync_interval_ms old, whichever comes first. The thresholds are
+ * checked as operations complete, so a stack that is left alone must be
+ * flushed with stack_journal_sync(); stack_free() also flushes. An
+ * operation is durable once it has been flushed.
+ *
+ * Opening the journal of a stack that was journaled before recovers the
+ * stack: the snapshot at <path>.snap, written by
+ * stack_journal_checkpoint() along with any deltas appended to it by
+ * stack_journal_checkpoint_delta(), is loaded and the journal is replayed
+ * onto it. A damaged or partly written record at the end of the journal,
+ * as left by a crash, ends the replay and is cut off. The files hold entries
+ * in the native byte order and word size.
+ *
+ * Changes made in place through stack_top_view() are not journaled; use
+ * stack_replace_top() on journaled stacks. Entries made with
+ * stack_push_reserve() are journaled by the next operation, by which time
+ * the caller has filled them.
+ *
+ * @param[in] stack_p
+ *     Empty stack to journal. Shared memory, arena, #STACK_FLAG_DROP_OLDEST
+ *     and #STACK_FLAG_MPSC stacks are not supported.
+ * @param[in] path
+ *     Path of the journal and snapshot without their suffixes. Files that
+ *     don't exist yet are created.
+ * @param[in] sync_ops
+ *     Number of waiting operations at which to flush, or 0 for no limit.
+ * @param[in] sync_interval_ms
+ *     Age in milliseconds of the oldest waiting operation at which to
+ *     flush, or 0 for no limit.
+ * @retval STACK_E_OK
+ *     Journal opened. The stack holds the recovered entries, if any.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter, unsupported or non-empty stack, or the stack
+ *     already has a journal.
+ * @retval STACK_E_FULL
+ *     The recovered entries don't fit in the stack.
+ * @retval STACK_E_NOMEM
+ *     Out of memory.
+ * @retval STACK_E_IO
+ *     The files can't be read or written, the snapshot is damaged, or the
+ *     journal doesn't belong with the snapshot.
+ * @retval STACK_E_INTERNAL
+ *     Another error occurred.
+ * @post
+ *     On error, the stack is left empty and has no journal.
+ * @see
+ *     stack_journal_sync(), stack_journal_checkpoint(),
+ *     stack_journal_checkpoint_delta(), stack_journal_restore()
+ */
+extern stack_err_e stack_journal_open(stack_t *stack_p,
+                                      const char *path,
+                                      size_t sync_ops,
+                                      unsigned int sync_interval_ms);
+
+/**
+ * Write and flush the waiting records of a stack's journal now.
+ *
+ * @param[in] stack_p
+ *     Journaled stack.
+ * @retval STACK_E_OK
+ *     Every operation so far is durable.
+ * @retval STACK_E_INVALID
+ *     Invalid stack, or the stack has no journal.
+ * @retval STACK_E_NOMEM
+ *     Out of memory for journal records, now or earlier.
+ * @retval STACK_E_IO
+ *     The journal could not be written, now or earlier.
+ * @note
+ *     After an error the journal stops recording, and every flush returns
+ *     the error until stack_journal_checkpoint() starts a new journal.
+ * @retval STACK_E_INTERNAL
+ *     Another error occurred.
+ */
+extern stack_err_e stack_journal_sync(stack_t *stack_p);
+
+/**
+ * Write a snapshot of a journaled stack and start a new, empty journal.
+ *
+ * The journal only grows until the next checkpoint, which bounds both its
+ * size and the time recovery takes. The snapshot is written to a
+ * temporary file that replaces the old snapshot once it is on disk, so a
+ * crash at any point leaves files that recover the stack.
+ *
+ * @param[in] stack_p
+ *     Journaled stack.
+ * @retval STACK_E_OK
+ *     Snapshot written and journal restarted.
+ * @retval STACK_E_INVALID
+ *     Invalid stack, or the stack has no journal.
+ * @retval STACK_E_IO
+ *     The snapshot could not be written, and the old snapshot and journal
+ *     are kept, or the new journal could not be started.
+ * @retval STACK_E_INTERNAL
+ *     Another error occurred.
+ */
+extern stack_err_e stack_journal_checkpoint(stack_t *stack_p);
+
+/**
+ * Write the changes to a journaled stack since its last checkpoint and
+ * start a new, empty journal.
+ *
+ * A stack only changes above the bottom entries that no operation has
+ * touched, so the changes are those entries' count and the entries above
+ * them. They are appended to the snapshot file as a delta, which costs
+ * I/O in proportion to how much of the stack changed rather than to its
+ * size. Recovery loads the snapshot and then applies its deltas in order.
+ *
+ * A full snapshot is written instead, as by stack_journal_checkpoint(),
+ * when there is no snapshot yet, when the delta would be no smaller than
+ * a full snapshot, or when it would make the snapshot file more than
+ * twice the size of a full snapshot, which bounds the time recovery
+ * takes.
+ *
+ * @param[in] stack_p
+ *     Journaled stack.
+ * @retval STACK_E_OK
+ *     Delta or snapshot written and journal restarted.
+ * @retval STACK_E_INVALID
+ *     Invalid stack, or the stack has no journal.
+ * @retval STACK_E_IO
+ *     The delta or snapshot could not be written, and the old snapshot
+ *     and journal are kept, or the new journal could not be started.
+ * @retval STACK_E_INTERNAL
+ *     Another error occurred.
+ */
+extern stack_err_e stack_journal_checkpoint_delta(stack_t *stack_p);
+
+/**
+ * Rebuild a stack from the snapshot, deltas and journal at a path.
+ *
+ * The files are read as stack_journal_open() would recover them, but are
+ * left as they are, and the stack is not journaled. A damaged tail of the
+ * journal or of the deltas is ignored. This restores a copy of a
+ * journaled stack, e.g., from a backup of its files.
+ *
+ * @param[in] stack_p
+ *     Empty stack without a journal to rebuild into. #STACK_FLAG_DROP_OLDEST
+ *     and #STACK_FLAG_MPSC stacks are not supported.
+ * @param[in] path
+ *     Path of the journal and snapshot without their suffixes. Missing
+ *     files count as empty.
+ * @retval STACK_E_OK
+ *     Stack rebuilt.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter, unsupported or non-empty stack, or the stack has
+ *     a journal.
+ * @retval STACK_E_FULL
+ *     The entries don't fit in the stack.
+ * @retval STACK_E_NOMEM
+ *     Out of memory.
+ * @retval STACK_E_IO
+ *     The files can't be read, the snapshot is damaged, or the journal
+ *     doesn't belong with the snapshot.
+ * @retval STACK_E_INTERNAL
+ *     Another error occurred.
+ * @post
+ *     On error, the stack is left empty.
+ */
+extern stack_err_e stack_journal_restore(stack_t *stack_p, const char *path);
+
+/**
+ * Increment reference count of stack.
+ *
+ * The reference count of a stack should be incremented whenever its
+ * pointer is copied. This will prevent one part of the system from
+ * releasing the stack's memory while it is still in use elsewhere.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @retval STACK_E_OK
+ *     Successfully incremented reference count. Caller is responsible
+ *     for decrementing the reference count using stack_free().
+ * @retval STACK_E_INVALID
+ *     Invalid stack.
+ * @retval STACK_E_MAX_REFCOUNT
+ *     Stack already has the maximum number of references. 
+ * @see
+ *     stack_alloc(), stack_get_refcount(), stack_free(),
+ */
+extern stack_err_e stack_incr_refcount(stack_t *stack_p);
+
+/**
+ * Get number of explicit references to the stack.
+ *
+ * @param[in] stack_p
+ *     Stack to query. Invalid stacks are considered to have 0 references.
+ * @returns
+ *     Number of references.
+ * @see
+ *     stack_alloc(), stack_incr_refcount(), stack_free()
+ */
+extern unsigned int stack_get_refcount(stack_t *stack_p);
+
+/**
+ * Decrement a stack's reference count and free its memory if there
+ * are no more references to it.
+ *
+ * @param[in] stack_p
+ *     Stack to free. Invalid stacks are considered to already be
+ *     freed, so nothign will happen in such cases. 
+ * @see
+ *     stack_alloc(), stack_incr_refcount()
+ */
+extern void stack_free(stack_t *stack_p);
+
+/**
+ * Decrement a stack's reference count and free its memory if there
+ * are no more references to it. Set pointer to NULL for safety.
+ *  
+ * @param[in,out] stack_pp
+ *     Initially, points to stack to free. *stack_pp will be set to point
+ *     to NULL at end of operation. Does nothing if stack_pp is NULL or
+ *     points to an invalid stack. 
+ * @see
+ *     stack_free()
+ */
+static inline void stack_free_and_clear(stack_t **stack_pp)
+{
+    if (NULL != stack_pp) {
+        stack_free(*stack_pp);
+        *stack_pp = NULL;
+    }
+}
+
+/**
+ * A group of stacks that share one buffer.
+ *
+ * Each stack of an arena owns a region of the shared buffer. When a stack
+ * runs out of room in its region, the free space of the whole arena is
+ * redistributed so that it can keep growing. Stacks that fill at different
+ * rates, such as the operand and control stacks of an interpreter, thus
+ * share their headroom instead of each reserving enough for its own worst
+ * case.
+ */
+typedef struct stack_arena_ stack_arena_t;
+
+/**
+ * Allocate several stacks that share one buffer.
+ *
+ * The stacks have no limits other than the size of the arena. A push onto
+ * one stack may move the entries of the others, so pointers obtained with
+ * stack_top_view() are invalidated by operations on any stack of the arena.
+ *
+ * @param[in] num_stacks
+ *     Number of stacks in the arena. Must be at least 1.
+ * @param[in] size
+ *     Size of the shared buffer in bytes.
+ * @returns
+ *     Newly allocated arena on success, NULL on failure. Caller is
+ *     responsible for freeing newly allocating object using
+ *     stack_arena_free().
+ * @see
+ *     stack_arena_get_stack(), stack_arena_free()
+ */
+extern stack_arena_t* stack_arena_alloc(size_t num_stacks, size_t size);
+
+/**
+ * Get one of the stacks of an arena.
+ *
+ * @param[in] arena_p
+ *     Arena to query.
+ * @param[in] index
+ *     Index of the stack, starting from 0.
+ * @returns
+ *     Stack on success, NULL if arena_p is invalid or index is out of
+ *     range. The stack belongs to the arena and is released by
+ *     stack_arena_free(); only references added with stack_incr_refcount()
+ *     should be released with stack_free().
+ */
+extern stack_t* stack_arena_get_stack(stack_arena_t *arena_p, size_t index);
+
+/**
+ * Free an arena and all of its stacks.
+ *
+ * @param[in] arena_p
+ *     Arena to free. Does nothing if arena_p is NULL or invalid.
+ */
+extern void stack_arena_free(stack_arena_t *arena_p);
+
+/**
+ * stack_open_shm() flag: create the stack if it does not exist yet.
+ */
+#define STACK_SHM_CREATE (1U << 16)
+
+/**
+ * stack_open_shm() flag: together with #STACK_SHM_CREATE, fail if the stack
+ * already exists.
+ */
+#define STACK_SHM_EXCL (1U << 17)
+
+/**
+ * Open a stack in POSIX shared memory.
+ *
+ * Processes that open the same name share one stack. Every stack operation
+ * takes a robust, process-shared lock on the stack for its duration, so
+ * several processes on one host can push and pop concurrently without a
+ * broker. If a process dies while holding the lock, the next process to
+ * take it sees the stack as it was after the last completed operation;
+ * should the dead process have left entries half rewritten, the stack is
+ * emptied instead.
+ *
+ * Each process gets its own handle. stack_top_view() returns a pointer
+ * into the shared segment, allowing zero-copy reads across processes, but
+ * the pointer only stays valid until any process next modifies the stack.
+ *
+ * @param[in] name
+ *     Name of the shared memory object, as for shm_open(): a leading '/'
+ *     followed by up to NAME_MAX characters, none of them '/'.
+ * @param[in] size
+ *     Size of the stack in bytes, used only when the stack is created.
+ *     Pass #STACK_MAX_SIZE_NONE for the default size.
+ * @param[in] flags
+ *     Combination of STACK_SHM_* values and, when the stack is created,
+ *     STACK_FLAG_* values. The behavior flags of an existing stack are
+ *     kept.
+ * @returns
+ *     Newly allocated handle on success, NULL on failure. Caller is
+ *     responsible for freeing the handle using stack_free(), which unmaps
+ *     the stack but leaves it in place for other processes.
+ * @see
+ *     stack_unlink_shm()
+ * @post
+ *     Newly opened handles have a reference count of 1.
+ */
+extern stack_t* stack_open_shm(const char *name,
+                               size_t size,
+                               stack_flags_t flags);
+
+/**
+ * Remove the name of a shared memory stack.
+ *
+ * Handles that are already open keep working; the memory is released once
+ * the last of them is freed.
+ *
+ * @param[in] name
+ *     Name that was passed to stack_open_shm().
+ * @retval STACK_E_OK
+ *     Successfully removed name.
+ * @retval STACK_E_INVALID
+ *     No shared memory stack by that name.
+ */
+extern stack_err_e stack_unlink_shm(const char *name);
+
+/**
+ * Output formats of stack_print_to().
+ */
+typedef enum {
+    /**
+     * The format of stack_print(): one line per entry, with entry data in
+     * hex digits separated by ':'.
+     */
+    STACK_PRINT_HEX = 0,
+    /**
+     * As #STACK_PRINT_HEX, but entry data is a quoted string in which
+     * unprintable characters appear as C escape sequences. A hex digit
+     * that follows a \\x escape is written as one too, so the string reads
+     * back as the same bytes.
+     */
+    STACK_PRINT_ESCAPED,
+    /**
+     * A JSON object with the stack's control data and an "items" array of
+     * entries, top entry first. Entry data is a string of hex digits.
+     */
+    STACK_PRINT_JSON,
+} stack_print_format_e;
+
+/**
+ * Print contents of stack to a stream.
+ *
+ * Output is formatted in a large buffer and written in big blocks, so
+ * printing a large stack is limited by the stream rather than by
+ * formatting.
+ *
+ * @param[in] stack_p
+ *     Stack to print. A suitable message will be displayed for invalid
+ *     stacks.
+ * @param[in] stream_p
+ *     Stream to print to.
+ * @param[in] format
+ *     Output format.
+ * @retval STACK_E_OK
+ *     Successfully printed stack.
+ * @retval STACK_E_INVALID
+ *     Invalid stack, stream or format. Invalid stacks are still printed.
+ * @retval STACK_E_INTERNAL
+ *     Writing to the stream failed.
+ */
+extern stack_err_e stack_print_to(stack_t *stack_p,
+                                  FILE *stream_p,
+                                  stack_print_format_e format);
+
+/**
+ * Print contents of stack to STDOUT.
+ *
+ * Equivalent to stack_print_to() with #STACK_PRINT_HEX.
  *
  * @param[in] stack_p
  *     Stack to print. A suitable message will be displayed for invalid stacks.
@@ -0,0 +1,151 @@
+/**
+ * @file
+ * Stack -- Server Wire Protocol
+ *
+ * Binary protocol spoken by "stack_cmd --listen" for clients that need more
+ * throughput than the line-based text shell gives.
+ *
+ * A client selects the protocol by sending #STACK_WIRE_HELLO as the first
+ * byte of the connection; any other first byte selects the text shell.
+ * The client then sends requests back to back, without waiting for the
+ * responses, and the server sends one response per request, in request
+ * order. Many requests can therefore be sent with a single write and many
+ * responses received with a single read.
+ *
+ * Each request is a #stack_wire_req_t header followed by name_size bytes of
+ * stack name and payload_size bytes of payload. Each response is a
+ * #stack_wire_rsp_t header followed by payload_size bytes of payload. All
+ * integers are in host byte order, since both ends are on the same host.
+ *
+ * <table>
+ *   <tr><th>Request</th><th>Request payload</th><th>Response payload</th>
+ *   <tr><td>#STACK_WIRE_OP_PUSH</td><td>Entry</td><td>None</td>
+ *   <tr><td>#STACK_WIRE_OP_POP</td><td>None</td><td>Entry</td>
+ *   <tr><td>#STACK_WIRE_OP_PEEK</td><td>None</td><td>Entry</td>
+ *   <tr><td>#STACK_WIRE_OP_SIZE</td><td>None</td>
+ *       <td>Number of entries, as a uint64_t</td>
+ * </table>
+ *
+ * An empty name means the session's stack, "default". A named stack is
+ * created by the first push to it; until then it reads as empty. When the
+ * server journals its stacks, a push to a stack whose journal file names
+ * would be longer than NAME_MAX fails with #STACK_E_INVALID. A response
+ * payload is only present if err is #STACK_E_OK. An entry of 4 GiB or more
+ * can't be returned; popping or peeking it fails with
+ * #STACK_E_BUF_OVERFLOW and leaves it on the stack.
+ *
+ * @author     Matthew Balint, mjbalint@gmail.com
+ * @date       November 2014
+ * @copyright
+ *     Copyright (c) 2014 by Matthew Balint.
+ *
+ *     This file is part of https://github.com/mjbalint/stack
+ *
+ *     https://github.com/mjbalint/stack is free software: you can
+ *     redistribute it and/or modify it under the terms of the
+ *     GNU Lesser Public License as published by the
+ *     Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     https://github.com/mjbalint/stack is distributed in the hope that it
+ *     will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *     warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *     See the GNU Lesser Public License for more details.
+ *
+ *     You should have received a copy of the GNU Lesser Public License
+ *     along with https://github.com/mjbalint/stack.  If not,
+ *     see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STACK_WIRE_H__
+#define __STACK_WIRE_H__
+
+#include <stdint.h>
+
+/**
+ * First byte a client sends to select the binary protocol. A text command
+ * can never start with it.
+ */
+#define STACK_WIRE_HELLO 0x00
+
+/**
+ * Largest request payload the server accepts. Larger requests end the
+ * connection.
+ */
+#define STACK_WIRE_MAX_PAYLOAD (1024 * 1024)
+
+/**
+ * Longest stack name the server accepts. Longer names end the connection.
+ */
+#define STACK_WIRE_MAX_NAME 255
+
+/**
+ * Request operations.
+ */
+typedef enum {
+    /**
+     * Push payload onto stack.
+     */
+    STACK_WIRE_OP_PUSH = 1,
+    /**
+     * Remove top entry of stack and return it.
+     */
+    STACK_WIRE_OP_POP,
+    /**
+     * Return top entry of stack.
+     */
+    STACK_WIRE_OP_PEEK,
+    /**
+     * Return number of entries in stack.
+     */
+    STACK_WIRE_OP_SIZE
+} stack_wire_op_e;
+
+/**
+ * Request header.
+ */
+typedef struct {
+    /**
+     * Number of payload bytes after the name.
+     */
+    uint32_t payload_size;
+    /**
+     * Number of stack name bytes after the header, with no terminating
+     * '\0'. 0 for the session's stack. A name containing '\0' ends the
+     * connection.
+     */
+    uint16_t name_size;
+    /**
+     * Operation, a #stack_wire_op_e.
+     */
+    uint8_t op;
+    /**
+     * Must be 0. Other values end the connection.
+     */
+    uint8_t reserved;
+} stack_wire_req_t;
+
+/**
+ * Response header.
+ */
+typedef struct {
+    /**
+     * Number of payload bytes after the header.
+     */
+    uint32_t payload_size;
+    /**
+     * Result, a #stack_err_e. Unknown operations fail with
+     * #STACK_E_INVALID.
+     */
+    uint16_t err;
+    /**
+     * Operation of the request being answered.
+     */
+    uint8_t op;
+    /**
+     * Always 0.
+     */
+    uint8_t reserved;
+} stack_wire_rsp_t;
+
+#endif /* __STACK_WIRE_H__ */
@@ -13,11 +13,11 @@
  *
  * Entries grow from the END of the buffer. This is a little counter-intuitive
  * but I think that it makes the code easier to read since the top-of-stack is
- * reachable by just adding the amount of free buffer space to the pointer
- * to the beginning of the buffer, e.g.,
+ * reachable by just adding the top-of-stack offset, which is also the amount
+ * of free buffer space, to the pointer to the beginning of the buffer, e.g.,
  *
  * <code>
- *     size_t *top_entry_size_p = stack_p->buf + stack_p->buf_free_size;
+ *     size_t *top_entry_size_p = stack_p->buf + stack_p->buf_top;
  * <endcode>
  *
  * The following diagram shows the layout of the stack's buffer for a sample
@@ -44,10 +44,114 @@
  *  |              `- End of free buffer space
  *  `- Start of free buffer space
  *
+ * @par Drop-oldest stacks
+ * Stacks created with #STACK_FLAG_DROP_OLDEST evict their bottom entries
+ * when they run out of room. To find the bottom entry without walking the
+ * whole stack, each entry also keeps a copy of its 'size' field after its
+ * 'data' field. The bottom entry ends at 'buf_end', so evicting it only
+ * moves that offset.
+ *
+ * Once the top entry reaches the start of the buffer, new entries wrap
+ * around to the space freed at the end of the buffer. The buffer then holds
+ * two runs of entries: the newer run from the top-of-stack to the end of the
+ * buffer, and the older run from 'buf_wrap' to 'buf_end'. Entries never
+ * straddle the end of the buffer; an entry that does not fit leaves a gap
+ * instead. For example, with 'T' marking the trailing 'size' copies:
+ *
+ *                 ,-- buf_end      ,-- Top-of-stack
+ *                 |                |
+ *                 V                V
+ * [__SddTSdTSdddT_________________SddTSdTSdddT]
+ *    ^
+ *    `- buf_wrap
+ *
+ * Operations that treat several entries as one region of bytes first
+ * rotate a wrapped buffer back into a single run.
+ *
+ * @par Shared memory stacks
+ * A stack opened with stack_open_shm() keeps its element buffer in a POSIX
+ * shared memory segment, behind a control block that holds the bookkeeping
+ * as plain offsets. Each process has its own handle pointing into its own
+ * mapping. Public operations bracket their work with stack_lock() and
+ * stack_unlock(), which take the segment's robust lock and copy the
+ * bookkeeping between the control block and the handle.
+ *
+ * @par Synchronized stacks
+ * Stacks created with #STACK_FLAG_SYNC, and all shared memory stacks, have
+ * a lock and two condition variables. stack_unlock() compares the stack
+ * with its state when it was locked and wakes threads waiting for entries
+ * or for free space, so every operation that adds or removes entries wakes
+ * the right waiters without knowing about them. For other stacks locking
+ * is a no-op.
+ *
+ * @par Snapshots
+ * A stack created with #STACK_FLAG_SNAPSHOT keeps its buffer in a reference
+ * counted chunk and, whenever an operation changes the stack, publishes a
+ * small view of it: the chunk, the top-of-stack and the number of entries.
+ * stack_snapshot_take() copies the published view and takes a reference to
+ * its chunk without any lock. This is safe because the owner only ever
+ * writes below the lowest top-of-stack it has published in the chunk,
+ * 'snap_shared_top'. An operation that must write above it first
+ * withdraws the view; if no reader holds the chunk, the write goes ahead
+ * in place, otherwise the owner moves to a copy of the chunk and the
+ * readers keep the old one.
+ *
+ * Withdrawn views are reclaimed after a grace period: readers announce
+ * themselves in 'snap_readers' for the few instructions it takes to copy a
+ * view, so once that count is seen at zero, no reader can still be looking
+ * at a view that is no longer published.
+ *
+ * @par Single-writer stacks
+ * A stack created with #STACK_FLAG_SINGLE_WRITER has a sequence count
+ * that stack_lock() makes odd and stack_unlock() makes even again, so it
+ * changes twice per operation. stack_peek() and stack_get_num_entries()
+ * read the stack without locking it and retry until the count was even
+ * and unchanged across their reads, which proves that no operation
+ * overlapped them.
+ *
+ * @par Counters
+ * A stack created with #STACK_FLAG_STATS counts pushes where entries are
+ * written into the buffer, pops in stack_remove_top(), and copies next to
+ * the memcpy() calls that make them. The high-water marks are raised in
+ * stack_unlock(), which every locked operation ends with, so no operation
+ * has to track them itself.
+ *
+ * @par Journals
+ * A stack given a journal with stack_journal_open() is recorded in an
+ * append-only file. Operations don't record themselves: stack_unlock()
+ * compares the stack with its state at the last record. Every operation
+ * only removes entries from the top and then adds entries on top, and
+ * the few places that remove entries or rewrite them in place call
+ * stack_journal_keep() with the bottom entries that they left alone. The
+ * change is then a pop of the entries above those and a push of the
+ * entries now above them, which are a single run of bytes in the buffer
+ * and are copied into the record as they are. Consecutive pops share a
+ * record, so popping one entry at a time costs no data.
+ *
+ * Records wait in memory until a flush is due, and then all of them are
+ * written with one write() and flushed with one fdatasync(), a group
+ * commit. Replay stops at the first record whose hash doesn't match, the
+ * torn tail of a crash. stack_journal_checkpoint() writes the whole stack
+ * as a single push record into a snapshot file with the next generation
+ * number, renames it into place and only then restarts the journal with
+ * that generation, so a journal one generation behind its snapshot is
+ * known to be already contained in it.
+ *
+ * stack_journal_checkpoint_delta() instead appends a delta to the
+ * snapshot file. Since operations only ever change a stack above some
+ * untouched bottom entries, the chunks of the buffer changed since the
+ * last checkpoint are always those above a low-water mark, counted from
+ * the end of the buffer so that it survives growth. stack_journal_log()
+ * keeps that mark as it records each change, in place of a dirty bit per
+ * chunk, and a delta is the count of entries below it and the bytes above
+ * it. Each delta moves the snapshot on by one generation, and the
+ * generations of a snapshot file's deltas must follow on from each other.
+ *
  * @par Limitations
- *    We are currently ignoring the stack configuration parameters and instead
- *    use a fixed-size buffer. We will add support for configuration in
- *    a future update.
+ *    Unless the stack has #STACK_FLAG_GROW, the buffer does not grow. Its
+ *    size is the stack's maximum size, or #STACK_DEFAULT_BUF_SIZE for
+ *    stacks without a maximum size. The default entry size is currently
+ *    ignored.
  *
  *    We use size_t for the size fields, which is necessary for enormous
  *    entries but is overkill for stacks which contain mostly small entries.
@@ -80,10 +184,22 @@
  */
 
 #include "../include/stack.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 /**
  * Stack operation return code to debug string array, indexed on return code
@@ -99,6 +215,8 @@ static char* stack_err_e_strings[STACK_NUM_ERR] =
     [STACK_E_INTERNAL]     = "INTERNAL",
     [STACK_E_BUF_OVERFLOW] = "BUFOVERFLOW",
     [STACK_E_MAX_REFCOUNT] = "MAXREFCOUNT",
+    [STACK_E_TIMEOUT]      = "TIMEOUT",
+    [STACK_E_IO]           = "IO",
 };
 
 /*
@@ -136,451 +254,5992 @@ const char* stack_err_e_to_string (stack_err_e err)
 #define STACK_MAX_REFCOUNT ((unsigned int)(-1))
 
 /**
- * A stack
+ * Buffer size for stacks that do not set a maximum size.
  */
-struct stack_ {
+#define STACK_DEFAULT_BUF_SIZE 1024
+
+/**
+ * Lock and wait conditions of a stack that may be used by several threads
+ * or processes at once.
+ */
+typedef struct stack_sync_ {
     /**
-     * Self pointer identify a properly intialized stack.
+     * Protects the stack's entries and bookkeeping.
      */
-    struct stack_ *self;
+    pthread_mutex_t lock;
     /**
-     * Stack element buffer.
+     * Broadcast when an empty stack gets entries.
+     */
+    pthread_cond_t not_empty;
+    /**
+     * Broadcast when entries are removed, freeing space.
+     */
+    pthread_cond_t not_full;
+} stack_sync_t;
+
+/**
+ * Magic number marking a fully initialized shared memory stack.
+ */
+#define STACK_SHM_MAGIC 0x53544b31U
+
+/**
+ * Control block at the start of a shared memory stack, followed by the
+ * element buffer.
+ *
+ * Every process maps the segment at a different address, so the control
+ * block holds only offsets and sizes. Each process keeps its own stack_t
+ * handle, whose pointers refer to its own mapping; stack_lock() loads the
+ * shared fields into the handle and stack_unlock() stores them back.
+ */
+typedef struct stack_shm_hdr_ {
+    /**
+     * #STACK_SHM_MAGIC once the creator has finished initializing.
      */
-    unsigned char buf[1024];
+    uint32_t magic;
     /**
-     * Amount of free space in buffer.
+     * Size of this control block, which is also the offset of the
+     * element buffer. Guards against mixing incompatible library builds.
      */
-    size_t buf_free_size;
+    uint32_t hdr_size;
+    /**
+     * Size of the whole segment in bytes.
+     */
+    size_t map_size;
+    /**
+     * Robust, process-shared lock protecting everything below, and the
+     * conditions that waiters sleep on.
+     */
+    stack_sync_t sync;
+    /**
+     * Behavior flags.
+     */
+    stack_flags_t flags;
+    /**
+     * Size of element buffer in bytes.
+     */
+    size_t buf_size;
+    /**
+     * Offset of top entry in buffer.
+     */
+    size_t buf_top;
+    /**
+     * Offset just past the bottom entry in buffer.
+     */
+    size_t buf_end;
+    /**
+     * Offset of the older run of entries when the buffer has wrapped.
+     */
+    size_t buf_wrap;
+    /**
+     * Does the buffer hold two runs of entries?
+     */
+    bool is_wrapped;
     /**
      * Number of entries in the stack.
      */
     size_t num_entries;
+} stack_shm_hdr_t;
+
+/**
+ * Reference counted element buffer of a #STACK_FLAG_SNAPSHOT stack.
+ */
+typedef struct {
     /**
-     * Reference count. 
+     * Number of references: one from the stack while it uses the chunk,
+     * one from each view of it. Updated atomically.
      */
-    unsigned int refcount;
-};
+    size_t refs;
+    /**
+     * Element buffer.
+     */
+    unsigned char data[];
+} stack_chunk_t;
 
-/*
- * Determine whether or not given stack is valid.
- *
- * See ../include/stack.h for API details.
+/**
+ * View of the entries of a #STACK_FLAG_SNAPSHOT stack at one point in
+ * time. The stack publishes views of itself, and each snapshot is a copy
+ * of a published view.
  */
-bool stack_is_valid (const stack_t *stack_p)
-{
-    return ((NULL != stack_p) && (stack_p == stack_p->self)); 
-}
+struct stack_snapshot_ {
+    /**
+     * Chunk holding the entries.
+     */
+    stack_chunk_t *chunk_p;
+    /**
+     * Offset of top entry in chunk.
+     */
+    size_t buf_top;
+    /**
+     * Number of entries.
+     */
+    size_t num_entries;
+    /**
+     * Next view on the stack's retired or free list.
+     */
+    struct stack_snapshot_ *next;
+};
 
-/*
- * Allocate a new stack.
- *
- * See ../include/stack.h for API details. 
+/**
+ * Identifies a journal file, "STKJ".
  */
-stack_t* stack_alloc_custom (__attribute__((unused)) size_t max_entries,
-                             __attribute__((unused)) size_t max_entry_size,
-                             __attribute__((unused)) size_t default_entry_size,
-                             __attribute__((unused)) size_t max_size)
-{
-    stack_t *new_stack_p = NULL;                 /* Newly allocated stack     */
-
-    new_stack_p = malloc(sizeof(stack_t));
-    if (NULL == new_stack_p) {
-        return (NULL);
-    }
-
-    /*
-     * Initialize the stack.
-     */
-    new_stack_p->num_entries = 0;
-    new_stack_p->buf_free_size = sizeof(new_stack_p->buf);
-    new_stack_p->refcount = 1;
-    new_stack_p->self = new_stack_p;
+#define STACK_JOURNAL_MAGIC 0x53544b4aU
 
-    return (new_stack_p);
-}
+/**
+ * Identifies a journal snapshot file, "STKS".
+ */
+#define STACK_JOURNAL_SNAP_MAGIC 0x53544b53U
 
-/*
- * Get number of entries in a stack.
- *
- * See ../include/stack.h for API details.
+/**
+ * Bytes of journal records collected in memory at which they are written
+ * out, even if they need not be flushed yet.
  */
-size_t stack_get_num_entries (stack_t *stack_p)
-{
-    if (! stack_is_valid(stack_p)) {
-        return (0);
-    }
+#define STACK_JOURNAL_WRITE_SIZE (1024 * 1024)
 
-    return (stack_p->num_entries);
-}
+/**
+ * Smallest buffer for journal records.
+ */
+#define STACK_JOURNAL_MIN_BUF_SIZE 4096
 
 /**
- * Determine whether or not stack is empty.
- *
- * @note
- *     This is a private implementation for use with stacks that have
- *     already been validated.
- *
- * @param[in] stack_p
- *     Stack to query. MUST BE A VALID STACK otherwise results are
- *     indeterminate.
- * @retval true
- *     Stack has no entries.
- * @retval false
- *     Stack has at least one entry.
+ * FNV-1a offset basis, the hash of no bytes.
  */
-static inline bool stack_is_empty_impl (const stack_t *stack_p)
-{
-    return (stack_p->num_entries < 1);
-}
+#define STACK_JOURNAL_HASH_INIT 2166136261U
 
 /**
- * Get top entry in stack. 
- *
- * @note
- *     This is a private implementation for use with stacks that have
- *     already been validated.
- *
- * @param[in] stack_p
- *     Stack to query. MUST BE A VALID, NON-EMPTY STACK otherwise results
- *     are indeterminate.
- * @param[out] size_pp
- *     If not NULL, will be updated with pointer to
- *     'size' field of top entry in stack. Pointer is valid only until
- *     next stack_push() or stack_pop() operation. 
- * @param[out] data_pp
- *     If not NULL, will be updated with pointer to
- *     'data' field of top entry in stack. Pointer is valid only until
- *     next stack_push() or stack_pop() operation. 
+ * Header at the start of journal and snapshot files.
  */
-static void stack_get_top_entry (const stack_t *stack_p,
-                                 size_t **size_pp,
-                                 void **data_pp)
-{
-    /*
-     * The top entry in the stack is located immediately after the
-     * the free portion of the buffer.
-     *
-     * The fixed-length 'size' field is first, followed by the
-     * variable-length 'data' field.
+typedef struct {
+    /**
+     * #STACK_JOURNAL_MAGIC or #STACK_JOURNAL_SNAP_MAGIC.
      */
-    if (NULL != size_pp) {
-        *size_pp = (size_t *)(stack_p->buf + stack_p->buf_free_size);
-    }
-    if (NULL != data_pp) {
-        *data_pp =
-            (void *)(stack_p->buf + stack_p->buf_free_size + sizeof(size_t));
-    }
-}
+    uint32_t magic;
+    /**
+     * Size of the 'size' field of entries, which are stored as they are
+     * laid out in a stack buffer.
+     */
+    uint32_t word_size;
+    /**
+     * Generation of a snapshot. A journal has the generation of the
+     * snapshot that it is replayed onto.
+     */
+    uint64_t gen;
+} stack_journal_hdr_t;
 
 /**
- * Get top entry in stack. 
- *
- * @note
- *     This is a private implementation for use with stacks that have
- *     already been validated.
- *
- * @param[in] stack_p
- *     Stack to query.
- *
- *     MUST BE A VALID, NON-EMPTY STACK otherwise results are indeterminate.
- * @param[in,out] size_pp
- *     Initially, set to point to 'size' field of current entry in stack,
- *     either from  stack_get_top_entry() or stack_get_next_entry().
- *     On success, will be set to point to 'size' field of next entry in stack,
- *     otherwise will be set to NULL.
- *
- *     MUST BE VALID, otherwise results are indeterminate.
- * @param[in,out] data_pp
- *     Initially, set to point to 'data' field of current entry in stack,
- *     either from stack_get_top_entry() or stack_get_next_entry().
- *     On success, will be set to point to 'data' field of next entry in stack,
- *     otherwise will be set to NULL.
- *
- *     MUST BE VALID, otherwise results are indeterminate.
- * @retval true
- *     Successfully retrieved next entry
- * @retval false
- *     Failed to retrieve next entry.
+ * Journal record types.
  */
-static bool stack_get_next_entry (const stack_t *stack_p,
-                                  size_t **size_pp,
-                                  void **data_pp)
-{
-    size_t *entry_size_p = NULL;                 /* Next entry's 'size' field */
-
-    if (NULL == *size_pp) {
-        *data_pp = NULL;
-        return (false);
-    }
-    if (NULL == *data_pp) {
-        *size_pp = NULL;
-        return (false); 
-    }
-
-    /*
-     * The next entry in the stack is located 'size' bytes after the
-     * data pointer. Make sure that this isn't past the end of the buffer. 
+typedef enum {
+    /**
+     * Entries pushed. The record data is the entries as laid out in the
+     * buffer, top entry first.
      */
-    entry_size_p = (size_t *)((unsigned char *)(*data_pp) + **size_pp);
-    if ((unsigned char *)entry_size_p > (stack_p->buf + sizeof(stack_p->buf))) {
-        *size_pp = NULL;
-        *data_pp = NULL;
-        return (false);
-    }
-    *size_pp = entry_size_p;
-    *data_pp = (void *)((unsigned char *)entry_size_p + sizeof(size_t));
-
-    return (true);
-}
+    STACK_JOURNAL_REC_PUSH = 1,
+    /**
+     * Entries removed from the top. The record has no data.
+     */
+    STACK_JOURNAL_REC_POP,
+    /**
+     * Changes since the previous generation of a snapshot, appended to the
+     * snapshot file. The record data is a #stack_journal_delta_t followed
+     * by the pushed entries as for #STACK_JOURNAL_REC_PUSH.
+     */
+    STACK_JOURNAL_REC_DELTA
+} stack_journal_rec_e;
 
-/*
- * Push copy of given entry onto a stack. 
- * 
- * See ../include/stack.h for API details.
+/**
+ * Header of a journal record. The record data follows it. A snapshot file
+ * holds a single push record of every entry.
  */
-stack_err_e stack_push (stack_t *stack_p,
-                        const void *entry_p, 
-                        size_t entry_size)
-{
-    size_t *buf_entry_size_p = NULL;                 /* Entry size in buffer  */
-    void   *buf_entry_p      = NULL;                 /* Entry in buffer       */
-    size_t  new_entry_size   = 0;                    /* Total new entry space */
-
-    /*
-     * Check inputs.
+typedef struct {
+    /**
+     * Record type, a #stack_journal_rec_e.
      */
-    if (! stack_is_valid(stack_p)) {
-        return (STACK_E_INVALID);
-    }
-    if ((NULL == entry_p) && (entry_size > 0)) { 
-        return (STACK_E_INVALID);
-    }
-
-    /*
-     * Make sure that there is enough space left in the buffer for the new
-     * entry.
+    uint32_t type;
+    /**
+     * FNV-1a hash of the header, with this field 0, and the data.
      */
-    new_entry_size = sizeof(size_t) + entry_size;
-    if (new_entry_size > stack_p->buf_free_size) {
-        return (STACK_E_FULL);
-    }
-
-    /*
-     * Reserve space for the new entry.
+    uint32_t check;
+    /**
+     * Number of entries pushed or removed.
      */
-    stack_p->num_entries++;
-    stack_p->buf_free_size -= new_entry_size;
-
-    /*
-     * Copy data for entry into buffer 
+    uint64_t num_entries;
+    /**
+     * Size of the record data in bytes.
      */
-    stack_get_top_entry(stack_p, &buf_entry_size_p, &buf_entry_p);
-    *buf_entry_size_p = entry_size;
-    if (entry_size > 0) {
-    	memcpy(buf_entry_p, entry_p, entry_size);
-    }
-
-    return (STACK_E_OK);
-}
+    uint64_t size;
+} stack_journal_rec_t;
+
+/**
+ * Start of the data of a delta record.
+ */
+typedef struct {
+    /**
+     * Generation that the delta moves the snapshot to, one more than the
+     * generation before it.
+     */
+    uint64_t gen;
+    /**
+     * Number of bottom entries kept from the previous generation. The
+     * entries above them are removed before the record's entries are
+     * pushed.
+     */
+    uint64_t num_kept;
+} stack_journal_delta_t;
+
+/**
+ * Journal of a durable stack.
+ */
+typedef struct {
+    /**
+     * Journal file, opened for appending.
+     */
+    int fd;
+    /**
+     * Path of the snapshot file.
+     */
+    char *snap_path_p;
+    /**
+     * Path at which a new snapshot is written before it replaces the old
+     * one.
+     */
+    char *tmp_path_p;
+    /**
+     * Generation of the snapshot and journal.
+     */
+    uint64_t gen;
+    /**
+     * Number of waiting operations at which to flush, or 0.
+     */
+    size_t sync_ops;
+    /**
+     * Age of the oldest waiting operation at which to flush, or 0.
+     */
+    unsigned int sync_interval_ms;
+    /**
+     * Records not yet written to the file.
+     */
+    unsigned char *buf;
+    /**
+     * Bytes of records in buf.
+     */
+    size_t buf_len;
+    /**
+     * Size of buf in bytes.
+     */
+    size_t buf_size;
+    /**
+     * Offset in buf of the last record if it is a pop record, which later
+     * pops are added to, or SIZE_MAX.
+     */
+    size_t pop_pos;
+    /**
+     * Number of entries in the stack as of the last record.
+     */
+    size_t num_logged;
+    /**
+     * Number of bottom entries that have not changed since the last
+     * record.
+     */
+    size_t num_kept;
+    /**
+     * Bytes used by the num_kept bottom entries.
+     */
+    size_t kept_size;
+    /**
+     * Is the top entry still being filled by the caller of
+     * stack_push_reserve()?
+     */
+    bool is_deferred;
+    /**
+     * Bytes of the snapshot file holding the snapshot and its deltas, or 0
+     * if there is no snapshot to add deltas to.
+     */
+    size_t snap_size;
+    /**
+     * Number of bottom entries that have not changed since the last
+     * checkpoint.
+     */
+    size_t snap_num_kept;
+    /**
+     * Bytes used by the snap_num_kept bottom entries.
+     */
+    size_t snap_kept_size;
+    /**
+     * Number of operations recorded since the last flush.
+     */
+    size_t num_unsynced;
+    /**
+     * When the oldest operation since the last flush was recorded.
+     */
+    struct timespec unsynced_since;
+    /**
+     * First error keeping the journal, after which it stops recording.
+     */
+    stack_err_e err;
+} stack_journal_t;
+
+/**
+ * A stack
+ */
+struct stack_ {
+    /**
+     * Self pointer identify a properly intialized stack.
+     */
+    struct stack_ *self;
+    /**
+     * Stack element buffer.
+     */
+    unsigned char *buf;
+    /**
+     * Size of element buffer in bytes.
+     */
+    size_t buf_size;
+    /**
+     * Offset of top entry in buffer.
+     */
+    size_t buf_top;
+    /**
+     * Offset just past the bottom entry in buffer.
+     */
+    size_t buf_end;
+    /**
+     * Offset of the older run of entries when the buffer has wrapped.
+     */
+    size_t buf_wrap;
+    /**
+     * Does the buffer hold two runs of entries?
+     */
+    bool is_wrapped;
+    /**
+     * Bytes of bookkeeping stored with each entry.
+     */
+    size_t entry_overhead;
+    /**
+     * Number of entries in the stack.
+     */
+    size_t num_entries;
+    /**
+     * Maximum number of entries, or #STACK_MAX_ENTRIES_NONE.
+     */
+    size_t max_entries;
+    /**
+     * Maximum size of an entry, or #STACK_MAX_ENTRY_SIZE_NONE.
+     */
+    size_t max_entry_size;
+    /**
+     * Size the buffer of a #STACK_FLAG_GROW stack may grow to, or
+     * #STACK_MAX_SIZE_NONE.
+     */
+    size_t max_size;
+    /**
+     * Behavior flags.
+     */
+    stack_flags_t flags;
+    /**
+     * Arena that owns the element buffer, or NULL if the stack owns it.
+     */
+    stack_arena_t *arena_p;
+    /**
+     * Lock and wait conditions, or NULL if the stack is used by only one
+     * thread. Points into the shared memory control block for shared
+     * memory stacks.
+     */
+    stack_sync_t *sync_p;
+    /**
+     * Number of entries when the stack was last locked.
+     */
+    size_t locked_num_entries;
+    /**
+     * Bytes used by entries when the stack was last locked.
+     */
+    size_t locked_used_size;
+    /**
+     * Top of the entry list of a #STACK_FLAG_MPSC stack.
+     */
+    stack_batch_t *mpsc_head;
+    /**
+     * Number of entries on the list of a #STACK_FLAG_MPSC stack. Updated
+     * atomically, apart from the list itself.
+     */
+    size_t mpsc_count;
+    /**
+     * Readiness notification descriptor, or -1 if none was requested.
+     */
+    int event_fd;
+    /**
+     * Number of entries at which event_fd becomes readable.
+     */
+    size_t event_threshold;
+    /**
+     * Is event_fd currently readable?
+     */
+    bool event_ready;
+    /**
+     * Shared memory control block, or NULL if the stack is private to this
+     * process.
+     */
+    stack_shm_hdr_t *shm_p;
+    /**
+     * Size of the shared memory mapping in bytes.
+     */
+    size_t shm_size;
+    /**
+     * Identity of the shared memory segment, the same in every process.
+     * Orders the locks of two stacks that are locked together.
+     */
+    ino_t shm_ino;
+    /**
+     * Chunk holding the element buffer of a #STACK_FLAG_SNAPSHOT stack.
+     */
+    stack_chunk_t *snap_chunk_p;
+    /**
+     * Chunk replaced by the current operation, or NULL. Its reference is
+     * only dropped when the operation ends, so that pointers into it taken
+     * earlier in the operation stay valid.
+     */
+    stack_chunk_t *snap_old_chunk_p;
+    /**
+     * Published view of a #STACK_FLAG_SNAPSHOT stack, or NULL while an
+     * operation rewrites entries that readers could otherwise see. Updated
+     * atomically.
+     */
+    stack_snapshot_t *snap_view_p;
+    /**
+     * Views that are no longer published but may still be being copied.
+     */
+    stack_snapshot_t *snap_retired_p;
+    /**
+     * Reclaimed views, ready to be published again.
+     */
+    stack_snapshot_t *snap_free_p;
+    /**
+     * Lowest offset in the current chunk that readers may see.
+     */
+    size_t snap_shared_top;
+    /**
+     * Number of threads copying the published view. Updated atomically.
+     */
+    unsigned int snap_readers;
+    /**
+     * Sequence count of a #STACK_FLAG_SINGLE_WRITER stack, odd while an
+     * operation is in progress. Updated atomically.
+     */
+    unsigned int seq;
+    /**
+     * Counters of a #STACK_FLAG_STATS stack.
+     */
+    stack_stats_t stats;
+    /**
+     * Journal of a durable stack, or NULL.
+     */
+    stack_journal_t *journal_p;
+    /**
+     * Reference count. 
+     */
+    unsigned int refcount;
+};
+
+/**
+ * Several stacks sharing one buffer.
+ */
+struct stack_arena_ {
+    /**
+     * Self pointer identify a properly intialized arena.
+     */
+    struct stack_arena_ *self;
+    /**
+     * Shared element buffer. Each stack owns a consecutive region of it.
+     */
+    unsigned char *buf;
+    /**
+     * Size of shared element buffer in bytes.
+     */
+    size_t buf_size;
+    /**
+     * Number of stacks in the arena.
+     */
+    size_t num_stacks;
+    /**
+     * The stacks, ordered by the position of their regions in the buffer.
+     */
+    struct stack_ *stacks;
+};
+
+/**
+ * Entries detached from a lock-free multi-producer stack by
+ * stack_take_all(), as a list of nodes from the top entry down. Each node
+ * is also the batch of itself and the entries below it.
+ */
+struct stack_batch_ {
+    /**
+     * Next entry down, or NULL for the bottom entry.
+     */
+    struct stack_batch_ *next;
+    /**
+     * Size of entry data in bytes.
+     */
+    size_t size;
+    /**
+     * Entry data.
+     */
+    unsigned char data[];
+};
+
+/*
+ * Determine whether or not given stack is valid.
+ *
+ * See ../include/stack.h for API details.
+ */
+bool stack_is_valid (const stack_t *stack_p)
+{
+    return ((NULL != stack_p) && (stack_p == stack_p->self)); 
+}
+
+/**
+ * Initialize a stack.
+ *
+ * @param[out] stack_p
+ *     Stack to initialize.
+ * @param[in] buf
+ *     Element buffer.
+ * @param[in] buf_size
+ *     Size of element buffer in bytes.
+ * @param[in] max_entries
+ *     Maximum number of entries, or #STACK_MAX_ENTRIES_NONE.
+ * @param[in] max_entry_size
+ *     Maximum size of an entry, or #STACK_MAX_ENTRY_SIZE_NONE.
+ * @param[in] flags
+ *     Behavior flags.
+ * @param[in] arena_p
+ *     Arena that owns the element buffer, or NULL.
+ */
+static void stack_init (stack_t *stack_p,
+                        unsigned char *buf,
+                        size_t buf_size,
+                        size_t max_entries,
+                        size_t max_entry_size,
+                        stack_flags_t flags,
+                        stack_arena_t *arena_p)
+{
+    stack_p->buf = buf;
+    stack_p->buf_size = buf_size;
+    stack_p->buf_top = buf_size;
+    stack_p->buf_end = buf_size;
+    stack_p->buf_wrap = 0;
+    stack_p->is_wrapped = false;
+    stack_p->entry_overhead = sizeof(size_t);
+    if (0 != (flags & STACK_FLAG_DROP_OLDEST)) {
+        stack_p->entry_overhead += sizeof(size_t);
+    }
+    stack_p->num_entries = 0;
+    stack_p->max_entries = max_entries;
+    stack_p->max_entry_size = max_entry_size;
+    stack_p->max_size = STACK_MAX_SIZE_NONE;
+    stack_p->flags = flags;
+    stack_p->arena_p = arena_p;
+    stack_p->sync_p = NULL;
+    stack_p->mpsc_head = NULL;
+    stack_p->mpsc_count = 0;
+    stack_p->event_fd = -1;
+    stack_p->event_threshold = 1;
+    stack_p->event_ready = false;
+    stack_p->locked_num_entries = 0;
+    stack_p->locked_used_size = 0;
+    stack_p->shm_p = NULL;
+    stack_p->shm_size = 0;
+    stack_p->shm_ino = 0;
+    stack_p->snap_chunk_p = NULL;
+    stack_p->snap_old_chunk_p = NULL;
+    stack_p->snap_view_p = NULL;
+    stack_p->snap_retired_p = NULL;
+    stack_p->snap_free_p = NULL;
+    stack_p->snap_shared_top = buf_size;
+    stack_p->snap_readers = 0;
+    stack_p->seq = 0;
+    memset(&(stack_p->stats), 0, sizeof(stack_p->stats));
+    stack_p->journal_p = NULL;
+    stack_p->refcount = 1;
+    stack_p->self = stack_p;
+}
+
+/**
+ * Initialize the lock and wait conditions of a stack.
+ *
+ * @param[out] sync_p
+ *     Lock and conditions to initialize.
+ * @param[in] is_shared
+ *     Will other processes use them? If so, the lock is also made robust,
+ *     so that it survives a process that dies while holding it.
+ * @retval true
+ *     Successfully initialized.
+ * @retval false
+ *     Initialization failed; nothing needs to be destroyed.
+ */
+static bool stack_sync_init (stack_sync_t *sync_p, bool is_shared)
+{
+    pthread_mutexattr_t  mutex_attr;             /* Lock attributes           */
+    pthread_condattr_t   cond_attr;              /* Condition attributes      */
+    int                  pshared = PTHREAD_PROCESS_PRIVATE; /* Sharing mode   */
+    int                  rc      = 0;            /* pthread return code       */
+
+    if (is_shared) {
+        pshared = PTHREAD_PROCESS_SHARED;
+    }
+
+    rc = pthread_mutexattr_init(&mutex_attr);
+    if (0 != rc) {
+        return (false);
+    }
+    rc = pthread_mutexattr_setpshared(&mutex_attr, pshared);
+    if ((0 == rc) && is_shared) {
+        rc = pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    }
+    if (0 == rc) {
+        rc = pthread_mutex_init(&(sync_p->lock), &mutex_attr);
+    }
+    (void)pthread_mutexattr_destroy(&mutex_attr);
+    if (0 != rc) {
+        return (false);
+    }
+
+    /*
+     * Timeouts are measured on the monotonic clock so that they are not
+     * affected by changes to the time of day.
+     */
+    rc = pthread_condattr_init(&cond_attr);
+    if (0 == rc) {
+        rc = pthread_condattr_setpshared(&cond_attr, pshared);
+        if (0 == rc) {
+            rc = pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+        }
+        if (0 == rc) {
+            rc = pthread_cond_init(&(sync_p->not_empty), &cond_attr);
+        }
+        if (0 == rc) {
+            rc = pthread_cond_init(&(sync_p->not_full), &cond_attr);
+            if (0 != rc) {
+                (void)pthread_cond_destroy(&(sync_p->not_empty));
+            }
+        }
+        (void)pthread_condattr_destroy(&cond_attr);
+    }
+    if (0 != rc) {
+        (void)pthread_mutex_destroy(&(sync_p->lock));
+        return (false);
+    }
+
+    return (true);
+}
+
+/**
+ * Drop a reference to the chunk of a #STACK_FLAG_SNAPSHOT stack, freeing
+ * the chunk with the last reference.
+ *
+ * @param[in] chunk_p
+ *     Chunk to release.
+ */
+static void stack_chunk_release (stack_chunk_t *chunk_p)
+{
+    if (0 == __atomic_sub_fetch(&(chunk_p->refs), 1, __ATOMIC_ACQ_REL)) {
+        free(chunk_p);
+    }
+}
+
+/**
+ * Make sure that a #STACK_FLAG_SNAPSHOT stack has a spare view, so that it
+ * can always publish itself again after withdrawing its view.
+ *
+ * @param[in,out] stack_p
+ *     Locked stack.
+ * @retval true
+ *     A spare view is available.
+ * @retval false
+ *     Out of memory.
+ */
+static bool stack_snapshot_reserve (stack_t *stack_p)
+{
+    stack_snapshot_t *view_p = NULL;             /* New spare view            */
+
+    if (NULL != stack_p->snap_free_p) {
+        return (true);
+    }
+    view_p = malloc(sizeof(stack_snapshot_t));
+    if (NULL == view_p) {
+        return (false);
+    }
+    view_p->next = NULL;
+    stack_p->snap_free_p = view_p;
+
+    return (true);
+}
+
+/**
+ * Reclaim the retired views of a #STACK_FLAG_SNAPSHOT stack if no reader
+ * can still be copying one of them.
+ *
+ * @param[in,out] stack_p
+ *     Locked stack.
+ */
+static void stack_snapshot_reclaim (stack_t *stack_p)
+{
+    stack_snapshot_t *view_p = NULL;             /* View being reclaimed      */
+
+    /*
+     * Views are retired after they are unpublished, so a reader that
+     * arrives after the count is seen at zero finds a newer view or none.
+     */
+    if (0 != __atomic_load_n(&(stack_p->snap_readers), __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    while (NULL != stack_p->snap_retired_p) {
+        view_p = stack_p->snap_retired_p;
+        stack_p->snap_retired_p = view_p->next;
+        stack_chunk_release(view_p->chunk_p);
+        view_p->next = stack_p->snap_free_p;
+        stack_p->snap_free_p = view_p;
+    }
+}
+
+/**
+ * Publish the current state of a #STACK_FLAG_SNAPSHOT stack for
+ * stack_snapshot_take(), if it changed since it was last published.
+ *
+ * @param[in,out] stack_p
+ *     Locked stack. Nothing is done for other stacks.
+ */
+static void stack_snapshot_publish (stack_t *stack_p)
+{
+    stack_snapshot_t *view_p = stack_p->snap_view_p; /* Current view      */
+
+    if (NULL == stack_p->snap_chunk_p) {
+        return;
+    }
+    if (NULL != stack_p->snap_old_chunk_p) {
+        stack_chunk_release(stack_p->snap_old_chunk_p);
+        stack_p->snap_old_chunk_p = NULL;
+    }
+    if ((NULL != view_p) &&
+        (view_p->chunk_p == stack_p->snap_chunk_p) &&
+        (view_p->buf_top == stack_p->buf_top) &&
+        (view_p->num_entries == stack_p->num_entries)) {
+        return;
+    }
+
+    /*
+     * Without memory for a new view, readers keep seeing the previous one.
+     * A withdrawn view always has a spare reserved to replace it.
+     */
+    if (! stack_snapshot_reserve(stack_p)) {
+        return;
+    }
+    view_p = stack_p->snap_free_p;
+    stack_p->snap_free_p = view_p->next;
+    view_p->chunk_p = stack_p->snap_chunk_p;
+    view_p->buf_top = stack_p->buf_top;
+    view_p->num_entries = stack_p->num_entries;
+    view_p->next = NULL;
+    (void)__atomic_add_fetch(&(view_p->chunk_p->refs), 1, __ATOMIC_RELAXED);
+
+    view_p = __atomic_exchange_n(&(stack_p->snap_view_p), view_p,
+                                 __ATOMIC_SEQ_CST);
+    if (NULL != view_p) {
+        view_p->next = stack_p->snap_retired_p;
+        stack_p->snap_retired_p = view_p;
+    }
+    if (stack_p->buf_top < stack_p->snap_shared_top) {
+        stack_p->snap_shared_top = stack_p->buf_top;
+    }
+    stack_snapshot_reclaim(stack_p);
+}
+
+/**
+ * Free the views and drop the chunk of a #STACK_FLAG_SNAPSHOT stack that
+ * is being freed. Snapshots already taken keep the chunk they refer to.
+ *
+ * @param[in,out] stack_p
+ *     Stack being freed. No reader may be taking a snapshot of it.
+ */
+static void stack_snapshot_destroy (stack_t *stack_p)
+{
+    stack_snapshot_t *view_p = NULL;             /* View being freed          */
+
+    if (NULL != stack_p->snap_view_p) {
+        stack_p->snap_view_p->next = stack_p->snap_retired_p;
+        stack_p->snap_retired_p = stack_p->snap_view_p;
+        stack_p->snap_view_p = NULL;
+    }
+    stack_snapshot_reclaim(stack_p);
+    while (NULL != stack_p->snap_free_p) {
+        view_p = stack_p->snap_free_p;
+        stack_p->snap_free_p = view_p->next;
+        free(view_p);
+    }
+    if (NULL != stack_p->snap_old_chunk_p) {
+        stack_chunk_release(stack_p->snap_old_chunk_p);
+        stack_p->snap_old_chunk_p = NULL;
+    }
+    stack_chunk_release(stack_p->snap_chunk_p);
+    stack_p->snap_chunk_p = NULL;
+    stack_p->buf = NULL;
+}
+
+/*
+ * Allocate a new stack with behavior flags.
+ *
+ * See ../include/stack.h for API details. 
+ */
+stack_t* stack_alloc_flags (size_t max_entries,
+                            size_t max_entry_size,
+                            __attribute__((unused)) size_t default_entry_size,
+                            size_t max_size,
+                            stack_flags_t flags)
+{
+    stack_t       *new_stack_p = NULL;           /* Newly allocated stack     */
+    unsigned char *buf         = NULL;           /* Element buffer            */
+    size_t         buf_size    = 0;              /* Element buffer size       */
+    stack_sync_t  *sync_p      = NULL;           /* Lock, if any              */
+    stack_chunk_t *chunk_p     = NULL;           /* Snapshot buffer, if any   */
+
+    if (0 != (flags & ~STACK_FLAGS_ALL)) {
+        return (NULL);
+    }
+
+    if ((0 != (flags & STACK_FLAG_MPSC)) && (STACK_FLAG_MPSC != flags)) {
+        return (NULL);
+    }
+    if ((0 != (flags & STACK_FLAG_SNAPSHOT)) &&
+        (0 != (flags & STACK_FLAG_DROP_OLDEST))) {
+        return (NULL);
+    }
+    if ((0 != (flags & STACK_FLAG_SINGLE_WRITER)) &&
+        (0 != (flags & (STACK_FLAG_SYNC | STACK_FLAG_SNAPSHOT)))) {
+        return (NULL);
+    }
+    if ((0 != (flags & STACK_FLAG_GROW)) &&
+        (0 != (flags & (STACK_FLAG_DROP_OLDEST | STACK_FLAG_SNAPSHOT |
+                        STACK_FLAG_SINGLE_WRITER)))) {
+        return (NULL);
+    }
+
+    /*
+     * Lock-free multi-producer stacks keep their entries in a list of
+     * nodes instead of a buffer. Growing stacks start small.
+     */
+    buf_size = max_size;
+    if (0 != (flags & STACK_FLAG_MPSC)) {
+        buf_size = 0;
+    } else if ((STACK_MAX_SIZE_NONE == buf_size) ||
+               ((0 != (flags & STACK_FLAG_GROW)) &&
+                (buf_size > STACK_DEFAULT_BUF_SIZE))) {
+        buf_size = STACK_DEFAULT_BUF_SIZE;
+    }
+
+    new_stack_p = malloc(sizeof(stack_t));
+    if (NULL == new_stack_p) {
+        return (NULL);
+    }
+    if (0 != (flags & STACK_FLAG_SNAPSHOT)) {
+        chunk_p = malloc(sizeof(stack_chunk_t) + buf_size);
+        if (NULL == chunk_p) {
+            free(new_stack_p);
+            return (NULL);
+        }
+        chunk_p->refs = 1;
+        buf = chunk_p->data;
+    } else if (buf_size > 0) {
+        buf = malloc(buf_size);
+        if (NULL == buf) {
+            free(new_stack_p);
+            return (NULL);
+        }
+    }
+    if (0 != (flags & STACK_FLAG_SYNC)) {
+        sync_p = malloc(sizeof(stack_sync_t));
+        if ((NULL == sync_p) || (! stack_sync_init(sync_p, false))) {
+            free(sync_p);
+            if (NULL == chunk_p) {
+                free(buf);
+            }
+            free(chunk_p);
+            free(new_stack_p);
+            return (NULL);
+        }
+    }
+
+    stack_init(new_stack_p, buf, buf_size, max_entries, max_entry_size,
+               flags, NULL);
+    new_stack_p->sync_p = sync_p;
+    if (0 != (flags & STACK_FLAG_GROW)) {
+        new_stack_p->max_size = max_size;
+    }
+
+    /*
+     * A snapshot stack always has a published view, even when empty.
+     */
+    if (NULL != chunk_p) {
+        new_stack_p->snap_chunk_p = chunk_p;
+        if (! stack_snapshot_reserve(new_stack_p)) {
+            stack_free(new_stack_p);
+            return (NULL);
+        }
+        stack_snapshot_publish(new_stack_p);
+    }
+
+    return (new_stack_p);
+}
+
+/*
+ * Allocate a new stack.
+ *
+ * See ../include/stack.h for API details. 
+ */
+stack_t* stack_alloc_custom (size_t max_entries,
+                             size_t max_entry_size,
+                             size_t default_entry_size,
+                             size_t max_size)
+{
+    return (stack_alloc_flags(max_entries,
+                              max_entry_size,
+                              default_entry_size,
+                              max_size,
+                              STACK_FLAG_NONE));
+}
+
+/**
+ * Determine whether or not stack is empty.
+ *
+ * @note
+ *     This is a private implementation for use with stacks that have
+ *     already been validated.
+ *
+ * @param[in] stack_p
+ *     Stack to query. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @retval true
+ *     Stack has no entries.
+ * @retval false
+ *     Stack has at least one entry.
+ */
+static inline bool stack_is_empty_impl (const stack_t *stack_p)
+{
+    return (stack_p->num_entries < 1);
+}
+
+/**
+ * Get top entry in stack. 
+ *
+ * @note
+ *     This is a private implementation for use with stacks that have
+ *     already been validated.
+ *
+ * @param[in] stack_p
+ *     Stack to query. MUST BE A VALID, NON-EMPTY STACK otherwise results
+ *     are indeterminate.
+ * @param[out] size_pp
+ *     If not NULL, will be updated with pointer to
+ *     'size' field of top entry in stack. Pointer is valid only until
+ *     next stack_push() or stack_pop() operation. 
+ * @param[out] data_pp
+ *     If not NULL, will be updated with pointer to
+ *     'data' field of top entry in stack. Pointer is valid only until
+ *     next stack_push() or stack_pop() operation. 
+ */
+static void stack_get_top_entry (const stack_t *stack_p,
+                                 size_t **size_pp,
+                                 void **data_pp)
+{
+    /*
+     * The top entry in the stack is located immediately after the
+     * the free portion of the buffer.
+     *
+     * The fixed-length 'size' field is first, followed by the
+     * variable-length 'data' field.
+     */
+    if (NULL != size_pp) {
+        *size_pp = (size_t *)(stack_p->buf + stack_p->buf_top);
+    }
+    if (NULL != data_pp) {
+        *data_pp = (void *)(stack_p->buf + stack_p->buf_top + sizeof(size_t));
+    }
+}
+
+/**
+ * Get top entry in stack. 
+ *
+ * @note
+ *     This is a private implementation for use with stacks that have
+ *     already been validated.
+ *
+ * @param[in] stack_p
+ *     Stack to query.
+ *
+ *     MUST BE A VALID, NON-EMPTY STACK otherwise results are indeterminate.
+ * @param[in,out] size_pp
+ *     Initially, set to point to 'size' field of current entry in stack,
+ *     either from  stack_get_top_entry() or stack_get_next_entry().
+ *     On success, will be set to point to 'size' field of next entry in stack,
+ *     otherwise will be set to NULL.
+ *
+ *     MUST BE VALID, otherwise results are indeterminate.
+ * @param[in,out] data_pp
+ *     Initially, set to point to 'data' field of current entry in stack,
+ *     either from stack_get_top_entry() or stack_get_next_entry().
+ *     On success, will be set to point to 'data' field of next entry in stack,
+ *     otherwise will be set to NULL.
+ *
+ *     MUST BE VALID, otherwise results are indeterminate.
+ * @retval true
+ *     Successfully retrieved next entry
+ * @retval false
+ *     Failed to retrieve next entry.
+ */
+static bool stack_get_next_entry (const stack_t *stack_p,
+                                  size_t **size_pp,
+                                  void **data_pp)
+{
+    size_t *entry_size_p = NULL;                 /* Next entry's 'size' field */
+
+    if (NULL == *size_pp) {
+        *data_pp = NULL;
+        return (false);
+    }
+    if (NULL == *data_pp) {
+        *size_pp = NULL;
+        return (false); 
+    }
+
+    /*
+     * The next entry in the stack is located 'size' bytes after the
+     * data pointer, plus the trailing copy of the 'size' field if the stack
+     * keeps one. Once the newer run of a wrapped buffer reaches the end of
+     * the buffer, the older run continues at the wrap offset. Make sure
+     * that this isn't past the end of the buffer. 
+     */
+    entry_size_p = (size_t *)((unsigned char *)(*data_pp) + **size_pp +
+                              (stack_p->entry_overhead - sizeof(size_t)));
+    if (stack_p->is_wrapped &&
+        ((unsigned char *)entry_size_p == (stack_p->buf + stack_p->buf_size))) {
+        entry_size_p = (size_t *)(stack_p->buf + stack_p->buf_wrap);
+    }
+    if ((unsigned char *)entry_size_p > (stack_p->buf + stack_p->buf_size)) {
+        *size_pp = NULL;
+        *data_pp = NULL;
+        return (false);
+    }
+    *size_pp = entry_size_p;
+    *data_pp = (void *)((unsigned char *)entry_size_p + sizeof(size_t));
+
+    return (true);
+}
+
+/**
+ * Get entry at a given depth below the top of the stack.
+ *
+ * @note
+ *     This is a private implementation for use with stacks that have
+ *     already been validated.
+ *
+ * @param[in] stack_p
+ *     Stack to query. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @param[in] depth
+ *     Number of entries to skip, starting from the top of the stack.
+ * @param[out] size_pp
+ *     On success, will be updated with pointer to 'size' field of entry.
+ *     MUST NOT BE NULL.
+ * @param[out] data_pp
+ *     On success, will be updated with pointer to 'data' field of entry.
+ *     MUST NOT BE NULL.
+ * @retval true
+ *     Successfully retrieved entry.
+ * @retval false
+ *     Stack has fewer than depth + 1 entries.
+ */
+static bool stack_get_entry_at_depth (const stack_t *stack_p,
+                                      size_t depth,
+                                      size_t **size_pp,
+                                      void **data_pp)
+{
+    size_t i = 0;                                /* Loop index counter        */
+
+    if (depth >= stack_p->num_entries) {
+        return (false);
+    }
+
+    stack_get_top_entry(stack_p, size_pp, data_pp);
+    for (i = 0; i < depth; i++) {
+        if (! stack_get_next_entry(stack_p, size_pp, data_pp)) {
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+/**
+ * Size of the bounce buffer used to rotate regions of a stack buffer.
+ * Large enough for typical interpreter operands.
+ */
+#define STACK_ROTATE_BOUNCE_SIZE 256
+
+/**
+ * Reverse a range of bytes in place.
+ *
+ * @param[in,out] region_p
+ *     Bytes to reverse.
+ * @param[in] region_size
+ *     Number of bytes to reverse.
+ */
+static void stack_reverse_bytes (unsigned char *region_p, size_t region_size)
+{
+    unsigned char *lo_p = region_p;              /* Low end of range          */
+    unsigned char *hi_p = region_p + region_size;/* High end of range         */
+    unsigned char  tmp  = 0;                     /* Byte being exchanged      */
+
+    while ((hi_p - lo_p) > 1) {
+        hi_p--;
+        tmp = *lo_p;
+        *lo_p = *hi_p;
+        *hi_p = tmp;
+        lo_p++;
+    }
+}
+
+/**
+ * Exchange two adjacent ranges of bytes in place, turning [A][B] into [B][A].
+ *
+ * Ranges of equal size are exchanged with plain swaps. Otherwise the
+ * smaller range is parked in a bounce buffer while the larger range is
+ * moved with memmove(). Ranges too large for the bounce buffer fall back
+ * to rotation by reversal, which needs no extra memory.
+ *
+ * @param[in,out] region_p
+ *     Start of range A, which is immediately followed by range B.
+ * @param[in] first_size
+ *     Size of range A in bytes.
+ * @param[in] region_size
+ *     Combined size of ranges A and B in bytes.
+ */
+static void stack_rotate_bytes (unsigned char *region_p,
+                                size_t first_size,
+                                size_t region_size)
+{
+    unsigned char bounce[STACK_ROTATE_BOUNCE_SIZE]; /* Parked range        */
+    size_t        second_size = 0;               /* Size of range B           */
+    size_t        chunk_size  = 0;               /* Bytes swapped this pass   */
+    size_t        pos         = 0;               /* Bytes swapped so far      */
+
+    second_size = region_size - first_size;
+    if ((0 == first_size) || (0 == second_size)) {
+        return;
+    }
+
+    if (first_size == second_size) {
+        while (pos < first_size) {
+            chunk_size = first_size - pos;
+            if (chunk_size > sizeof(bounce)) {
+                chunk_size = sizeof(bounce);
+            }
+            memcpy(bounce, region_p + pos, chunk_size);
+            memcpy(region_p + pos, region_p + first_size + pos, chunk_size);
+            memcpy(region_p + first_size + pos, bounce, chunk_size);
+            pos += chunk_size;
+        }
+    } else if (first_size <= sizeof(bounce)) {
+        memcpy(bounce, region_p, first_size);
+        memmove(region_p, region_p + first_size, second_size);
+        memcpy(region_p + second_size, bounce, first_size);
+    } else if (second_size <= sizeof(bounce)) {
+        memcpy(bounce, region_p + first_size, second_size);
+        memmove(region_p + second_size, region_p, first_size);
+        memcpy(region_p, bounce, second_size);
+    } else {
+        stack_reverse_bytes(region_p, first_size);
+        stack_reverse_bytes(region_p + first_size, second_size);
+        stack_reverse_bytes(region_p, region_size);
+    }
+}
+
+/**
+ * Determine whether or not stack evicts its bottom entries to make room.
+ *
+ * @param[in] stack_p
+ *     Stack to query. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @retval true
+ *     Stack was created with #STACK_FLAG_DROP_OLDEST.
+ * @retval false
+ *     Stack reports STACK_E_FULL when it runs out of room.
+ */
+static inline bool stack_is_drop_oldest (const stack_t *stack_p)
+{
+    return (0 != (stack_p->flags & STACK_FLAG_DROP_OLDEST));
+}
+
+/**
+ * Determine whether or not stack is a lock-free multi-producer stack.
+ *
+ * @param[in] stack_p
+ *     Stack to query. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @retval true
+ *     Stack was created with #STACK_FLAG_MPSC.
+ * @retval false
+ *     Stack keeps its entries in its buffer.
+ */
+static inline bool stack_is_mpsc (const stack_t *stack_p)
+{
+    return (0 != (stack_p->flags & STACK_FLAG_MPSC));
+}
+
+/**
+ * Determine whether or not stack publishes views for concurrent readers.
+ *
+ * @param[in] stack_p
+ *     Stack to query. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @retval true
+ *     Stack was created with #STACK_FLAG_SNAPSHOT.
+ * @retval false
+ *     Stack has no readers outside of its own operations.
+ */
+static inline bool stack_is_snapshot (const stack_t *stack_p)
+{
+    return (0 != (stack_p->flags & STACK_FLAG_SNAPSHOT));
+}
+
+/**
+ * Determine whether or not stack can be read by other threads through its
+ * sequence count.
+ *
+ * @param[in] stack_p
+ *     Stack to query. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @retval true
+ *     Stack was created with #STACK_FLAG_SINGLE_WRITER.
+ * @retval false
+ *     Stack is read under its lock, if any.
+ */
+static inline bool stack_is_single_writer (const stack_t *stack_p)
+{
+    return (0 != (stack_p->flags & STACK_FLAG_SINGLE_WRITER));
+}
+
+/**
+ * Get number of buffer bytes occupied by entries.
+ *
+ * @param[in] stack_p
+ *     Stack to query. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @returns
+ *     Number of bytes used, including per-entry bookkeeping.
+ */
+static size_t stack_get_used_size (const stack_t *stack_p)
+{
+    if (stack_p->is_wrapped) {
+        return ((stack_p->buf_size - stack_p->buf_top) +
+                (stack_p->buf_end - stack_p->buf_wrap));
+    }
+
+    return (stack_p->buf_end - stack_p->buf_top);
+}
+
+/**
+ * Does a stack keep counters?
+ *
+ * @param[in] stack_p
+ *     Stack to check. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @retval true
+ *     Stack was created with #STACK_FLAG_STATS.
+ * @retval false
+ *     Stack keeps no counters.
+ */
+static inline bool stack_has_stats (const stack_t *stack_p)
+{
+    return (0 != (stack_p->flags & STACK_FLAG_STATS));
+}
+
+/**
+ * Count entries pushed onto a stack.
+ *
+ * @param[in,out] stack_p
+ *     Stack the entries went onto. Nothing is done unless it keeps
+ *     counters.
+ * @param[in] entry_size
+ *     Size of each entry in bytes.
+ * @param[in] num_entries
+ *     Number of entries.
+ */
+static void stack_stats_push (stack_t *stack_p,
+                              size_t entry_size,
+                              size_t num_entries)
+{
+    unsigned int bucket = 0;                     /* Histogram bucket          */
+
+    if (! stack_has_stats(stack_p)) {
+        return;
+    }
+    if (entry_size > 0) {
+        bucket = (8 * sizeof(unsigned long long)) -
+                 __builtin_clzll(entry_size);
+    }
+    if (bucket >= STACK_STATS_NUM_SIZES) {
+        bucket = STACK_STATS_NUM_SIZES - 1;
+    }
+    stack_p->stats.num_pushes += num_entries;
+    stack_p->stats.sizes[bucket] += num_entries;
+}
+
+/**
+ * Count bytes copied by a stack.
+ *
+ * @param[in,out] stack_p
+ *     Stack that copied the bytes. Nothing is done unless it keeps
+ *     counters.
+ * @param[in] size
+ *     Number of bytes.
+ */
+static inline void stack_stats_copy (stack_t *stack_p, size_t size)
+{
+    if (stack_has_stats(stack_p)) {
+        stack_p->stats.bytes_copied += size;
+    }
+}
+
+/**
+ * Raise the high-water marks of a stack to its current contents.
+ *
+ * @param[in,out] stack_p
+ *     Stack to update. Nothing is done unless it keeps counters.
+ */
+static void stack_stats_high_water (stack_t *stack_p)
+{
+    size_t used_size = 0;                        /* Bytes used by entries     */
+
+    if (! stack_has_stats(stack_p)) {
+        return;
+    }
+    if (stack_p->num_entries > stack_p->stats.max_entries) {
+        stack_p->stats.max_entries = stack_p->num_entries;
+    }
+    used_size = stack_get_used_size(stack_p);
+    if (used_size > stack_p->stats.max_used_size) {
+        stack_p->stats.max_used_size = used_size;
+    }
+}
+
+/**
+ * Add bytes to an FNV-1a hash.
+ *
+ * @param[in] hash
+ *     Hash of the bytes so far, or #STACK_JOURNAL_HASH_INIT.
+ * @param[in] data_p
+ *     Bytes to add.
+ * @param[in] size
+ *     Number of bytes.
+ * @returns
+ *     Hash including the bytes.
+ */
+static uint32_t stack_journal_hash (uint32_t hash,
+                                    const void *data_p,
+                                    size_t size)
+{
+    const unsigned char *byte_p = data_p;        /* Current byte              */
+    size_t               i      = 0;             /* Loop index counter        */
+
+    for (i = 0; i < size; i++) {
+        hash ^= byte_p[i];
+        hash *= 16777619U;                       /* FNV prime                 */
+    }
+
+    return (hash);
+}
+
+/**
+ * Set the check field of a journal record.
+ *
+ * @param[in,out] rec_p
+ *     Record header.
+ * @param[in] data_p
+ *     Record data.
+ */
+static void stack_journal_seal (stack_journal_rec_t *rec_p, const void *data_p)
+{
+    rec_p->check = 0;
+    rec_p->check = stack_journal_hash(
+                       stack_journal_hash(STACK_JOURNAL_HASH_INIT,
+                                          rec_p, sizeof(*rec_p)),
+                       data_p, rec_p->size);
+}
+
+/**
+ * Note that an operation on a journaled stack changed every entry above
+ * its bottom ones.
+ *
+ * @param[in,out] stack_p
+ *     Stack being changed. Nothing is done unless it has a journal.
+ * @param[in] num_kept
+ *     Number of bottom entries that were not changed.
+ * @param[in] kept_pos
+ *     Offset in the buffer at which the unchanged entries start.
+ */
+static inline void stack_journal_keep (stack_t *stack_p,
+                                       size_t num_kept,
+                                       size_t kept_pos)
+{
+    stack_journal_t *journal_p = stack_p->journal_p; /* Journal to update  */
+
+    if ((NULL != journal_p) && (num_kept < journal_p->num_kept)) {
+        journal_p->num_kept = num_kept;
+        journal_p->kept_size = stack_p->buf_end - kept_pos;
+    }
+}
+
+/**
+ * Add a record to the waiting records of a journal.
+ *
+ * @param[in,out] journal_p
+ *     Journal to update.
+ * @param[in] type
+ *     Record type.
+ * @param[in] num_entries
+ *     Number of entries pushed or removed.
+ * @param[in] data_p
+ *     Record data.
+ * @param[in] size
+ *     Size of record data in bytes.
+ * @retval true
+ *     Record added.
+ * @retval false
+ *     Out of memory.
+ */
+static bool stack_journal_append (stack_journal_t *journal_p,
+                                  stack_journal_rec_e type,
+                                  size_t num_entries,
+                                  const void *data_p,
+                                  size_t size)
+{
+    stack_journal_rec_t  rec;                    /* Record header             */
+    unsigned char       *new_buf  = NULL;        /* Grown record buffer       */
+    size_t               new_size = 0;           /* Size of grown buffer      */
+
+    if (size > (SIZE_MAX - sizeof(rec) - journal_p->buf_len)) {
+        return (false);
+    }
+    if ((sizeof(rec) + size) > (journal_p->buf_size - journal_p->buf_len)) {
+        new_size = (journal_p->buf_size < STACK_JOURNAL_MIN_BUF_SIZE) ?
+                   STACK_JOURNAL_MIN_BUF_SIZE : journal_p->buf_size;
+        while ((sizeof(rec) + size) > (new_size - journal_p->buf_len)) {
+            new_size = (new_size > (SIZE_MAX / 2)) ? SIZE_MAX : (2 * new_size);
+        }
+        new_buf = realloc(journal_p->buf, new_size);
+        if (NULL == new_buf) {
+            return (false);
+        }
+        journal_p->buf = new_buf;
+        journal_p->buf_size = new_size;
+    }
+
+    rec.type = type;
+    rec.num_entries = num_entries;
+    rec.size = size;
+    stack_journal_seal(&rec, data_p);
+    memcpy(journal_p->buf + journal_p->buf_len, &rec, sizeof(rec));
+    if (size > 0) {
+        memcpy(journal_p->buf + journal_p->buf_len + sizeof(rec), data_p, size);
+    }
+    journal_p->pop_pos = (STACK_JOURNAL_REC_POP == type) ?
+                         journal_p->buf_len : SIZE_MAX;
+    journal_p->buf_len += sizeof(rec) + size;
+
+    return (true);
+}
+
+/**
+ * Record the changes made to a journaled stack since its last record.
+ *
+ * Every operation on a stack without drop-oldest behavior only removes
+ * entries from the top and then adds entries on top, so its changes are
+ * recorded as a pop of the entries above the unchanged bottom ones,
+ * followed by a push of the entries now above them.
+ *
+ * @param[in,out] stack_p
+ *     Locked stack. Nothing is done unless it has a journal.
+ */
+static void stack_journal_log (stack_t *stack_p)
+{
+    stack_journal_t     *journal_p = stack_p->journal_p; /* Journal        */
+    stack_journal_rec_t  rec;                    /* Earlier pop record        */
+    size_t               used_size = 0;          /* Bytes used by entries     */
+
+    if (NULL == journal_p) {
+        return;
+    }
+    if (journal_p->is_deferred) {
+        /*
+         * The reserved entry is recorded with the next operation.
+         */
+        journal_p->is_deferred = false;
+        return;
+    }
+    if ((journal_p->num_kept == journal_p->num_logged) &&
+        (journal_p->num_kept == stack_p->num_entries)) {
+        return;
+    }
+    if (journal_p->num_kept < journal_p->snap_num_kept) {
+        journal_p->snap_num_kept = journal_p->num_kept;
+        journal_p->snap_kept_size = journal_p->kept_size;
+    }
+
+    used_size = stack_get_used_size(stack_p);
+    if (STACK_E_OK == journal_p->err) {
+        if ((journal_p->num_kept < journal_p->num_logged) &&
+            (SIZE_MAX != journal_p->pop_pos)) {
+            memcpy(&rec, journal_p->buf + journal_p->pop_pos, sizeof(rec));
+            rec.num_entries += journal_p->num_logged - journal_p->num_kept;
+            stack_journal_seal(&rec, NULL);
+            memcpy(journal_p->buf + journal_p->pop_pos, &rec, sizeof(rec));
+        } else if ((journal_p->num_kept < journal_p->num_logged) &&
+                   (! stack_journal_append(journal_p, STACK_JOURNAL_REC_POP,
+                                           journal_p->num_logged -
+                                               journal_p->num_kept,
+                                           NULL, 0))) {
+            journal_p->err = STACK_E_NOMEM;
+        }
+        if ((stack_p->num_entries > journal_p->num_kept) &&
+            (! stack_journal_append(journal_p, STACK_JOURNAL_REC_PUSH,
+                                    stack_p->num_entries - journal_p->num_kept,
+                                    stack_p->buf + stack_p->buf_top,
+                                    used_size - journal_p->kept_size))) {
+            journal_p->err = STACK_E_NOMEM;
+        }
+        if ((0 == journal_p->num_unsynced) &&
+            (0 != journal_p->sync_interval_ms)) {
+            (void)clock_gettime(CLOCK_MONOTONIC, &(journal_p->unsynced_since));
+        }
+        journal_p->num_unsynced++;
+    }
+
+    journal_p->num_logged = stack_p->num_entries;
+    journal_p->num_kept = stack_p->num_entries;
+    journal_p->kept_size = used_size;
+}
+
+/**
+ * Write bytes to a file.
+ *
+ * @param[in] fd
+ *     File to write to.
+ * @param[in] data_p
+ *     Bytes to write.
+ * @param[in] size
+ *     Number of bytes.
+ * @retval true
+ *     All bytes written.
+ * @retval false
+ *     Write failed.
+ */
+static bool stack_journal_write (int fd, const void *data_p, size_t size)
+{
+    const unsigned char *byte_p = data_p;        /* Next byte to write        */
+    ssize_t              rc     = 0;             /* write() return code       */
+
+    while (size > 0) {
+        rc = write(fd, byte_p, size);
+        if (rc < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return (false);
+        }
+        byte_p += rc;
+        size -= rc;
+    }
+
+    return (true);
+}
+
+/**
+ * Write out the waiting records of a journal, and flush them to disk if
+ * a flush is due.
+ *
+ * @param[in,out] journal_p
+ *     Journal of a locked stack.
+ * @param[in] is_forced
+ *     Flush even if no flush is due?
+ * @retval STACK_E_OK
+ *     Records written and flushed as needed.
+ * @retval STACK_E_NOMEM
+ * @retval STACK_E_IO
+ *     The journal could not be kept, now or earlier.
+ */
+static stack_err_e stack_journal_commit (stack_journal_t *journal_p,
+                                         bool is_forced)
+{
+    struct timespec  now;                        /* Current time              */
+    bool             is_due     = is_forced;     /* Flush now?                */
+    uint64_t         elapsed_ms = 0;             /* Age of oldest operation   */
+
+    if ((STACK_E_OK != journal_p->err) || (0 == journal_p->num_unsynced)) {
+        return (journal_p->err);
+    }
+    if ((! is_due) && (0 != journal_p->sync_ops)) {
+        is_due = (journal_p->num_unsynced >= journal_p->sync_ops);
+    }
+    if ((! is_due) && (0 != journal_p->sync_interval_ms)) {
+        (void)clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed_ms = ((uint64_t)(now.tv_sec - journal_p->unsynced_since.tv_sec) *
+                      1000) +
+                     ((now.tv_nsec - journal_p->unsynced_since.tv_nsec) /
+                      1000000);
+        is_due = (elapsed_ms >= journal_p->sync_interval_ms);
+    }
+    if ((! is_due) && (journal_p->buf_len < STACK_JOURNAL_WRITE_SIZE)) {
+        return (STACK_E_OK);
+    }
+
+    /*
+     * Group commit: all of the waiting operations share one write and one
+     * flush.
+     */
+    if (! stack_journal_write(journal_p->fd, journal_p->buf,
+                              journal_p->buf_len)) {
+        journal_p->err = STACK_E_IO;
+    }
+    journal_p->buf_len = 0;
+    journal_p->pop_pos = SIZE_MAX;
+    if (journal_p->buf_size > STACK_JOURNAL_WRITE_SIZE) {
+        free(journal_p->buf);
+        journal_p->buf = NULL;
+        journal_p->buf_size = 0;
+    }
+    if ((STACK_E_OK == journal_p->err) && is_due) {
+        if (0 != fdatasync(journal_p->fd)) {
+            journal_p->err = STACK_E_IO;
+        }
+        journal_p->num_unsynced = 0;
+    }
+
+    return (journal_p->err);
+}
+
+/**
+ * Determine whether an entry of the given size could ever be pushed.
+ *
+ * @param[in] stack_p
+ *     Stack to query. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @param[in] entry_size
+ *     Size of entry data in bytes.
+ * @retval STACK_E_OK
+ *     Entry is acceptable.
+ * @retval STACK_E_INVALID
+ *     Entry is larger than the stack's maximum entry size.
+ * @retval STACK_E_FULL
+ *     Entry would not fit even in an empty stack.
+ */
+static stack_err_e stack_check_entry_size (const stack_t *stack_p,
+                                           size_t entry_size)
+{
+    size_t capacity = 0;                         /* Largest possible buffer   */
+
+    if ((STACK_MAX_ENTRY_SIZE_NONE != stack_p->max_entry_size) &&
+        (entry_size > stack_p->max_entry_size)) {
+        return (STACK_E_INVALID);
+    }
+    capacity = stack_p->buf_size;
+    if (NULL != stack_p->arena_p) {
+        capacity = stack_p->arena_p->buf_size;
+    } else if (0 != (stack_p->flags & STACK_FLAG_GROW)) {
+        capacity = (STACK_MAX_SIZE_NONE == stack_p->max_size) ?
+                   SIZE_MAX : stack_p->max_size;
+    }
+    if ((capacity < stack_p->entry_overhead) ||
+        (entry_size > (capacity - stack_p->entry_overhead))) {
+        return (STACK_E_FULL);
+    }
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Forget all entries in a stack.
+ *
+ * @param[in] stack_p
+ *     Stack to update. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ */
+static void stack_reset (stack_t *stack_p)
+{
+    stack_p->buf_top = stack_p->buf_size;
+    stack_p->buf_end = stack_p->buf_size;
+    stack_p->buf_wrap = 0;
+    stack_p->is_wrapped = false;
+    stack_p->num_entries = 0;
+    stack_journal_keep(stack_p, 0, stack_p->buf_end);
+}
+
+/**
+ * Remove the top entry from a stack without copying it.
+ *
+ * @param[in] stack_p
+ *     Stack to update. MUST BE A VALID, NON-EMPTY STACK otherwise results
+ *     are indeterminate.
+ */
+static void stack_remove_top (stack_t *stack_p)
+{
+    size_t *entry_size_p = NULL;                 /* Top entry 'size' field    */
+
+    stack_get_top_entry(stack_p, &entry_size_p, NULL);
+    stack_p->buf_top += stack_p->entry_overhead + *entry_size_p;
+    (stack_p->num_entries)--;
+    if (stack_has_stats(stack_p)) {
+        stack_p->stats.num_pops++;
+    }
+    stack_journal_keep(stack_p, stack_p->num_entries, stack_p->buf_top);
+
+    if (0 == stack_p->num_entries) {
+        stack_reset(stack_p);
+    } else if (stack_p->is_wrapped &&
+               (stack_p->buf_top == stack_p->buf_size)) {
+        /*
+         * The newer run is gone; only the older run is left.
+         */
+        stack_p->buf_top = stack_p->buf_wrap;
+        stack_p->is_wrapped = false;
+    }
+}
+
+/**
+ * Remove the bottom entry from a stack.
+ *
+ * @note
+ *     Only stacks created with #STACK_FLAG_DROP_OLDEST keep the trailing
+ *     copy of each entry's 'size' field that makes this possible.
+ *
+ * @param[in] stack_p
+ *     Stack to update. MUST BE A VALID, NON-EMPTY, DROP-OLDEST STACK
+ *     otherwise results are indeterminate.
+ */
+static void stack_evict_bottom (stack_t *stack_p)
+{
+    size_t entry_size = 0;                       /* Bottom entry data size    */
+
+    memcpy(&entry_size, stack_p->buf + stack_p->buf_end - sizeof(size_t),
+           sizeof(size_t));
+    stack_p->buf_end -= stack_p->entry_overhead + entry_size;
+    (stack_p->num_entries)--;
+
+    if (0 == stack_p->num_entries) {
+        stack_reset(stack_p);
+    } else if (stack_p->is_wrapped &&
+               (stack_p->buf_end == stack_p->buf_wrap)) {
+        /*
+         * The older run is gone; only the newer run is left.
+         */
+        stack_p->buf_end = stack_p->buf_size;
+        stack_p->is_wrapped = false;
+    }
+}
+
+/**
+ * Move the entries of a wrapped stack back into a single run.
+ *
+ * Operations that treat several entries as one region of bytes call this
+ * first. Only drop-oldest stacks ever wrap.
+ *
+ * @param[in] stack_p
+ *     Stack to update. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ */
+static void stack_linearize (stack_t *stack_p)
+{
+    size_t used_size = 0;                        /* Bytes used by entries     */
+
+    if (! stack_p->is_wrapped) {
+        return;
+    }
+
+    /*
+     * From the wrap offset onward the buffer holds [older][free][newer].
+     * Moving the older run past the newer run leaves [free][newer][older],
+     * which is a single run ending at the end of the buffer.
+     */
+    used_size = stack_get_used_size(stack_p);
+    stack_rotate_bytes(stack_p->buf + stack_p->buf_wrap,
+                       stack_p->buf_end - stack_p->buf_wrap,
+                       stack_p->buf_size - stack_p->buf_wrap);
+    stack_p->buf_top = stack_p->buf_size - used_size;
+    stack_p->buf_end = stack_p->buf_size;
+    stack_p->buf_wrap = 0;
+    stack_p->is_wrapped = false;
+}
+
+/**
+ * Redistribute the free space of an arena so that one of its stacks gets
+ * room for more data.
+ *
+ * Rebalancing is lazy: it only happens when a stack runs out of room in
+ * its own region. The requesting stack gets the space it needs, and the
+ * rest of the free space is shared evenly among all stacks of the arena
+ * so that a stack that fills up faster than the others does not
+ * immediately trigger another rebalance.
+ *
+ * @param[in] stack_p
+ *     Stack that needs room. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @param[in] needed_size
+ *     Number of free bytes the stack needs below its top entry.
+ * @retval true
+ *     Stack now has at least needed_size free bytes.
+ * @retval false
+ *     Stack is not part of an arena, or the arena does not have enough
+ *     free space. Nothing was changed.
+ */
+static bool stack_arena_make_room (stack_t *stack_p, size_t needed_size)
+{
+    stack_arena_t *arena_p     = stack_p->arena_p; /* Arena to rebalance     */
+    stack_t       *member_p    = NULL;           /* Current arena stack       */
+    size_t         total_used  = 0;              /* Bytes used by all stacks  */
+    size_t         share       = 0;              /* Free bytes per stack      */
+    size_t         new_lo      = 0;              /* Start of new region       */
+    size_t         used_size   = 0;              /* Bytes used by a stack     */
+    size_t        *new_sizes   = NULL;           /* New region sizes          */
+    size_t         old_pos     = 0;              /* Old offset of stack data  */
+    size_t         new_pos     = 0;              /* New offset of stack data  */
+    size_t         i           = 0;              /* Loop index counter        */
+
+    if (NULL == arena_p) {
+        return (false);
+    }
+
+    for (i = 0; i < arena_p->num_stacks; i++) {
+        total_used += stack_get_used_size(&(arena_p->stacks[i]));
+    }
+    if ((arena_p->buf_size - total_used) < needed_size) {
+        return (false);
+    }
+    new_sizes = malloc(arena_p->num_stacks * sizeof(size_t));
+    if (NULL == new_sizes) {
+        return (false);
+    }
+
+    /*
+     * Size the new regions. The last region absorbs any rounding.
+     */
+    share = (arena_p->buf_size - total_used - needed_size) /
+            arena_p->num_stacks;
+    new_lo = 0;
+    for (i = 0; i < arena_p->num_stacks; i++) {
+        member_p = &(arena_p->stacks[i]);
+        new_sizes[i] = stack_get_used_size(member_p) + share;
+        if (member_p == stack_p) {
+            new_sizes[i] += needed_size;
+        }
+        if ((i + 1) == arena_p->num_stacks) {
+            new_sizes[i] = arena_p->buf_size - new_lo;
+        }
+        new_lo += new_sizes[i];
+    }
+
+    /*
+     * Move each stack's entries to the end of its new region. The regions
+     * keep their order, so moving the stacks that shift down from first to
+     * last, and then the stacks that shift up from last to first, never
+     * overwrites entries that have not been moved yet.
+     */
+    new_lo = 0;
+    for (i = 0; i < arena_p->num_stacks; i++) {
+        member_p = &(arena_p->stacks[i]);
+        used_size = stack_get_used_size(member_p);
+        old_pos = (member_p->buf - arena_p->buf) + member_p->buf_top;
+        new_pos = new_lo + new_sizes[i] - used_size;
+        if (new_pos < old_pos) {
+            memmove(arena_p->buf + new_pos, arena_p->buf + old_pos, used_size);
+        }
+        new_lo += new_sizes[i];
+    }
+    for (i = arena_p->num_stacks; i > 0; i--) {
+        member_p = &(arena_p->stacks[i - 1]);
+        new_lo -= new_sizes[i - 1];
+        used_size = stack_get_used_size(member_p);
+        old_pos = (member_p->buf - arena_p->buf) + member_p->buf_top;
+        new_pos = new_lo + new_sizes[i - 1] - used_size;
+        if (new_pos > old_pos) {
+            memmove(arena_p->buf + new_pos, arena_p->buf + old_pos, used_size);
+        }
+
+        member_p->buf = arena_p->buf + new_lo;
+        member_p->buf_size = new_sizes[i - 1];
+        member_p->buf_top = member_p->buf_size - used_size;
+        member_p->buf_end = member_p->buf_size;
+    }
+    free(new_sizes);
+
+    return (true);
+}
+
+/**
+ * Grow the buffer of a #STACK_FLAG_GROW stack so that it has room for
+ * more data.
+ *
+ * The buffer at least doubles, so pushing n bytes costs O(n) copying
+ * overall. Only the bytes in use are copied, to the end of the new buffer.
+ *
+ * @param[in] stack_p
+ *     Stack that needs room. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @param[in] needed_size
+ *     Number of free bytes the stack needs below its top entry.
+ * @retval true
+ *     Stack now has at least needed_size free bytes.
+ * @retval false
+ *     Stack can't grow, would grow beyond its maximum size, or is out of
+ *     memory. Nothing was changed.
+ */
+static bool stack_grow (stack_t *stack_p, size_t needed_size)
+{
+    unsigned char *new_buf   = NULL;             /* Grown element buffer      */
+    size_t         used_size = 0;                /* Bytes used by entries     */
+    size_t         new_size  = 0;                /* Size of grown buffer      */
+    size_t         max_size  = SIZE_MAX;         /* Largest buffer allowed    */
+
+    if (0 == (stack_p->flags & STACK_FLAG_GROW)) {
+        return (false);
+    }
+    if (STACK_MAX_SIZE_NONE != stack_p->max_size) {
+        max_size = stack_p->max_size;
+    }
+
+    used_size = stack_get_used_size(stack_p);
+    if ((needed_size > max_size) || (used_size > (max_size - needed_size))) {
+        return (false);
+    }
+    new_size = stack_p->buf_size;
+    while ((new_size - used_size) < needed_size) {
+        new_size = (new_size > (max_size / 2)) ? max_size : (2 * new_size);
+    }
+
+    new_buf = malloc(new_size);
+    if (NULL == new_buf) {
+        return (false);
+    }
+    if (used_size > 0) {
+        memcpy(new_buf + new_size - used_size,
+               stack_p->buf + stack_p->buf_top, used_size);
+        stack_stats_copy(stack_p, used_size);
+    }
+    free(stack_p->buf);
+    stack_p->buf = new_buf;
+    stack_p->buf_size = new_size;
+    stack_p->buf_top = new_size - used_size;
+    stack_p->buf_end = new_size;
+
+    return (true);
+}
+
+/**
+ * Get more room in a stack's buffer, from its arena or by growing the
+ * buffer.
+ *
+ * @param[in] stack_p
+ *     Stack that needs room. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @param[in] needed_size
+ *     Number of free bytes the stack needs below its top entry.
+ * @retval true
+ *     Stack now has at least needed_size free bytes.
+ * @retval false
+ *     No more room can be had. Nothing was changed.
+ */
+static bool stack_make_room (stack_t *stack_p, size_t needed_size)
+{
+    if (NULL != stack_p->arena_p) {
+        return (stack_arena_make_room(stack_p, needed_size));
+    }
+    return (stack_grow(stack_p, needed_size));
+}
+
+/**
+ * Prepare a #STACK_FLAG_SNAPSHOT stack for writing into its buffer.
+ *
+ * Bytes that a published view or a snapshot may cover are never written
+ * in place. If the write reaches them, the view is withdrawn; the write
+ * can then go ahead in place once no reader holds the chunk, and
+ * otherwise the stack moves its entries to a new chunk. Either way, the
+ * caller may write anywhere in the buffer until the stack is unlocked.
+ *
+ * @param[in,out] stack_p
+ *     Locked stack. Nothing is done for other stacks.
+ * @param[in] write_end
+ *     Offset just past the highest byte that will be written.
+ * @retval STACK_E_OK
+ *     Buffer may be written.
+ * @retval STACK_E_NOMEM
+ *     Out of memory. The stack is unchanged.
+ */
+static stack_err_e stack_snapshot_prepare_write (stack_t *stack_p,
+                                                 size_t write_end)
+{
+    stack_chunk_t    *chunk_p = NULL;            /* New chunk                 */
+    stack_snapshot_t *view_p  = NULL;            /* Withdrawn view            */
+
+    if ((! stack_is_snapshot(stack_p)) ||
+        (write_end <= stack_p->snap_shared_top)) {
+        return (STACK_E_OK);
+    }
+    if (! stack_snapshot_reserve(stack_p)) {
+        return (STACK_E_NOMEM);
+    }
+
+    view_p = __atomic_exchange_n(&(stack_p->snap_view_p), NULL,
+                                 __ATOMIC_SEQ_CST);
+    if (NULL != view_p) {
+        view_p->next = stack_p->snap_retired_p;
+        stack_p->snap_retired_p = view_p;
+    }
+    stack_snapshot_reclaim(stack_p);
+    if ((NULL == stack_p->snap_retired_p) &&
+        (1 == __atomic_load_n(&(stack_p->snap_chunk_p->refs),
+                              __ATOMIC_ACQUIRE))) {
+        stack_p->snap_shared_top = stack_p->buf_size;
+        return (STACK_E_OK);
+    }
+
+    chunk_p = malloc(sizeof(stack_chunk_t) + stack_p->buf_size);
+    if (NULL == chunk_p) {
+        return (STACK_E_NOMEM);
+    }
+    chunk_p->refs = 1;
+    memcpy(chunk_p->data + stack_p->buf_top,
+           stack_p->buf + stack_p->buf_top,
+           stack_p->buf_end - stack_p->buf_top);
+
+    /*
+     * Snapshots may drop their references to the old chunk at any time,
+     * without the lock, so the stack keeps its own until
+     * stack_snapshot_publish() ends the operation. Pointers into the old
+     * chunk, such as the source of stack_dup(), stay valid until then.
+     */
+    if (NULL != stack_p->snap_old_chunk_p) {
+        stack_chunk_release(stack_p->snap_old_chunk_p);
+    }
+    stack_p->snap_old_chunk_p = stack_p->snap_chunk_p;
+    stack_p->snap_chunk_p = chunk_p;
+    stack_p->buf = chunk_p->data;
+    stack_p->snap_shared_top = stack_p->buf_size;
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Push copy of given entry onto a stack.
+ *
+ * @note
+ *     This is a private implementation for use with stacks that have
+ *     already been validated.
+ *
+ * @param[in] stack_p
+ *     Stack to update. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @param[in] entry_p
+ *     Entry to copy to top of stack. May point at an entry of the same
+ *     stack, even one that is evicted to make room.
+ * @param[in] entry_size
+ *     Size of entry in bytes.
+ * @retval STACK_E_OK
+ *     Successfully added entry.
+ * @retval STACK_E_FULL
+ *     Not enough room in stack.
+ * @retval STACK_E_INVALID
+ *     Entry is larger than the stack's maximum entry size.
+ */
+static stack_err_e stack_push_impl (stack_t *stack_p,
+                                    const void *entry_p,
+                                    size_t entry_size)
+{
+    stack_err_e  err            = STACK_E_OK;    /* Operation return code     */
+    size_t       new_entry_size = 0;             /* Total new entry space     */
+    size_t       new_entry_pos  = 0;             /* Offset of new entry       */
+    unsigned char *new_entry_p  = NULL;          /* New entry in buffer       */
+
+    err = stack_check_entry_size(stack_p, entry_size);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    new_entry_size = stack_p->entry_overhead + entry_size;
+
+    if ((STACK_MAX_ENTRIES_NONE != stack_p->max_entries) &&
+        (stack_p->num_entries >= stack_p->max_entries)) {
+        if (! stack_is_drop_oldest(stack_p)) {
+            return (STACK_E_FULL);
+        }
+        stack_evict_bottom(stack_p);
+    }
+
+    /*
+     * Find room for the new entry. Normally it goes directly below the
+     * current top entry. A drop-oldest stack that reaches the start of the
+     * buffer wraps around to the space freed at the end of the buffer by
+     * evicting its bottom entries, so eviction never moves any data.
+     */
+    for (;;) {
+        if (! stack_p->is_wrapped) {
+            if (new_entry_size <= stack_p->buf_top) {
+                new_entry_pos = stack_p->buf_top - new_entry_size;
+                break;
+            }
+            if (stack_is_drop_oldest(stack_p) &&
+                (new_entry_size <= (stack_p->buf_size - stack_p->buf_end))) {
+                stack_p->buf_wrap = stack_p->buf_top;
+                stack_p->is_wrapped = true;
+                new_entry_pos = stack_p->buf_size - new_entry_size;
+                break;
+            }
+        } else if (new_entry_size <= (stack_p->buf_top - stack_p->buf_end)) {
+            new_entry_pos = stack_p->buf_top - new_entry_size;
+            break;
+        }
+
+        if (! stack_is_drop_oldest(stack_p)) {
+            if (! stack_make_room(stack_p, new_entry_size)) {
+                return (STACK_E_FULL);
+            }
+            continue;
+        }
+        if (stack_is_empty_impl(stack_p)) {
+            return (STACK_E_FULL);
+        }
+        stack_evict_bottom(stack_p);
+    }
+    err = stack_snapshot_prepare_write(stack_p, new_entry_pos + new_entry_size);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+
+    /*
+     * Copy data for entry into buffer. The data is copied before the
+     * 'size' fields are written since the source may overlap the new
+     * entry if it was just evicted.
+     */
+    new_entry_p = stack_p->buf + new_entry_pos;
+    if ((entry_size > 0) && (NULL != entry_p)) {
+        memmove(new_entry_p + sizeof(size_t), entry_p, entry_size);
+    }
+    memcpy(new_entry_p, &entry_size, sizeof(size_t));
+    if (stack_is_drop_oldest(stack_p)) {
+        memcpy(new_entry_p + sizeof(size_t) + entry_size,
+               &entry_size, sizeof(size_t));
+    }
+
+    stack_p->buf_top = new_entry_pos;
+    stack_p->num_entries++;
+    stack_stats_push(stack_p, entry_size, 1);
+    if (NULL != entry_p) {
+        stack_stats_copy(stack_p, entry_size);
+    }
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Determine whether the bookkeeping of a stack describes a well-formed
+ * sequence of entries.
+ *
+ * @param[in] stack_p
+ *     Stack to check. MUST BE A VALID STACK otherwise results are
+ *     indeterminate.
+ * @retval true
+ *     Every entry lies within the buffer and the entries exactly fill the
+ *     used part of the buffer.
+ * @retval false
+ *     Bookkeeping and buffer contents disagree.
+ */
+static bool stack_check_layout (const stack_t *stack_p)
+{
+    size_t pos        = stack_p->buf_top;        /* Offset of current entry   */
+    size_t run_end    = stack_p->buf_end;        /* End of current run        */
+    bool   in_newer   = stack_p->is_wrapped;     /* In newer run of wrap?     */
+    size_t entry_size = 0;                       /* Current entry data size   */
+    size_t i          = 0;                       /* Loop index counter        */
+
+    if (stack_p->buf_end > stack_p->buf_size) {
+        return (false);
+    }
+    if (in_newer) {
+        if ((stack_p->buf_wrap > stack_p->buf_end) ||
+            (stack_p->buf_end > stack_p->buf_top)) {
+            return (false);
+        }
+        run_end = stack_p->buf_size;
+    }
+    if (pos > run_end) {
+        return (false);
+    }
+
+    for (i = 0; i < stack_p->num_entries; i++) {
+        if (in_newer && (pos == run_end)) {
+            in_newer = false;
+            pos = stack_p->buf_wrap;
+            run_end = stack_p->buf_end;
+        }
+        if ((run_end - pos) < stack_p->entry_overhead) {
+            return (false);
+        }
+        memcpy(&entry_size, stack_p->buf + pos, sizeof(size_t));
+        if (entry_size > (run_end - pos - stack_p->entry_overhead)) {
+            return (false);
+        }
+        pos += stack_p->entry_overhead + entry_size;
+    }
+
+    return ((! in_newer) && (pos == run_end));
+}
+
+/**
+ * Bring the handle of a freshly locked stack up to date.
+ *
+ * For shared memory stacks this loads the shared bookkeeping into the
+ * handle, so that the rest of the implementation can treat the stack like
+ * any other. It also remembers the size of the stack so that
+ * stack_unlock() can tell which waiters to wake.
+ *
+ * @param[in,out] stack_p
+ *     Locked stack.
+ * @param[in] is_stale
+ *     Did the previous owner of the lock die while holding it?
+ */
+static void stack_sync_load (stack_t *stack_p, bool is_stale)
+{
+    stack_shm_hdr_t *hdr_p = stack_p->shm_p;     /* Shared control block      */
+
+    if (NULL != hdr_p) {
+        stack_p->buf_top = hdr_p->buf_top;
+        stack_p->buf_end = hdr_p->buf_end;
+        stack_p->buf_wrap = hdr_p->buf_wrap;
+        stack_p->is_wrapped = hdr_p->is_wrapped;
+        stack_p->num_entries = hdr_p->num_entries;
+    }
+
+    /*
+     * The shared bookkeeping is only stored back by stack_unlock(), so
+     * after a process dies holding the lock it still describes the stack
+     * as of its last completed operation. The dead process may have been
+     * rewriting entries in place, though, so the stack is emptied if its
+     * entries no longer match the bookkeeping.
+     */
+    if (is_stale && (! stack_check_layout(stack_p))) {
+        stack_reset(stack_p);
+    }
+
+    stack_p->locked_num_entries = stack_p->num_entries;
+    stack_p->locked_used_size = stack_get_used_size(stack_p);
+}
+
+/**
+ * Publish the bookkeeping of a locked stack and wake any waiters that its
+ * changes concern.
+ *
+ * @param[in] stack_p
+ *     Locked stack.
+ */
+static void stack_sync_store (const stack_t *stack_p)
+{
+    stack_shm_hdr_t *hdr_p = stack_p->shm_p;     /* Shared control block      */
+
+    if (NULL != hdr_p) {
+        hdr_p->buf_top = stack_p->buf_top;
+        hdr_p->buf_end = stack_p->buf_end;
+        hdr_p->buf_wrap = stack_p->buf_wrap;
+        hdr_p->is_wrapped = stack_p->is_wrapped;
+        hdr_p->num_entries = stack_p->num_entries;
+    }
+
+    if (stack_p->num_entries > stack_p->locked_num_entries) {
+        (void)pthread_cond_broadcast(&(stack_p->sync_p->not_empty));
+    }
+    if ((stack_p->num_entries < stack_p->locked_num_entries) ||
+        (stack_get_used_size(stack_p) < stack_p->locked_used_size)) {
+        (void)pthread_cond_broadcast(&(stack_p->sync_p->not_full));
+    }
+}
+
+/**
+ * Lock a stack for the duration of one operation.
+ *
+ * Stacks used by only one thread need no locking. Others have a lock,
+ * which is robust and process-shared for shared memory stacks.
+ *
+ * @param[in] stack_p
+ *     Stack to lock. Only the handle is updated, so const stacks may be
+ *     passed.
+ * @retval STACK_E_OK
+ *     Successfully locked stack. Caller must call stack_unlock().
+ * @retval STACK_E_INVALID
+ *     Invalid stack, or a #STACK_FLAG_MPSC stack, which has no buffer for
+ *     locked operations to work on.
+ * @retval STACK_E_INTERNAL
+ *     The lock could not be taken.
+ */
+static stack_err_e stack_lock (const stack_t *stack_p)
+{
+    stack_t *handle_p = (stack_t *)stack_p;      /* Handle to update          */
+    int      rc       = 0;                       /* pthread return code       */
+    bool     is_stale = false;                   /* Previous owner died?      */
+
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if (stack_is_mpsc(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if (stack_is_single_writer(stack_p)) {
+        __atomic_store_n(&(handle_p->seq), stack_p->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+    if (NULL == stack_p->sync_p) {
+        return (STACK_E_OK);
+    }
+
+    rc = pthread_mutex_lock(&(stack_p->sync_p->lock));
+    if (EOWNERDEAD == rc) {
+        rc = pthread_mutex_consistent(&(stack_p->sync_p->lock));
+        is_stale = true;
+    }
+    if (0 != rc) {
+        return (STACK_E_INTERNAL);
+    }
+    stack_sync_load(handle_p, is_stale);
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Make the readiness notification descriptor of a stack match the number
+ * of entries in it.
+ *
+ * The descriptor's counter is only ever 0 or 1: it is incremented when the
+ * stack reaches the threshold and read back to 0 when it drops below it,
+ * so the descriptor is readable exactly while the stack is at or above the
+ * threshold.
+ *
+ * @param[in,out] stack_p
+ *     Locked stack. Nothing is done if it has no descriptor.
+ */
+static void stack_event_update (stack_t *stack_p)
+{
+    bool     is_ready = false;                   /* Should fd be readable?    */
+    uint64_t count    = 1;                       /* eventfd counter value     */
+
+    if (stack_p->event_fd < 0) {
+        return;
+    }
+
+    is_ready = (stack_p->num_entries >= stack_p->event_threshold);
+    if (is_ready == stack_p->event_ready) {
+        return;
+    }
+    if (is_ready) {
+        if (sizeof(count) != write(stack_p->event_fd, &count, sizeof(count))) {
+            return;
+        }
+    } else {
+        if (sizeof(count) != read(stack_p->event_fd, &count, sizeof(count))) {
+            return;
+        }
+    }
+    stack_p->event_ready = is_ready;
+}
+
+/**
+ * Unlock a stack locked with stack_lock().
+ *
+ * @param[in] stack_p
+ *     Stack to unlock. MUST HAVE BEEN LOCKED by the caller.
+ */
+static void stack_unlock (const stack_t *stack_p)
+{
+    stack_stats_high_water((stack_t *)stack_p);
+    if (NULL != stack_p->journal_p) {
+        stack_journal_log((stack_t *)stack_p);
+        (void)stack_journal_commit(stack_p->journal_p, false);
+    }
+    stack_event_update((stack_t *)stack_p);
+    stack_snapshot_publish((stack_t *)stack_p);
+    if (stack_is_single_writer(stack_p)) {
+        __atomic_store_n(&(((stack_t *)stack_p)->seq), stack_p->seq + 1,
+                         __ATOMIC_RELEASE);
+    }
+
+    if (NULL == stack_p->sync_p) {
+        return;
+    }
+
+    stack_sync_store(stack_p);
+    (void)pthread_mutex_unlock(&(stack_p->sync_p->lock));
+}
+
+/**
+ * Compute the deadline for a wait.
+ *
+ * @param[in] timeout_ms
+ *     Longest time to wait, in milliseconds. Must not be negative.
+ * @param[out] deadline_p
+ *     Will be updated with the deadline on the monotonic clock.
+ */
+static void stack_get_deadline (int timeout_ms, struct timespec *deadline_p)
+{
+    (void)clock_gettime(CLOCK_MONOTONIC, deadline_p);
+    deadline_p->tv_sec += timeout_ms / 1000;
+    deadline_p->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline_p->tv_nsec >= 1000000000L) {
+        deadline_p->tv_sec++;
+        deadline_p->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * Release the lock of a stack until a condition is signalled.
+ *
+ * @param[in,out] stack_p
+ *     Stack to wait on. MUST BE LOCKED by the caller and have a lock. Is
+ *     locked again, with up to date bookkeeping, when this returns.
+ * @param[in] cond_p
+ *     Condition to wait for.
+ * @param[in] deadline_p
+ *     Deadline on the monotonic clock, or NULL to wait forever.
+ * @retval STACK_E_OK
+ *     Condition was signalled. The caller must check its predicate again.
+ * @retval STACK_E_TIMEOUT
+ *     Deadline passed.
+ * @retval STACK_E_INTERNAL
+ *     Waiting failed.
+ */
+static stack_err_e stack_wait (stack_t *stack_p,
+                               pthread_cond_t *cond_p,
+                               const struct timespec *deadline_p)
+{
+    pthread_mutex_t *lock_p   = &(stack_p->sync_p->lock); /* Stack's lock   */
+    int              rc       = 0;               /* pthread return code       */
+    bool             is_stale = false;           /* Previous owner died?      */
+
+    stack_sync_store(stack_p);
+    if (NULL == deadline_p) {
+        rc = pthread_cond_wait(cond_p, lock_p);
+    } else {
+        rc = pthread_cond_timedwait(cond_p, lock_p, deadline_p);
+    }
+    if (EOWNERDEAD == rc) {
+        rc = pthread_mutex_consistent(lock_p);
+        is_stale = true;
+    }
+    stack_sync_load(stack_p, is_stale);
+
+    if (ETIMEDOUT == rc) {
+        return (STACK_E_TIMEOUT);
+    }
+    if (0 != rc) {
+        return (STACK_E_INTERNAL);
+    }
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Lock two stacks for an operation that involves both.
+ *
+ * Stacks are always locked in the same order so that threads or processes
+ * locking the same pair of stacks from opposite ends cannot deadlock:
+ * shared memory stacks first, ordered by segment identity, then the other
+ * stacks, ordered by the address of their locks.
+ *
+ * @param[in] first_p
+ *     First stack to lock.
+ * @param[in] second_p
+ *     Second stack to lock.
+ * @retval STACK_E_OK
+ *     Successfully locked both stacks. Caller must call stack_unlock() on
+ *     each.
+ * @retval STACK_E_INVALID
+ *     Either stack is invalid, or both are the same stack.
+ * @retval STACK_E_INTERNAL
+ *     A lock could not be taken.
+ */
+static stack_err_e stack_lock_pair (stack_t *first_p, stack_t *second_p)
+{
+    stack_err_e  err        = STACK_E_OK;        /* Operation return code     */
+    stack_t     *tmp_p      = NULL;              /* Stack being reordered     */
+    bool         is_swapped = false;             /* Lock second stack first?  */
+
+    if ((! stack_is_valid(first_p)) || (! stack_is_valid(second_p))) {
+        return (STACK_E_INVALID);
+    }
+    if (first_p == second_p) {
+        return (STACK_E_INVALID);
+    }
+    if ((NULL != first_p->shm_p) && (NULL != second_p->shm_p)) {
+        /*
+         * Two handles for the same segment share one lock.
+         */
+        if (first_p->shm_ino == second_p->shm_ino) {
+            return (STACK_E_INVALID);
+        }
+        is_swapped = (first_p->shm_ino > second_p->shm_ino);
+    } else if (NULL != second_p->shm_p) {
+        is_swapped = true;
+    } else if (NULL == first_p->shm_p) {
+        is_swapped = ((uintptr_t)first_p->sync_p >
+                      (uintptr_t)second_p->sync_p);
+    }
+    if (is_swapped) {
+        tmp_p = first_p;
+        first_p = second_p;
+        second_p = tmp_p;
+    }
+
+    err = stack_lock(first_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_lock(second_p);
+    if (stack_err_e_is_error(err)) {
+        stack_unlock(first_p);
+        return (err);
+    }
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Push copy of given entry onto a lock-free multi-producer stack.
+ *
+ * May be called from any number of threads at once.
+ *
+ * @param[in] stack_p
+ *     Stack to update. MUST BE A VALID MPSC STACK otherwise results are
+ *     indeterminate.
+ * @param[in] entry_p
+ *     Entry to copy to top of stack.
+ * @param[in] entry_size
+ *     Size of entry in bytes.
+ * @retval STACK_E_OK
+ *     Successfully added entry.
+ * @retval STACK_E_INVALID
+ *     Entry is larger than the stack's maximum entry size.
+ * @retval STACK_E_NOMEM
+ *     Out of memory.
+ */
+static stack_err_e stack_mpsc_push (stack_t *stack_p,
+                                    const void *entry_p,
+                                    size_t entry_size)
+{
+    stack_batch_t *node_p = NULL;                /* New list node             */
+
+    if ((STACK_MAX_ENTRY_SIZE_NONE != stack_p->max_entry_size) &&
+        (entry_size > stack_p->max_entry_size)) {
+        return (STACK_E_INVALID);
+    }
+    node_p = malloc(sizeof(stack_batch_t) + entry_size);
+    if (NULL == node_p) {
+        return (STACK_E_NOMEM);
+    }
+    node_p->size = entry_size;
+    if (entry_size > 0) {
+        memcpy(node_p->data, entry_p, entry_size);
+    }
+
+    /*
+     * Count the entry first so that the count never drops below the
+     * number of entries on the list, even briefly.
+     */
+    (void)__atomic_add_fetch(&(stack_p->mpsc_count), 1, __ATOMIC_RELAXED);
+
+    /*
+     * Link the node in with a single compare-and-swap, retrying only if
+     * another thread changed the top of the list in the meantime.
+     */
+    node_p->next = __atomic_load_n(&(stack_p->mpsc_head), __ATOMIC_RELAXED);
+    while (! __atomic_compare_exchange_n(&(stack_p->mpsc_head),
+                                         &(node_p->next), node_p,
+                                         true,
+                                         __ATOMIC_RELEASE,
+                                         __ATOMIC_RELAXED)) {
+        /* node_p->next now holds the new top of the list; try again. */
+    }
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Copy the top entry of a lock-free multi-producer stack, and optionally
+ * remove it.
+ *
+ * Must only be called from the stack's single consumer thread. Nodes are
+ * only ever freed by the consumer, so the top node cannot disappear while
+ * the consumer looks at it, and the list cannot suffer from ABA.
+ *
+ * @param[in] stack_p
+ *     Stack to update. MUST BE A VALID MPSC STACK otherwise results are
+ *     indeterminate.
+ * @param[in] entry_p
+ *     As for stack_pop().
+ * @param[in,out] entry_size_p
+ *     As for stack_pop().
+ * @param[in] is_remove
+ *     Remove the entry from the stack?
+ * @returns
+ *     As for stack_pop().
+ */
+static stack_err_e stack_mpsc_pop (stack_t *stack_p,
+                                   void *entry_p,
+                                   size_t *entry_size_p,
+                                   bool is_remove)
+{
+    stack_batch_t *node_p = NULL;                /* Top list node             */
+
+    if (NULL == entry_size_p) {
+        return (STACK_E_INVALID);
+    }
+    if ((NULL != entry_p) && (*entry_size_p < 1)) {
+        return (STACK_E_INVALID);
+    }
+
+    node_p = __atomic_load_n(&(stack_p->mpsc_head), __ATOMIC_ACQUIRE);
+    for (;;) {
+        if (NULL == node_p) {
+            return (STACK_E_EMPTY);
+        }
+        if ((NULL != entry_p) && (node_p->size > *entry_size_p)) {
+            return (STACK_E_BUF_OVERFLOW);
+        }
+        if (! is_remove) {
+            break;
+        }
+        if (__atomic_compare_exchange_n(&(stack_p->mpsc_head),
+                                        &node_p, node_p->next,
+                                        true,
+                                        __ATOMIC_ACQUIRE,
+                                        __ATOMIC_ACQUIRE)) {
+            (void)__atomic_sub_fetch(&(stack_p->mpsc_count), 1,
+                                     __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    if ((NULL != entry_p) && (node_p->size > 0)) {
+        memcpy(entry_p, node_p->data, node_p->size);
+    }
+    *entry_size_p = node_p->size;
+    if (is_remove) {
+        free(node_p);
+    }
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Read the number of entries and the top entry of a single-writer stack
+ * from any thread, without taking part in the writer's operations.
+ *
+ * Reads are repeated until they fall between two operations. A read that
+ * overlaps an operation may see a half-updated stack, so every offset is
+ * checked against the buffer before it is followed, and the result of such
+ * a read is thrown away. ThreadSanitizer cannot tell that the sequence
+ * count makes these reads safe, so it is told not to check them.
+ *
+ * @param[in] stack_p
+ *     Stack to query. MUST BE A VALID, SINGLE-WRITER STACK otherwise
+ *     results are indeterminate.
+ * @param[out] entry_p
+ *     Output buffer for a copy of the top entry, or NULL.
+ * @param[in,out] entry_size_p
+ *     As for stack_peek(), already checked by the caller, or NULL to only
+ *     count the entries.
+ * @param[out] num_entries_p
+ *     Will be updated with the number of entries.
+ * @retval STACK_E_OK
+ *     Successful completion.
+ * @retval STACK_E_EMPTY
+ *     No entries in stack; only when entry_size_p is given.
+ * @retval STACK_E_BUF_OVERFLOW
+ *     Output buffer too small.
+ */
+__attribute__((no_sanitize("thread")))
+static stack_err_e stack_seq_read (const stack_t *stack_p,
+                                   void *entry_p,
+                                   size_t *entry_size_p,
+                                   size_t *num_entries_p)
+{
+    const volatile stack_t       *vol_stack_p = stack_p; /* Racy reads */
+    const volatile unsigned char *buf_p       = NULL; /* Top entry bytes   */
+    stack_err_e  err            = STACK_E_OK;    /* Operation return code     */
+    unsigned int seq            = 0;             /* Count before reading      */
+    size_t       buf_top        = 0;             /* Offset of top entry       */
+    size_t       num_entries    = 0;             /* Number of entries         */
+    size_t       in_entry_size  = 0;             /* Output data buffer size   */
+    size_t       out_entry_size = 0;             /* Stack entry data size     */
+    size_t       i              = 0;             /* Loop index counter        */
+
+    if ((NULL != entry_p) && (NULL != entry_size_p)) {
+        in_entry_size = *entry_size_p;
+    }
+
+    for (;;) {
+        seq = __atomic_load_n(&(stack_p->seq), __ATOMIC_ACQUIRE);
+        if (0 != (seq & 1)) {
+            (void)sched_yield();
+            continue;
+        }
+
+        err = STACK_E_OK;
+        num_entries = vol_stack_p->num_entries;
+        buf_top = vol_stack_p->buf_top;
+        out_entry_size = 0;
+        if (NULL == entry_size_p) {
+            /* Only counting. */
+        } else if (0 == num_entries) {
+            err = STACK_E_EMPTY;
+        } else if (buf_top > (stack_p->buf_size - sizeof(size_t))) {
+            err = STACK_E_INTERNAL;
+        } else {
+            buf_p = stack_p->buf + buf_top;
+            for (i = 0; i < sizeof(size_t); i++) {
+                ((unsigned char *)&out_entry_size)[i] = buf_p[i];
+            }
+            buf_p += sizeof(size_t);
+            if (out_entry_size >
+                (stack_p->buf_size - buf_top - sizeof(size_t))) {
+                err = STACK_E_INTERNAL;
+            } else if ((out_entry_size > 0) && (NULL != entry_p)) {
+                if (out_entry_size > in_entry_size) {
+                    err = STACK_E_BUF_OVERFLOW;
+                } else {
+                    for (i = 0; i < out_entry_size; i++) {
+                        ((unsigned char *)entry_p)[i] = buf_p[i];
+                    }
+                }
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq == __atomic_load_n(&(stack_p->seq), __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    *num_entries_p = num_entries;
+    if ((NULL != entry_size_p) && (STACK_E_OK == err)) {
+        *entry_size_p = out_entry_size;
+    }
+
+    return (err);
+}
+
+/*
+ * Get number of entries in a stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+size_t stack_get_num_entries (stack_t *stack_p)
+{
+    size_t num_entries = 0;                      /* Number of entries         */
+
+    if (stack_is_valid(stack_p) && stack_is_mpsc(stack_p)) {
+        return (__atomic_load_n(&(stack_p->mpsc_count), __ATOMIC_RELAXED));
+    }
+    if (stack_is_valid(stack_p) && stack_is_single_writer(stack_p)) {
+        (void)stack_seq_read(stack_p, NULL, NULL, &num_entries);
+        return (num_entries);
+    }
+    if (stack_err_e_is_error(stack_lock(stack_p))) {
+        return (0);
+    }
+    num_entries = stack_p->num_entries;
+    stack_unlock(stack_p);
+
+    return (num_entries);
+}
+
+/*
+ * Push copy of given entry onto a stack. 
+ * 
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_push (stack_t *stack_p,
+                        const void *entry_p, 
+                        size_t entry_size)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    /*
+     * Check inputs.
+     */
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if ((NULL == entry_p) && (entry_size > 0)) { 
+        return (STACK_E_INVALID);
+    }
+    if (stack_is_mpsc(stack_p)) {
+        return (stack_mpsc_push(stack_p, entry_p, entry_size));
+    }
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_push_impl(stack_p, entry_p, entry_size);
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/*
+ * Push a new entry onto a stack for the caller to fill.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_push_reserve (stack_t *stack_p,
+                                size_t entry_size,
+                                void **entry_pp)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    /*
+     * Check inputs. The caller fills the entry after the stack is
+     * unlocked, so stacks that let others read it by then are left out: a
+     * snapshot stack has published the entry, a single-writer stack has
+     * let lock-free readers in, and a stack with a lock has woken its
+     * waiters, or other processes.
+     */
+    if ((! stack_is_valid(stack_p)) || (NULL == entry_pp)) {
+        return (STACK_E_INVALID);
+    }
+    if (stack_is_mpsc(stack_p) || stack_is_snapshot(stack_p) ||
+        stack_is_single_writer(stack_p) || (NULL != stack_p->sync_p) ||
+        (NULL != stack_p->shm_p)) {
+        return (STACK_E_INVALID);
+    }
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_push_impl(stack_p, NULL, entry_size);
+    if (STACK_E_OK == err) {
+        stack_get_top_entry(stack_p, NULL, entry_pp);
+        if (NULL != stack_p->journal_p) {
+            stack_p->journal_p->is_deferred = true;
+        }
+    }
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/**
+ * Push copies of several entries onto a stack.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * See stack_push_multi() in ../include/stack.h for API details.
+ */
+static stack_err_e stack_push_multi_locked (stack_t *stack_p,
+                                            const void *const *entries_pp,
+                                            const size_t *entry_sizes_p,
+                                            size_t num_entries)
+{
+    stack_err_e    err        = STACK_E_OK;      /* Operation return code     */
+    size_t         total_size = 0;               /* Bytes needed for entries  */
+    size_t         entry_size = 0;               /* Size of current entry     */
+    unsigned char *entry_p    = NULL;            /* Current entry in buffer   */
+    size_t         i          = 0;               /* Loop index counter        */
+
+    /*
+     * Make sure that the stack will accept every entry before changing it.
+     */
+    for (i = 0; i < num_entries; i++) {
+        if ((NULL == entries_pp[i]) && (entry_sizes_p[i] > 0)) {
+            return (STACK_E_INVALID);
+        }
+        err = stack_check_entry_size(stack_p, entry_sizes_p[i]);
+        if (stack_err_e_is_error(err)) {
+            return (err);
+        }
+        entry_size = stack_p->entry_overhead + entry_sizes_p[i];
+        if (entry_size > (SIZE_MAX - total_size)) {
+            return (STACK_E_FULL);
+        }
+        total_size += entry_size;
+    }
+
+    if (stack_is_drop_oldest(stack_p)) {
+        for (i = 0; i < num_entries; i++) {
+            err = stack_push_impl(stack_p, entries_pp[i], entry_sizes_p[i]);
+            if (stack_err_e_is_error(err)) {
+                return (err);
+            }
+        }
+        return (STACK_E_OK);
+    }
+    if ((STACK_MAX_ENTRIES_NONE != stack_p->max_entries) &&
+        ((stack_p->max_entries - stack_p->num_entries) < num_entries)) {
+        return (STACK_E_FULL);
+    }
+    if ((total_size > stack_p->buf_top) &&
+        (! stack_make_room(stack_p, total_size))) {
+        return (STACK_E_FULL);
+    }
+    err = stack_snapshot_prepare_write(stack_p, stack_p->buf_top);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+
+    /*
+     * Lay the entries out below the current top, deepest first, and only
+     * then move the top past all of them.
+     */
+    entry_p = stack_p->buf + stack_p->buf_top;
+    for (i = 0; i < num_entries; i++) {
+        entry_size = entry_sizes_p[i];
+        entry_p -= sizeof(size_t) + entry_size;
+        memcpy(entry_p, &entry_size, sizeof(size_t));
+        if (entry_size > 0) {
+            memcpy(entry_p + sizeof(size_t), entries_pp[i], entry_size);
+        }
+        stack_stats_push(stack_p, entry_size, 1);
+        stack_stats_copy(stack_p, entry_size);
+    }
+    stack_p->buf_top -= total_size;
+    stack_p->num_entries += num_entries;
+
+    return (STACK_E_OK);
+}
+
+/*
+ * Push copies of several entries onto a stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_push_multi (stack_t *stack_p,
+                              const void *const *entries_pp,
+                              const size_t *entry_sizes_p,
+                              size_t num_entries)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+    size_t       i   = 0;                        /* Loop index counter        */
+
+    /*
+     * Check inputs.
+     */
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if ((num_entries > 0) &&
+        ((NULL == entries_pp) || (NULL == entry_sizes_p))) {
+        return (STACK_E_INVALID);
+    }
+    if (stack_is_mpsc(stack_p)) {
+        for (i = 0; i < num_entries; i++) {
+            err = stack_push(stack_p, entries_pp[i], entry_sizes_p[i]);
+            if (stack_err_e_is_error(err)) {
+                return (err);
+            }
+        }
+        return (STACK_E_OK);
+    }
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_push_multi_locked(stack_p, entries_pp, entry_sizes_p,
+                                  num_entries);
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/**
+ * Look at top entry of stack.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * See stack_peek() in ../include/stack.h for API details.
+ */
+static stack_err_e stack_peek_locked (const stack_t *stack_p,
+                                      void *entry_p,
+                                      size_t *entry_size_p)
+{
+    size_t  in_entry_size    = 0;                /* Output data buffer size   */
+    size_t  out_entry_size   = 0;                /* Stack entry data size     */
+    size_t *buf_entry_size_p = NULL;             /* Entry size in buffer      */
+    void   *buf_entry_p      = NULL;             /* Entry in buffer           */
+
+    /*
+     * Check parameters.
+     */
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if (NULL == entry_size_p) {
+        return (STACK_E_INVALID);
+    }
+    if (NULL != entry_p) {
+        /*
+         * If an output buffer is supplied, it must have at least one byte.
+         */
+        in_entry_size = *entry_size_p;
+        if (in_entry_size < 1) { 
+            return (STACK_E_INVALID);
+        }
+    }
+
+    /*
+     * Nothing to do for empty stacks.
+     */
+    if (stack_is_empty_impl(stack_p)) {
+        return (STACK_E_EMPTY);
+    }
+
+    /*
+     * Copy data for entry from buffer. 
+     */
+    stack_get_top_entry(stack_p, &buf_entry_size_p, &buf_entry_p);
+    out_entry_size = *buf_entry_size_p;
+    if ((out_entry_size > 0) && (NULL != entry_p)) {
+        if (out_entry_size > in_entry_size) {
+            return (STACK_E_BUF_OVERFLOW);
+        }
+        memcpy(entry_p, buf_entry_p, out_entry_size);
+        stack_stats_copy((stack_t *)stack_p, out_entry_size);
+    }
+    *entry_size_p = out_entry_size;
+
+    return (STACK_E_OK);
+}
+
+/*
+ * Look at top entry of stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_peek (const stack_t *stack_p,
+                        void *entry_p,
+                        size_t *entry_size_p)
+{
+    stack_err_e  err         = STACK_E_OK;       /* Operation return code     */
+    size_t       num_entries = 0;                /* Number of entries         */
+
+    if (stack_is_valid(stack_p) && stack_is_mpsc(stack_p)) {
+        return (stack_mpsc_pop((stack_t *)stack_p, entry_p, entry_size_p,
+                               false));
+    }
+    if (stack_is_valid(stack_p) && stack_is_single_writer(stack_p)) {
+        if ((NULL == entry_size_p) ||
+            ((NULL != entry_p) && (*entry_size_p < 1))) {
+            return (STACK_E_INVALID);
+        }
+        return (stack_seq_read(stack_p, entry_p, entry_size_p,
+                               &num_entries));
+    }
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_peek_locked(stack_p, entry_p, entry_size_p);
+    if ((STACK_E_OK == err) && stack_has_stats(stack_p)) {
+        ((stack_t *)stack_p)->stats.num_peeks++;
+    }
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/*
+ * Remove the top entry from a stack and return a copy of it.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_pop (stack_t *stack_p, void *entry_p, size_t *entry_size_p)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    if (stack_is_valid(stack_p) && stack_is_mpsc(stack_p)) {
+        return (stack_mpsc_pop(stack_p, entry_p, entry_size_p, true));
+    }
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+
+    /*
+     * First copy value from top of stack, then remove entry from stack.
+     */
+    err = stack_peek_locked(stack_p, entry_p, entry_size_p);
+    if (! stack_err_e_is_error(err)) {
+        stack_remove_top(stack_p);
+    }
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/*
+ * Remove the top entry from a stack, waiting for one if the stack is empty.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_pop_wait (stack_t *stack_p,
+                            void *entry_p,
+                            size_t *entry_size_p,
+                            int timeout_ms)
+{
+    stack_err_e      err = STACK_E_OK;           /* Operation return code     */
+    struct timespec  deadline;                   /* When to stop waiting      */
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    if (NULL == stack_p->sync_p) {
+        stack_unlock(stack_p);
+        return (STACK_E_INVALID);
+    }
+    if (timeout_ms > 0) {
+        stack_get_deadline(timeout_ms, &deadline);
+    }
+
+    while (stack_is_empty_impl(stack_p)) {
+        if (0 == timeout_ms) {
+            err = STACK_E_TIMEOUT;
+            break;
+        }
+        err = stack_wait(stack_p, &(stack_p->sync_p->not_empty),
+                         (timeout_ms < 0) ? NULL : &deadline);
+        if (stack_err_e_is_error(err)) {
+            break;
+        }
+    }
+
+    if (! stack_err_e_is_error(err)) {
+        err = stack_peek_locked(stack_p, entry_p, entry_size_p);
+    }
+    if (! stack_err_e_is_error(err)) {
+        stack_remove_top(stack_p);
+    }
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/*
+ * Push copy of given entry onto a stack, waiting for room if the stack is
+ * full.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_push_wait (stack_t *stack_p,
+                             const void *entry_p,
+                             size_t entry_size,
+                             int timeout_ms)
+{
+    stack_err_e      err = STACK_E_OK;           /* Operation return code     */
+    struct timespec  deadline;                   /* When to stop waiting      */
+
+    if ((NULL == entry_p) && (entry_size > 0)) {
+        return (STACK_E_INVALID);
+    }
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    if (NULL == stack_p->sync_p) {
+        stack_unlock(stack_p);
+        return (STACK_E_INVALID);
+    }
+
+    /*
+     * Don't wait for room that can never appear.
+     */
+    err = stack_check_entry_size(stack_p, entry_size);
+    if (stack_err_e_is_error(err)) {
+        stack_unlock(stack_p);
+        return (err);
+    }
+    if (timeout_ms > 0) {
+        stack_get_deadline(timeout_ms, &deadline);
+    }
+
+    for (;;) {
+        err = stack_push_impl(stack_p, entry_p, entry_size);
+        if (STACK_E_FULL != err) {
+            break;
+        }
+        if (0 == timeout_ms) {
+            err = STACK_E_TIMEOUT;
+            break;
+        }
+        err = stack_wait(stack_p, &(stack_p->sync_p->not_full),
+                         (timeout_ms < 0) ? NULL : &deadline);
+        if (stack_err_e_is_error(err)) {
+            break;
+        }
+    }
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/**
+ * Copy a byte range out of an entry without removing it.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * See stack_peek_range() in ../include/stack.h for API details.
+ */
+static stack_err_e stack_peek_range_locked (const stack_t *stack_p,
+                                            size_t depth,
+                                            size_t offset,
+                                            void *entry_p,
+                                            size_t *entry_size_p)
+{
+    size_t  copy_size        = 0;                /* Number of bytes to copy   */
+    size_t *buf_entry_size_p = NULL;             /* Entry size in buffer      */
+    void   *buf_entry_p      = NULL;             /* Entry in buffer           */
+
+    /*
+     * Check parameters.
+     */
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if ((NULL == entry_p) || (NULL == entry_size_p)) {
+        return (STACK_E_INVALID);
+    }
+
+    /*
+     * Locate the entry. Only the entries above it are visited, so
+     * looking near the top of a deep stack stays cheap.
+     */
+    if (! stack_get_entry_at_depth(stack_p, depth,
+                                   &buf_entry_size_p, &buf_entry_p)) {
+        return (STACK_E_EMPTY);
+    }
+    if (offset > *buf_entry_size_p) {
+        return (STACK_E_INVALID);
+    }
+
+    /*
+     * Clip the range to the end of the entry and copy only that slice.
+     */
+    copy_size = *buf_entry_size_p - offset;
+    if (copy_size > *entry_size_p) {
+        copy_size = *entry_size_p;
+    }
+    if (copy_size > 0) {
+        memcpy(entry_p, (unsigned char *)buf_entry_p + offset, copy_size);
+    }
+    *entry_size_p = copy_size;
+
+    return (STACK_E_OK);
+}
+
+/*
+ * Copy a byte range out of an entry without removing it.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_peek_range (const stack_t *stack_p,
+                              size_t depth,
+                              size_t offset,
+                              void *entry_p,
+                              size_t *entry_size_p)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_peek_range_locked(stack_p, depth, offset, entry_p,
+                                 entry_size_p);
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/**
+ * Get direct access to the top entry of a stack.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * See stack_top_view() in ../include/stack.h for API details.
+ */
+static stack_err_e stack_top_view_locked (stack_t *stack_p,
+                                          void **entry_pp,
+                                          size_t *entry_size_p)
+{
+    size_t *buf_entry_size_p = NULL;             /* Entry size in buffer      */
+
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if ((NULL == entry_pp) || (NULL == entry_size_p)) {
+        return (STACK_E_INVALID);
+    }
+
+    /*
+     * The caller writes to the entry after the stack is unlocked, when
+     * its view has already been published.
+     */
+    if (stack_is_snapshot(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if (stack_is_empty_impl(stack_p)) {
+        return (STACK_E_EMPTY);
+    }
+
+    stack_get_top_entry(stack_p, &buf_entry_size_p, entry_pp);
+    *entry_size_p = *buf_entry_size_p;
+
+    return (STACK_E_OK);
+}
+
+/*
+ * Get direct access to the top entry of a stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_top_view (stack_t *stack_p,
+                            void **entry_pp,
+                            size_t *entry_size_p)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_top_view_locked(stack_p, entry_pp, entry_size_p);
+    if ((STACK_E_OK == err) && stack_has_stats(stack_p)) {
+        stack_p->stats.num_peeks++;
+    }
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/**
+ * Replace the top entry of a stack with a copy of the given entry.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * See stack_replace_top() in ../include/stack.h for API details.
+ */
+static stack_err_e stack_replace_top_locked (stack_t *stack_p,
+                                             const void *entry_p,
+                                             size_t entry_size)
+{
+    size_t *buf_entry_size_p = NULL;             /* Entry size in buffer      */
+    void   *buf_entry_p      = NULL;             /* Entry in buffer           */
+    size_t  old_entry_size   = 0;                /* Size of replaced entry    */
+    stack_err_e err          = STACK_E_OK;       /* Operation return code     */
+
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if ((NULL == entry_p) && (entry_size > 0)) {
+        return (STACK_E_INVALID);
+    }
+    if (stack_is_empty_impl(stack_p)) {
+        return (STACK_E_EMPTY);
+    }
+
+    stack_get_top_entry(stack_p, &buf_entry_size_p, &buf_entry_p);
+    old_entry_size = *buf_entry_size_p;
+    if (entry_size == old_entry_size) {
+        err = stack_snapshot_prepare_write(stack_p, stack_p->buf_end);
+        if (stack_err_e_is_error(err)) {
+            return (err);
+        }
+        stack_get_top_entry(stack_p, NULL, &buf_entry_p);
+        if (entry_size > 0) {
+            memcpy(buf_entry_p, entry_p, entry_size);
+        }
+        stack_journal_keep(stack_p, stack_p->num_entries - 1,
+                           stack_p->buf_top + stack_p->entry_overhead +
+                               entry_size);
+        return (STACK_E_OK);
+    }
+
+    /*
+     * The top entry borders the free space, so a change in size only
+     * moves the top-of-stack; no other entries need to move.
+     */
+    err = stack_check_entry_size(stack_p, entry_size);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    if ((! stack_is_drop_oldest(stack_p)) &&
+        (entry_size > (stack_p->buf_top + old_entry_size)) &&
+        (! stack_make_room(stack_p, entry_size - old_entry_size))) {
+        return (STACK_E_FULL);
+    }
+
+    /*
+     * Once the top is removed, the push must not fail, so the buffer is
+     * made writable first.
+     */
+    err = stack_snapshot_prepare_write(stack_p, stack_p->buf_end);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    stack_remove_top(stack_p);
+
+    return (stack_push_impl(stack_p, entry_p, entry_size));
+}
+
+/*
+ * Replace the top entry of a stack with a copy of the given entry.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_replace_top (stack_t *stack_p,
+                               const void *entry_p,
+                               size_t entry_size)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_replace_top_locked(stack_p, entry_p, entry_size);
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/**
+ * Push a copy of the entry at the given depth onto a stack.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @param[in] depth
+ *     Entry to copy, counted from the top of the stack.
+ * @retval STACK_E_OK
+ *     Successfully copied entry.
+ * @retval STACK_E_EMPTY
+ *     Stack has fewer than depth + 1 entries.
+ * @retval STACK_E_FULL
+ *     Not enough space in stack for the copy.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
+ */
+static stack_err_e stack_push_copy_locked (stack_t *stack_p, size_t depth)
+{
+    size_t *buf_entry_size_p = NULL;             /* Entry size in buffer      */
+    void   *buf_entry_p      = NULL;             /* Entry in buffer           */
+    size_t  new_entry_size   = 0;                /* Total new entry space     */
+
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if (! stack_get_entry_at_depth(stack_p, depth,
+                                   &buf_entry_size_p, &buf_entry_p)) {
+        return (STACK_E_EMPTY);
+    }
+
+    /*
+     * Growing the buffer or rebalancing an arena moves every entry, so
+     * room is made before the source is found again by its depth. A
+     * drop-oldest stack instead evicts entries without moving any, and
+     * may evict the source itself, which the push implementation allows
+     * for.
+     */
+    if (! stack_is_drop_oldest(stack_p)) {
+        new_entry_size = stack_p->entry_overhead + *buf_entry_size_p;
+        if ((new_entry_size > stack_p->buf_top) &&
+            (! stack_make_room(stack_p, new_entry_size))) {
+            return (STACK_E_FULL);
+        }
+        (void)stack_get_entry_at_depth(stack_p, depth,
+                                       &buf_entry_size_p, &buf_entry_p);
+    }
+
+    return (stack_push_impl(stack_p, buf_entry_p, *buf_entry_size_p));
+}
+
+/**
+ * Push a copy of the entry at the given depth onto a stack.
+ *
+ * See stack_push_copy_locked() for details.
+ */
+static stack_err_e stack_push_copy (stack_t *stack_p, size_t depth)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_push_copy_locked(stack_p, depth);
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/*
+ * Push a copy of the top entry onto a stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_dup (stack_t *stack_p)
+{
+    return (stack_push_copy(stack_p, 0));
+}
+
+/*
+ * Push a copy of the second entry onto a stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_over (stack_t *stack_p)
+{
+    return (stack_push_copy(stack_p, 1));
+}
+
+/**
+ * Move the entry at the given depth to the top of the stack, shifting the
+ * entries above it down by one.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @param[in] depth
+ *     Entry to move, counted from the top of the stack.
+ * @retval STACK_E_OK
+ *     Successfully moved entry.
+ * @retval STACK_E_EMPTY
+ *     Stack has fewer than depth + 1 entries.
+ * @retval STACK_E_INVALID
+ *     Invalid parameter.
+ */
+static stack_err_e stack_roll_locked (stack_t *stack_p, size_t depth)
+{
+    size_t        *buf_entry_size_p = NULL;      /* Entry size in buffer      */
+    void          *buf_entry_p      = NULL;      /* Entry in buffer           */
+    unsigned char *top_p            = NULL;      /* Start of top entry        */
+    unsigned char *moved_p          = NULL;      /* Start of moved entry      */
+    size_t         moved_size       = 0;         /* Size of moved entry       */
+
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if (depth >= stack_p->num_entries) {
+        return (STACK_E_EMPTY);
+    }
+    stack_linearize(stack_p);
+    if (stack_err_e_is_error(stack_snapshot_prepare_write(stack_p,
+                                                          stack_p->buf_end))) {
+        return (STACK_E_NOMEM);
+    }
+    if (! stack_get_entry_at_depth(stack_p, depth,
+                                   &buf_entry_size_p, &buf_entry_p)) {
+        return (STACK_E_INTERNAL);
+    }
+
+    /*
+     * Entries are contiguous, so the entries above the moved one and the
+     * moved entry itself form two adjacent regions that just trade places.
+     */
+    top_p = stack_p->buf + stack_p->buf_top;
+    moved_p = (unsigned char *)buf_entry_size_p;
+    moved_size = stack_p->entry_overhead + *buf_entry_size_p;
+    stack_rotate_bytes(top_p, moved_p - top_p, (moved_p - top_p) + moved_size);
+    stack_journal_keep(stack_p, stack_p->num_entries - depth - 1,
+                       (moved_p - stack_p->buf) + moved_size);
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Move the entry at the given depth to the top of the stack.
+ *
+ * See stack_roll_locked() for details.
+ */
+static stack_err_e stack_roll (stack_t *stack_p, size_t depth)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_roll_locked(stack_p, depth);
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/*
+ * Exchange the top two entries of a stack in place.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_swap (stack_t *stack_p)
+{
+    return (stack_roll(stack_p, 1));
+}
+
+/*
+ * Move the third entry of a stack to the top in place.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_rot (stack_t *stack_p)
+{
+    return (stack_roll(stack_p, 2));
+}
+
+/**
+ * Remove the top entries from a stack without copying them.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * See stack_drop() in ../include/stack.h for API details.
+ */
+static stack_err_e stack_drop_locked (stack_t *stack_p, size_t num_entries)
+{
+    size_t i = 0;                                /* Loop index counter        */
+
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if (num_entries > stack_p->num_entries) {
+        return (STACK_E_EMPTY);
+    }
+
+    /*
+     * Removing an entry only moves the top-of-stack past it, so the
+     * entries are never copied.
+     */
+    for (i = 0; i < num_entries; i++) {
+        stack_remove_top(stack_p);
+    }
+
+    return (STACK_E_OK);
+}
+
+/*
+ * Remove the top entries from a stack without copying them.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_drop (stack_t *stack_p, size_t num_entries)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_drop_locked(stack_p, num_entries);
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/**
+ * Push the top entries of one stack onto another one entry at a time,
+ * starting with the deepest.
+ *
+ * This handles transfers that cannot be done as one block copy because
+ * the stacks lay out their entries differently or the destination may
+ * have to evict entries.
+ *
+ * @param[in] src_stack_p
+ *     Stack to take entries from. MUST BE A VALID, LINEAR STACK with at
+ *     least num_entries entries, otherwise results are indeterminate.
+ * @param[in] dst_stack_p
+ *     Stack to add entries to. MUST BE A VALID STACK with room for the
+ *     entries, otherwise results are indeterminate.
+ * @param[in] num_entries
+ *     Number of entries to move.
+ * @retval STACK_E_OK
+ *     Successfully moved entries.
+ * @retval STACK_E_NOMEM
+ *     Out of memory. Neither stack is changed.
+ */
+static stack_err_e stack_transfer_each (stack_t *src_stack_p,
+                                        stack_t *dst_stack_p,
+                                        size_t num_entries)
+{
+    stack_err_e  err           = STACK_E_OK;     /* Operation return code     */
+    size_t     **entry_sizes_p = NULL;           /* Moved 'size' fields       */
+    void        *entry_data_p  = NULL;           /* Current 'data' field      */
+    size_t       i             = 0;              /* Loop index counter        */
+
+    /*
+     * Entries can only be walked from the top, so remember where each one
+     * is before pushing them in reverse.
+     */
+    entry_sizes_p = malloc(num_entries * sizeof(size_t *));
+    if (NULL == entry_sizes_p) {
+        return (STACK_E_NOMEM);
+    }
+
+    /*
+     * The pushes only write below the destination's top, and must not
+     * fail once the first one is done.
+     */
+    err = stack_snapshot_prepare_write(dst_stack_p, dst_stack_p->buf_top);
+    if (stack_err_e_is_error(err)) {
+        free(entry_sizes_p);
+        return (err);
+    }
+    stack_get_top_entry(src_stack_p, &(entry_sizes_p[0]), &entry_data_p);
+    for (i = 1; i < num_entries; i++) {
+        entry_sizes_p[i] = entry_sizes_p[i - 1];
+        (void)stack_get_next_entry(src_stack_p,
+                                   &(entry_sizes_p[i]), &entry_data_p);
+    }
+
+    for (i = num_entries; i > 0; i--) {
+        err = stack_push_impl(dst_stack_p,
+                              (unsigned char *)entry_sizes_p[i - 1] +
+                                  sizeof(size_t),
+                              *(entry_sizes_p[i - 1]));
+        if (stack_err_e_is_error(err)) {
+            free(entry_sizes_p);
+            return (err);
+        }
+    }
+    free(entry_sizes_p);
+
+    for (i = 0; i < num_entries; i++) {
+        stack_remove_top(src_stack_p);
+    }
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Move the top entries of one stack onto another stack.
+ *
+ * @note
+ *     Caller must hold the locks of both stacks.
+ *
+ * See stack_transfer() in ../include/stack.h for API details.
+ */
+static stack_err_e stack_transfer_locked (stack_t *src_stack_p,
+                                          stack_t *dst_stack_p,
+                                          size_t num_entries)
+{
+    stack_err_e  err              = STACK_E_OK;  /* Operation return code     */
+    size_t      *buf_entry_size_p = NULL;        /* Entry size in buffer      */
+    void        *buf_entry_p      = NULL;        /* Entry in buffer           */
+    size_t       move_size        = 0;           /* Bytes to move             */
+    size_t       dst_size         = 0;           /* Bytes needed in dst       */
+    size_t       i                = 0;           /* Loop index counter        */
+
+    if ((! stack_is_valid(src_stack_p)) || (! stack_is_valid(dst_stack_p))) {
+        return (STACK_E_INVALID);
+    }
+    if (src_stack_p == dst_stack_p) {
+        return (STACK_E_INVALID);
+    }
+    if (0 == num_entries) {
+        return (STACK_E_OK);
+    }
+    if (num_entries > src_stack_p->num_entries) {
+        return (STACK_E_EMPTY);
+    }
+
+    /*
+     * Make sure that the destination will accept every moved entry before
+     * changing either stack.
+     */
+    stack_linearize(src_stack_p);
+    stack_get_top_entry(src_stack_p, &buf_entry_size_p, &buf_entry_p);
+    for (i = 0; i < num_entries; i++) {
+        if (i > 0) {
+            (void)stack_get_next_entry(src_stack_p,
+                                       &buf_entry_size_p, &buf_entry_p);
+        }
+        err = stack_check_entry_size(dst_stack_p, *buf_entry_size_p);
+        if (stack_err_e_is_error(err)) {
+            return (err);
+        }
+        dst_size += dst_stack_p->entry_overhead + *buf_entry_size_p;
+    }
+    move_size = ((unsigned char *)buf_entry_p + *buf_entry_size_p +
+                 (src_stack_p->entry_overhead - sizeof(size_t))) -
+                (src_stack_p->buf + src_stack_p->buf_top);
+
+    if (stack_is_drop_oldest(dst_stack_p)) {
+        return (stack_transfer_each(src_stack_p, dst_stack_p, num_entries));
+    }
+    if ((STACK_MAX_ENTRIES_NONE != dst_stack_p->max_entries) &&
+        ((dst_stack_p->max_entries - dst_stack_p->num_entries) <
+         num_entries)) {
+        return (STACK_E_FULL);
+    }
+    if ((dst_size > dst_stack_p->buf_top) &&
+        (! stack_make_room(dst_stack_p, dst_size))) {
+        return (STACK_E_FULL);
+    }
+    if (src_stack_p->entry_overhead != dst_stack_p->entry_overhead) {
+        return (stack_transfer_each(src_stack_p, dst_stack_p, num_entries));
+    }
+
+    err = stack_snapshot_prepare_write(dst_stack_p, dst_stack_p->buf_top);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+
+    /*
+     * Both stacks use the same entry layout, so the top entries of the
+     * source are a contiguous run of bytes that can be placed as-is on top
+     * of the destination.
+     */
+    dst_stack_p->buf_top -= move_size;
+    memcpy(dst_stack_p->buf + dst_stack_p->buf_top,
+           src_stack_p->buf + src_stack_p->buf_top,
+           move_size);
+    dst_stack_p->num_entries += num_entries;
+    stack_stats_copy(dst_stack_p, move_size);
+    if (stack_has_stats(dst_stack_p)) {
+        stack_get_top_entry(dst_stack_p, &buf_entry_size_p, &buf_entry_p);
+        for (i = 0; i < num_entries; i++) {
+            if (i > 0) {
+                (void)stack_get_next_entry(dst_stack_p,
+                                           &buf_entry_size_p, &buf_entry_p);
+            }
+            stack_stats_push(dst_stack_p, *buf_entry_size_p, 1);
+        }
+    }
+
+    src_stack_p->buf_top += move_size;
+    src_stack_p->num_entries -= num_entries;
+    stack_journal_keep(src_stack_p, src_stack_p->num_entries,
+                       src_stack_p->buf_top);
+    if (stack_has_stats(src_stack_p)) {
+        src_stack_p->stats.num_pops += num_entries;
+    }
+    if (0 == src_stack_p->num_entries) {
+        stack_reset(src_stack_p);
+    }
+
+    return (STACK_E_OK);
+}
+
+/*
+ * Move the top entries of one stack onto another stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_transfer (stack_t *src_stack_p,
+                            stack_t *dst_stack_p,
+                            size_t num_entries)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    err = stack_lock_pair(src_stack_p, dst_stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_transfer_locked(src_stack_p, dst_stack_p, num_entries);
+    stack_unlock(dst_stack_p);
+    stack_unlock(src_stack_p);
+
+    return (err);
+}
+
+/*
+ * Move all entries of one stack onto another stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_concat (stack_t *dst_stack_p, stack_t *src_stack_p)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    err = stack_lock_pair(src_stack_p, dst_stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_transfer_locked(src_stack_p, dst_stack_p,
+                                src_stack_p->num_entries);
+    stack_unlock(dst_stack_p);
+    stack_unlock(src_stack_p);
+
+    return (err);
+}
+
+/**
+ * Remove every entry from a stack and export them into a single buffer.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * See stack_drain() in ../include/stack.h for API details.
+ */
+static stack_err_e stack_drain_locked (stack_t *stack_p,
+                                       void *buf_p,
+                                       size_t *buf_size_p,
+                                       stack_order_e order)
+{
+    size_t        *entry_size_p = NULL;          /* Stack entry 'size' field  */
+    void          *entry_data_p = NULL;          /* Stack entry 'data' field  */
+    size_t         out_size     = 0;             /* Bytes of records          */
+    size_t         record_size  = 0;             /* Size of current record    */
+    size_t         record_pos   = 0;             /* Record offset in output   */
+    size_t         i            = 0;             /* Loop index counter        */
+
+    /*
+     * Check parameters.
+     */
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+    if (NULL == buf_size_p) {
+        return (STACK_E_INVALID);
+    }
+    if ((STACK_ORDER_TOP_FIRST != order) &&
+        (STACK_ORDER_BOTTOM_FIRST != order)) {
+        return (STACK_E_INVALID);
+    }
+
+    /*
+     * Records omit the trailing 'size' copy kept by drop-oldest stacks.
+     */
+    out_size = stack_get_used_size(stack_p) -
+               (stack_p->num_entries *
+                (stack_p->entry_overhead - sizeof(size_t)));
+    if (NULL == buf_p) {
+        *buf_size_p = out_size;
+        return (STACK_E_OK);
+    }
+    if (out_size > *buf_size_p) {
+        *buf_size_p = out_size;
+        return (STACK_E_BUF_OVERFLOW);
+    }
+
+    if ((STACK_ORDER_TOP_FIRST == order) && (! stack_is_drop_oldest(stack_p))) {
+        /*
+         * The used part of the buffer is already a packed sequence of
+         * records from the top of the stack to the bottom.
+         */
+        if (out_size > 0) {
+            memcpy(buf_p, stack_p->buf + stack_p->buf_top, out_size);
+        }
+    } else if (! stack_is_empty_impl(stack_p)) {
+        /*
+         * Copy one record at a time. For bottom-first order, mirror the
+         * record order: a record that starts N bytes into the top-first
+         * output ends N bytes before the end of the output.
+         */
+        stack_get_top_entry(stack_p, &entry_size_p, &entry_data_p);
+        for (i = 0; i < stack_p->num_entries; i++) {
+            if (NULL == entry_size_p) {
+                return (STACK_E_INTERNAL);
+            }
+            record_size = sizeof(size_t) + *entry_size_p;
+            if (STACK_ORDER_TOP_FIRST == order) {
+                memcpy((unsigned char *)buf_p + record_pos,
+                       entry_size_p, record_size);
+            } else {
+                memcpy((unsigned char *)buf_p +
+                           (out_size - record_pos - record_size),
+                       entry_size_p, record_size);
+            }
+            record_pos += record_size;
+
+            (void)stack_get_next_entry(stack_p, &entry_size_p, &entry_data_p);
+        }
+    }
+    *buf_size_p = out_size;
+
+    /*
+     * Forget all entries at once.
+     */
+    stack_reset(stack_p);
+
+    return (STACK_E_OK);
+}
+
+/*
+ * Remove every entry from a stack and export them into a single buffer.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_drain (stack_t *stack_p,
+                         void *buf_p,
+                         size_t *buf_size_p,
+                         stack_order_e order)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    err = stack_drain_locked(stack_p, buf_p, buf_size_p, order);
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/*
+ * Detach every entry from a lock-free multi-producer stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_batch_t* stack_take_all (stack_t *stack_p)
+{
+    stack_batch_t *batch_p = NULL;               /* Detached entries          */
+    stack_batch_t *node_p  = NULL;               /* Current list node         */
+    size_t         count   = 0;                  /* Entries detached          */
+
+    if ((! stack_is_valid(stack_p)) || (! stack_is_mpsc(stack_p))) {
+        return (NULL);
+    }
+
+    batch_p = __atomic_exchange_n(&(stack_p->mpsc_head), NULL,
+                                  __ATOMIC_ACQUIRE);
+    for (node_p = batch_p; NULL != node_p; node_p = node_p->next) {
+        count++;
+    }
+    (void)__atomic_sub_fetch(&(stack_p->mpsc_count), count, __ATOMIC_RELAXED);
+
+    return (batch_p);
+}
+
+/*
+ * Free a batch of entries returned by stack_take_all().
+ *
+ * See ../include/stack.h for API details.
+ */
+void stack_batch_free (stack_batch_t *batch_p)
+{
+    stack_batch_t *next_p = NULL;                /* Next list node            */
+
+    while (NULL != batch_p) {
+        next_p = batch_p->next;
+        free(batch_p);
+        batch_p = next_p;
+    }
+}
+
+/*
+ * Start walking the entries of a stack from the top down.
+ *
+ * See ../include/stack.h for API details.
+ */
+void stack_iter_init (stack_iter_t *iter_p, const stack_t *stack_p)
+{
+    if (NULL == iter_p) {
+        return;
+    }
+    iter_p->stack_p = NULL;
+    iter_p->next_p = NULL;
+    iter_p->remaining = 0;
+
+    if (stack_err_e_is_error(stack_lock(stack_p))) {
+        return;
+    }
+    if (! stack_is_empty_impl(stack_p)) {
+        iter_p->stack_p = stack_p;
+        iter_p->next_p = stack_p->buf + stack_p->buf_top;
+        iter_p->remaining = stack_p->num_entries;
+    }
+    stack_unlock(stack_p);
+}
+
+/*
+ * Start walking a batch of entries from the top down.
+ *
+ * See ../include/stack.h for API details.
+ */
+void stack_batch_iter_init (stack_iter_t *iter_p,
+                            const stack_batch_t *batch_p)
+{
+    if (NULL == iter_p) {
+        return;
+    }
+    iter_p->stack_p = NULL;
+    iter_p->next_p = batch_p;
+    iter_p->remaining = 0;
+}
+
+/*
+ * Get the next entry of a walk.
+ *
+ * See ../include/stack.h for API details.
+ */
+bool stack_iter_next (stack_iter_t *iter_p,
+                      const void **entry_pp,
+                      size_t *entry_size_p)
+{
+    const stack_batch_t *node_p           = NULL; /* Current batch node    */
+    size_t              *buf_entry_size_p = NULL; /* Entry size in buffer  */
+    void                *buf_entry_p      = NULL; /* Entry in buffer       */
+
+    if ((NULL == iter_p) || (NULL == entry_pp) || (NULL == entry_size_p)) {
+        return (false);
+    }
+    if (NULL == iter_p->next_p) {
+        return (false);
+    }
+
+    if ((NULL == iter_p->stack_p) && (0 == iter_p->remaining)) {
+        node_p = iter_p->next_p;
+        *entry_pp = node_p->data;
+        *entry_size_p = node_p->size;
+        iter_p->next_p = node_p->next;
+        return (true);
+    }
+
+    /*
+     * The entries of a snapshot are a single run, so the next entry
+     * directly follows the current one.
+     */
+    if (NULL == iter_p->stack_p) {
+        buf_entry_size_p = (size_t *)iter_p->next_p;
+        *entry_pp = (unsigned char *)buf_entry_size_p + sizeof(size_t);
+        *entry_size_p = *buf_entry_size_p;
+        iter_p->remaining--;
+        iter_p->next_p = NULL;
+        if (iter_p->remaining > 0) {
+            iter_p->next_p = (const unsigned char *)*entry_pp + *entry_size_p;
+        }
+        return (true);
+    }
+
+    buf_entry_size_p = (size_t *)iter_p->next_p;
+    buf_entry_p = (unsigned char *)buf_entry_size_p + sizeof(size_t);
+    *entry_pp = buf_entry_p;
+    *entry_size_p = *buf_entry_size_p;
+
+    iter_p->remaining--;
+    iter_p->next_p = NULL;
+    if ((iter_p->remaining > 0) &&
+        stack_get_next_entry(iter_p->stack_p,
+                             &buf_entry_size_p, &buf_entry_p)) {
+        iter_p->next_p = buf_entry_size_p;
+    }
+
+    return (true);
+}
+
+/*
+ * Take a consistent snapshot of a stack without blocking its owner.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_snapshot_t* stack_snapshot_take (const stack_t *stack_p)
+{
+    stack_t          *handle_p   = (stack_t *)stack_p; /* Handle to update */
+    stack_snapshot_t *snapshot_p = NULL;         /* New snapshot              */
+    stack_snapshot_t *view_p     = NULL;         /* Published view            */
+
+    if ((! stack_is_valid(stack_p)) || (! stack_is_snapshot(stack_p))) {
+        return (NULL);
+    }
+    snapshot_p = malloc(sizeof(stack_snapshot_t));
+    if (NULL == snapshot_p) {
+        return (NULL);
+    }
+
+    /*
+     * The view can only be withdrawn and reused while no reader is
+     * registered, and its chunk reference keeps the chunk alive until the
+     * snapshot has a reference of its own. There is no view only while the
+     * owner rewrites entries in place, which takes a moment.
+     */
+    for (;;) {
+        (void)__atomic_add_fetch(&(handle_p->snap_readers), 1,
+                                 __ATOMIC_SEQ_CST);
+        view_p = __atomic_load_n(&(handle_p->snap_view_p), __ATOMIC_SEQ_CST);
+        if (NULL != view_p) {
+            snapshot_p->chunk_p = view_p->chunk_p;
+            snapshot_p->buf_top = view_p->buf_top;
+            snapshot_p->num_entries = view_p->num_entries;
+            (void)__atomic_add_fetch(&(view_p->chunk_p->refs), 1,
+                                     __ATOMIC_RELAXED);
+        }
+        (void)__atomic_sub_fetch(&(handle_p->snap_readers), 1,
+                                 __ATOMIC_RELEASE);
+        if (NULL != view_p) {
+            break;
+        }
+        (void)sched_yield();
+    }
+    snapshot_p->next = NULL;
+
+    return (snapshot_p);
+}
+
+/*
+ * Free a snapshot taken with stack_snapshot_take().
+ *
+ * See ../include/stack.h for API details.
+ */
+void stack_snapshot_free (stack_snapshot_t *snapshot_p)
+{
+    if (NULL == snapshot_p) {
+        return;
+    }
+    stack_chunk_release(snapshot_p->chunk_p);
+    free(snapshot_p);
+}
+
+/*
+ * Get number of entries in a snapshot.
+ *
+ * See ../include/stack.h for API details.
+ */
+size_t stack_snapshot_get_num_entries (const stack_snapshot_t *snapshot_p)
+{
+    if (NULL == snapshot_p) {
+        return (0);
+    }
+
+    return (snapshot_p->num_entries);
+}
+
+/*
+ * Start walking the entries of a snapshot from the top down.
+ *
+ * See ../include/stack.h for API details.
+ */
+void stack_snapshot_iter_init (stack_iter_t *iter_p,
+                               const stack_snapshot_t *snapshot_p)
+{
+    if (NULL == iter_p) {
+        return;
+    }
+    iter_p->stack_p = NULL;
+    iter_p->next_p = NULL;
+    iter_p->remaining = 0;
+
+    if ((NULL != snapshot_p) && (snapshot_p->num_entries > 0)) {
+        iter_p->next_p = snapshot_p->chunk_p->data + snapshot_p->buf_top;
+        iter_p->remaining = snapshot_p->num_entries;
+    }
+}
+
+/*
+ * Get a descriptor that is readable while a stack has enough entries.
+ *
+ * See ../include/stack.h for API details.
+ */
+int stack_get_event_fd (stack_t *stack_p, size_t threshold)
+{
+    int event_fd = -1;                           /* Descriptor to return      */
+
+    if (threshold < 1) {
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_lock(stack_p))) {
+        return (-1);
+    }
+
+    /*
+     * Other processes can't signal our descriptor, so it would miss their
+     * changes to a shared memory stack.
+     */
+    if (NULL == stack_p->shm_p) {
+        if (stack_p->event_fd < 0) {
+            stack_p->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            stack_p->event_ready = false;
+        }
+        stack_p->event_threshold = threshold;
+        event_fd = stack_p->event_fd;
+    }
+
+    /*
+     * Unlocking brings the descriptor up to date with the new threshold.
+     */
+    stack_unlock(stack_p);
+
+    return (event_fd);
+}
+
+/*
+ * Get the counters of a stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_get_stats (stack_t *stack_p, stack_stats_t *stats_p)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    if ((! stack_is_valid(stack_p)) || (NULL == stats_p)) {
+        return (STACK_E_INVALID);
+    }
+    if (! stack_has_stats(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    *stats_p = stack_p->stats;
+    stack_unlock(stack_p);
+
+    return (STACK_E_OK);
+}
+
+/*
+ * Set the counters of a stack back to zero.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_reset_stats (stack_t *stack_p)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    if ((! stack_is_valid(stack_p)) || (! stack_has_stats(stack_p))) {
+        return (STACK_E_INVALID);
+    }
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    memset(&(stack_p->stats), 0, sizeof(stack_p->stats));
+    stack_unlock(stack_p);
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Push entries that are laid out as in a stack buffer, top entry first,
+ * as one block.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * @param[in] stack_p
+ *     Stack to update. MUST BE A VALID STACK WITHOUT DROP-OLDEST BEHAVIOR
+ *     otherwise results are indeterminate.
+ * @param[in] region_p
+ *     Entries to push.
+ * @param[in] size
+ *     Size of region in bytes.
+ * @param[in] num_entries
+ *     Number of entries in region.
+ * @retval STACK_E_OK
+ *     Entries pushed.
+ * @retval STACK_E_FULL
+ *     Not enough room in stack.
+ * @retval STACK_E_INVALID
+ *     An entry is larger than the stack's maximum entry size.
+ * @retval STACK_E_IO
+ *     Region isn't made up of num_entries entries.
+ * @retval STACK_E_NOMEM
+ *     Out of memory.
+ */
+static stack_err_e stack_push_region (stack_t *stack_p,
+                                      const unsigned char *region_p,
+                                      size_t size,
+                                      size_t num_entries)
+{
+    stack_err_e  err        = STACK_E_OK;        /* Operation return code     */
+    size_t       entry_size = 0;                 /* Size of current entry     */
+    size_t       pos        = 0;                 /* Offset of current entry   */
+    size_t       i          = 0;                 /* Loop index counter        */
+
+    for (i = 0; i < num_entries; i++) {
+        if ((size - pos) < sizeof(size_t)) {
+            return (STACK_E_IO);
+        }
+        memcpy(&entry_size, region_p + pos, sizeof(size_t));
+        if (entry_size > (size - pos - sizeof(size_t))) {
+            return (STACK_E_IO);
+        }
+        err = stack_check_entry_size(stack_p, entry_size);
+        if (stack_err_e_is_error(err)) {
+            return (err);
+        }
+        pos += sizeof(size_t) + entry_size;
+    }
+    if (pos != size) {
+        return (STACK_E_IO);
+    }
+
+    if ((STACK_MAX_ENTRIES_NONE != stack_p->max_entries) &&
+        ((stack_p->max_entries - stack_p->num_entries) < num_entries)) {
+        return (STACK_E_FULL);
+    }
+    if ((size > stack_p->buf_top) && (! stack_make_room(stack_p, size))) {
+        return (STACK_E_FULL);
+    }
+    err = stack_snapshot_prepare_write(stack_p, stack_p->buf_top);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+
+    stack_p->buf_top -= size;
+    if (size > 0) {
+        memcpy(stack_p->buf + stack_p->buf_top, region_p, size);
+    }
+    stack_p->num_entries += num_entries;
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Apply the records of a journal, or the records of a snapshot and its
+ * deltas, to a stack.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * @param[in] stack_p
+ *     Stack to update. MUST BE A VALID STACK WITHOUT DROP-OLDEST BEHAVIOR
+ *     otherwise results are indeterminate.
+ * @param[in] data_p
+ *     Records.
+ * @param[in] size
+ *     Size of records in bytes.
+ * @param[in,out] gen_p
+ *     Generation of the stack. Advanced by each delta record.
+ * @param[out] valid_size_p
+ *     Updated with the size of the intact records, which are the ones
+ *     applied. Records end at the first one that is damaged or cut short.
+ * @retval STACK_E_OK
+ *     Intact records applied.
+ * @returns
+ *     Otherwise, error applying a record, such as #STACK_E_IO for a pop
+ *     of more entries than the stack has or a delta out of sequence.
+ */
+static stack_err_e stack_journal_replay (stack_t *stack_p,
+                                         const unsigned char *data_p,
+                                         size_t size,
+                                         uint64_t *gen_p,
+                                         size_t *valid_size_p)
+{
+    stack_err_e            err   = STACK_E_OK;   /* Operation return code     */
+    stack_journal_rec_t    rec;                  /* Current record header     */
+    stack_journal_delta_t  delta;                /* Start of delta record     */
+    uint32_t               check = 0;            /* Stored record hash        */
+    size_t                 pos   = 0;            /* Offset of current record  */
+
+    while ((size - pos) >= sizeof(rec)) {
+        memcpy(&rec, data_p + pos, sizeof(rec));
+        if (rec.size > (size - pos - sizeof(rec))) {
+            break;
+        }
+        check = rec.check;
+        stack_journal_seal(&rec, data_p + pos + sizeof(rec));
+        if (check != rec.check) {
+            break;
+        }
+
+        if ((STACK_JOURNAL_REC_PUSH == rec.type) &&
+            (rec.num_entries <= SIZE_MAX)) {
+            err = stack_push_region(stack_p, data_p + pos + sizeof(rec),
+                                    rec.size, rec.num_entries);
+        } else if ((STACK_JOURNAL_REC_POP == rec.type) &&
+                   (rec.num_entries <= stack_p->num_entries)) {
+            err = stack_drop_locked(stack_p, rec.num_entries);
+        } else if ((STACK_JOURNAL_REC_DELTA == rec.type) &&
+                   (rec.size >= sizeof(delta)) &&
+                   (rec.num_entries <= SIZE_MAX)) {
+            memcpy(&delta, data_p + pos + sizeof(rec), sizeof(delta));
+            if ((delta.gen != (*gen_p + 1)) ||
+                (delta.num_kept > stack_p->num_entries)) {
+                err = STACK_E_IO;
+            } else {
+                err = stack_drop_locked(stack_p, stack_p->num_entries -
+                                                 delta.num_kept);
+            }
+            if (STACK_E_OK == err) {
+                err = stack_push_region(stack_p,
+                                        data_p + pos + sizeof(rec) +
+                                            sizeof(delta),
+                                        rec.size - sizeof(delta),
+                                        rec.num_entries);
+            }
+            *gen_p = delta.gen;
+        } else {
+            err = STACK_E_IO;
+        }
+        if (stack_err_e_is_error(err)) {
+            return (err);
+        }
+        pos += sizeof(rec) + rec.size;
+    }
+    *valid_size_p = pos;
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Map a journal or snapshot file into memory and check its header.
+ *
+ * @param[in] fd
+ *     File to map.
+ * @param[in] magic
+ *     Expected magic number.
+ * @param[out] data_pp
+ *     Updated with the mapping, or NULL if the file is too short to have
+ *     a header. Caller must munmap() it.
+ * @param[out] size_p
+ *     Updated with the size of the file in bytes.
+ * @param[out] gen_p
+ *     Updated with the generation of the file, if it has a header.
+ * @retval STACK_E_OK
+ *     File mapped, or it has no header.
+ * @retval STACK_E_IO
+ *     File can't be read, or it belongs to something else.
+ */
+static stack_err_e stack_journal_map (int fd,
+                                      uint32_t magic,
+                                      unsigned char **data_pp,
+                                      size_t *size_p,
+                                      uint64_t *gen_p)
+{
+    struct stat          st;                     /* File status               */
+    stack_journal_hdr_t  hdr;                    /* File header               */
+    void                *data_p = NULL;          /* Mapping of file           */
+
+    *data_pp = NULL;
+    *size_p = 0;
+    if (0 != fstat(fd, &st)) {
+        return (STACK_E_IO);
+    }
+    *size_p = st.st_size;
+    if (*size_p < sizeof(hdr)) {
+        return (STACK_E_OK);
+    }
+
+    data_p = mmap(NULL, *size_p, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == data_p) {
+        return (STACK_E_IO);
+    }
+    memcpy(&hdr, data_p, sizeof(hdr));
+    if ((magic != hdr.magic) || (sizeof(size_t) != hdr.word_size)) {
+        (void)munmap(data_p, *size_p);
+        return (STACK_E_IO);
+    }
+    *data_pp = data_p;
+    *gen_p = hdr.gen;
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Start an empty journal file.
+ *
+ * @param[in] journal_p
+ *     Journal whose file to empty. Its generation goes in the header.
+ * @retval true
+ *     Journal started and flushed to disk.
+ * @retval false
+ *     Journal could not be written.
+ */
+static bool stack_journal_restart (stack_journal_t *journal_p)
+{
+    stack_journal_hdr_t hdr;                     /* File header               */
+
+    hdr.magic = STACK_JOURNAL_MAGIC;
+    hdr.word_size = sizeof(size_t);
+    hdr.gen = journal_p->gen;
+
+    return ((0 == ftruncate(journal_p->fd, 0)) &&
+            stack_journal_write(journal_p->fd, &hdr, sizeof(hdr)) &&
+            (0 == fdatasync(journal_p->fd)));
+}
+
+/**
+ * Load a snapshot and its deltas into an empty stack.
+ *
+ * Deltas are appended to the snapshot file in place, so a crash can leave
+ * a damaged or partly written delta at its end, which is ignored. The
+ * snapshot itself is always whole.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * @param[in] stack_p
+ *     Empty stack to load into.
+ * @param[in] snap_path_p
+ *     Path of the snapshot file.
+ * @param[out] gen_p
+ *     Updated with the generation of the last intact delta, or of the
+ *     snapshot if it has none, or 0 if there is no snapshot.
+ * @param[out] snap_size_p
+ *     Updated with the bytes of the file holding the snapshot and its
+ *     intact deltas, or 0 if there is no snapshot.
+ * @retval STACK_E_OK
+ *     Snapshot loaded, or there is none.
+ * @returns
+ *     Otherwise, error from stack_journal_open().
+ */
+static stack_err_e stack_journal_load (stack_t *stack_p,
+                                       const char *snap_path_p,
+                                       uint64_t *gen_p,
+                                       size_t *snap_size_p)
+{
+    stack_err_e    err        = STACK_E_OK;      /* Operation return code     */
+    int            fd         = -1;              /* Snapshot file             */
+    unsigned char *data_p     = NULL;            /* Mapped file               */
+    size_t         size       = 0;               /* Size of mapped file       */
+    size_t         valid_size = 0;               /* Size of intact records    */
+
+    *gen_p = 0;
+    *snap_size_p = 0;
+    fd = open(snap_path_p, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ((ENOENT == errno) ? STACK_E_OK : STACK_E_IO);
+    }
+    err = stack_journal_map(fd, STACK_JOURNAL_SNAP_MAGIC, &data_p, &size,
+                            gen_p);
+    (void)close(fd);
+    if ((STACK_E_OK == err) && (NULL == data_p)) {
+        err = STACK_E_IO;
+    }
+    if (STACK_E_OK == err) {
+        err = stack_journal_replay(stack_p,
+                                   data_p + sizeof(stack_journal_hdr_t),
+                                   size - sizeof(stack_journal_hdr_t),
+                                   gen_p, &valid_size);
+        if ((STACK_E_OK == err) && (0 == valid_size)) {
+            err = STACK_E_IO;
+        }
+        *snap_size_p = sizeof(stack_journal_hdr_t) + valid_size;
+    }
+    if (NULL != data_p) {
+        (void)munmap(data_p, size);
+    }
+
+    return (err);
+}
+
+/**
+ * Recover an empty stack from its snapshot and journal, and open the
+ * journal for appending.
+ *
+ * Each checkpoint moves on to a new generation: the snapshot or delta is
+ * written with it, and only then is the journal restarted with it. A
+ * journal one generation behind the snapshot is therefore left over from
+ * a checkpoint that was cut short, and everything in it is already in the
+ * snapshot.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * @param[in] stack_p
+ *     Empty stack to recover.
+ * @param[in,out] journal_p
+ *     Journal of stack. Updated with the journal file, the generation, the
+ *     size of the snapshot file and the bottom entries left alone since
+ *     the snapshot.
+ * @param[in] journal_path_p
+ *     Path of the journal file.
+ * @param[in] is_restore
+ *     Only read the files, for stack_journal_restore()? Otherwise, the
+ *     journal is created if needed and its damaged tail is cut off.
+ * @retval STACK_E_OK
+ *     Stack recovered.
+ * @returns
+ *     Otherwise, error from stack_journal_open().
+ */
+static stack_err_e stack_journal_recover (stack_t *stack_p,
+                                          stack_journal_t *journal_p,
+                                          const char *journal_path_p,
+                                          bool is_restore)
+{
+    stack_err_e    err         = STACK_E_OK;     /* Operation return code     */
+    unsigned char *data_p      = NULL;           /* Mapped file               */
+    size_t         size        = 0;              /* Size of mapped file       */
+    size_t         valid_size  = 0;              /* Size of intact records    */
+    size_t         keep_size   = 0;              /* Journal bytes to keep     */
+    uint64_t       journal_gen = 0;              /* Generation of journal     */
+
+    err = stack_journal_load(stack_p, journal_p->snap_path_p,
+                             &(journal_p->gen), &(journal_p->snap_size));
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+
+    if (is_restore) {
+        journal_p->fd = open(journal_path_p, O_RDONLY | O_CLOEXEC);
+        if ((journal_p->fd < 0) && (ENOENT == errno)) {
+            return (STACK_E_OK);
+        }
+    } else {
+        journal_p->fd = open(journal_path_p,
+                             O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    }
+    if (journal_p->fd < 0) {
+        return (STACK_E_IO);
+    }
+    err = stack_journal_map(journal_p->fd, STACK_JOURNAL_MAGIC, &data_p,
+                            &size, &journal_gen);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    journal_p->num_kept = stack_p->num_entries;
+    journal_p->kept_size = stack_get_used_size(stack_p);
+    if ((NULL != data_p) && (journal_gen == journal_p->gen)) {
+        /*
+         * The journal is attached while it is replayed, so that the
+         * entries it removes lower the mark of those left alone since the
+         * snapshot, which the next delta starts from.
+         */
+        stack_p->journal_p = journal_p;
+        err = stack_journal_replay(stack_p,
+                                   data_p + sizeof(stack_journal_hdr_t),
+                                   size - sizeof(stack_journal_hdr_t),
+                                   &journal_gen, &valid_size);
+        stack_p->journal_p = NULL;
+        keep_size = sizeof(stack_journal_hdr_t) + valid_size;
+    } else if ((NULL != data_p) && ((journal_gen + 1) != journal_p->gen)) {
+        err = STACK_E_IO;
+    }
+    if (NULL != data_p) {
+        (void)munmap(data_p, size);
+    }
+    journal_p->snap_num_kept = journal_p->num_kept;
+    journal_p->snap_kept_size = journal_p->kept_size;
+    if (stack_err_e_is_error(err) || is_restore) {
+        return (err);
+    }
+
+    /*
+     * Cut off a damaged tail, or start afresh.
+     */
+    if ((0 == keep_size) && (! stack_journal_restart(journal_p))) {
+        return (STACK_E_IO);
+    }
+    if ((0 != keep_size) && (keep_size != size) &&
+        ((0 != ftruncate(journal_p->fd, keep_size)) ||
+         (0 != fdatasync(journal_p->fd)))) {
+        return (STACK_E_IO);
+    }
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Free a journal, closing its file.
+ *
+ * @param[in] journal_p
+ *     Journal to free, or NULL.
+ */
+static void stack_journal_free (stack_journal_t *journal_p)
+{
+    if (NULL == journal_p) {
+        return;
+    }
+    if (journal_p->fd >= 0) {
+        (void)close(journal_p->fd);
+    }
+    free(journal_p->buf);
+    free(journal_p->tmp_path_p);
+    free(journal_p->snap_path_p);
+    free(journal_p);
+}
+
+/**
+ * Allocate a journal for the files at a path.
+ *
+ * @param[in] path
+ *     Path of the journal and snapshot without their suffixes.
+ * @param[out] journal_path_pp
+ *     Updated with the path of the journal file. Caller must free it.
+ * @returns
+ *     New journal without a file, or NULL if out of memory.
+ */
+static stack_journal_t *stack_journal_alloc (const char *path,
+                                             char **journal_path_pp)
+{
+    stack_journal_t *journal_p = NULL;           /* New journal               */
+    size_t           path_size = 0;              /* Size of longest path      */
+
+    path_size = strlen(path) + sizeof(".journal");
+    journal_p = calloc(1, sizeof(*journal_p));
+    *journal_path_pp = malloc(path_size);
+    if (NULL != journal_p) {
+        journal_p->fd = -1;
+        journal_p->snap_path_p = malloc(path_size);
+        journal_p->tmp_path_p = malloc(path_size);
+    }
+    if ((NULL == journal_p) || (NULL == *journal_path_pp) ||
+        (NULL == journal_p->snap_path_p) || (NULL == journal_p->tmp_path_p)) {
+        free(*journal_path_pp);
+        *journal_path_pp = NULL;
+        stack_journal_free(journal_p);
+        return (NULL);
+    }
+    (void)snprintf(*journal_path_pp, path_size, "%s.journal", path);
+    (void)snprintf(journal_p->snap_path_p, path_size, "%s.snap", path);
+    (void)snprintf(journal_p->tmp_path_p, path_size, "%s.snap.tmp", path);
+    journal_p->pop_pos = SIZE_MAX;
+
+    return (journal_p);
+}
 
 /*
- * Remove the top entry from a stack and return a copy of it.
+ * Make a stack durable by keeping a journal of its changes in a file.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_journal_open (stack_t *stack_p,
+                                const char *path,
+                                size_t sync_ops,
+                                unsigned int sync_interval_ms)
+{
+    stack_err_e      err            = STACK_E_OK; /* Operation return code    */
+    stack_journal_t *journal_p      = NULL;      /* New journal               */
+    char            *journal_path_p = NULL;      /* Path of journal file      */
+
+    /*
+     * Check inputs. Journal records describe the top of a single run of
+     * entries, so drop-oldest stacks, whose bottom entries go away too,
+     * are left out.
+     */
+    if ((! stack_is_valid(stack_p)) || (NULL == path)) {
+        return (STACK_E_INVALID);
+    }
+    if (stack_is_mpsc(stack_p) || stack_is_drop_oldest(stack_p) ||
+        (NULL != stack_p->shm_p) || (NULL != stack_p->arena_p)) {
+        return (STACK_E_INVALID);
+    }
+
+    journal_p = stack_journal_alloc(path, &journal_path_p);
+    if (NULL == journal_p) {
+        return (STACK_E_NOMEM);
+    }
+    journal_p->sync_ops = sync_ops;
+    journal_p->sync_interval_ms = sync_interval_ms;
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        free(journal_path_p);
+        stack_journal_free(journal_p);
+        return (err);
+    }
+    if ((NULL != stack_p->journal_p) || (! stack_is_empty_impl(stack_p))) {
+        err = STACK_E_INVALID;
+    } else {
+        err = stack_journal_recover(stack_p, journal_p, journal_path_p,
+                                    false);
+        if (stack_err_e_is_error(err)) {
+            (void)stack_drop_locked(stack_p, stack_p->num_entries);
+        }
+    }
+    if (STACK_E_OK == err) {
+        journal_p->num_logged = stack_p->num_entries;
+        journal_p->num_kept = stack_p->num_entries;
+        journal_p->kept_size = stack_get_used_size(stack_p);
+        stack_p->journal_p = journal_p;
+        journal_p = NULL;
+    }
+    stack_unlock(stack_p);
+
+    free(journal_path_p);
+    stack_journal_free(journal_p);
+    return (err);
+}
+
+/*
+ * Rebuild a stack from the snapshot, deltas and journal at a path.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_journal_restore (stack_t *stack_p, const char *path)
+{
+    stack_err_e      err            = STACK_E_OK; /* Operation return code    */
+    stack_journal_t *journal_p      = NULL;      /* Files to read             */
+    char            *journal_path_p = NULL;      /* Path of journal file      */
+
+    if ((! stack_is_valid(stack_p)) || (NULL == path)) {
+        return (STACK_E_INVALID);
+    }
+    if (stack_is_mpsc(stack_p) || stack_is_drop_oldest(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+
+    journal_p = stack_journal_alloc(path, &journal_path_p);
+    if (NULL == journal_p) {
+        return (STACK_E_NOMEM);
+    }
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        free(journal_path_p);
+        stack_journal_free(journal_p);
+        return (err);
+    }
+    if ((NULL != stack_p->journal_p) || (! stack_is_empty_impl(stack_p))) {
+        err = STACK_E_INVALID;
+    } else {
+        err = stack_journal_recover(stack_p, journal_p, journal_path_p, true);
+        if (stack_err_e_is_error(err)) {
+            (void)stack_drop_locked(stack_p, stack_p->num_entries);
+        }
+    }
+    stack_unlock(stack_p);
+
+    free(journal_path_p);
+    stack_journal_free(journal_p);
+    return (err);
+}
+
+/*
+ * Write and flush the waiting records of a stack's journal now.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_journal_sync (stack_t *stack_p)
+{
+    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+
+    if ((! stack_is_valid(stack_p)) || (NULL == stack_p->journal_p)) {
+        return (STACK_E_INVALID);
+    }
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    stack_journal_log(stack_p);
+    err = stack_journal_commit(stack_p->journal_p, true);
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/**
+ * Write a snapshot of a journaled stack in place of its old one.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * @param[in] stack_p
+ *     Stack to write.
+ * @param[in] gen
+ *     Generation of snapshot.
+ * @retval STACK_E_OK
+ *     Snapshot written and flushed to disk.
+ * @retval STACK_E_IO
+ *     Snapshot could not be written. The old snapshot is kept.
+ */
+static stack_err_e stack_journal_snapshot (stack_t *stack_p, uint64_t gen)
+{
+    stack_journal_t     *journal_p = stack_p->journal_p; /* Journal        */
+    stack_journal_hdr_t  hdr;                    /* File header               */
+    stack_journal_rec_t  rec;                    /* Record of every entry     */
+    char                *dir_p     = NULL;       /* Directory of snapshot     */
+    char                *slash_p   = NULL;       /* End of directory name     */
+    int                  fd        = -1;         /* New snapshot file         */
+    bool                 is_ok     = false;      /* Written successfully?     */
+
+    hdr.magic = STACK_JOURNAL_SNAP_MAGIC;
+    hdr.word_size = sizeof(size_t);
+    hdr.gen = gen;
+    rec.type = STACK_JOURNAL_REC_PUSH;
+    rec.num_entries = stack_p->num_entries;
+    rec.size = stack_get_used_size(stack_p);
+    stack_journal_seal(&rec, stack_p->buf + stack_p->buf_top);
+
+    fd = open(journal_p->tmp_path_p, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+              0666);
+    if (fd >= 0) {
+        is_ok = stack_journal_write(fd, &hdr, sizeof(hdr)) &&
+                stack_journal_write(fd, &rec, sizeof(rec)) &&
+                stack_journal_write(fd, stack_p->buf + stack_p->buf_top,
+                                    rec.size) &&
+                (0 == fdatasync(fd));
+        is_ok = (0 == close(fd)) && is_ok;
+    }
+    if (is_ok) {
+        is_ok = (0 == rename(journal_p->tmp_path_p, journal_p->snap_path_p));
+    }
+    if (! is_ok) {
+        (void)unlink(journal_p->tmp_path_p);
+        return (STACK_E_IO);
+    }
+    journal_p->snap_size = sizeof(hdr) + sizeof(rec) + rec.size;
+
+    /*
+     * Flush the directory too, so that the rename itself is on disk. The
+     * snapshot is in place either way, so this is only best effort.
+     */
+    dir_p = strdup(journal_p->snap_path_p);
+    if (NULL != dir_p) {
+        slash_p = strrchr(dir_p, '/');
+        if (NULL == slash_p) {
+            strcpy(dir_p, ".");
+        } else {
+            slash_p[(slash_p == dir_p) ? 1 : 0] = '\0';
+        }
+        fd = open(dir_p, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            (void)fsync(fd);
+            (void)close(fd);
+        }
+        free(dir_p);
+    }
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Append a delta of a journaled stack to its snapshot file.
+ *
+ * The delta holds only the entries above the bottom ones left alone since
+ * the last checkpoint, and how many of those there are.
+ *
+ * @note
+ *     Caller must hold the stack lock.
+ *
+ * @param[in] stack_p
+ *     Stack to write. Its snapshot file MUST EXIST.
+ * @param[in] gen
+ *     Generation that the delta moves the snapshot to.
+ * @retval STACK_E_OK
+ *     Delta written and flushed to disk.
+ * @retval STACK_E_IO
+ *     Delta could not be written. The snapshot file is cut back to the
+ *     deltas before it, or if that fails too, the journal stops recording
+ *     until a full checkpoint.
+ */
+static stack_err_e stack_journal_snapshot_delta (stack_t *stack_p,
+                                                 uint64_t gen)
+{
+    stack_journal_t       *journal_p = stack_p->journal_p; /* Journal      */
+    stack_journal_rec_t    rec;                  /* Delta record header       */
+    stack_journal_delta_t  delta;                /* Start of delta record     */
+    int                    fd        = -1;       /* Snapshot file             */
+    bool                   is_ok     = false;    /* Written successfully?     */
+
+    delta.gen = gen;
+    delta.num_kept = journal_p->snap_num_kept;
+    rec.type = STACK_JOURNAL_REC_DELTA;
+    rec.check = 0;
+    rec.num_entries = stack_p->num_entries - journal_p->snap_num_kept;
+    rec.size = sizeof(delta) + stack_get_used_size(stack_p) -
+               journal_p->snap_kept_size;
+    rec.check = stack_journal_hash(
+                    stack_journal_hash(
+                        stack_journal_hash(STACK_JOURNAL_HASH_INIT,
+                                           &rec, sizeof(rec)),
+                        &delta, sizeof(delta)),
+                    stack_p->buf + stack_p->buf_top, rec.size - sizeof(delta));
+
+    /*
+     * Cut off any damaged tail first, so that the delta directly follows
+     * the intact ones.
+     */
+    fd = open(journal_p->snap_path_p, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return (STACK_E_IO);
+    }
+    is_ok = (0 == ftruncate(fd, journal_p->snap_size)) &&
+            stack_journal_write(fd, &rec, sizeof(rec)) &&
+            stack_journal_write(fd, &delta, sizeof(delta)) &&
+            stack_journal_write(fd, stack_p->buf + stack_p->buf_top,
+                                rec.size - sizeof(delta)) &&
+            (0 == fdatasync(fd));
+    if ((! is_ok) && (0 != ftruncate(fd, journal_p->snap_size))) {
+        /*
+         * A whole delta may be left behind, which recovery would take as
+         * newer than the journal.
+         */
+        journal_p->snap_size = 0;
+        journal_p->err = STACK_E_IO;
+    }
+    (void)close(fd);
+    if (! is_ok) {
+        return (STACK_E_IO);
+    }
+    journal_p->snap_size += sizeof(rec) + rec.size;
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Write a snapshot or a delta of a journaled stack, and start a new,
+ * empty journal.
+ *
+ * @param[in] stack_p
+ *     Journaled stack.
+ * @param[in] is_delta
+ *     Write a delta if that is worthwhile, for
+ *     stack_journal_checkpoint_delta()? Otherwise, a full snapshot is
+ *     written.
+ * @returns
+ *     Error from stack_journal_checkpoint().
+ */
+static stack_err_e stack_journal_checkpoint_impl (stack_t *stack_p,
+                                                  bool is_delta)
+{
+    stack_err_e      err        = STACK_E_OK;    /* Operation return code     */
+    stack_journal_t *journal_p  = NULL;          /* Journal to restart        */
+    size_t           used_size  = 0;             /* Bytes used by entries     */
+    size_t           full_size  = 0;             /* Size of a full snapshot   */
+    size_t           delta_size = 0;             /* Size of a delta           */
+
+    if ((! stack_is_valid(stack_p)) || (NULL == stack_p->journal_p)) {
+        return (STACK_E_INVALID);
+    }
+    journal_p = stack_p->journal_p;
+
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+    stack_journal_log(stack_p);
+    used_size = stack_get_used_size(stack_p);
+
+    /*
+     * A delta needs a snapshot file to go on, has to be smaller than a
+     * full snapshot, and may only grow the file to twice the size of one,
+     * which bounds the time that loading the file takes.
+     */
+    full_size = sizeof(stack_journal_hdr_t) + sizeof(stack_journal_rec_t) +
+                used_size;
+    delta_size = sizeof(stack_journal_rec_t) + sizeof(stack_journal_delta_t) +
+                 used_size - journal_p->snap_kept_size;
+    if (is_delta && (0 != journal_p->snap_size) && (delta_size < full_size) &&
+        ((journal_p->snap_size + delta_size) <= (2 * full_size))) {
+        err = stack_journal_snapshot_delta(stack_p, journal_p->gen + 1);
+    } else {
+        err = stack_journal_snapshot(stack_p, journal_p->gen + 1);
+    }
+    if (STACK_E_OK == err) {
+        /*
+         * The snapshot holds everything the journal did, waiting records
+         * included, so they are dropped, and so is any earlier error.
+         */
+        journal_p->gen++;
+        journal_p->buf_len = 0;
+        journal_p->pop_pos = SIZE_MAX;
+        journal_p->num_unsynced = 0;
+        journal_p->num_logged = stack_p->num_entries;
+        journal_p->num_kept = stack_p->num_entries;
+        journal_p->kept_size = used_size;
+        journal_p->snap_num_kept = stack_p->num_entries;
+        journal_p->snap_kept_size = used_size;
+        journal_p->err = STACK_E_OK;
+        if (! stack_journal_restart(journal_p)) {
+            journal_p->err = STACK_E_IO;
+            err = STACK_E_IO;
+        }
+    }
+    stack_unlock(stack_p);
+
+    return (err);
+}
+
+/*
+ * Write a snapshot of a journaled stack and start a new, empty journal.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_journal_checkpoint (stack_t *stack_p)
+{
+    return (stack_journal_checkpoint_impl(stack_p, false));
+}
+
+/*
+ * Write the changes to a journaled stack since its last checkpoint and
+ * start a new, empty journal.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_journal_checkpoint_delta (stack_t *stack_p)
+{
+    return (stack_journal_checkpoint_impl(stack_p, true));
+}
+
+/*
+ * Increment reference count of stack.
+ *
+ * See ../include/stack.h for API details. 
+ */
+stack_err_e stack_incr_refcount (stack_t *stack_p)
+{
+    if (! stack_is_valid(stack_p)) {
+        return (STACK_E_INVALID);
+    }
+
+    if (stack_p->refcount >= STACK_MAX_REFCOUNT) {
+        return (STACK_E_MAX_REFCOUNT);
+    }
+
+    (stack_p->refcount)++;
+
+    return (STACK_E_OK);
+}
+
+/*
+ * Get number of explicit references to the stack.
+ *
+ * See ../include/stack.h for API details. 
+ */
+unsigned int stack_get_refcount (stack_t *stack_p)
+{
+    if (! stack_is_valid(stack_p)) {
+        return (0);
+    }
+
+    return (stack_p->refcount);
+}
+
+/*
+ * Decrement a stack's reference count and free its memory if there
+ * are no more references to it.
  *
  * See ../include/stack.h for API details.
  */
-stack_err_e stack_pop (stack_t *stack_p, void *entry_p, size_t *entry_size_p)
-{
-    stack_err_e  err = STACK_E_OK;               /* Operation return code     */
+void stack_free (stack_t *stack_p)
+{
+    if (NULL == stack_p) {
+        return;
+    }
+
+    (stack_p->refcount)--;
+    if ((0 == stack_p->refcount) && (stack_p->event_fd >= 0)) {
+        (void)close(stack_p->event_fd);
+        stack_p->event_fd = -1;
+    }
+    if ((0 == stack_p->refcount) && (NULL != stack_p->shm_p)) {
+        /*
+         * Only this process's mapping goes away; the segment itself lives
+         * on until stack_unlink_shm().
+         */
+        (void)munmap(stack_p->shm_p, stack_p->shm_size);
+        stack_p->self = NULL;
+        free(stack_p);
+    } else if ((0 == stack_p->refcount) && (NULL == stack_p->arena_p)) {
+        if (NULL != stack_p->sync_p) {
+            (void)pthread_cond_destroy(&(stack_p->sync_p->not_full));
+            (void)pthread_cond_destroy(&(stack_p->sync_p->not_empty));
+            (void)pthread_mutex_destroy(&(stack_p->sync_p->lock));
+            free(stack_p->sync_p);
+        }
+        stack_batch_free(stack_p->mpsc_head);
+        if (NULL != stack_p->journal_p) {
+            stack_journal_log(stack_p);
+            (void)stack_journal_commit(stack_p->journal_p, true);
+            stack_journal_free(stack_p->journal_p);
+        }
+        if (NULL != stack_p->snap_chunk_p) {
+            stack_snapshot_destroy(stack_p);
+        }
+        free(stack_p->buf);
+        free(stack_p);
+    }
+}
+
+/**
+ * Size of the buffer in which stack_print_to() formats its output.
+ */
+#define STACK_PRINT_BUF_SIZE 65536
+
+/**
+ * How stack_print_to() encodes entry data.
+ */
+typedef enum {
+    /**
+     * Hex digits with ':' between bytes.
+     */
+    STACK_PRINT_ENCODE_HEX_COLON = 0,
+    /**
+     * Hex digits only.
+     */
+    STACK_PRINT_ENCODE_HEX,
+    /**
+     * Printable characters as-is, others as C escape sequences.
+     */
+    STACK_PRINT_ENCODE_ESCAPED,
+} stack_print_encode_e;
+
+/**
+ * Layout of one output format of stack_print_to(). The strings are printf
+ * formats with the arguments noted.
+ */
+typedef struct {
+    /**
+     * Invalid stack: stack pointer.
+     */
+    const char *invalid_p;
+    /**
+     * Header: stack pointer, references, entries, used and free bytes.
+     */
+    const char *header_p;
+    /**
+     * Between two entries.
+     */
+    const char *separator_p;
+    /**
+     * Start of entry: 'size' field pointer, entry size.
+     */
+    const char *entry_p;
+    /**
+     * Before the data of a non-empty entry.
+     */
+    const char *data_p;
+    /**
+     * After the data of a non-empty entry.
+     */
+    const char *data_end_p;
+    /**
+     * End of entry.
+     */
+    const char *entry_end_p;
+    /**
+     * Footer.
+     */
+    const char *footer_p;
+    /**
+     * Encoding of entry data.
+     */
+    stack_print_encode_e encode;
+} stack_print_style_t;
+
+/**
+ * Layouts of the stack_print_to() formats, indexed on format.
+ */
+static const stack_print_style_t stack_print_styles[] = {
+    [STACK_PRINT_HEX] = {
+        "<stack ptr=%p valid=false></stack>\n",
+        "<stack ptr=%p refs=%u entries=%lu used_bytes=%lu "
+            "avail_bytes=%lu>\n",
+        "",
+        "  <stack_entry ptr=%p size=%lu",
+        " data=",
+        "",
+        "></stack_entry>\n",
+        "</stack>\n",
+        STACK_PRINT_ENCODE_HEX_COLON
+    },
+    [STACK_PRINT_ESCAPED] = {
+        "<stack ptr=%p valid=false></stack>\n",
+        "<stack ptr=%p refs=%u entries=%lu used_bytes=%lu "
+            "avail_bytes=%lu>\n",
+        "",
+        "  <stack_entry ptr=%p size=%lu",
+        " data=\"",
+        "\"",
+        "></stack_entry>\n",
+        "</stack>\n",
+        STACK_PRINT_ENCODE_ESCAPED
+    },
+    [STACK_PRINT_JSON] = {
+        "{\"ptr\":\"%p\",\"valid\":false}\n",
+        "{\"ptr\":\"%p\",\"refs\":%u,\"entries\":%lu,\"used_bytes\":%lu,"
+            "\"avail_bytes\":%lu,\"items\":[",
+        ",",
+        "\n  {\"ptr\":\"%p\",\"size\":%lu",
+        ",\"data\":\"",
+        "\"",
+        "}",
+        "\n]}\n",
+        STACK_PRINT_ENCODE_HEX
+    },
+};
 
-    /*
-     * First copy value from top of stack. 
-     */
-    err = stack_peek(stack_p, entry_p, entry_size_p);
-    if (stack_err_e_is_error(err)) {
-        return (err);
-    }
+/**
+ * Hex digits, indexed on value.
+ */
+static const char stack_hex_digits[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
+};
 
-    /*
-     * Remove entry from stack.
+/**
+ * C escape sequence letters, indexed on character, or 0 for characters
+ * without one.
+ */
+static const char stack_escape_letters[128] = {
+    ['\a'] = 'a', ['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n',
+    ['\v'] = 'v', ['\f'] = 'f', ['\r'] = 'r',
+    ['"'] = '"', ['\\'] = '\\'
+};
+
+/**
+ * Output being formatted by stack_print_to().
+ */
+typedef struct {
+    /**
+     * Stream to write to.
      */
-    stack_p->buf_free_size += sizeof(size_t) + *entry_size_p;
-    (stack_p->num_entries)--;
+    FILE *stream_p;
+    /**
+     * Bytes formatted but not yet written.
+     */
+    size_t len;
+    /**
+     * Did a write fail?
+     */
+    bool is_failed;
+    /**
+     * Formatted output.
+     */
+    char buf[STACK_PRINT_BUF_SIZE];
+} stack_print_out_t;
 
-    return (STACK_E_OK);
+/**
+ * Write formatted output to its stream.
+ *
+ * @param[in,out] out_p
+ *     Output to write.
+ */
+static void stack_print_flush (stack_print_out_t *out_p)
+{
+    if ((out_p->len > 0) && (! out_p->is_failed) &&
+        (out_p->len != fwrite(out_p->buf, 1, out_p->len, out_p->stream_p))) {
+        out_p->is_failed = true;
+    }
+    out_p->len = 0;
 }
 
-/*
- * Look at top entry of stack.
+/**
+ * Format text into the output buffer.
  *
- * See ../include/stack.h for API details.
+ * @param[in,out] out_p
+ *     Output to add to.
+ * @param[in] format_p
+ *     printf format. Text longer than the whole buffer is truncated.
  */
-stack_err_e stack_peek (const stack_t *stack_p,
-                        void *entry_p,
-                        size_t *entry_size_p)
+static void stack_print_fmt (stack_print_out_t *out_p,
+                             const char *format_p, ...)
+    __attribute__((format(printf, 2, 3)));
+static void stack_print_fmt (stack_print_out_t *out_p,
+                             const char *format_p, ...)
 {
-    size_t  in_entry_size    = 0;                /* Output data buffer size   */
-    size_t  out_entry_size   = 0;                /* Stack entry data size     */
-    size_t *buf_entry_size_p = NULL;             /* Entry size in buffer      */
-    void   *buf_entry_p      = NULL;             /* Entry in buffer           */
+    va_list args;                                /* Format arguments          */
+    int     len = 0;                             /* Length of text            */
 
-    /*
-     * Check parameters.
-     */
-    if (! stack_is_valid(stack_p)) {
-        return (STACK_E_INVALID);
+    va_start(args, format_p);
+    len = vsnprintf(out_p->buf + out_p->len, STACK_PRINT_BUF_SIZE - out_p->len,
+                    format_p, args);
+    va_end(args);
+    if (len < 0) {
+        return;
     }
-    if (NULL == entry_size_p) {
-        return (STACK_E_INVALID);
+    if ((size_t)len >= (STACK_PRINT_BUF_SIZE - out_p->len)) {
+        stack_print_flush(out_p);
+        va_start(args, format_p);
+        len = vsnprintf(out_p->buf, STACK_PRINT_BUF_SIZE, format_p, args);
+        va_end(args);
+        if ((len < 0) || (len >= STACK_PRINT_BUF_SIZE)) {
+            len = STACK_PRINT_BUF_SIZE - 1;
+        }
     }
-    if (NULL != entry_p) {
+    out_p->len += (size_t)len;
+}
+
+/**
+ * Encode entry data into the output buffer.
+ *
+ * Bytes are encoded in runs that are known to fit in the buffer, so the
+ * inner loops only look up tables and store characters. In escaped data,
+ * a hex digit right after a \\x escape is escaped too, since a C reader
+ * would otherwise take it as part of that escape.
+ *
+ * @param[in,out] out_p
+ *     Output to add to.
+ * @param[in] data_p
+ *     Data to encode.
+ * @param[in] size
+ *     Size of data in bytes.
+ * @param[in] encode
+ *     Encoding to use.
+ */
+static void stack_print_data (stack_print_out_t *out_p,
+                              const unsigned char *data_p,
+                              size_t size,
+                              stack_print_encode_e encode)
+{
+    char          *dst_p    = NULL;              /* Next output character     */
+    size_t         run_size = 0;                 /* Bytes to encode this run  */
+    size_t         done     = 0;                 /* Bytes already encoded     */
+    size_t         i        = 0;                 /* Loop index counter        */
+    unsigned char  c        = 0;                 /* Current byte              */
+    bool           is_hex   = false;             /* Last byte written as \x?  */
+
+    while (done < size) {
         /*
-         * If an output buffer is supplied, it must have at least one byte.
+         * No byte takes more than four characters.
          */
-        in_entry_size = *entry_size_p;
-        if (in_entry_size < 1) { 
-            return (STACK_E_INVALID);
+        if ((STACK_PRINT_BUF_SIZE - out_p->len) < 4) {
+            stack_print_flush(out_p);
+        }
+        run_size = (STACK_PRINT_BUF_SIZE - out_p->len) / 4;
+        if (run_size > (size - done)) {
+            run_size = size - done;
+        }
+        dst_p = out_p->buf + out_p->len;
+
+        for (i = 0; i < run_size; i++) {
+            c = data_p[done + i];
+            switch (encode) {
+            case STACK_PRINT_ENCODE_HEX_COLON:
+                if ((done + i) > 0) {
+                    *dst_p++ = ':';
+                }
+                /* fall through */
+            case STACK_PRINT_ENCODE_HEX:
+                *dst_p++ = stack_hex_digits[c >> 4];
+                *dst_p++ = stack_hex_digits[c & 0x0F];
+                break;
+            case STACK_PRINT_ENCODE_ESCAPED:
+                if ((c < 128) && (0 != stack_escape_letters[c])) {
+                    *dst_p++ = '\\';
+                    *dst_p++ = stack_escape_letters[c];
+                    is_hex = false;
+                } else if ((c >= 0x20) && (c < 0x7F) &&
+                           ((! is_hex) || (! isxdigit(c)))) {
+                    *dst_p++ = (char)c;
+                    is_hex = false;
+                } else {
+                    *dst_p++ = '\\';
+                    *dst_p++ = 'x';
+                    *dst_p++ = stack_hex_digits[c >> 4];
+                    *dst_p++ = stack_hex_digits[c & 0x0F];
+                    is_hex = true;
+                }
+                break;
+            }
         }
+
+        out_p->len = dst_p - out_p->buf;
+        done += run_size;
+    }
+}
+
+/*
+ * Print content of stack to a stream.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_print_to (stack_t *stack_p,
+                            FILE *stream_p,
+                            stack_print_format_e format)
+{
+    const stack_print_style_t *style_p      = NULL; /* Output layout       */
+    size_t                    *entry_size_p = NULL; /* Entry 'size' field  */
+    size_t                     entry_size   = 0;  /* Stack entry data size    */
+    unsigned char             *entry_data_p = NULL; /* Entry 'data' field  */
+    size_t                     i            = 0;  /* Loop index counter       */
+    stack_err_e                err          = STACK_E_OK; /* Return code      */
+    stack_print_out_t          out;              /* Formatted output          */
+
+    if ((NULL == stream_p) ||
+        ((STACK_PRINT_HEX != format) && (STACK_PRINT_ESCAPED != format) &&
+         (STACK_PRINT_JSON != format))) {
+        return (STACK_E_INVALID);
     }
+    style_p = &(stack_print_styles[format]);
+    out.stream_p = stream_p;
+    out.len = 0;
+    out.is_failed = false;
 
     /*
-     * Nothing to do for empty stacks.
+     * Print an abbreviated entry for invalid stacks.
      */
-    if (stack_is_empty_impl(stack_p)) {
-        return (STACK_E_EMPTY);
+    err = stack_lock(stack_p);
+    if (stack_err_e_is_error(err)) {
+        stack_print_fmt(&out, style_p->invalid_p, (void *)stack_p);
+        stack_print_flush(&out);
+        return (err);
     }
 
     /*
-     * Copy data for entry from buffer. 
+     * Print header containing stack control data
      */
-    stack_get_top_entry(stack_p, &buf_entry_size_p, &buf_entry_p);
-    out_entry_size = *buf_entry_size_p;
-    if ((out_entry_size > 0) && (NULL != entry_p)) {
-        if (out_entry_size > in_entry_size) {
-            return (STACK_E_BUF_OVERFLOW);
+    stack_print_fmt(&out, style_p->header_p,
+                    (void *)stack_p,
+                    stack_p->refcount,
+                    stack_p->num_entries,
+                    stack_get_used_size(stack_p),
+                    stack_p->buf_size - stack_get_used_size(stack_p));
+
+    /*
+     * Print each entry in the stack.
+     */
+    if (! stack_is_empty_impl(stack_p)) {
+        stack_get_top_entry(stack_p, &entry_size_p, (void **)&entry_data_p);
+    }
+    for (i = 0; i < stack_p->num_entries; i++) {
+        if (i > 0) {
+            stack_print_fmt(&out, "%s", style_p->separator_p);
         }
-        memcpy(entry_p, buf_entry_p, out_entry_size);
+        entry_size = *entry_size_p;
+        stack_print_fmt(&out, style_p->entry_p,
+                        (void *)entry_size_p, entry_size);
+        if (entry_size > 0) {
+            stack_print_fmt(&out, "%s", style_p->data_p);
+            stack_print_data(&out, entry_data_p, entry_size,
+                             style_p->encode);
+            stack_print_fmt(&out, "%s", style_p->data_end_p);
+        }
+        stack_print_fmt(&out, "%s", style_p->entry_end_p);
+
+        (void)stack_get_next_entry(stack_p,
+                                   &entry_size_p,
+                                   (void **)&entry_data_p);
+    }
+
+    /*
+     * Print footer.
+     */
+    stack_print_fmt(&out, "%s", style_p->footer_p);
+    stack_unlock(stack_p);
+
+    stack_print_flush(&out);
+    if (out.is_failed) {
+        return (STACK_E_INTERNAL);
     }
-    *entry_size_p = out_entry_size;
 
     return (STACK_E_OK);
 }
 
 /*
- * Increment reference count of stack.
+ * Print content of stack to STDOUT.
  *
- * See ../include/stack.h for API details. 
+ * See ../include/stack.h for API details.
  */
-stack_err_e stack_incr_refcount (stack_t *stack_p)
+void stack_print (stack_t *stack_p)
 {
-    if (! stack_is_valid(stack_p)) {
-        return (STACK_E_INVALID);
+    (void)stack_print_to(stack_p, stdout, STACK_PRINT_HEX);
+}
+
+/*
+ * Allocate several stacks that share one buffer.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_arena_t* stack_arena_alloc (size_t num_stacks, size_t size)
+{
+    stack_arena_t *new_arena_p = NULL;           /* Newly allocated arena     */
+    size_t         region_size = 0;              /* Initial region size       */
+    size_t         i           = 0;              /* Loop index counter        */
+
+    if ((num_stacks < 1) || (size < num_stacks)) {
+        return (NULL);
     }
 
-    if (stack_p->refcount >= STACK_MAX_REFCOUNT) {
-        return (STACK_E_MAX_REFCOUNT);
+    new_arena_p = malloc(sizeof(stack_arena_t));
+    if (NULL == new_arena_p) {
+        return (NULL);
+    }
+    new_arena_p->buf = malloc(size);
+    new_arena_p->stacks = malloc(num_stacks * sizeof(stack_t));
+    if ((NULL == new_arena_p->buf) || (NULL == new_arena_p->stacks)) {
+        free(new_arena_p->buf);
+        free(new_arena_p->stacks);
+        free(new_arena_p);
+        return (NULL);
     }
+    new_arena_p->buf_size = size;
+    new_arena_p->num_stacks = num_stacks;
+    new_arena_p->self = new_arena_p;
 
-    (stack_p->refcount)++;
+    /*
+     * Start with equal regions; the last one absorbs any rounding.
+     */
+    region_size = size / num_stacks;
+    for (i = 0; i < num_stacks; i++) {
+        stack_init(&(new_arena_p->stacks[i]),
+                   new_arena_p->buf + (i * region_size),
+                   ((i + 1) == num_stacks) ?
+                       (size - (i * region_size)) : region_size,
+                   STACK_MAX_ENTRIES_NONE,
+                   STACK_MAX_ENTRY_SIZE_NONE,
+                   STACK_FLAG_NONE,
+                   new_arena_p);
+    }
 
-    return (STACK_E_OK);
+    return (new_arena_p);
 }
 
 /*
- * Get number of explicit references to the stack.
+ * Get one of the stacks of an arena.
  *
- * See ../include/stack.h for API details. 
+ * See ../include/stack.h for API details.
  */
-unsigned int stack_get_refcount (stack_t *stack_p)
+stack_t* stack_arena_get_stack (stack_arena_t *arena_p, size_t index)
 {
-    if (! stack_is_valid(stack_p)) {
-        return (0);
+    if ((NULL == arena_p) || (arena_p != arena_p->self)) {
+        return (NULL);
+    }
+    if (index >= arena_p->num_stacks) {
+        return (NULL);
     }
 
-    return (stack_p->refcount);
+    return (&(arena_p->stacks[index]));
 }
 
 /*
- * Decrement a stack's reference count and free its memory if there
- * are no more references to it.
+ * Free an arena and all of its stacks.
  *
  * See ../include/stack.h for API details.
  */
-void stack_free (stack_t *stack_p)
+void stack_arena_free (stack_arena_t *arena_p)
 {
-    if (NULL == stack_p) {
+    size_t i = 0;                                /* Loop index counter        */
+
+    if ((NULL == arena_p) || (arena_p != arena_p->self)) {
         return;
     }
 
-    (stack_p->refcount)--;
-    if (0 == stack_p->refcount) {
-        free(stack_p);
+    /*
+     * Invalidate the stacks in case stale handles are still around.
+     */
+    for (i = 0; i < arena_p->num_stacks; i++) {
+        arena_p->stacks[i].self = NULL;
     }
+    arena_p->self = NULL;
+
+    free(arena_p->stacks);
+    free(arena_p->buf);
+    free(arena_p);
 }
 
-/*
- * Print content of stack to STDOUT.
+/**
+ * Number of times stack_shm_attach() checks whether the creator of a
+ * shared memory stack has finished initializing it.
+ */
+#define STACK_SHM_ATTACH_TRIES 1000
+
+/**
+ * Delay between checks in stack_shm_attach(), in nanoseconds.
+ */
+#define STACK_SHM_ATTACH_DELAY_NS 1000000
+
+/**
+ * Initialize a newly created shared memory segment.
  *
- * See ../include/stack.h for API details.
+ * @param[in] fd
+ *     Descriptor of the new, empty segment.
+ * @param[in] buf_size
+ *     Size of the element buffer in bytes.
+ * @param[in] flags
+ *     Stack behavior flags.
+ * @returns
+ *     Mapped control block on success, NULL on failure.
  */
-void stack_print (stack_t *stack_p)
+static stack_shm_hdr_t* stack_shm_create (int fd,
+                                          size_t buf_size,
+                                          stack_flags_t flags)
 {
-    size_t        *entry_size_p = NULL;          /* Stack entry 'size' field  */
-    size_t         entry_size   = 0;             /* Stack entry data size     */
-    unsigned char *entry_data_p = NULL;          /* Stack entry 'data' field  */
-    unsigned int   i,j;                          /* Loop index counter        */
+    stack_shm_hdr_t *hdr_p    = NULL;            /* Shared control block      */
+    size_t           map_size = 0;               /* Size of whole segment     */
 
-    /*
-     * Print an abbreviated entry for invalid stacks.
-     */
-    if (! stack_is_valid(stack_p)) { 
-        printf("<stack ptr=%p valid=false></stack>\n", stack_p);
+    map_size = sizeof(stack_shm_hdr_t) + buf_size;
+    if ((map_size < buf_size) || (0 != ftruncate(fd, (off_t)map_size))) {
+        return (NULL);
+    }
+    hdr_p = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == hdr_p) {
+        return (NULL);
     }
 
-    /*
-     * Print header containing stack control data
-     */
-    printf("<stack ptr=%p refs=%u entries=%lu used_bytes=%lu "
-             "avail_bytes=%lu>\n",
-           stack_p,
-           stack_p->refcount,
-           stack_p->num_entries,
-           sizeof(stack_p->buf) - stack_p->buf_free_size,
-           stack_p->buf_free_size);
+    if (! stack_sync_init(&(hdr_p->sync), true)) {
+        (void)munmap(hdr_p, map_size);
+        return (NULL);
+    }
+
+    hdr_p->hdr_size = sizeof(stack_shm_hdr_t);
+    hdr_p->map_size = map_size;
+    hdr_p->flags = flags;
+    hdr_p->buf_size = buf_size;
+    hdr_p->buf_top = buf_size;
+    hdr_p->buf_end = buf_size;
+    hdr_p->buf_wrap = 0;
+    hdr_p->is_wrapped = false;
+    hdr_p->num_entries = 0;
 
     /*
-     * Print each entry in the stack.
+     * Publish the segment last, so that processes attaching concurrently
+     * never see a partially initialized control block.
      */
-    if (! stack_is_empty_impl(stack_p)) {
-	stack_get_top_entry(stack_p, &entry_size_p, (void **)&entry_data_p);
+    __atomic_store_n(&(hdr_p->magic), STACK_SHM_MAGIC, __ATOMIC_RELEASE);
 
-    	for (i = 0; i < stack_p->num_entries; i++) {
-            if (NULL == entry_size_p) {
-                printf("  <stack_entry ptr=NULL></stack_entry>\n");
-                break;
-            }
+    return (hdr_p);
+}
 
-            entry_size = *entry_size_p;
-            printf("  <stack_entry ptr=%p size=%lu",
-                   entry_size_p, entry_size);
-            if (entry_size > 0) {
-                printf(" data=");
-                for (j = 0; j < entry_size; j++) {
-                    if (j > 0) {
-                        printf(":");
-                    }
-                    printf("%02X", entry_data_p[j]);
+/**
+ * Map an existing shared memory segment, waiting for its creator to finish
+ * initializing it if necessary.
+ *
+ * @param[in] fd
+ *     Descriptor of the segment.
+ * @returns
+ *     Mapped control block on success, NULL on failure.
+ */
+static stack_shm_hdr_t* stack_shm_attach (int fd)
+{
+    stack_shm_hdr_t *hdr_p = NULL;               /* Shared control block      */
+    struct stat      st;                         /* Segment attributes        */
+    struct timespec  delay = {0, STACK_SHM_ATTACH_DELAY_NS}; /* Retry delay   */
+    unsigned int     i     = 0;                  /* Loop index counter        */
+
+    for (i = 0; i < STACK_SHM_ATTACH_TRIES; i++) {
+        if (0 != fstat(fd, &st)) {
+            return (NULL);
+        }
+
+        /*
+         * The creator sizes the segment before initializing it, so once
+         * it is large enough for a control block it has its final size.
+         */
+        if ((size_t)st.st_size >= sizeof(stack_shm_hdr_t)) {
+            hdr_p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+            if (MAP_FAILED == hdr_p) {
+                return (NULL);
+            }
+            if (STACK_SHM_MAGIC ==
+                __atomic_load_n(&(hdr_p->magic), __ATOMIC_ACQUIRE)) {
+                if ((sizeof(stack_shm_hdr_t) != hdr_p->hdr_size) ||
+                    ((size_t)st.st_size != hdr_p->map_size) ||
+                    (0 != (hdr_p->flags & ~STACK_FLAGS_ALL))) {
+                    (void)munmap(hdr_p, (size_t)st.st_size);
+                    return (NULL);
                 }
+                return (hdr_p);
             }
-            printf("></stack_entry>\n");
+            (void)munmap(hdr_p, (size_t)st.st_size);
+        }
+        (void)nanosleep(&delay, NULL);
+    }
+
+    return (NULL);
+}
+
+/*
+ * Open a stack in POSIX shared memory.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_t* stack_open_shm (const char *name, size_t size, stack_flags_t flags)
+{
+    stack_t         *new_stack_p = NULL;         /* Newly allocated handle    */
+    stack_shm_hdr_t *hdr_p       = NULL;         /* Shared control block      */
+    struct stat      st;                         /* Segment attributes        */
+    int              fd          = -1;           /* Segment descriptor        */
+    bool             is_creator  = false;        /* Did we create segment?    */
+
+    if (NULL == name) {
+        return (NULL);
+    }
+    if (0 != (flags & ~(STACK_FLAGS_ALL | STACK_SHM_CREATE | STACK_SHM_EXCL))) {
+        return (NULL);
+    }
+    if (0 != (flags & (STACK_FLAG_MPSC | STACK_FLAG_SNAPSHOT |
+                       STACK_FLAG_SINGLE_WRITER | STACK_FLAG_GROW |
+                       STACK_FLAG_STATS))) {
+        return (NULL);
+    }
+    if (STACK_MAX_SIZE_NONE == size) {
+        size = STACK_DEFAULT_BUF_SIZE;
+    }
 
-            (void)stack_get_next_entry(stack_p,
-                                       &entry_size_p,
-                                       (void **)&entry_data_p);
+    new_stack_p = malloc(sizeof(stack_t));
+    if (NULL == new_stack_p) {
+        return (NULL);
+    }
+
+    /*
+     * Exactly one process creates the segment; everyone else attaches to
+     * it, even if they also asked to create it.
+     */
+    if (0 != (flags & STACK_SHM_CREATE)) {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        is_creator = (fd >= 0);
+        if ((! is_creator) &&
+            ((EEXIST != errno) || (0 != (flags & STACK_SHM_EXCL)))) {
+            free(new_stack_p);
+            return (NULL);
+        }
+    }
+    if (! is_creator) {
+        fd = shm_open(name, O_RDWR, 0);
+    }
+    if (fd < 0) {
+        free(new_stack_p);
+        return (NULL);
+    }
+
+    if (is_creator) {
+        hdr_p = stack_shm_create(fd, size, flags & STACK_FLAGS_ALL);
+        if (NULL == hdr_p) {
+            (void)shm_unlink(name);
+        }
+    } else {
+        hdr_p = stack_shm_attach(fd);
+    }
+    if ((NULL == hdr_p) || (0 != fstat(fd, &st))) {
+        if (NULL != hdr_p) {
+            (void)munmap(hdr_p, hdr_p->map_size);
         }
+        (void)close(fd);
+        free(new_stack_p);
+        return (NULL);
     }
+    (void)close(fd);
 
     /*
-     * Print footer.
+     * The handle is private to this process. Its buffer pointer refers to
+     * this process's mapping, and stack_lock() refreshes the rest of its
+     * bookkeeping from the control block.
      */
-    printf("</stack>\n");
+    stack_init(new_stack_p,
+               (unsigned char *)hdr_p + hdr_p->hdr_size,
+               hdr_p->buf_size,
+               STACK_MAX_ENTRIES_NONE,
+               STACK_MAX_ENTRY_SIZE_NONE,
+               hdr_p->flags,
+               NULL);
+    new_stack_p->sync_p = &(hdr_p->sync);
+    new_stack_p->shm_p = hdr_p;
+    new_stack_p->shm_size = hdr_p->map_size;
+    new_stack_p->shm_ino = st.st_ino;
+
+    return (new_stack_p);
+}
+
+/*
+ * Remove the name of a shared memory stack.
+ *
+ * See ../include/stack.h for API details.
+ */
+stack_err_e stack_unlink_shm (const char *name)
+{
+    if (NULL == name) {
+        return (STACK_E_INVALID);
+    }
+    if (0 != shm_unlink(name)) {
+        return (STACK_E_INVALID);
+    }
+
+    return (STACK_E_OK);
 }
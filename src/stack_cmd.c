@@ -3,18 +3,76 @@
  * Interactive stack command. 
  *
  * This command creates a simple interactive shell that allows the user
- * manipulate a single stack. The shell supports the following commands:
+ * manipulate named stacks. The shell supports the following commands:
  *
  * <ul>
  *   <li><b>push</b> <i><string></i> -- Push a string onto the stack.
  *   <li><b>pop</b> -- Remove string from top of stack. 
  *   <li><b>peek</b> -- Look at top string without removing it.
+ *   <li><b>pushn</b> <i><string> ...</i> -- Push several strings at once.
+ *   <li><b>popn</b> <i><n></i> -- Remove the top <i>n</i> strings.
+ *   <li><b>fill</b> <i><n> <size></i> -- Push <i>n</i> generated strings
+ *       of <i>size</i> bytes each.
+ *   <li><b>drain</b> -- Remove and show every string in the stack.
  *   <li><b>show</b> -- Show current contents of stack.
  *   <li><b>help</b> -- Show command list.
  *   <li><b>size</b> -- Report number of items in stack.
+ *   <li><b>stats</b> -- Report the stack's operation counters, high-water
+ *       marks, bytes copied and entry size histogram.
+ *   <li><b>bench</b> <i><op> <n> <size></i> -- Time <i>n</i> push, pop,
+ *       peek or pushpop operations on entries of <i>size</i> bytes.
+ *   <li><b>checkpoint</b> <i>[-d]</i> -- Save a snapshot of a journaled
+ *       stack, or with <i>-d</i> only its changes since the last one, and
+ *       restart its journal.
+ *   <li><b>use</b> <i><name></i> -- Make the named stack current, creating
+ *       it if needed.
+ *   <li><b>list</b> -- List the named stacks.
  *   <li><b>quit</b> -- Exit shell
  * </ul>
  *
+ * The shell starts with a single stack named "default". The commands other
+ * than use, list, help and quit work on the current stack unless their
+ * arguments start with <i>@<name></i>, e.g., "push @jobs run backup".
+ * Pushing to a named stack creates it if needed.
+ *
+ * Values can be of any length and hold any bytes. After the optional
+ * <i>@<name></i>, the commands that push, pop or peek values take
+ * <i>-x</i> for values written as hex digits or <i>-b</i> for base64,
+ * e.g., "push -x 00ff10" or "pop @blobs -b". pushn values are separated
+ * by whitespace, so text values given to it can't contain any.
+ *
+ * @par Usage
+ * <code>
+ *     stack_cmd [-j <dir> [-s <ops>] [-i <ms>]] [-f <script>]
+ *     stack_cmd [-j <dir> [-s <ops>] [-i <ms>]] -l <socket path> [-t <threads>]
+ * <endcode>
+ *
+ * The shell runs in batch mode when it reads commands from a script given
+ * with -f, or when its standard input is not a terminal, e.g., a pipe. In
+ * batch mode, the help banner and the prompts are left out and output is
+ * fully buffered, so that large scripts can replay millions of operations.
+ *
+ * With -l (or --listen), the command instead serves the shell to any number
+ * of clients connecting to a Unix domain socket at the given path, e.g.,
+ * with "socat - UNIX-CONNECT:<socket path>". Each connection is a batch-mode
+ * session with its own current stack, and all sessions share the named
+ * stacks. 'quit' ends the session. The server runs until it is killed.
+ * Clients that start the connection with a NUL byte speak the pipelined
+ * binary protocol described in include/stack_wire.h instead. With -t (or
+ * --threads), the server runs the given number of worker threads rather
+ * than one.
+ *
+ * With -j (or --journal), the stacks are durable: each one keeps a journal
+ * of its changes in the given directory, created if needed, and the stacks
+ * found there are recovered when the command starts. Journal writes are
+ * group committed: a journal is written and flushed to disk once every
+ * -i (or --sync-ms) milliseconds, 10 by default, or once every -s (or
+ * --sync-ops) operations, if given, whichever comes first. A crash loses
+ * at most the changes since the last flush. 'checkpoint' bounds the
+ * journal's size and the time taken to recover the stack. 'checkpoint -d'
+ * writes only what changed since the last checkpoint, so that large
+ * stacks can be checkpointed often.
+ *
  * @par Design
  * The command makes use of the libstack.so shared library that is the
  * core of the https://github.com/mbjalint/stack repository. It uses the
@@ -22,7 +80,35 @@
  *
  * The push command converts the rest of the line into a string and copies
  * it into the stack. In this way, we can test the variable-length data
- * portion of the include/stack.h interface.
+ * portion of the include/stack.h interface. The stacks are created with
+ * STACK_FLAG_GROW, so they have no fixed size. A value is decoded straight
+ * into the entry that stack_push_reserve() makes for it, and popped or
+ * peeked values are encoded straight from stack memory into the output
+ * buffer, so a large value is copied once each way. The bulk commands map
+ * onto one library call each: pushn and fill use stack_push_multi(), which
+ * makes room for all of their entries at once (fill in batches of
+ * STACK_CMD_FILL_BATCH copies of one value), while popn and drain walk the
+ * entries in place with an iterator and remove them with one stack_drop().
+ * Each session keeps its partial input line in a buffer that grows as
+ * needed up to STACK_CMD_LINE_MAX.
+ *
+ * The stacks are also created with STACK_FLAG_STATS, so the library counts
+ * every operation on them, whichever protocol it came from, and 'stats'
+ * just reads the counters. 'bench' times a loop of library calls on the
+ * stack with the monotonic clock. It pushes whatever entries it needs
+ * before the clock starts and drops whatever it pushed after the clock
+ * stops, so the stack's contents are left as they were, though its
+ * counters include the benchmark. A benchmark runs to completion on its
+ * worker, so other clients of that worker wait for it.
+ *
+ * A journaled stack's files are named after the stack, with bytes other
+ * than letters, digits, '_', '-' and non-leading '.' written as %XX, so
+ * that any stack name maps to a safe file name and back. Names whose file
+ * names would not fit in NAME_MAX bytes are refused. The library
+ * checks whether a flush is due whenever an operation finishes, so busy
+ * stacks flush themselves. Idle stacks are flushed by their worker, which
+ * wakes up at least once per interval to do so, and by the shell before
+ * it waits for more input.
  *
  * The shell uses a simple, single-keyword parser. It implements first
  * unique match semantics and is case-insensitive. For example, any of
@@ -30,21 +116,59 @@
  * since there are no other commands that start with 'q'. The parser will
  * not match commands with extra characters, such as 'quitX'. There are several
  * commands starting with 'p' so either 'p' or 'P' will report an insufficient
- * match. 'pu', 'po' and 'pe' will all be accepted.
+ * match. 'pe' will be accepted, and so will 'push' even though 'pushn'
+ * starts with it.
  *
  * The parser uses a simple array of commands to determine the legal keywords
  * and associated callback functions. New commands can be added to the shell
- * by adding extra entries into the array.
+ * by adding extra entries into the array. At startup, the command names are
+ * loaded into a case-insensitive trie, so dispatching a line costs one step
+ * per character of the command word however many commands there are. Each
+ * trie node records how many commands lie below it, so any unique prefix of
+ * a command selects it, and a complete command name is always selected even
+ * if it is also a prefix of another command.
+ *
+ * Input is read in large blocks with read(2) and split into lines, which
+ * are then parsed. Command handlers work on a session, which holds the
+ * current stack, and append their output to the session's output buffer
+ * rather than printing it. The buffer is copied to STDOUT or sent to the
+ * session's socket once a block of input has been handled.
+ *
+ * Each server worker thread runs an epoll(7) loop that waits on the
+ * listening socket and on its connections, all of which are non-blocking.
+ * Each connection has a buffer for its partial input line and the session
+ * output buffer for output that the socket isn't yet ready to take. A
+ * connection stops being read while its pending output is above a limit, so
+ * a client that sends commands but doesn't read replies can't use up memory.
+ *
+ * Binary requests are run as soon as they have fully arrived, but their
+ * responses are collected in an I/O vector and sent with one sendmsg(2) per
+ * block of input. Popped and peeked entries are not copied: the vector
+ * points at the entries in stack memory. Such a pointer is only valid until
+ * its stack changes, so the vector is first sent (and whatever the socket
+ * won't take is copied to the output buffer) before a stack it points into
+ * is changed. Entries popped from a stack are therefore only looked at with
+ * an iterator, and dropped together when the vector is sent.
+ *
+ * The named stacks are sharded across the workers by the hash of their
+ * names, and each worker keeps a registry of the stacks it owns. A stack is
+ * only ever touched by its owner, so stacks need no locks and stay in the
+ * owner's cache. A command for a stack owned by another worker moves the
+ * whole connection there: it is taken out of the worker's epoll set and
+ * queued, together with its unrun input, on the owner's inbox, and the
+ * owner is woken through an eventfd(2) and runs the command. A client
+ * therefore gets the most throughput from stacks owned by the same worker;
+ * 'list' visits every worker in turn.
  * 
  * @par Limitations
  * <ol>
- *    <li>Command always runs interactive mode so there is limited support
- *        for i/o redirection and command chaining.
  *    <li>Parser is serviceable for this simple program but would need
  *        extensive re-architecture to do anything fancy (deep keyword
  *        hierarchies, inline validation, typed inputs, etc). It would
  *        probably be best to make use of third-party parser library. 
- *    <li>Only one stack.
+ *    <li>Lines longer than STACK_CMD_LINE_MAX - 1 characters fail. A value
+ *        is only pushed once its whole line has arrived, so the line is
+ *        held in memory next to its decoded entry.
  *    <li>'show' command currently dumps contents of stack using the
  *         stack_print() debug function so it includes lots of internal
  *         details and shows the strings as a hex-dump. Should be replaced
@@ -77,454 +201,4383 @@
  */
 
 #include "../include/stack.h"
+#include "../include/stack_wire.h"
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 /**
- * Stack to manipulate
+ * Size of the input buffer.
  */
-static stack_t *g_stack_p = NULL;
+#define STACK_CMD_IN_BUF_SIZE 65536
 
 /**
- * Callback function type for parsed commands.
- *
- * @param[in]
- *     Arguments for command.
- * @retval true
- *     Continue execution
- * @retval false
- *     End program
+ * Size of the output buffer in batch mode.
+ */
+#define STACK_CMD_OUT_BUF_SIZE 65536
+
+/**
+ * Maximum length of an input line, including the terminating '\0'. Longer
+ * lines are rejected.
+ */
+#define STACK_CMD_LINE_MAX (64 * 1024 * 1024)
+
+/**
+ * Initial size of a session line buffer. A buffer grown beyond
+ * STACK_CMD_IN_BUF_SIZE for a long line is freed once the line has run.
+ */
+#define STACK_CMD_LINE_MIN_SIZE 256
+
+/**
+ * Maximum length of a stack name, the same as in the binary protocol.
+ */
+#define STACK_CMD_NAME_MAX STACK_WIRE_MAX_NAME
+
+/**
+ * Codec table value of a character that is not a digit.
+ */
+#define STACK_CMD_CODEC_BAD 0xff
+
+/**
+ * Number of entries that 'fill' pushes with each stack_push_multi() call.
+ */
+#define STACK_CMD_FILL_BATCH 1024
+
+/**
+ * Initial size of a session output buffer.
+ */
+#define STACK_CMD_OUT_MIN_SIZE 4096
+
+/**
+ * Amount of unsent output above which the server stops reading commands
+ * from a connection.
+ */
+#define STACK_CMD_OUT_HIGH_WATER (1024 * 1024)
+
+/**
+ * Maximum number of epoll events handled per wait.
+ */
+#define STACK_CMD_MAX_EVENTS 64
+
+/**
+ * Listening socket backlog.
+ */
+#define STACK_CMD_LISTEN_BACKLOG 128
+
+/**
+ * Maximum number of server worker threads.
+ */
+#define STACK_CMD_MAX_WORKERS 256
+
+/**
+ * Default age in milliseconds of the oldest waiting journaled operation
+ * at which a stack's journal is flushed.
+ */
+#define STACK_CMD_SYNC_MS 10
+
+/**
+ * Maximum number of binary responses collected before they are sent.
+ */
+#define STACK_CMD_BIN_MAX_RSPS 256
+
+/**
+ * Maximum number of stacks that collected binary responses may point into.
+ */
+#define STACK_CMD_BIN_MAX_PINS 16
+
+/**
+ * Maximum number of nodes in the command trie.
+ */
+#define STACK_CMD_TRIE_MAX_NODES 256
+
+/**
+ * Number of characters that command names may contain, 'a' to 'z'.
  */
-typedef bool (*stack_cmd_command_fn)(const char* args);
+#define STACK_CMD_TRIE_NUM_CHARS 26
 
 /**
- * A parser command.
+ * Node index that marks a missing trie child. The root node is never a
+ * child, so its index doubles as the marker.
  */
-typedef struct stack_cmd_command_ {
+#define STACK_CMD_TRIE_NONE 0
+
+/**
+ * Command trie node, reached by a prefix of one or more command names.
+ */
+typedef struct {
     /**
-     * Name of command.
+     * Node reached by each next character, or STACK_CMD_TRIE_NONE.
      */
-    const char* name;
+    unsigned char child[STACK_CMD_TRIE_NUM_CHARS];
     /**
-     * Command argument format
+     * Number of commands whose names start with this prefix.
      */
-    const char* args;
+    unsigned char num_commands;
     /**
-     * Command description
+     * Index of the command named exactly by this prefix, or -1.
      */
-    const char* help;
+    signed char exact;
     /**
-     * Callback function to run if command is parsed. 
+     * Index of a command whose name starts with this prefix. It is the
+     * only such command if num_commands is 1.
      */
-    stack_cmd_command_fn cb;
-} stack_cmd_command_t;
+    unsigned char any;
+} stack_cmd_trie_node_t;
 
-/*
- * Forward declaration
+/**
+ * Initial number of slots in the stack registry. Must be a power of 2.
  */
-static bool stack_cmd_help(const char* args);
+#define STACK_CMD_REG_MIN_SLOTS 64
 
 /**
- * Handle 'peek' command.
- *
- * @retval true
- *     Continue processing.
- * @retval false
- *     Exit program. 
+ * Name of the stack that the shell starts with.
  */
-static bool stack_cmd_peek (__attribute__((unused)) const char* args)
-{
-    stack_err_e err           = STACK_E_OK;      /* Operation return code     */
-    char        out_args[128] = "";              /* Copied value buffer       */
-    size_t      out_args_size = 0;               /* Copied value buffer size  */
+#define STACK_CMD_DEFAULT_NAME "default"
+
+/**
+ * Stack registry slot.
+ */
+typedef struct {
+    /**
+     * Stack name, or NULL if the slot is free.
+     */
+    char *name_p;
+    /**
+     * Hash of name.
+     */
+    uint32_t hash;
+    /**
+     * Named stack.
+     */
+    stack_t *stack_p;
+    /**
+     * Did the last flush of the stack's journal fail?
+     */
+    bool is_journal_failed;
+} stack_cmd_reg_slot_t;
+
+/**
+ * Registry of named stacks. It is an open-addressed hash table with linear
+ * probing that doubles in size when it becomes 3/4 full. Stacks are never
+ * removed, so there are no tombstones.
+ */
+typedef struct {
+    /**
+     * Slot array.
+     */
+    stack_cmd_reg_slot_t *slots_p;
+    /**
+     * Number of slots, a power of 2.
+     */
+    size_t num_slots;
+    /**
+     * Number of slots in use.
+     */
+    size_t num_used;
+} stack_cmd_reg_t;
+
+/**
+ * Output buffer. Bytes from pos up to len are waiting to be written.
+ */
+typedef struct {
+    /**
+     * Buffer, or NULL if nothing has been output yet.
+     */
+    char *buf_p;
+    /**
+     * Size of buffer.
+     */
+    size_t size;
+    /**
+     * Offset of end of output.
+     */
+    size_t len;
+    /**
+     * Offset of first byte not yet written.
+     */
+    size_t pos;
+    /**
+     * Was output lost because we ran out of memory?
+     */
+    bool is_failed;
+} stack_cmd_out_t;
+
+/**
+ * Shell session, i.e., the state of one stream of commands.
+ */
+typedef struct {
+    /**
+     * Current stack, i.e., the stack to manipulate when no name is given.
+     */
+    stack_t *stack_p;
+    /**
+     * Name of current stack.
+     */
+    const char *name_p;
+    /**
+     * Worker that owns the current stack.
+     */
+    unsigned int stack_worker;
+    /**
+     * Worker running the session.
+     */
+    unsigned int worker;
+    /**
+     * Worker the session must move to before its current line can run,
+     * or -1.
+     */
+    int move_to;
+    /**
+     * Next worker whose stacks 'list' shows.
+     */
+    unsigned int list_next;
+    /**
+     * Is line a complete line waiting to be run after a move?
+     */
+    bool is_line_ready;
+    /**
+     * Prompt to output after each command, or NULL for none.
+     */
+    const char *prompt_p;
+    /**
+     * Command output.
+     */
+    stack_cmd_out_t out;
+    /**
+     * Length of partial input line.
+     */
+    size_t line_len;
+    /**
+     * Size of line buffer.
+     */
+    size_t line_size;
+    /**
+     * Is the partial input line too long to store?
+     */
+    bool is_line_long;
+    /**
+     * Partial input line, or NULL if no buffer is allocated.
+     */
+    char *line_p;
+} stack_cmd_session_t;
+
+/**
+ * Encodings of command values.
+ */
+typedef enum {
+    /**
+     * The value is the text itself.
+     */
+    STACK_CMD_ENC_TEXT = 0,
+    /**
+     * Hex digits, two per byte.
+     */
+    STACK_CMD_ENC_HEX,
+    /**
+     * Base64, as in RFC 4648.
+     */
+    STACK_CMD_ENC_BASE64
+} stack_cmd_enc_e;
+
+/**
+ * Operations that 'bench' can time.
+ */
+typedef enum {
+    /**
+     * Push entries.
+     */
+    STACK_CMD_BENCH_PUSH = 0,
+    /**
+     * Pop entries pushed beforehand.
+     */
+    STACK_CMD_BENCH_POP,
+    /**
+     * Peek at an entry pushed beforehand.
+     */
+    STACK_CMD_BENCH_PEEK,
+    /**
+     * Push an entry and pop it again.
+     */
+    STACK_CMD_BENCH_PUSHPOP,
+    /**
+     * Number of operations.
+     *
+     * @note
+     *     This must always be the last enumeration value.
+     */
+    STACK_CMD_BENCH_NUM_OPS
+} stack_cmd_bench_e;
+
+/**
+ * Protocol spoken by a server connection.
+ */
+typedef enum {
+    /**
+     * Not known until the first byte arrives.
+     */
+    STACK_CMD_PROTO_UNKNOWN = 0,
+    /**
+     * Line-based text shell.
+     */
+    STACK_CMD_PROTO_TEXT,
+    /**
+     * Pipelined binary protocol, see include/stack_wire.h.
+     */
+    STACK_CMD_PROTO_BINARY
+} stack_cmd_proto_e;
+
+/**
+ * Binary protocol state of a server connection.
+ */
+typedef struct {
+    /**
+     * Number of collected responses.
+     */
+    unsigned int num_rsps;
+    /**
+     * Number of entries in iov.
+     */
+    unsigned int num_iov;
+    /**
+     * Number of entries in pins.
+     */
+    unsigned int num_pins;
+    /**
+     * Number of entries popped from pop_stack_p but not yet dropped.
+     */
+    size_t num_pops;
+    /**
+     * Stack entries are being popped from, or NULL.
+     */
+    stack_t *pop_stack_p;
+    /**
+     * Walk over the entries of pop_stack_p, at the next entry to pop.
+     */
+    stack_iter_t pop_iter;
+    /**
+     * Stacks that iov points into.
+     */
+    stack_t *pins[STACK_CMD_BIN_MAX_PINS];
+    /**
+     * Collected response headers.
+     */
+    stack_wire_rsp_t rsps[STACK_CMD_BIN_MAX_RSPS];
+    /**
+     * Stack sizes returned by collected responses.
+     */
+    uint64_t sizes[STACK_CMD_BIN_MAX_RSPS];
+    /**
+     * Collected responses, i.e., headers and their payloads.
+     */
+    struct iovec iov[2 * STACK_CMD_BIN_MAX_RSPS];
+} stack_cmd_bin_t;
+
+/**
+ * Server connection.
+ */
+typedef struct stack_cmd_conn_ {
+    /**
+     * Next connection in a worker's inbox.
+     */
+    struct stack_cmd_conn_ *next_p;
+    /**
+     * Connected socket.
+     */
+    int fd;
+    /**
+     * Events the connection is registered for with epoll.
+     */
+    uint32_t events;
+    /**
+     * Has the session ended? The connection is closed once its output
+     * has been sent.
+     */
+    bool is_closing;
+    /**
+     * Has the client finished sending?
+     */
+    bool is_eof;
+    /**
+     * Input received but not yet run: a request that hasn't fully arrived
+     * yet, or everything after the line or request the session moved for.
+     */
+    char *in_p;
+    /**
+     * Number of bytes in in_p.
+     */
+    size_t in_len;
+    /**
+     * Size of in_p buffer.
+     */
+    size_t in_size;
+    /**
+     * Protocol spoken.
+     */
+    stack_cmd_proto_e proto;
+    /**
+     * Binary protocol state, or NULL unless proto is
+     * STACK_CMD_PROTO_BINARY.
+     */
+    stack_cmd_bin_t *bin_p;
+    /**
+     * Session served over connection.
+     */
+    stack_cmd_session_t sess;
+} stack_cmd_conn_t;
+
+/**
+ * Server worker, i.e., a thread with its own event loop that owns a share
+ * of the named stacks. The shell outside of server mode is worker 0.
+ */
+typedef struct {
+    /**
+     * Worker number.
+     */
+    unsigned int index;
+    /**
+     * Thread running worker.
+     */
+    pthread_t thread;
+    /**
+     * epoll instance.
+     */
+    int ep_fd;
+    /**
+     * Listening socket.
+     */
+    int listen_fd;
+    /**
+     * eventfd signalled when connections are added to inbox.
+     */
+    int wake_fd;
+    /**
+     * Protects inbox_p.
+     */
+    pthread_mutex_t inbox_lock;
+    /**
+     * Connections moved to worker and not yet picked up.
+     */
+    stack_cmd_conn_t *inbox_p;
+    /**
+     * Named stacks owned by worker.
+     */
+    stack_cmd_reg_t reg;
+    /**
+     * When the worker last flushed the journals of its stacks.
+     */
+    struct timespec synced;
+    /**
+     * Input block buffer.
+     */
+    char in_buf[STACK_CMD_IN_BUF_SIZE];
+} stack_cmd_worker_t;
+
+/**
+ * Workers.
+ */
+static stack_cmd_worker_t *g_stack_cmd_workers = NULL;
+
+/**
+ * Number of workers.
+ */
+static unsigned int g_stack_cmd_num_workers = 0;
+
+/**
+ * Stack that sessions start with.
+ */
+static stack_t *g_stack_cmd_default_p = NULL;
+
+/**
+ * Name of g_stack_cmd_default_p, as stored in the registry.
+ */
+static const char *g_stack_cmd_default_name_p = NULL;
+
+/**
+ * Worker that owns g_stack_cmd_default_p.
+ */
+static unsigned int g_stack_cmd_default_worker = 0;
+
+/**
+ * Directory holding the journals of the named stacks, or NULL if they
+ * aren't journaled.
+ */
+static const char *g_stack_cmd_journal_dir_p = NULL;
+
+/**
+ * Number of waiting journaled operations at which a stack's journal is
+ * flushed, or 0 for no limit.
+ */
+static size_t g_stack_cmd_sync_ops = 0;
+
+/**
+ * Age in milliseconds of the oldest waiting journaled operation at which
+ * a stack's journal is flushed, or 0 for no limit.
+ */
+static unsigned int g_stack_cmd_sync_ms = STACK_CMD_SYNC_MS;
+
+/**
+ * Command trie. Node 0 is the root, i.e., the empty prefix.
+ */
+static stack_cmd_trie_node_t g_stack_cmd_trie[STACK_CMD_TRIE_MAX_NODES];
+
+/**
+ * Number of nodes used in the command trie.
+ */
+static unsigned int g_stack_cmd_trie_num_nodes = 0;
+
+/**
+ * Base64 digits.
+ */
+static const char g_stack_cmd_b64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * Two hex digits of each byte value, in output order.
+ */
+static uint16_t g_stack_cmd_hex_pairs[256];
+
+/**
+ * Value of each hex digit character, or STACK_CMD_CODEC_BAD.
+ */
+static unsigned char g_stack_cmd_hex_values[256];
+
+/**
+ * Value of each base64 digit character, or STACK_CMD_CODEC_BAD.
+ */
+static unsigned char g_stack_cmd_b64_values[256];
+
+/**
+ * Names of the 'bench' operations, indexed by stack_cmd_bench_e.
+ */
+static const char *g_stack_cmd_bench_ops[STACK_CMD_BENCH_NUM_OPS] = {
+    "push", "pop", "peek", "pushpop"
+};
+
+/**
+ * Callback function type for parsed commands.
+ *
+ * @param[in,out]
+ *     Session running the command.
+ * @param[in]
+ *     Arguments for command.
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+typedef bool (*stack_cmd_command_fn)(stack_cmd_session_t *sess_p,
+                                     const char          *args);
+
+/**
+ * Command parser control.
+ */
+typedef struct {
+    /**
+     * Command keyword
+     */
+    const char* name;
+    /**
+     * Command argument format
+     */
+    const char* args;
+    /**
+     * Command description
+     */
+    const char* help;
+    /**
+     * Callback function to run if command is parsed.
+     */
+    stack_cmd_command_fn cb;
+} stack_cmd_command_t;
+
+/*
+ * Forward declaration
+ */
+static bool stack_cmd_help(stack_cmd_session_t *sess_p, const char* args);
+
+/**
+ * Make room for more output.
+ *
+ * @param[in,out] out_p
+ *     Output buffer.
+ * @param[in] len
+ *     Number of bytes to make room for.
+ * @retval true
+ *     There is room for len more bytes at out_p->len.
+ * @retval false
+ *     Out of memory. The buffer is marked as failed.
+ */
+static bool stack_cmd_out_reserve (stack_cmd_out_t *out_p, size_t len)
+{
+    char   *buf_p = NULL;                        /* Grown buffer              */
+    size_t  size  = 0;                           /* Grown buffer size         */
+
+    if (len <= (out_p->size - out_p->len)) {
+        return (true);
+    }
+
+    /*
+     * Reclaim space taken by output that has already been written before
+     * resorting to a bigger buffer.
+     */
+    if (out_p->pos > 0) {
+        memmove(out_p->buf_p, out_p->buf_p + out_p->pos,
+                out_p->len - out_p->pos);
+        out_p->len -= out_p->pos;
+        out_p->pos = 0;
+        if (len <= (out_p->size - out_p->len)) {
+            return (true);
+        }
+    }
+
+    size = (0 == out_p->size) ? STACK_CMD_OUT_MIN_SIZE : out_p->size;
+    while (size < (out_p->len + len)) {
+        size *= 2;
+    }
+    buf_p = realloc(out_p->buf_p, size);
+    if (NULL == buf_p) {
+        out_p->is_failed = true;
+        return (false);
+    }
+    out_p->buf_p = buf_p;
+    out_p->size = size;
+
+    return (true);
+}
+
+/**
+ * Append bytes to output.
+ *
+ * @param[in,out] out_p
+ *     Output buffer.
+ * @param[in] data_p
+ *     Bytes to append.
+ * @param[in] len
+ *     Number of bytes to append.
+ */
+static void stack_cmd_out_append (stack_cmd_out_t *out_p,
+                                  const void      *data_p,
+                                  size_t           len)
+{
+    if ((len > 0) && stack_cmd_out_reserve(out_p, len)) {
+        memcpy(out_p->buf_p + out_p->len, data_p, len);
+        out_p->len += len;
+    }
+}
+
+/**
+ * Append a character repeated several times to output.
+ *
+ * @param[in,out] out_p
+ *     Output buffer.
+ * @param[in] c
+ *     Character to append.
+ * @param[in] count
+ *     Number of times to append it.
+ */
+static void stack_cmd_out_repeat (stack_cmd_out_t *out_p,
+                                  char             c,
+                                  size_t           count)
+{
+    if ((count > 0) && stack_cmd_out_reserve(out_p, count)) {
+        memset(out_p->buf_p + out_p->len, c, count);
+        out_p->len += count;
+    }
+}
+
+/**
+ * Append formatted text to output.
+ *
+ * @param[in,out] out_p
+ *     Output buffer.
+ * @param[in] format_p
+ *     printf() format.
+ */
+static void stack_cmd_out_printf (stack_cmd_out_t *out_p,
+                                  const char      *format_p,
+                                  ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void stack_cmd_out_printf (stack_cmd_out_t *out_p,
+                                  const char      *format_p,
+                                  ...)
+{
+    va_list ap;                                  /* Format arguments          */
+    int     len = 0;                             /* Formatted text length     */
+
+    /*
+     * Format straight into the buffer, and only if that doesn't fit, make
+     * room and format again.
+     */
+    if (! stack_cmd_out_reserve(out_p, 1)) {
+        return;
+    }
+    va_start(ap, format_p);
+    len = vsnprintf(out_p->buf_p + out_p->len, out_p->size - out_p->len,
+                    format_p, ap);
+    va_end(ap);
+    if (len < 0) {
+        out_p->is_failed = true;
+        return;
+    }
+    if ((size_t)len >= (out_p->size - out_p->len)) {
+        if (! stack_cmd_out_reserve(out_p, (size_t)len + 1)) {
+            return;
+        }
+        va_start(ap, format_p);
+        (void)vsnprintf(out_p->buf_p + out_p->len, out_p->size - out_p->len,
+                        format_p, ap);
+        va_end(ap);
+    }
+    out_p->len += len;
+}
+
+/**
+ * Get amount of output waiting to be written.
+ *
+ * @param[in] out_p
+ *     Output buffer.
+ * @returns
+ *     Number of bytes.
+ */
+static inline size_t stack_cmd_out_pending (const stack_cmd_out_t *out_p)
+{
+    return (out_p->len - out_p->pos);
+}
+
+/**
+ * Write output to a stdio stream.
+ *
+ * @param[in,out] out_p
+ *     Output buffer. It is left empty.
+ * @param[in] stream_p
+ *     Stream to write to.
+ */
+static void stack_cmd_out_fwrite (stack_cmd_out_t *out_p, FILE *stream_p)
+{
+    if (stack_cmd_out_pending(out_p) > 0) {
+        (void)fwrite(out_p->buf_p + out_p->pos, 1,
+                     stack_cmd_out_pending(out_p), stream_p);
+    }
+    out_p->pos = 0;
+    out_p->len = 0;
+}
+
+/**
+ * Send as much output as a non-blocking socket will take.
+ *
+ * @param[in,out] out_p
+ *     Output buffer.
+ * @param[in] fd
+ *     Socket to send to.
+ * @retval true
+ *     Output sent, or the socket is full and the rest must wait.
+ * @retval false
+ *     The connection failed.
+ */
+static bool stack_cmd_out_send (stack_cmd_out_t *out_p, int fd)
+{
+    ssize_t len = 0;                             /* Bytes sent                */
+
+    while (stack_cmd_out_pending(out_p) > 0) {
+        len = send(fd, out_p->buf_p + out_p->pos, stack_cmd_out_pending(out_p),
+                   MSG_NOSIGNAL);
+        if (len < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return ((EAGAIN == errno) || (EWOULDBLOCK == errno));
+        }
+        out_p->pos += len;
+    }
+    out_p->pos = 0;
+    out_p->len = 0;
+
+    return (true);
+}
+
+/**
+ * Build the codec lookup tables.
+ */
+static void stack_cmd_codec_init (void)
+{
+    static const char hex_digits[] = "0123456789abcdef"; /* Hex digits       */
+    char              pair[2];                   /* Hex digits of a byte      */
+    unsigned int      i = 0;                     /* Loop index counter        */
+
+    memset(g_stack_cmd_hex_values, STACK_CMD_CODEC_BAD,
+           sizeof(g_stack_cmd_hex_values));
+    memset(g_stack_cmd_b64_values, STACK_CMD_CODEC_BAD,
+           sizeof(g_stack_cmd_b64_values));
+
+    for (i = 0; i < 256; i++) {
+        pair[0] = hex_digits[i >> 4];
+        pair[1] = hex_digits[i & 0x0f];
+        memcpy(&(g_stack_cmd_hex_pairs[i]), pair, sizeof(pair));
+    }
+    for (i = 0; i < 16; i++) {
+        g_stack_cmd_hex_values[(unsigned char)hex_digits[i]] = i;
+        g_stack_cmd_hex_values[toupper((unsigned char)hex_digits[i])] = i;
+    }
+    for (i = 0; i < 64; i++) {
+        g_stack_cmd_b64_values[(unsigned char)g_stack_cmd_b64_digits[i]] = i;
+    }
+}
+
+/**
+ * Encode bytes as hex digits.
+ *
+ * @param[out] dst_p
+ *     Encoded text, 2 * len characters, not '\0'-terminated.
+ * @param[in] src_p
+ *     Bytes to encode.
+ * @param[in] len
+ *     Number of bytes.
+ */
+static void stack_cmd_hex_encode (char                *dst_p,
+                                  const unsigned char *src_p,
+                                  size_t               len)
+{
+    size_t i = 0;                                /* Loop index counter        */
+
+    for (i = 0; i < len; i++) {
+        memcpy(dst_p + (2 * i), &(g_stack_cmd_hex_pairs[src_p[i]]), 2);
+    }
+}
+
+/**
+ * Decode hex digits, in either case.
+ *
+ * @param[out] dst_p
+ *     Decoded bytes, len / 2 of them.
+ * @param[in] src_p
+ *     Text to decode.
+ * @param[in] len
+ *     Number of characters. Must be even.
+ * @retval true
+ *     Text decoded.
+ * @retval false
+ *     Text has a character that is not a hex digit. dst_p holds garbage.
+ */
+static bool stack_cmd_hex_decode (unsigned char *dst_p,
+                                  const char    *src_p,
+                                  size_t         len)
+{
+    unsigned char hi  = 0;                       /* Value of high digit       */
+    unsigned char lo  = 0;                       /* Value of low digit        */
+    unsigned char bad = 0;                       /* OR of all digit values    */
+    size_t        i   = 0;                       /* Loop index counter        */
+
+    /*
+     * Invalid characters are only checked for at the end: their value has
+     * bits that no digit has, which survive the OR.
+     */
+    for (i = 0; i < (len / 2); i++) {
+        hi = g_stack_cmd_hex_values[(unsigned char)src_p[2 * i]];
+        lo = g_stack_cmd_hex_values[(unsigned char)src_p[(2 * i) + 1]];
+        bad |= hi | lo;
+        dst_p[i] = (unsigned char)((hi << 4) | lo);
+    }
+
+    return (0 == (bad & 0xf0));
+}
+
+/**
+ * Get the length of the base64 encoding of some bytes, with padding.
+ *
+ * @param[in] len
+ *     Number of bytes.
+ * @returns
+ *     Number of characters.
+ */
+static inline size_t stack_cmd_b64_encoded_len (size_t len)
+{
+    return (4 * ((len + 2) / 3));
+}
+
+/**
+ * Encode bytes as base64, with padding.
+ *
+ * @param[out] dst_p
+ *     Encoded text, stack_cmd_b64_encoded_len(len) characters, not
+ *     '\0'-terminated.
+ * @param[in] src_p
+ *     Bytes to encode.
+ * @param[in] len
+ *     Number of bytes.
+ */
+static void stack_cmd_b64_encode (char                *dst_p,
+                                  const unsigned char *src_p,
+                                  size_t               len)
+{
+    const char *digits_p = g_stack_cmd_b64_digits; /* Base64 digits           */
+    uint32_t    group    = 0;                    /* 3 bytes being encoded     */
+
+    for (; len >= 3; len -= 3) {
+        group = ((uint32_t)src_p[0] << 16) | ((uint32_t)src_p[1] << 8) |
+                src_p[2];
+        dst_p[0] = digits_p[group >> 18];
+        dst_p[1] = digits_p[(group >> 12) & 0x3f];
+        dst_p[2] = digits_p[(group >> 6) & 0x3f];
+        dst_p[3] = digits_p[group & 0x3f];
+        src_p += 3;
+        dst_p += 4;
+    }
+
+    if (len > 0) {
+        group = (uint32_t)src_p[0] << 16;
+        if (len > 1) {
+            group |= (uint32_t)src_p[1] << 8;
+        }
+        dst_p[0] = digits_p[group >> 18];
+        dst_p[1] = digits_p[(group >> 12) & 0x3f];
+        dst_p[2] = (len > 1) ? digits_p[(group >> 6) & 0x3f] : '=';
+        dst_p[3] = '=';
+    }
+}
+
+/**
+ * Get the number of bytes that base64 text decodes to. Padding is
+ * optional.
+ *
+ * @param[in] src_p
+ *     Text to decode.
+ * @param[in,out] len_p
+ *     Number of characters. Updated to leave out the padding.
+ * @param[out] size_p
+ *     Updated with the number of decoded bytes.
+ * @retval true
+ *     Text has a valid length.
+ * @retval false
+ *     Text can't be base64.
+ */
+static bool stack_cmd_b64_decoded_size (const char *src_p,
+                                        size_t     *len_p,
+                                        size_t     *size_p)
+{
+    size_t len = *len_p;                         /* Length without padding    */
+
+    if ((len > 0) && (0 == (len % 4)) && ('=' == src_p[len - 1])) {
+        len--;
+        if ('=' == src_p[len - 1]) {
+            len--;
+        }
+    }
+    if (1 == (len % 4)) {
+        return (false);
+    }
+
+    *len_p = len;
+    *size_p = ((len / 4) * 3) + (((len % 4) > 0) ? ((len % 4) - 1) : 0);
+    return (true);
+}
+
+/**
+ * Decode base64 text without padding.
+ *
+ * @param[out] dst_p
+ *     Decoded bytes, as many as stack_cmd_b64_decoded_size() gives.
+ * @param[in] src_p
+ *     Text to decode.
+ * @param[in] len
+ *     Number of characters, as updated by stack_cmd_b64_decoded_size().
+ * @retval true
+ *     Text decoded.
+ * @retval false
+ *     Text has a character that is not a base64 digit. dst_p holds
+ *     garbage.
+ */
+static bool stack_cmd_b64_decode (unsigned char *dst_p,
+                                  const char    *src_p,
+                                  size_t         len)
+{
+    const unsigned char *values_p = g_stack_cmd_b64_values; /* Digit values  */
+    uint32_t             group    = 0;           /* 4 digits being decoded    */
+    unsigned char        bad      = 0;           /* OR of all digit values    */
+    unsigned char        value    = 0;           /* Current digit value       */
+    size_t               i        = 0;           /* Loop index counter        */
+
+    /*
+     * As for hex, invalid characters have bits that no digit has.
+     */
+    for (; len >= 4; len -= 4) {
+        bad |= values_p[(unsigned char)src_p[0]] |
+               values_p[(unsigned char)src_p[1]] |
+               values_p[(unsigned char)src_p[2]] |
+               values_p[(unsigned char)src_p[3]];
+        group = ((uint32_t)values_p[(unsigned char)src_p[0]] << 18) |
+                ((uint32_t)values_p[(unsigned char)src_p[1]] << 12) |
+                ((uint32_t)values_p[(unsigned char)src_p[2]] << 6) |
+                values_p[(unsigned char)src_p[3]];
+        dst_p[0] = (unsigned char)(group >> 16);
+        dst_p[1] = (unsigned char)(group >> 8);
+        dst_p[2] = (unsigned char)group;
+        src_p += 4;
+        dst_p += 3;
+    }
+
+    if (len > 0) {
+        group = 0;
+        for (i = 0; i < len; i++) {
+            value = values_p[(unsigned char)src_p[i]];
+            bad |= value;
+            group |= (uint32_t)(value & 0x3f) << (18 - (6 * i));
+        }
+        dst_p[0] = (unsigned char)(group >> 16);
+        if (len > 2) {
+            dst_p[1] = (unsigned char)(group >> 8);
+        }
+    }
+
+    return (0 == (bad & 0xc0));
+}
+
+/**
+ * Append a value to output in an encoding.
+ *
+ * @param[in,out] out_p
+ *     Output buffer.
+ * @param[in] enc
+ *     Encoding to use.
+ * @param[in] data_p
+ *     Value.
+ * @param[in] size
+ *     Size of value in bytes.
+ */
+static void stack_cmd_out_value (stack_cmd_out_t *out_p,
+                                 stack_cmd_enc_e  enc,
+                                 const void      *data_p,
+                                 size_t           size)
+{
+    size_t len = 0;                              /* Length of encoded value   */
+
+    switch (enc) {
+    case STACK_CMD_ENC_HEX:
+        len = 2 * size;
+        if ((len > 0) && stack_cmd_out_reserve(out_p, len)) {
+            stack_cmd_hex_encode(out_p->buf_p + out_p->len, data_p, size);
+            out_p->len += len;
+        }
+        break;
+    case STACK_CMD_ENC_BASE64:
+        len = stack_cmd_b64_encoded_len(size);
+        if ((len > 0) && stack_cmd_out_reserve(out_p, len)) {
+            stack_cmd_b64_encode(out_p->buf_p + out_p->len, data_p, size);
+            out_p->len += len;
+        }
+        break;
+    default:
+        stack_cmd_out_append(out_p, data_p, size);
+        break;
+    }
+}
+
+/**
+ * Get the number of bytes that a value in an encoding decodes to.
+ *
+ * @param[in] enc
+ *     Encoding of value.
+ * @param[in] value_p
+ *     Encoded value.
+ * @param[in,out] len_p
+ *     Length of encoded value. Updated to leave out base64 padding.
+ * @param[out] size_p
+ *     Updated with the number of decoded bytes.
+ * @retval true
+ *     Value has a valid length.
+ * @retval false
+ *     Value can't be in the encoding.
+ */
+static bool stack_cmd_decoded_size (stack_cmd_enc_e  enc,
+                                    const char      *value_p,
+                                    size_t          *len_p,
+                                    size_t          *size_p)
+{
+    switch (enc) {
+    case STACK_CMD_ENC_HEX:
+        *size_p = *len_p / 2;
+        return (0 == (*len_p % 2));
+    case STACK_CMD_ENC_BASE64:
+        return (stack_cmd_b64_decoded_size(value_p, len_p, size_p));
+    default:
+        *size_p = *len_p;
+        return (true);
+    }
+}
+
+/**
+ * Decode a value in an encoding.
+ *
+ * @param[in] enc
+ *     Encoding of value.
+ * @param[out] dst_p
+ *     Decoded bytes, as many as stack_cmd_decoded_size() gives.
+ * @param[in] value_p
+ *     Encoded value.
+ * @param[in] len
+ *     Length of encoded value, as updated by stack_cmd_decoded_size().
+ * @retval true
+ *     Value decoded.
+ * @retval false
+ *     Value has a character that is not valid in the encoding. dst_p
+ *     holds garbage.
+ */
+static bool stack_cmd_decode (stack_cmd_enc_e  enc,
+                              void            *dst_p,
+                              const char      *value_p,
+                              size_t           len)
+{
+    switch (enc) {
+    case STACK_CMD_ENC_HEX:
+        return (stack_cmd_hex_decode(dst_p, value_p, len));
+    case STACK_CMD_ENC_BASE64:
+        return (stack_cmd_b64_decode(dst_p, value_p, len));
+    default:
+        if (len > 0) {
+            memcpy(dst_p, value_p, len);
+        }
+        return (true);
+    }
+}
+
+/**
+ * Push a value given in an encoding, decoding it straight into the stack.
+ *
+ * @param[in] stack_p
+ *     Stack to push onto.
+ * @param[in] enc
+ *     Encoding of value.
+ * @param[in] value_p
+ *     Encoded value.
+ * @param[in] len
+ *     Length of encoded value.
+ * @retval STACK_E_OK
+ *     Value pushed.
+ * @retval STACK_E_INVALID
+ *     Value is not validly encoded. Nothing was pushed.
+ * @returns
+ *     Otherwise, error from stack_push_reserve().
+ */
+static stack_err_e stack_cmd_push_value (stack_t         *stack_p,
+                                         stack_cmd_enc_e  enc,
+                                         const char      *value_p,
+                                         size_t           len)
+{
+    void        *entry_p = NULL;                 /* Reserved entry            */
+    size_t       size    = 0;                    /* Decoded size              */
+    stack_err_e  err     = STACK_E_OK;           /* Operation return code     */
+
+    if (! stack_cmd_decoded_size(enc, value_p, &len, &size)) {
+        return (STACK_E_INVALID);
+    }
+    err = stack_push_reserve(stack_p, size, &entry_p);
+    if (stack_err_e_is_error(err)) {
+        return (err);
+    }
+
+    /*
+     * Bad characters are only found while decoding, so take back the
+     * entry they went into.
+     */
+    if (! stack_cmd_decode(enc, entry_p, value_p, len)) {
+        (void)stack_drop(stack_p, 1);
+        return (STACK_E_INVALID);
+    }
+
+    return (STACK_E_OK);
+}
+
+/**
+ * Hash a stack name with 32-bit FNV-1a.
+ *
+ * @param[in] name_p
+ *     Name to hash.
+ * @returns
+ *     Hash value.
+ */
+static uint32_t stack_cmd_reg_hash (const char *name_p)
+{
+    uint32_t hash = 2166136261u;                 /* FNV offset basis          */
+
+    while ('\0' != *name_p) {
+        hash ^= (unsigned char)*name_p;
+        hash *= 16777619u;                       /* FNV prime                 */
+        name_p++;
+    }
+
+    return (hash);
+}
+
+/**
+ * Check whether a byte of a stack name is written as is in the names of
+ * its journal files, rather than as '%' and two hex digits.
+ *
+ * @param[in] name_p
+ *     Stack name.
+ * @param[in] i
+ *     Index of byte in name.
+ * @retval true
+ *     Byte is written as is.
+ * @retval false
+ *     Byte is escaped.
+ */
+static bool stack_cmd_journal_is_plain (const char *name_p, size_t i)
+{
+    return (isalnum((unsigned char)name_p[i]) || ('_' == name_p[i]) ||
+            ('-' == name_p[i]) || (('.' == name_p[i]) && (i > 0)));
+}
+
+/**
+ * Check whether a stack can be journaled: the name of each of its journal
+ * files, the escaped stack name with the longest suffix stack_journal_open()
+ * adds, ".snap.tmp", must fit in NAME_MAX bytes.
+ *
+ * @param[in] name_p
+ *     Stack name.
+ * @retval true
+ *     Stack can be journaled, or journaling is off.
+ * @retval false
+ *     Name is too long.
+ */
+static bool stack_cmd_journal_name_fits (const char *name_p)
+{
+    size_t len = strlen(".snap.tmp");            /* Length of file name       */
+    size_t i   = 0;                              /* Loop index counter        */
+
+    if (NULL == g_stack_cmd_journal_dir_p) {
+        return (true);
+    }
+    for (i = 0; '\0' != name_p[i]; i++) {
+        len += stack_cmd_journal_is_plain(name_p, i) ? 1 : 3;
+    }
+    return (len <= NAME_MAX);
+}
+
+/**
+ * Give a new named stack a journal in the journal directory, recovering
+ * whatever the journal already holds.
+ *
+ * The journal is named after the stack, with each byte other than a
+ * letter, a digit, '_', '-' or a '.' after the first written as '%' and
+ * two hex digits. Names that don't pass stack_cmd_journal_name_fits() are
+ * refused.
+ *
+ * @param[in] stack_p
+ *     Empty stack.
+ * @param[in] name_p
+ *     Stack name.
+ * @retval STACK_E_OK
+ *     Journal opened.
+ * @retval STACK_E_INVALID
+ *     Name is too long.
+ * @returns
+ *     Otherwise, error from stack_journal_open().
+ */
+static stack_err_e stack_cmd_journal_open (stack_t *stack_p, const char *name_p)
+{
+    stack_err_e  err     = STACK_E_OK;           /* Operation return code     */
+    size_t       dir_len = 0;                    /* Length of directory path  */
+    char        *path_p  = NULL;                 /* Journal path              */
+    char        *out_p   = NULL;                 /* End of path so far        */
+    size_t       i       = 0;                    /* Loop index counter        */
+
+    if (! stack_cmd_journal_name_fits(name_p)) {
+        return (STACK_E_INVALID);
+    }
+    dir_len = strlen(g_stack_cmd_journal_dir_p);
+    path_p = malloc(dir_len + 1 + (3 * strlen(name_p)) + 1);
+    if (NULL == path_p) {
+        return (STACK_E_NOMEM);
+    }
+    memcpy(path_p, g_stack_cmd_journal_dir_p, dir_len);
+    out_p = path_p + dir_len;
+    *(out_p++) = '/';
+    for (i = 0; '\0' != name_p[i]; i++) {
+        if (stack_cmd_journal_is_plain(name_p, i)) {
+            *(out_p++) = name_p[i];
+        } else {
+            out_p += sprintf(out_p, "%%%02X", (unsigned char)name_p[i]);
+        }
+    }
+    *out_p = '\0';
+
+    err = stack_journal_open(stack_p, path_p, g_stack_cmd_sync_ops,
+                             g_stack_cmd_sync_ms);
+    free(path_p);
+    return (err);
+}
+
+/**
+ * Get the name of the stack that a file in the journal directory belongs
+ * to, undoing the escapes of stack_cmd_journal_open().
+ *
+ * @param[in] file_p
+ *     File name.
+ * @param[out] name_p
+ *     Updated with the stack name. Must have room for
+ *     STACK_CMD_NAME_MAX + 1 characters.
+ * @retval true
+ *     File is the journal or snapshot of a stack.
+ * @retval false
+ *     File is something else.
+ */
+static bool stack_cmd_journal_name (const char *file_p, char *name_p)
+{
+    size_t        len      = 0;                  /* Length of escaped name    */
+    size_t        name_len = 0;                  /* Length of stack name      */
+    unsigned char high     = 0;                  /* First hex digit value     */
+    unsigned char low      = 0;                  /* Second hex digit value    */
+    size_t        i        = 0;                  /* Index in file name        */
+
+    len = strlen(file_p);
+    if ((len > strlen(".journal")) &&
+        (0 == strcmp(file_p + len - strlen(".journal"), ".journal"))) {
+        len -= strlen(".journal");
+    } else if ((len > strlen(".snap")) &&
+               (0 == strcmp(file_p + len - strlen(".snap"), ".snap"))) {
+        len -= strlen(".snap");
+    } else {
+        return (false);
+    }
+
+    for (i = 0; i < len; name_len++) {
+        if (name_len >= STACK_CMD_NAME_MAX) {
+            return (false);
+        }
+        if ('%' != file_p[i]) {
+            name_p[name_len] = file_p[i];
+            i++;
+            continue;
+        }
+        if ((i + 3) > len) {
+            return (false);
+        }
+        high = g_stack_cmd_hex_values[(unsigned char)file_p[i + 1]];
+        low = g_stack_cmd_hex_values[(unsigned char)file_p[i + 2]];
+        if ((STACK_CMD_CODEC_BAD == high) || (STACK_CMD_CODEC_BAD == low) ||
+            ((0 == high) && (0 == low))) {
+            return (false);
+        }
+        name_p[name_len] = (char)((high << 4) | low);
+        i += 3;
+    }
+    name_p[name_len] = '\0';
+
+    return (name_len > 0);
+}
+
+/**
+ * Find the registry slot for a name.
+ *
+ * @param[in] reg_p
+ *     Registry to search.
+ * @param[in] name_p
+ *     Name to look for.
+ * @param[in] hash
+ *     Hash of name.
+ * @returns
+ *     Slot holding the name, or the free slot where it would be added.
+ */
+static stack_cmd_reg_slot_t *stack_cmd_reg_find (stack_cmd_reg_t *reg_p,
+                                                 const char      *name_p,
+                                                 uint32_t         hash)
+{
+    stack_cmd_reg_slot_t *slot_p = NULL;         /* Current slot              */
+    size_t                mask   = 0;            /* Slot index mask           */
+    size_t                i      = 0;            /* Slot index                */
+
+    mask = reg_p->num_slots - 1;
+    for (i = hash & mask; ; i = (i + 1) & mask) {
+        slot_p = &(reg_p->slots_p[i]);
+        if ((NULL == slot_p->name_p) ||
+            ((hash == slot_p->hash) && (0 == strcmp(name_p, slot_p->name_p)))) {
+            return (slot_p);
+        }
+    }
+}
+
+/**
+ * Double the number of registry slots.
+ *
+ * @param[in,out] reg_p
+ *     Registry to grow.
+ * @retval true
+ *     Registry grown.
+ * @retval false
+ *     Out of memory. The registry is unchanged.
+ */
+static bool stack_cmd_reg_grow (stack_cmd_reg_t *reg_p)
+{
+    stack_cmd_reg_t       new_reg = { NULL, 0, 0 }; /* Grown registry         */
+    stack_cmd_reg_slot_t *slot_p  = NULL;        /* Current old slot          */
+    size_t                i       = 0;           /* Loop index counter        */
+
+    new_reg.num_slots = reg_p->num_slots * 2;
+    new_reg.num_used = reg_p->num_used;
+    new_reg.slots_p = calloc(new_reg.num_slots, sizeof(*new_reg.slots_p));
+    if (NULL == new_reg.slots_p) {
+        return (false);
+    }
+
+    for (i = 0; i < reg_p->num_slots; i++) {
+        slot_p = &(reg_p->slots_p[i]);
+        if (NULL != slot_p->name_p) {
+            *stack_cmd_reg_find(&new_reg, slot_p->name_p, slot_p->hash) =
+                *slot_p;
+        }
+    }
+
+    free(reg_p->slots_p);
+    *reg_p = new_reg;
+    return (true);
+}
+
+/**
+ * Get the worker that owns a named stack.
+ *
+ * @param[in] hash
+ *     Hash of stack name.
+ * @returns
+ *     Worker number.
+ */
+static inline unsigned int stack_cmd_reg_owner (uint32_t hash)
+{
+    return (hash % g_stack_cmd_num_workers);
+}
+
+/**
+ * Look up a named stack, optionally creating it.
+ *
+ * @param[in,out] reg_p
+ *     Registry to search. Must belong to the worker that owns the stack.
+ * @param[in] name_p
+ *     Stack name.
+ * @param[in] hash
+ *     Hash of name.
+ * @param[in] is_create
+ *     Create the stack if it doesn't exist?
+ * @returns
+ *     Registry slot of the stack, or NULL if the stack doesn't exist and
+ *     either is_create is false or we ran out of memory. The slot is only
+ *     valid until the next stack is created, but the name and stack it
+ *     holds stay valid until the registry is freed.
+ */
+static stack_cmd_reg_slot_t *stack_cmd_reg_get (stack_cmd_reg_t *reg_p,
+                                                const char      *name_p,
+                                                uint32_t         hash,
+                                                bool             is_create)
+{
+    stack_cmd_reg_slot_t *slot_p = NULL;         /* Slot for name             */
+
+    slot_p = stack_cmd_reg_find(reg_p, name_p, hash);
+    if ((NULL != slot_p->name_p) || (! is_create)) {
+        return ((NULL != slot_p->name_p) ? slot_p : NULL);
+    }
+
+    /*
+     * Add new stack, growing the table first if the addition would make
+     * it more than 3/4 full.
+     */
+    if (4 * (reg_p->num_used + 1) > 3 * reg_p->num_slots) {
+        if (! stack_cmd_reg_grow(reg_p)) {
+            return (NULL);
+        }
+        slot_p = stack_cmd_reg_find(reg_p, name_p, hash);
+    }
+    slot_p->stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                        STACK_MAX_ENTRY_SIZE_NONE,
+                                        STACK_DEFAULT_ENTRY_SIZE,
+                                        STACK_MAX_SIZE_NONE,
+                                        STACK_FLAG_GROW | STACK_FLAG_STATS);
+    if (NULL == slot_p->stack_p) {
+        return (NULL);
+    }
+    if ((NULL != g_stack_cmd_journal_dir_p) &&
+        stack_err_e_is_error(stack_cmd_journal_open(slot_p->stack_p,
+                                                    name_p))) {
+        stack_free(slot_p->stack_p);
+        slot_p->stack_p = NULL;
+        return (NULL);
+    }
+    slot_p->name_p = strdup(name_p);
+    if (NULL == slot_p->name_p) {
+        stack_free(slot_p->stack_p);
+        slot_p->stack_p = NULL;
+        return (NULL);
+    }
+    slot_p->hash = hash;
+    reg_p->num_used++;
+
+    return (slot_p);
+}
+
+/**
+ * Create an empty stack registry.
+ *
+ * @param[out] reg_p
+ *     Registry to create.
+ * @retval true
+ *     Registry created.
+ * @retval false
+ *     Out of memory.
+ */
+static bool stack_cmd_reg_init (stack_cmd_reg_t *reg_p)
+{
+    reg_p->num_slots = STACK_CMD_REG_MIN_SLOTS;
+    reg_p->num_used = 0;
+    reg_p->slots_p = calloc(reg_p->num_slots, sizeof(*reg_p->slots_p));
+    return (NULL != reg_p->slots_p);
+}
+
+/**
+ * Free a stack registry and all of its stacks.
+ *
+ * @param[in,out] reg_p
+ *     Registry to free.
+ */
+static void stack_cmd_reg_fini (stack_cmd_reg_t *reg_p)
+{
+    stack_cmd_reg_slot_t *slot_p = NULL;         /* Current slot              */
+    size_t                i      = 0;            /* Loop index counter        */
+
+    for (i = 0; i < reg_p->num_slots; i++) {
+        slot_p = &(reg_p->slots_p[i]);
+        if (NULL != slot_p->name_p) {
+            stack_free(slot_p->stack_p);
+            free(slot_p->name_p);
+        }
+    }
+    free(reg_p->slots_p);
+    memset(reg_p, 0, sizeof(*reg_p));
+}
+
+/**
+ * Create the workers, each with an empty share of the named stacks, and
+ * the default stack. The workers' threads and event loops are not started.
+ *
+ * @param[in] num_workers
+ *     Number of workers.
+ * @retval true
+ *     Workers created.
+ * @retval false
+ *     Out of memory.
+ */
+static bool stack_cmd_workers_init (unsigned int num_workers)
+{
+    stack_cmd_worker_t   *worker_p = NULL;       /* Current worker            */
+    stack_cmd_reg_slot_t *slot_p   = NULL;       /* Default stack slot        */
+    uint32_t              hash     = 0;          /* Default stack name hash   */
+    unsigned int          i        = 0;          /* Loop index counter        */
+
+    g_stack_cmd_workers = calloc(num_workers, sizeof(*g_stack_cmd_workers));
+    if (NULL == g_stack_cmd_workers) {
+        return (false);
+    }
+    g_stack_cmd_num_workers = num_workers;
+    for (i = 0; i < num_workers; i++) {
+        worker_p = &(g_stack_cmd_workers[i]);
+        worker_p->index = i;
+        worker_p->ep_fd = -1;
+        worker_p->listen_fd = -1;
+        worker_p->wake_fd = -1;
+        (void)pthread_mutex_init(&(worker_p->inbox_lock), NULL);
+        if (! stack_cmd_reg_init(&(worker_p->reg))) {
+            return (false);
+        }
+    }
+
+    hash = stack_cmd_reg_hash(STACK_CMD_DEFAULT_NAME);
+    g_stack_cmd_default_worker = stack_cmd_reg_owner(hash);
+    slot_p = stack_cmd_reg_get(
+                 &(g_stack_cmd_workers[g_stack_cmd_default_worker].reg),
+                 STACK_CMD_DEFAULT_NAME, hash, true);
+    if (NULL == slot_p) {
+        return (false);
+    }
+    g_stack_cmd_default_p = slot_p->stack_p;
+    g_stack_cmd_default_name_p = slot_p->name_p;
+
+    return (true);
+}
+
+/**
+ * Create the named stacks that have journals in the journal directory,
+ * recovering their entries.
+ *
+ * @retval true
+ *     Stacks recovered.
+ * @retval false
+ *     An error occurred and was reported.
+ */
+static bool stack_cmd_journal_recover (void)
+{
+    DIR           *dir_p = NULL;                 /* Journal directory         */
+    struct dirent *ent_p = NULL;                 /* Current directory entry   */
+    char           name[STACK_CMD_NAME_MAX + 1]; /* Stack name                */
+    uint32_t       hash  = 0;                    /* Hash of name              */
+    bool           is_ok = true;                 /* All stacks recovered?     */
+
+    dir_p = opendir(g_stack_cmd_journal_dir_p);
+    if (NULL == dir_p) {
+        fprintf(stderr, "Can't read journal directory '%s': %s\n",
+                g_stack_cmd_journal_dir_p, strerror(errno));
+        return (false);
+    }
+
+    /*
+     * A stack's journal and snapshot both lead here; the second one finds
+     * the stack already recovered.
+     */
+    while (is_ok && (NULL != (ent_p = readdir(dir_p)))) {
+        if (! stack_cmd_journal_name(ent_p->d_name, name)) {
+            continue;
+        }
+        hash = stack_cmd_reg_hash(name);
+        if (NULL == stack_cmd_reg_get(
+                        &(g_stack_cmd_workers[stack_cmd_reg_owner(hash)].reg),
+                        name, hash, true)) {
+            fprintf(stderr, "Can't recover stack '%s'\n", name);
+            is_ok = false;
+        }
+    }
+    (void)closedir(dir_p);
+
+    return (is_ok);
+}
+
+/**
+ * Flush the journals of a worker's stacks, so that operations on stacks
+ * that are no longer busy don't wait for the next operation to be flushed.
+ *
+ * @param[in,out] worker_p
+ *     Worker whose stacks to flush. Must be running on this thread.
+ * @param[in] is_forced
+ *     Flush even if the last flush was less than g_stack_cmd_sync_ms ago?
+ */
+static void stack_cmd_worker_sync (stack_cmd_worker_t *worker_p,
+                                   bool is_forced)
+{
+    struct timespec       now;                   /* Current time              */
+    uint64_t              elapsed_ms = 0;        /* Time since last flush     */
+    stack_cmd_reg_slot_t *slot_p     = NULL;     /* Current slot              */
+    stack_err_e           err        = STACK_E_OK; /* Operation return code   */
+    size_t                i          = 0;        /* Loop index counter        */
+
+    if (NULL == g_stack_cmd_journal_dir_p) {
+        return;
+    }
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ms = ((uint64_t)(now.tv_sec - worker_p->synced.tv_sec) * 1000) +
+                 ((now.tv_nsec - worker_p->synced.tv_nsec) / 1000000);
+    if ((! is_forced) && (elapsed_ms < g_stack_cmd_sync_ms)) {
+        return;
+    }
+    worker_p->synced = now;
+
+    for (i = 0; i < worker_p->reg.num_slots; i++) {
+        slot_p = &(worker_p->reg.slots_p[i]);
+        if (NULL == slot_p->name_p) {
+            continue;
+        }
+        err = stack_journal_sync(slot_p->stack_p);
+        if (stack_err_e_is_error(err) && (! slot_p->is_journal_failed)) {
+            fprintf(stderr, "Can't flush journal of stack '%s': %d(%s)\n",
+                    slot_p->name_p, err, stack_err_e_to_string(err));
+        }
+        slot_p->is_journal_failed = stack_err_e_is_error(err);
+    }
+}
+
+/**
+ * Free the workers and all of the named stacks. Their threads must have
+ * ended.
+ */
+static void stack_cmd_workers_fini (void)
+{
+    stack_cmd_worker_t *worker_p = NULL;         /* Current worker            */
+    unsigned int        i        = 0;            /* Loop index counter        */
+
+    for (i = 0; (NULL != g_stack_cmd_workers) &&
+                (i < g_stack_cmd_num_workers); i++) {
+        worker_p = &(g_stack_cmd_workers[i]);
+        stack_cmd_reg_fini(&(worker_p->reg));
+        (void)pthread_mutex_destroy(&(worker_p->inbox_lock));
+    }
+    free(g_stack_cmd_workers);
+    g_stack_cmd_workers = NULL;
+    g_stack_cmd_num_workers = 0;
+}
+
+/**
+ * Start a session on the default stack.
+ *
+ * @param[out] sess_p
+ *     Session to start.
+ * @param[in] worker
+ *     Worker to run session.
+ * @param[in] prompt_p
+ *     Prompt to output after each command, or NULL for none.
+ */
+static void stack_cmd_session_init (stack_cmd_session_t *sess_p,
+                                    unsigned int         worker,
+                                    const char          *prompt_p)
+{
+    memset(sess_p, 0, sizeof(*sess_p));
+    sess_p->stack_p = g_stack_cmd_default_p;
+    sess_p->name_p = g_stack_cmd_default_name_p;
+    sess_p->stack_worker = g_stack_cmd_default_worker;
+    sess_p->worker = worker;
+    sess_p->move_to = -1;
+    sess_p->prompt_p = prompt_p;
+}
+
+/**
+ * Check that a session runs on the worker that owns the stacks it is about
+ * to use, and if not, ask for it to move there.
+ *
+ * @param[in,out] sess_p
+ *     Session to check.
+ * @param[in] worker
+ *     Worker that owns the stacks.
+ * @retval true
+ *     Session must move; the line will be run again by the worker.
+ * @retval false
+ *     Session is on the right worker.
+ */
+static bool stack_cmd_session_move (stack_cmd_session_t *sess_p,
+                                    unsigned int         worker)
+{
+    if (worker == sess_p->worker) {
+        return (false);
+    }
+    sess_p->move_to = worker;
+    return (true);
+}
+
+/**
+ * Get the registry of the worker running a session.
+ *
+ * @param[in] sess_p
+ *     Session.
+ * @returns
+ *     Registry.
+ */
+static inline stack_cmd_reg_t *stack_cmd_session_reg (
+                                                const stack_cmd_session_t *sess_p)
+{
+    return (&(g_stack_cmd_workers[sess_p->worker].reg));
+}
+
+/**
+ * End a session.
+ *
+ * @param[in,out] sess_p
+ *     Session to end.
+ */
+static void stack_cmd_session_fini (stack_cmd_session_t *sess_p)
+{
+    free(sess_p->out.buf_p);
+    free(sess_p->line_p);
+    memset(sess_p, 0, sizeof(*sess_p));
+}
+
+/**
+ * Get the stack a command works on. If the arguments start with
+ * "@<name>", the named stack is used and the arguments are advanced past
+ * the name, otherwise the session's current stack is used.
+ *
+ * @param[in,out] sess_p
+ *     Session running the command.
+ * @param[in,out] args_pp
+ *     Command arguments.
+ * @param[in] is_create
+ *     Create the named stack if it doesn't exist?
+ * @returns
+ *     Stack to use, or NULL if the named stack can't be found or created,
+ *     in which case an error is output, or if the session must first move
+ *     to the stack's worker.
+ */
+static stack_t *stack_cmd_target (stack_cmd_session_t  *sess_p,
+                                  const char          **args_pp,
+                                  bool                  is_create)
+{
+    const char           *args_p    = *args_pp;  /* Current argument char     */
+    const char           *start_p   = NULL;      /* Start of stack name       */
+    char                  name[STACK_CMD_NAME_MAX + 1]; /* Stack name         */
+    size_t                name_len  = 0;         /* Stack name length         */
+    stack_cmd_reg_slot_t *slot_p    = NULL;      /* Slot for named stack      */
+    uint32_t              hash      = 0;         /* Hash of name              */
+
+    if ('@' != *args_p) {
+        if (stack_cmd_session_move(sess_p, sess_p->stack_worker)) {
+            return (NULL);
+        }
+        return (sess_p->stack_p);
+    }
+
+    args_p++;
+    start_p = args_p;
+    while (('\0' != *args_p) && (' ' != *args_p) && ('\t' != *args_p)) {
+        args_p++;
+    }
+    name_len = args_p - start_p;
+    while ((' ' == *args_p) || ('\t' == *args_p)) {
+        args_p++;
+    }
+    *args_pp = args_p;
+
+    if (0 == name_len) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Missing stack name after '@'\n");
+        return (NULL);
+    }
+    if (name_len > STACK_CMD_NAME_MAX) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Stack name longer than %d characters\n",
+                             STACK_CMD_NAME_MAX);
+        return (NULL);
+    }
+    memcpy(name, start_p, name_len);
+    name[name_len] = '\0';
+    if (! stack_cmd_journal_name_fits(name)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Stack name too long to journal\n");
+        return (NULL);
+    }
+    hash = stack_cmd_reg_hash(name);
+    if (stack_cmd_session_move(sess_p, stack_cmd_reg_owner(hash))) {
+        return (NULL);
+    }
+    slot_p = stack_cmd_reg_get(stack_cmd_session_reg(sess_p), name, hash,
+                               is_create);
+    if (NULL == slot_p) {
+        stack_cmd_out_printf(&(sess_p->out), "Error: %s stack '%s'\n",
+                             is_create ? "Can't create" : "No such", name);
+        return (NULL);
+    }
+
+    return (slot_p->stack_p);
+}
+
+/**
+ * Get the encoding option at the start of a command's arguments: "-x" for
+ * hex or "-b" for base64. Without one, values are text.
+ *
+ * @param[in,out] args_pp
+ *     Command arguments. Advanced past the option, if any.
+ * @returns
+ *     Encoding.
+ */
+static stack_cmd_enc_e stack_cmd_encoding (const char **args_pp)
+{
+    const char      *args_p = *args_pp;          /* Command arguments         */
+    stack_cmd_enc_e  enc    = STACK_CMD_ENC_TEXT; /* Encoding of values       */
+
+    if (('-' != args_p[0]) || ('\0' == args_p[1]) ||
+        (('\0' != args_p[2]) && (' ' != args_p[2]) && ('\t' != args_p[2]))) {
+        return (STACK_CMD_ENC_TEXT);
+    }
+    if ('x' == args_p[1]) {
+        enc = STACK_CMD_ENC_HEX;
+    } else if ('b' == args_p[1]) {
+        enc = STACK_CMD_ENC_BASE64;
+    } else {
+        return (STACK_CMD_ENC_TEXT);
+    }
+
+    args_p += 2;
+    while ((' ' == *args_p) || ('\t' == *args_p)) {
+        args_p++;
+    }
+    *args_pp = args_p;
+    return (enc);
+}
+
+/**
+ * Handle 'peek' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_peek (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_err_e      err        = STACK_E_OK;    /* Operation return code     */
+    stack_t         *stack_p    = NULL;          /* Stack to peek at          */
+    void            *entry_p    = NULL;          /* Top entry in stack        */
+    size_t           entry_size = 0;             /* Size of top entry         */
+    stack_cmd_enc_e  enc        = STACK_CMD_ENC_TEXT; /* Output encoding      */
+
+    stack_p = stack_cmd_target(sess_p, &args, false);
+    if (NULL == stack_p) {
+        return (true);
+    }
+    enc = stack_cmd_encoding(&args);
+
+    /*
+     * The entry is encoded straight from stack memory into the output.
+     */
+    err = stack_top_view(stack_p, &entry_p, &entry_size);
+    if (stack_err_e_is_error(err)) {
+        stack_cmd_out_printf(&(sess_p->out), "Error: Can't peek: %d(%s)\n",
+                             err, stack_err_e_to_string(err));
+    } else {
+        stack_cmd_out_append(&(sess_p->out), "'", 1);
+        stack_cmd_out_value(&(sess_p->out), enc, entry_p, entry_size);
+        stack_cmd_out_printf(&(sess_p->out), "' is at top of stack\n");
+    }
+
+    return (true);
+}
+
+/**
+ * Handle 'pop' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_pop (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_err_e      err        = STACK_E_OK;    /* Operation return code     */
+    stack_t         *stack_p    = NULL;          /* Stack to pop from         */
+    void            *entry_p    = NULL;          /* Top entry in stack        */
+    size_t           entry_size = 0;             /* Size of top entry         */
+    stack_cmd_enc_e  enc        = STACK_CMD_ENC_TEXT; /* Output encoding      */
+
+    stack_p = stack_cmd_target(sess_p, &args, false);
+    if (NULL == stack_p) {
+        return (true);
+    }
+    enc = stack_cmd_encoding(&args);
+
+    /*
+     * The entry is encoded straight from stack memory into the output, and
+     * only then dropped.
+     */
+    err = stack_top_view(stack_p, &entry_p, &entry_size);
+    if (stack_err_e_is_error(err)) {
+        stack_cmd_out_printf(&(sess_p->out), "Error: Can't pop: %d(%s)\n",
+                             err, stack_err_e_to_string(err));
+    } else {
+        stack_cmd_out_printf(&(sess_p->out), "Popped '");
+        stack_cmd_out_value(&(sess_p->out), enc, entry_p, entry_size);
+        stack_cmd_out_printf(&(sess_p->out), "' off the stack\n");
+        (void)stack_drop(stack_p, 1);
+    }
+
+    return (true);
+}
+
+/**
+ * Handle 'push' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_push (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_err_e      err     = STACK_E_OK;       /* Operation return code     */
+    stack_t         *stack_p = NULL;             /* Stack to push onto        */
+    stack_cmd_enc_e  enc     = STACK_CMD_ENC_TEXT; /* Input encoding          */
+
+    stack_p = stack_cmd_target(sess_p, &args, true);
+    if (NULL == stack_p) {
+        return (true);
+    }
+    enc = stack_cmd_encoding(&args);
+
+    err = stack_cmd_push_value(stack_p, enc, args, strlen(args));
+    if (stack_err_e_is_error(err)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Can't push '%s': %d(%s)\n",
+                             args, err, stack_err_e_to_string(err));
+    } else {
+        stack_cmd_out_printf(&(sess_p->out), "Pushed '%s' unto the stack\n",
+                             args);
+    }
+
+    return (true);
+}
+
+/**
+ * Get the next whitespace-separated word of a command's arguments.
+ *
+ * @param[in,out] args_pp
+ *     Command arguments. Advanced past the word and the whitespace after
+ *     it.
+ * @param[out] len_p
+ *     Updated with the length of the word.
+ * @returns
+ *     Start of the word, or NULL if there are no more words.
+ */
+static const char *stack_cmd_next_word (const char **args_pp, size_t *len_p)
+{
+    const char *args_p = *args_pp;               /* Current argument char     */
+    const char *word_p = NULL;                   /* Start of word             */
+
+    if ('\0' == *args_p) {
+        return (NULL);
+    }
+    word_p = args_p;
+    while (('\0' != *args_p) && (' ' != *args_p) && ('\t' != *args_p)) {
+        args_p++;
+    }
+    *len_p = args_p - word_p;
+    while ((' ' == *args_p) || ('\t' == *args_p)) {
+        args_p++;
+    }
+    *args_pp = args_p;
+
+    return (word_p);
+}
+
+/**
+ * Get a decimal number from the start of a command's arguments.
+ *
+ * @param[in,out] args_pp
+ *     Command arguments. Advanced past the number and the whitespace
+ *     after it.
+ * @param[out] value_p
+ *     Updated with the number.
+ * @retval true
+ *     Number parsed.
+ * @retval false
+ *     Arguments don't start with a number that fits in a size_t.
+ */
+static bool stack_cmd_number (const char **args_pp, size_t *value_p)
+{
+    const char         *word_p = NULL;           /* Number text               */
+    size_t              len    = 0;              /* Length of number text     */
+    char               *end_p  = NULL;           /* End of parsed number      */
+    unsigned long long  value  = 0;              /* Parsed number             */
+
+    word_p = stack_cmd_next_word(args_pp, &len);
+    if ((NULL == word_p) || (! isdigit((unsigned char)*word_p))) {
+        return (false);
+    }
+    errno = 0;
+    value = strtoull(word_p, &end_p, 10);
+    if ((0 != errno) || (end_p != (word_p + len)) || (value > SIZE_MAX)) {
+        return (false);
+    }
+
+    *value_p = value;
+    return (true);
+}
+
+/**
+ * Remove the top entries of a stack, outputting each of them.
+ *
+ * The entries are encoded straight from stack memory into the output,
+ * walking the stack in place, and then dropped all together.
+ *
+ * @param[in,out] sess_p
+ *     Session running the command.
+ * @param[in] stack_p
+ *     Stack to remove entries from.
+ * @param[in] enc
+ *     Output encoding.
+ * @param[in] num_entries
+ *     Number of entries to remove. If the stack has fewer entries, all of
+ *     them are removed.
+ */
+static void stack_cmd_pop_entries (stack_cmd_session_t *sess_p,
+                                   stack_t             *stack_p,
+                                   stack_cmd_enc_e      enc,
+                                   size_t               num_entries)
+{
+    stack_iter_t  iter;                          /* Walk over top entries     */
+    const void   *entry_p    = NULL;             /* Current entry             */
+    size_t        entry_size = 0;                /* Size of current entry     */
+    size_t        i          = 0;                /* Loop index counter        */
+
+    stack_iter_init(&iter, stack_p);
+    for (i = 0; i < num_entries; i++) {
+        if (! stack_iter_next(&iter, &entry_p, &entry_size)) {
+            break;
+        }
+        stack_cmd_out_append(&(sess_p->out), "'", 1);
+        stack_cmd_out_value(&(sess_p->out), enc, entry_p, entry_size);
+        stack_cmd_out_append(&(sess_p->out), "'\n", 2);
+    }
+    (void)stack_drop(stack_p, i);
+
+    stack_cmd_out_printf(&(sess_p->out), "Popped %zu entries off the stack\n",
+                         i);
+}
+
+/**
+ * Handle 'popn' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_popn (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_t         *stack_p     = NULL;         /* Stack to pop from         */
+    stack_cmd_enc_e  enc         = STACK_CMD_ENC_TEXT; /* Output encoding     */
+    size_t           num_entries = 0;            /* Entries to pop            */
+
+    stack_p = stack_cmd_target(sess_p, &args, false);
+    if (NULL == stack_p) {
+        return (true);
+    }
+    enc = stack_cmd_encoding(&args);
+    if ((! stack_cmd_number(&args, &num_entries)) || ('\0' != *args)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Expected number of entries\n");
+        return (true);
+    }
+
+    stack_cmd_pop_entries(sess_p, stack_p, enc, num_entries);
+    return (true);
+}
+
+/**
+ * Handle 'drain' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_drain (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_t         *stack_p = NULL;             /* Stack to drain            */
+    stack_cmd_enc_e  enc     = STACK_CMD_ENC_TEXT; /* Output encoding         */
+
+    stack_p = stack_cmd_target(sess_p, &args, false);
+    if (NULL == stack_p) {
+        return (true);
+    }
+    enc = stack_cmd_encoding(&args);
+
+    stack_cmd_pop_entries(sess_p, stack_p, enc,
+                          stack_get_num_entries(stack_p));
+    return (true);
+}
+
+/**
+ * Handle 'pushn' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_pushn (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_err_e      err         = STACK_E_OK;   /* Operation return code     */
+    stack_t         *stack_p     = NULL;         /* Stack to push onto        */
+    stack_cmd_enc_e  enc         = STACK_CMD_ENC_TEXT; /* Input encoding      */
+    const char      *values_p    = NULL;         /* First value               */
+    const char      *word_p      = NULL;         /* Current value             */
+    size_t           len         = 0;            /* Length of current value   */
+    size_t           size        = 0;            /* Decoded size of value     */
+    size_t           num_entries = 0;            /* Number of values          */
+    size_t           data_size   = 0;            /* Decoded size of values    */
+    const void     **entries_pp  = NULL;         /* Entries to push           */
+    size_t          *sizes_p     = NULL;         /* Sizes of entries          */
+    unsigned char   *data_p      = NULL;         /* Decoded values            */
+    size_t           i           = 0;            /* Loop index counter        */
+
+    stack_p = stack_cmd_target(sess_p, &args, true);
+    if (NULL == stack_p) {
+        return (true);
+    }
+    enc = stack_cmd_encoding(&args);
+
+    /*
+     * Size everything up first, so that the values can be decoded into a
+     * single buffer and pushed with one call.
+     */
+    values_p = args;
+    while (NULL != (word_p = stack_cmd_next_word(&args, &len))) {
+        if (! stack_cmd_decoded_size(enc, word_p, &len, &size)) {
+            stack_cmd_out_printf(&(sess_p->out),
+                                 "Error: Can't push value %zu: %d(%s)\n",
+                                 num_entries + 1, STACK_E_INVALID,
+                                 stack_err_e_to_string(STACK_E_INVALID));
+            return (true);
+        }
+        num_entries++;
+        data_size += size;
+    }
+    if (0 == num_entries) {
+        stack_cmd_out_printf(&(sess_p->out), "Error: Expected values\n");
+        return (true);
+    }
+
+    entries_pp = malloc(num_entries * sizeof(*entries_pp));
+    sizes_p = malloc(num_entries * sizeof(*sizes_p));
+    if (STACK_CMD_ENC_TEXT != enc) {
+        data_p = malloc(data_size + 1);
+    }
+    if ((NULL == entries_pp) || (NULL == sizes_p) ||
+        ((STACK_CMD_ENC_TEXT != enc) && (NULL == data_p))) {
+        err = STACK_E_NOMEM;
+    }
+
+    /*
+     * Text values are pushed straight from the line.
+     */
+    args = values_p;
+    data_size = 0;
+    for (i = 0; (i < num_entries) && (! stack_err_e_is_error(err)); i++) {
+        word_p = stack_cmd_next_word(&args, &len);
+        (void)stack_cmd_decoded_size(enc, word_p, &len, &size);
+        entries_pp[i] = word_p;
+        sizes_p[i] = size;
+        if (STACK_CMD_ENC_TEXT == enc) {
+            continue;
+        }
+        entries_pp[i] = data_p + data_size;
+        data_size += size;
+        if (! stack_cmd_decode(enc, data_p + data_size - size, word_p, len)) {
+            err = STACK_E_INVALID;
+        }
+    }
+    if (! stack_err_e_is_error(err)) {
+        err = stack_push_multi(stack_p, entries_pp, sizes_p, num_entries);
+    }
+
+    if (stack_err_e_is_error(err)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Can't push %zu entries: %d(%s)\n",
+                             num_entries, err, stack_err_e_to_string(err));
+    } else {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Pushed %zu entries unto the stack\n",
+                             num_entries);
+    }
+
+    free(data_p);
+    free(sizes_p);
+    free(entries_pp);
+    return (true);
+}
+
+/**
+ * Handle 'fill' command.
+ *
+ * Every entry is a copy of the same generated value, so the entries are
+ * pushed in batches of STACK_CMD_FILL_BATCH that all point at it.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_fill (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_err_e    err         = STACK_E_OK;     /* Operation return code     */
+    stack_t       *stack_p     = NULL;           /* Stack to fill             */
+    size_t         num_entries = 0;              /* Entries to push           */
+    size_t         entry_size  = 0;              /* Size of each entry        */
+    size_t         num_pushed  = 0;              /* Entries pushed so far     */
+    size_t         batch       = 0;              /* Entries in current batch  */
+    unsigned char *value_p     = NULL;           /* Generated value           */
+    const void    *entries[STACK_CMD_FILL_BATCH]; /* Entries of a batch       */
+    size_t         sizes[STACK_CMD_FILL_BATCH];  /* Sizes of a batch          */
+    size_t         i           = 0;              /* Loop index counter        */
+
+    stack_p = stack_cmd_target(sess_p, &args, true);
+    if (NULL == stack_p) {
+        return (true);
+    }
+    if ((! stack_cmd_number(&args, &num_entries)) ||
+        (! stack_cmd_number(&args, &entry_size)) || ('\0' != *args)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Expected number and size of entries\n");
+        return (true);
+    }
+
+    value_p = malloc(entry_size + 1);
+    if (NULL == value_p) {
+        err = STACK_E_NOMEM;
+    }
+    for (i = 0; (i < entry_size) && (NULL != value_p); i++) {
+        value_p[i] = (unsigned char)('a' + (i % 26));
+    }
+    for (i = 0; i < STACK_CMD_FILL_BATCH; i++) {
+        entries[i] = value_p;
+        sizes[i] = entry_size;
+    }
+
+    while ((num_pushed < num_entries) && (! stack_err_e_is_error(err))) {
+        batch = num_entries - num_pushed;
+        if (batch > STACK_CMD_FILL_BATCH) {
+            batch = STACK_CMD_FILL_BATCH;
+        }
+        err = stack_push_multi(stack_p, entries, sizes, batch);
+        if (! stack_err_e_is_error(err)) {
+            num_pushed += batch;
+        }
+    }
+
+    if (stack_err_e_is_error(err)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Can't fill after %zu entries: %d(%s)\n",
+                             num_pushed, err, stack_err_e_to_string(err));
+    } else {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Pushed %zu entries unto the stack\n",
+                             num_pushed);
+    }
+
+    free(value_p);
+    return (true);
+}
+
+/**
+ * Handle 'quit' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_quit (__attribute__((unused)) stack_cmd_session_t *sess_p,
+                            __attribute__((unused)) const char* args)
+{
+    return (false);
+}
+
+/**
+ * Handle 'show' command.
+ *
+ * @retval true
+ *     Continue procesing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_show (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_t *stack_p  = NULL;                    /* Stack to show             */
+    FILE    *stream_p = NULL;                    /* Stream to print to        */
+    char    *text_p   = NULL;                    /* Printed text              */
+    size_t   text_len = 0;                       /* Printed text length       */
+
+    stack_p = stack_cmd_target(sess_p, &args, false);
+    if (NULL == stack_p) {
+        return (true);
+    }
+
+    /*
+     * stack_print_to() writes to a stream, so print to memory and copy
+     * the text into the session output.
+     */
+    stream_p = open_memstream(&text_p, &text_len);
+    if (NULL == stream_p) {
+        stack_cmd_out_printf(&(sess_p->out), "Error: Can't show stack\n");
+        return (true);
+    }
+    (void)stack_print_to(stack_p, stream_p, STACK_PRINT_HEX);
+    if (0 == fclose(stream_p)) {
+        stack_cmd_out_append(&(sess_p->out), text_p, text_len);
+    }
+    free(text_p);
+
+    return (true);
+}
+
+/**
+ * Handle 'size' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_size (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_t *stack_p = NULL;                     /* Stack to measure          */
+
+    stack_p = stack_cmd_target(sess_p, &args, false);
+    if (NULL != stack_p) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "There are %lu entries in the stack.\n",
+                             stack_get_num_entries(stack_p));
+    }
+
+    return (true);
+}
+
+/**
+ * Handle 'stats' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_stats (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_err_e    err     = STACK_E_OK;         /* Operation return code     */
+    stack_t       *stack_p = NULL;               /* Stack to report on        */
+    stack_stats_t  stats;                        /* Stack counters            */
+    char           label[48];                    /* Size bucket label         */
+    unsigned int   i       = 0;                  /* Loop index counter        */
+
+    stack_p = stack_cmd_target(sess_p, &args, false);
+    if (NULL == stack_p) {
+        return (true);
+    }
+
+    err = stack_get_stats(stack_p, &stats);
+    if (stack_err_e_is_error(err)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Can't get stats: %d(%s)\n",
+                             err, stack_err_e_to_string(err));
+        return (true);
+    }
+
+    stack_cmd_out_printf(&(sess_p->out),
+                         "Pushes:                    %zu\n"
+                         "Pops:                      %zu\n"
+                         "Peeks:                     %zu\n"
+                         "Most entries:              %zu\n"
+                         "Most bytes used:           %zu\n"
+                         "Bytes copied:              %zu\n"
+                         "Entries pushed by size:\n",
+                         stats.num_pushes, stats.num_pops, stats.num_peeks,
+                         stats.max_entries, stats.max_used_size,
+                         stats.bytes_copied);
+    for (i = 0; i < STACK_STATS_NUM_SIZES; i++) {
+        if (0 == stats.sizes[i]) {
+            continue;
+        }
+        if (0 == i) {
+            snprintf(label, sizeof(label), "0 bytes:");
+        } else if ((STACK_STATS_NUM_SIZES - 1) == i) {
+            snprintf(label, sizeof(label), "%zu+ bytes:",
+                     (size_t)1 << (i - 1));
+        } else {
+            snprintf(label, sizeof(label), "%zu-%zu bytes:",
+                     (size_t)1 << (i - 1), ((size_t)1 << i) - 1);
+        }
+        stack_cmd_out_printf(&(sess_p->out), "  %-24s %zu\n", label,
+                             stats.sizes[i]);
+    }
+
+    return (true);
+}
+
+/**
+ * Run a timed benchmark of one operation on a stack.
+ *
+ * Entries that the benchmark needs are pushed before the clock starts, and
+ * entries it pushes are dropped after the clock stops, so the stack ends
+ * up as it was.
+ *
+ * @param[in] stack_p
+ *     Stack to run on.
+ * @param[in] op
+ *     Operation to benchmark.
+ * @param[in] buf_p
+ *     Buffer of entry_size bytes to push from and pop into.
+ * @param[in] entry_size
+ *     Size of entries in bytes.
+ * @param[in] count
+ *     Number of operations to run.
+ * @param[out] elapsed_ns_p
+ *     Updated with the time the operations took, in nanoseconds.
+ * @retval STACK_E_OK
+ *     Benchmark run.
+ * @returns
+ *     Otherwise, error from the operation. The stack is unchanged.
+ */
+static stack_err_e stack_cmd_bench_run (stack_t            *stack_p,
+                                        stack_cmd_bench_e   op,
+                                        void               *buf_p,
+                                        size_t              entry_size,
+                                        size_t              count,
+                                        uint64_t           *elapsed_ns_p)
+{
+    stack_err_e      err      = STACK_E_OK;      /* Operation return code     */
+    struct timespec  start;                      /* Time benchmark started    */
+    struct timespec  end;                        /* Time benchmark ended      */
+    size_t           out_size = 0;               /* Size of popped entry      */
+    size_t           num_left = 0;               /* Entries to drop at end    */
+    size_t           i        = 0;               /* Loop index counter        */
+
+    if (STACK_CMD_BENCH_POP == op) {
+        for (i = 0; (i < count) && (STACK_E_OK == err); i++) {
+            err = stack_push(stack_p, buf_p, entry_size);
+        }
+        if (stack_err_e_is_error(err)) {
+            (void)stack_drop(stack_p, i - 1);
+            return (err);
+        }
+    } else if (STACK_CMD_BENCH_PEEK == op) {
+        err = stack_push(stack_p, buf_p, entry_size);
+        if (stack_err_e_is_error(err)) {
+            return (err);
+        }
+        num_left = 1;
+    }
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+    switch (op) {
+    case STACK_CMD_BENCH_PUSH:
+        for (i = 0; (i < count) && (STACK_E_OK == err); i++) {
+            err = stack_push(stack_p, buf_p, entry_size);
+        }
+        num_left = stack_err_e_is_error(err) ? (i - 1) : i;
+        break;
+    case STACK_CMD_BENCH_POP:
+        for (i = 0; (i < count) && (STACK_E_OK == err); i++) {
+            out_size = entry_size + 1;
+            err = stack_pop(stack_p, buf_p, &out_size);
+        }
+        break;
+    case STACK_CMD_BENCH_PEEK:
+        for (i = 0; (i < count) && (STACK_E_OK == err); i++) {
+            out_size = entry_size + 1;
+            err = stack_peek(stack_p, buf_p, &out_size);
+        }
+        break;
+    default:
+        for (i = 0; (i < count) && (STACK_E_OK == err); i++) {
+            err = stack_push(stack_p, buf_p, entry_size);
+            if (STACK_E_OK == err) {
+                out_size = entry_size + 1;
+                err = stack_pop(stack_p, buf_p, &out_size);
+            }
+        }
+        break;
+    }
+    (void)clock_gettime(CLOCK_MONOTONIC, &end);
+
+    (void)stack_drop(stack_p, num_left);
+    *elapsed_ns_p = ((uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL) +
+                    end.tv_nsec - start.tv_nsec;
+    return (err);
+}
+
+/**
+ * Handle 'bench' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_bench (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_err_e        err        = STACK_E_OK;  /* Operation return code     */
+    stack_t           *stack_p    = NULL;        /* Stack to run on           */
+    const char        *op_p       = NULL;        /* Operation name            */
+    size_t             op_len     = 0;           /* Length of operation name  */
+    stack_cmd_bench_e  op         = STACK_CMD_BENCH_PUSH; /* Operation        */
+    size_t             count      = 0;           /* Number of operations      */
+    size_t             entry_size = 0;           /* Size of entries           */
+    void              *buf_p      = NULL;        /* Entry buffer              */
+    uint64_t           elapsed_ns = 0;           /* Time taken                */
+
+    stack_p = stack_cmd_target(sess_p, &args, true);
+    if (NULL == stack_p) {
+        return (true);
+    }
+
+    op_p = stack_cmd_next_word(&args, &op_len);
+    for (op = 0; op < STACK_CMD_BENCH_NUM_OPS; op++) {
+        if ((NULL != op_p) &&
+            (strlen(g_stack_cmd_bench_ops[op]) == op_len) &&
+            (0 == strncasecmp(op_p, g_stack_cmd_bench_ops[op], op_len))) {
+            break;
+        }
+    }
+    if ((STACK_CMD_BENCH_NUM_OPS == op) ||
+        (! stack_cmd_number(&args, &count)) || (0 == count) ||
+        (! stack_cmd_number(&args, &entry_size)) || ('\0' != *args)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Expected push, pop, peek or pushpop, "
+                             "then number and size of entries\n");
+        return (true);
+    }
+
+    buf_p = calloc(1, entry_size + 1);
+    if (NULL == buf_p) {
+        err = STACK_E_NOMEM;
+    } else {
+        err = stack_cmd_bench_run(stack_p, op, buf_p, entry_size, count,
+                                  &elapsed_ns);
+    }
+    free(buf_p);
+
+    if (stack_err_e_is_error(err)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Can't run benchmark: %d(%s)\n",
+                             err, stack_err_e_to_string(err));
+    } else {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "%s: %zu ops of %zu bytes in %.3f ms, "
+                             "%.1f ns/op\n",
+                             g_stack_cmd_bench_ops[op], count, entry_size,
+                             elapsed_ns / 1e6, (double)elapsed_ns / count);
+    }
+
+    return (true);
+}
+
+/**
+ * Handle 'checkpoint' command. With "-d", only the changes since the last
+ * checkpoint are written, as a delta.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_checkpoint (stack_cmd_session_t *sess_p,
+                                  const char* args)
+{
+    stack_err_e  err      = STACK_E_OK;          /* Operation return code     */
+    stack_t     *stack_p  = NULL;                /* Stack to checkpoint       */
+    bool         is_delta = false;               /* Write only changes?       */
+
+    stack_p = stack_cmd_target(sess_p, &args, false);
+    if (NULL == stack_p) {
+        return (true);
+    }
+    if (0 == strcmp(args, "-d")) {
+        is_delta = true;
+    } else if ('\0' != *args) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Expected -d or nothing\n");
+        return (true);
+    }
+    if (NULL == g_stack_cmd_journal_dir_p) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Stacks aren't journaled\n");
+        return (true);
+    }
+
+    if (is_delta) {
+        err = stack_journal_checkpoint_delta(stack_p);
+    } else {
+        err = stack_journal_checkpoint(stack_p);
+    }
+    if (stack_err_e_is_error(err)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Can't checkpoint: %d(%s)\n",
+                             err, stack_err_e_to_string(err));
+    } else {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Saved snapshot, journal restarted\n");
+    }
+
+    return (true);
+}
+
+/**
+ * Handle 'use' command.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_use (stack_cmd_session_t *sess_p, const char* args)
+{
+    stack_cmd_reg_slot_t *slot_p = NULL;         /* Slot for named stack      */
+    uint32_t              hash   = 0;            /* Hash of name              */
+
+    if ('\0' == *args) {
+        stack_cmd_out_printf(&(sess_p->out), "Using stack '%s'\n",
+                             sess_p->name_p);
+        return (true);
+    }
+
+    if (strlen(args) > STACK_CMD_NAME_MAX) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Stack name longer than %d characters\n",
+                             STACK_CMD_NAME_MAX);
+        return (true);
+    }
+    if (! stack_cmd_journal_name_fits(args)) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Stack name too long to journal\n");
+        return (true);
+    }
+    hash = stack_cmd_reg_hash(args);
+    if (stack_cmd_session_move(sess_p, stack_cmd_reg_owner(hash))) {
+        return (true);
+    }
+    slot_p = stack_cmd_reg_get(stack_cmd_session_reg(sess_p), args, hash,
+                               true);
+    if (NULL == slot_p) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Can't create stack '%s'\n", args);
+    } else {
+        sess_p->stack_p = slot_p->stack_p;
+        sess_p->name_p = slot_p->name_p;
+        sess_p->stack_worker = sess_p->worker;
+        stack_cmd_out_printf(&(sess_p->out), "Using stack '%s'\n",
+                             sess_p->name_p);
+    }
+
+    return (true);
+}
+
+/**
+ * Handle 'list' command. Each worker lists the stacks it owns, so the
+ * session visits the workers in turn, running the command again on each.
+ *
+ * @retval true
+ *     Continue processing.
+ * @retval false
+ *     End session.
+ */
+static bool stack_cmd_list (stack_cmd_session_t *sess_p,
+                            __attribute__((unused)) const char* args)
+{
+    stack_cmd_reg_t      *reg_p  = NULL;         /* Worker's registry         */
+    stack_cmd_reg_slot_t *slot_p = NULL;         /* Current slot              */
+    size_t                i      = 0;            /* Loop index counter        */
+
+    if (stack_cmd_session_move(sess_p, sess_p->list_next)) {
+        return (true);
+    }
+
+    reg_p = stack_cmd_session_reg(sess_p);
+    for (i = 0; i < reg_p->num_slots; i++) {
+        slot_p = &(reg_p->slots_p[i]);
+        if (NULL != slot_p->name_p) {
+            stack_cmd_out_printf(&(sess_p->out), "%c %s (%lu entries)\n",
+                                 (slot_p->stack_p == sess_p->stack_p) ?
+                                 '*' : ' ',
+                                 slot_p->name_p,
+                                 stack_get_num_entries(slot_p->stack_p));
+        }
+    }
+
+    sess_p->list_next++;
+    if (sess_p->list_next < g_stack_cmd_num_workers) {
+        (void)stack_cmd_session_move(sess_p, sess_p->list_next);
+    } else {
+        sess_p->list_next = 0;
+    }
+
+    return (true);
+}
+
+/**
+ * Supported commands for interactive parser.
+ */
+static stack_cmd_command_t g_stack_cmd_commands[] =
+{
+    { "bench", "[@<name>] <op> <n> <size>", "Time <n> ops on <size> bytes",
+      stack_cmd_bench },
+    { "checkpoint", "[@<name>] [-d]", "Snapshot stack, restart journal",
+      stack_cmd_checkpoint },
+    { "drain", "[@<name>] [-x|-b]",      "Remove all entries of stack",
+      stack_cmd_drain },
+    { "fill", "[@<name>] <n> <size>",    "Add <n> entries of <size> bytes",
+      stack_cmd_fill },
+    { "help", NULL,              "Show this message",          stack_cmd_help },
+    { "list", NULL,              "List named stacks",          stack_cmd_list },
+    { "peek", "[@<name>] [-x|-b]",       "Look at top entry of stack",
+      stack_cmd_peek },
+    { "pop",  "[@<name>] [-x|-b]",       "Remove top entry of stack",
+      stack_cmd_pop },
+    { "popn", "[@<name>] [-x|-b] <n>",   "Remove top <n> entries of stack",
+      stack_cmd_popn },
+    { "push", "[@<name>] [-x|-b] <val>", "Add <val> to stack",
+      stack_cmd_push },
+    { "pushn", "[@<name>] [-x|-b] <val> ...", "Add each <val> to stack",
+      stack_cmd_pushn },
+    { "quit", NULL,              "End program",                stack_cmd_quit },
+    { "show", "[@<name>]",       "Display stack",              stack_cmd_show },
+    { "size", "[@<name>]",       "Display stack size",         stack_cmd_size },
+    { "stats", "[@<name>]",      "Display stack counters",     stack_cmd_stats },
+    { "use",  "<name>",          "Switch to stack <name>",     stack_cmd_use },
+};
+
+/**
+ * Number of commands supported by parser.
+ */
+#define STACK_CMD_NUM_COMMANDS \
+            (sizeof(g_stack_cmd_commands) / sizeof(stack_cmd_command_t))
+
+/**
+ * Command 'name' field header.
+ */
+#define STACK_CMD_HDR_NAME "Command"
+
+/**
+ * Command 'help' field header.
+ */
+#define STACK_CMD_HDR_HELP "Description"
+
+
+/**
+ * Output help message.
+ */
+static bool stack_cmd_help (stack_cmd_session_t *sess_p,
+                            __attribute__((unused)) const char* args)
+{
+    unsigned int         i            = 0;       /* Loop index counter        */
+    size_t               max_name_len = 0;       /* Maximum command name size */
+    size_t               max_help_len = 0;       /* Maximum help string size  */
+    stack_cmd_command_t *command_p    = NULL;    /* Current command           */
+    size_t               cmd_name_len = 0;       /* Current command name size */
+    size_t               cmd_help_len = 0;       /* Current help string size  */
+    stack_cmd_out_t     *out_p        = &(sess_p->out); /* Help output        */
+
+    /*
+     * Determine column sizes.
+     */
+    max_name_len = strlen(STACK_CMD_HDR_NAME);
+    max_help_len = strlen(STACK_CMD_HDR_HELP);
+    for (i = 0; i < STACK_CMD_NUM_COMMANDS; i++) {
+        command_p = &(g_stack_cmd_commands[i]);
+
+        cmd_name_len = strlen(command_p->name);
+        if (NULL != command_p->args) {
+            cmd_name_len += 1 + strlen(command_p->args);
+        }
+        if (cmd_name_len > max_name_len) {
+            max_name_len = cmd_name_len;
+        }
+
+        cmd_help_len = strlen(command_p->help);
+        if (cmd_help_len > max_help_len) {
+            max_help_len = cmd_help_len;
+        }
+    }
+
+    /*
+     * Output header, which will be of the form:
+     *
+     * Command      Description
+     * ===========  ==============
+     */
+    stack_cmd_out_printf(out_p, "%-*s  " STACK_CMD_HDR_HELP "\n",
+                         (int)max_name_len, STACK_CMD_HDR_NAME);
+    stack_cmd_out_repeat(out_p, '=', max_name_len);
+    stack_cmd_out_repeat(out_p, ' ', 2);
+    stack_cmd_out_repeat(out_p, '=', max_help_len);
+    stack_cmd_out_repeat(out_p, '\n', 1);
+
+    /*
+     * Output commands.
+     */
+    for (i = 0; i < STACK_CMD_NUM_COMMANDS; i++) {
+        command_p = &(g_stack_cmd_commands[i]);
+
+        cmd_name_len = strlen(command_p->name);
+        if (NULL != command_p->args) {
+            cmd_name_len += 1 + strlen(command_p->args);
+        }
+        stack_cmd_out_printf(out_p, "%s%s%s%*s  %s\n",
+                             command_p->name,
+                             (NULL != command_p->args) ? " " : "",
+                             (NULL != command_p->args) ? command_p->args : "",
+                             (int)(max_name_len - cmd_name_len), "",
+                             command_p->help);
+    }
+
+    return (true);
+}
+
+/**
+ * Map a character onto its command trie child slot.
+ *
+ * @param[in] c
+ *     Character to map.
+ * @returns
+ *     Child slot, or -1 if no command name contains the character.
+ */
+static inline int stack_cmd_trie_slot (int c)
+{
+    c = tolower(c);
+    if ((c < 'a') || (c > 'z')) {
+        return (-1);
+    }
+    return (c - 'a');
+}
+
+/**
+ * Load the command names into the command trie.
+ *
+ * @retval true
+ *     Trie built.
+ * @retval false
+ *     A command name contains a character other than a letter, or the
+ *     names don't fit in STACK_CMD_TRIE_MAX_NODES nodes.
+ */
+static bool stack_cmd_trie_init (void)
+{
+    stack_cmd_trie_node_t *node_p = NULL;        /* Current trie node         */
+    const char            *name_p = NULL;        /* Current name character    */
+    unsigned int           node   = 0;           /* Current trie node index   */
+    unsigned int           i      = 0;           /* Loop index counter        */
+    int                    slot   = 0;           /* Child slot for character  */
+
+    memset(g_stack_cmd_trie, 0, sizeof(g_stack_cmd_trie));
+    g_stack_cmd_trie[0].exact = -1;
+    g_stack_cmd_trie_num_nodes = 1;
+
+    for (i = 0; i < STACK_CMD_NUM_COMMANDS; i++) {
+        node = 0;
+        name_p = g_stack_cmd_commands[i].name;
+        for (;;) {
+            node_p = &(g_stack_cmd_trie[node]);
+            node_p->num_commands++;
+            node_p->any = i;
+            if ('\0' == *name_p) {
+                node_p->exact = i;
+                break;
+            }
+
+            slot = stack_cmd_trie_slot((unsigned char)*name_p);
+            if (slot < 0) {
+                return (false);
+            }
+            if (STACK_CMD_TRIE_NONE == node_p->child[slot]) {
+                if (g_stack_cmd_trie_num_nodes == STACK_CMD_TRIE_MAX_NODES) {
+                    return (false);
+                }
+                node_p->child[slot] = g_stack_cmd_trie_num_nodes;
+                g_stack_cmd_trie[g_stack_cmd_trie_num_nodes].exact = -1;
+                g_stack_cmd_trie_num_nodes++;
+            }
+            node = node_p->child[slot];
+            name_p++;
+        }
+    }
+
+    return (true);
+}
+
+/**
+ * Parse and run a line.
+ *
+ * @param[in,out] sess_p
+ *     Session to run line in.
+ * @param[in] line_p
+ *     Line, without its newline.
+ * @retval true
+ *     Continue execution
+ * @retval false
+ *     End session, or move it to sess_p->move_to and run the line again.
+ */
+static bool stack_cmd_parse_line (stack_cmd_session_t *sess_p,
+                                  const char          *line_p)
+{
+    const char            *cmd_p     = NULL;     /* Start of command word     */
+    int                    cmd_len   = 0;        /* Length of command word    */
+    stack_cmd_trie_node_t *node_p    = NULL;     /* Trie node for cmd so far  */
+    stack_cmd_command_t   *command_p = NULL;     /* Matching command          */
+    int                    slot      = 0;        /* Trie slot for character   */
+
+    /*
+     * Strip initial whitespace, and ignore blank lines.
+     */
+    while ((' ' == *line_p) || ('\t' == *line_p)) {
+        line_p++;
+    }
+    if ('\0' == *line_p) {
+        return (true);
+    }
+
+    /*
+     * Start at the root of the trie, which every command is below, and
+     * descend one level per character of the command word. Falling off the
+     * trie means no command matches.
+     */
+    node_p = &(g_stack_cmd_trie[0]);
+    cmd_p = line_p;
+    while (('\0' != *line_p) && (' ' != *line_p) && ('\t' != *line_p)) {
+        if (NULL != node_p) {
+            slot = stack_cmd_trie_slot((unsigned char)*line_p);
+            if ((slot < 0) || (STACK_CMD_TRIE_NONE == node_p->child[slot])) {
+                node_p = NULL;
+            } else {
+                node_p = &(g_stack_cmd_trie[node_p->child[slot]]);
+            }
+        }
+        line_p++;
+    }
+    cmd_len = line_p - cmd_p;
+
+    /*
+     * The arguments are the rest of the line, after first stripping out
+     * any whitespace between the command and first argument.
+     */
+    while ((' ' == *line_p) || ('\t' == *line_p)) {
+        line_p++;
+    }
+
+    if (NULL == node_p) {
+        stack_cmd_out_printf(&(sess_p->out),
+                     "Unknown command '%.*s'. Type HELP for command list.\n",
+                     cmd_len, cmd_p);
+    } else if ((node_p->exact >= 0) || (1 == node_p->num_commands)) {
+        command_p = &(g_stack_cmd_commands[(node_p->exact >= 0) ?
+                                           (unsigned int)node_p->exact :
+                                           node_p->any]);
+        return ((command_p->cb(sess_p, line_p)) && (sess_p->move_to < 0));
+    } else {
+        /*
+         * Multiple matches.
+         */
+        stack_cmd_out_printf(&(sess_p->out),
+                     "Incomplete command '%.*s'. Type HELP for command list.\n",
+                     cmd_len, cmd_p);
+    }
+
+    return (true);
+}
+
+/**
+ * Make room in a session's line buffer for more of the partial line.
+ *
+ * @param[in,out] sess_p
+ *     Session to make room in.
+ * @param[in] len
+ *     Number of bytes to add to the line.
+ * @retval true
+ *     Room made.
+ * @retval false
+ *     Out of memory.
+ */
+static bool stack_cmd_session_line_reserve (stack_cmd_session_t *sess_p,
+                                            size_t               len)
+{
+    size_t  size   = sess_p->line_size;          /* New buffer size           */
+    char   *line_p = NULL;                       /* New buffer                */
+
+    if ((sess_p->line_len + len) <= sess_p->line_size) {
+        return (true);
+    }
+    if (0 == size) {
+        size = STACK_CMD_LINE_MIN_SIZE;
+    }
+    while (size < (sess_p->line_len + len)) {
+        size *= 2;
+    }
+
+    line_p = realloc(sess_p->line_p, size);
+    if (NULL == line_p) {
+        return (false);
+    }
+    sess_p->line_p = line_p;
+    sess_p->line_size = size;
+    return (true);
+}
+
+/**
+ * Run the line held by a session.
+ *
+ * @param[in,out] sess_p
+ *     Session to run line in.
+ * @retval true
+ *     Continue execution
+ * @retval false
+ *     End session, or move it to sess_p->move_to. In the latter case, the
+ *     line is kept, to be run again by that worker.
+ */
+static bool stack_cmd_session_run_line (stack_cmd_session_t *sess_p)
+{
+    bool is_continue = true;                     /* Continue execution?       */
+
+    if (sess_p->is_line_long) {
+        stack_cmd_out_printf(&(sess_p->out),
+                             "Error: Line longer than %d characters\n",
+                             STACK_CMD_LINE_MAX - 1);
+    } else if (stack_cmd_session_line_reserve(sess_p, 1)) {
+        sess_p->line_p[sess_p->line_len] = '\0';
+        is_continue = stack_cmd_parse_line(sess_p, sess_p->line_p);
+    } else {
+        stack_cmd_out_printf(&(sess_p->out), "Error: Out of memory\n");
+    }
+    if (! is_continue) {
+        sess_p->is_line_ready = (sess_p->move_to >= 0);
+        return (false);
+    }
+
+    /*
+     * Only a buffer of ordinary size is kept between lines, so one long
+     * value doesn't pin its memory for the rest of the session.
+     */
+    sess_p->line_len = 0;
+    sess_p->is_line_long = false;
+    sess_p->is_line_ready = false;
+    if (sess_p->line_size > STACK_CMD_IN_BUF_SIZE) {
+        free(sess_p->line_p);
+        sess_p->line_p = NULL;
+        sess_p->line_size = 0;
+    }
+    return (true);
+}
+
+/**
+ * Run the complete lines in a block of input. A trailing partial line is
+ * kept until the rest of it arrives.
+ *
+ * @param[in,out] sess_p
+ *     Session to run lines in.
+ * @param[in] data_p
+ *     Input.
+ * @param[in] len
+ *     Number of input bytes.
+ * @param[out] used_p
+ *     Updated with the number of input bytes used, if the session has to
+ *     move. The rest must be fed to the session once it has moved.
+ * @retval true
+ *     Continue execution
+ * @retval false
+ *     End session, or move it to sess_p->move_to. Input after the line
+ *     that ended the session is ignored.
+ */
+static bool stack_cmd_session_feed (stack_cmd_session_t *sess_p,
+                                    const char          *data_p,
+                                    size_t               len,
+                                    size_t              *used_p)
+{
+    const char *nl_p     = NULL;                 /* Next newline              */
+    size_t      part_len = 0;                    /* Bytes up to newline       */
+    size_t      copy_len = 0;                    /* Bytes to add to line      */
+
+    *used_p = 0;
+    while (len > 0) {
+        /*
+         * Add everything up to the next newline to the line, growing the
+         * buffer as needed. A line that gets too long is skipped up to its
+         * newline, and then fails.
+         */
+        nl_p = memchr(data_p, '\n', len);
+        part_len = (NULL != nl_p) ? (size_t)(nl_p - data_p) : len;
+        copy_len = part_len;
+        if ((sess_p->line_len + copy_len) > (STACK_CMD_LINE_MAX - 1)) {
+            sess_p->is_line_long = true;
+        }
+        if ((! sess_p->is_line_long) &&
+            (! stack_cmd_session_line_reserve(sess_p, copy_len + 1))) {
+            sess_p->is_line_long = true;
+        }
+        if ((! sess_p->is_line_long) && (copy_len > 0)) {
+            memcpy(sess_p->line_p + sess_p->line_len, data_p, copy_len);
+            sess_p->line_len += copy_len;
+        }
+        if (NULL == nl_p) {
+            break;
+        }
+        data_p += part_len + 1;
+        len -= part_len + 1;
+        *used_p += part_len + 1;
+
+        if (! stack_cmd_session_run_line(sess_p)) {
+            return (false);
+        }
+        if (NULL != sess_p->prompt_p) {
+            stack_cmd_out_printf(&(sess_p->out), "%s", sess_p->prompt_p);
+        }
+    }
+
+    return (true);
+}
+
+/**
+ * Run any partial line left at the end of input.
+ *
+ * @param[in,out] sess_p
+ *     Session to run line in.
+ * @retval true
+ *     Line run, if there was one.
+ * @retval false
+ *     End session, or move it to sess_p->move_to.
+ */
+static bool stack_cmd_session_finish (stack_cmd_session_t *sess_p)
+{
+    if ((sess_p->line_len > 0) || sess_p->is_line_long) {
+        return (stack_cmd_session_run_line(sess_p));
+    }
+    return (true);
+}
+
+/**
+ * Run a session on commands read from a descriptor, with output to STDOUT.
+ *
+ * @param[in,out] sess_p
+ *     Session to run.
+ * @param[in] fd
+ *     Descriptor to read commands from.
+ */
+static void stack_cmd_run (stack_cmd_session_t *sess_p, int fd)
+{
+    char    *buf_p       = g_stack_cmd_workers[0].in_buf; /* Input buffer     */
+    ssize_t  len         = 0;                    /* Bytes read                */
+    size_t   used        = 0;                    /* Bytes used                */
+    bool     is_continue = true;                 /* Continue to next block?   */
+
+    while (is_continue) {
+        /*
+         * Write output of the previous block. Input is read with read(),
+         * which doesn't flush a prompt the way stdio input would.
+         */
+        stack_cmd_out_fwrite(&(sess_p->out), stdout);
+        if (NULL != sess_p->prompt_p) {
+            (void)fflush(stdout);
+        }
+        stack_cmd_worker_sync(&(g_stack_cmd_workers[0]), true);
+
+        len = read(fd, buf_p, STACK_CMD_IN_BUF_SIZE);
+        if (len < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            fprintf(stderr, "Can't read commands: %s\n", strerror(errno));
+        }
+        if (len <= 0) {
+            (void)stack_cmd_session_finish(sess_p);
+            is_continue = false;
+        } else {
+            is_continue = stack_cmd_session_feed(sess_p, buf_p, len, &used);
+        }
+    }
+    stack_cmd_out_fwrite(&(sess_p->out), stdout);
+}
+
+/**
+ * Send the collected binary responses, and drop the entries they popped.
+ *
+ * @param[in,out] conn_p
+ *     Connection.
+ * @retval true
+ *     Responses sent, or copied to the output buffer to be sent once the
+ *     socket is ready.
+ * @retval false
+ *     The connection failed.
+ */
+static bool stack_cmd_bin_settle (stack_cmd_conn_t *conn_p)
+{
+    stack_cmd_bin_t *bin_p = conn_p->bin_p;      /* Binary protocol state     */
+    struct iovec    *iov_p = NULL;               /* Current vector entry      */
+    struct msghdr    msg;                        /* Message to send           */
+    ssize_t          len   = 0;                  /* Bytes sent                */
+    size_t           skip  = 0;                  /* Bytes of entry sent       */
+    unsigned int     i     = 0;                  /* Loop index counter        */
+
+    /*
+     * Responses can only be sent directly if no earlier output is still
+     * waiting for the socket.
+     */
+    if ((bin_p->num_iov > 0) &&
+        (0 == stack_cmd_out_pending(&(conn_p->sess.out)))) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = bin_p->iov;
+        msg.msg_iovlen = bin_p->num_iov;
+        do {
+            len = sendmsg(conn_p->fd, &msg, MSG_NOSIGNAL);
+        } while ((len < 0) && (EINTR == errno));
+        if (len < 0) {
+            if ((EAGAIN != errno) && (EWOULDBLOCK != errno)) {
+                return (false);
+            }
+            len = 0;
+        }
+    }
+
+    /*
+     * Whatever wasn't sent has to be copied before its stacks change.
+     */
+    for (i = 0; i < bin_p->num_iov; i++) {
+        iov_p = &(bin_p->iov[i]);
+        skip = ((size_t)len < iov_p->iov_len) ? (size_t)len : iov_p->iov_len;
+        len -= skip;
+        stack_cmd_out_append(&(conn_p->sess.out),
+                             (const char*)iov_p->iov_base + skip,
+                             iov_p->iov_len - skip);
+    }
+
+    if (NULL != bin_p->pop_stack_p) {
+        (void)stack_drop(bin_p->pop_stack_p, bin_p->num_pops);
+    }
+    bin_p->num_rsps = 0;
+    bin_p->num_iov = 0;
+    bin_p->num_pins = 0;
+    bin_p->num_pops = 0;
+    bin_p->pop_stack_p = NULL;
+
+    return (! conn_p->sess.out.is_failed);
+}
+
+/**
+ * Determine whether collected binary responses point into a stack.
+ *
+ * @param[in] bin_p
+ *     Binary protocol state.
+ * @param[in] stack_p
+ *     Stack to check.
+ * @retval true
+ *     Responses point into the stack.
+ * @retval false
+ *     They don't.
+ */
+static bool stack_cmd_bin_is_pinned (const stack_cmd_bin_t *bin_p,
+                                     const stack_t         *stack_p)
+{
+    unsigned int i = 0;                          /* Loop index counter        */
+
+    for (i = 0; i < bin_p->num_pins; i++) {
+        if (stack_p == bin_p->pins[i]) {
+            return (true);
+        }
+    }
+    return (false);
+}
+
+/**
+ * Collect a binary response.
+ *
+ * @param[in,out] bin_p
+ *     Binary protocol state. There must be room for another response.
+ * @param[in] op
+ *     Operation of the request being answered.
+ * @param[in] err
+ *     Result.
+ * @param[in] payload_p
+ *     Payload, or NULL for none. Must stay valid until the response is
+ *     sent; if it points into a stack, the stack must be pinned.
+ * @param[in] payload_size
+ *     Size of payload in bytes. Must fit in a uint32_t.
+ */
+static void stack_cmd_bin_respond (stack_cmd_bin_t *bin_p,
+                                   uint8_t          op,
+                                   stack_err_e      err,
+                                   const void      *payload_p,
+                                   size_t           payload_size)
+{
+    stack_wire_rsp_t *rsp_p = &(bin_p->rsps[bin_p->num_rsps]); /* Response   */
+
+    rsp_p->payload_size = (NULL != payload_p) ? (uint32_t)payload_size : 0;
+    rsp_p->err = err;
+    rsp_p->op = op;
+    rsp_p->reserved = 0;
+    bin_p->num_rsps++;
+
+    bin_p->iov[bin_p->num_iov].iov_base = rsp_p;
+    bin_p->iov[bin_p->num_iov].iov_len = sizeof(*rsp_p);
+    bin_p->num_iov++;
+    if ((NULL != payload_p) && (payload_size > 0)) {
+        bin_p->iov[bin_p->num_iov].iov_base = (void*)payload_p;
+        bin_p->iov[bin_p->num_iov].iov_len = payload_size;
+        bin_p->num_iov++;
+    }
+}
+
+/**
+ * Run a binary request.
+ *
+ * @param[in,out] conn_p
+ *     Connection the request came from.
+ * @param[in] req_p
+ *     Request header.
+ * @param[in] name_p
+ *     Stack name, req_p->name_size bytes long.
+ * @param[in] payload_p
+ *     Payload, req_p->payload_size bytes long.
+ * @retval true
+ *     Request run and its response collected.
+ * @retval false
+ *     The connection failed, or the session must move to sess.move_to
+ *     before the request can run.
+ */
+static bool stack_cmd_bin_run (stack_cmd_conn_t       *conn_p,
+                               const stack_wire_req_t *req_p,
+                               const char             *name_p,
+                               const void             *payload_p)
+{
+    stack_cmd_bin_t      *bin_p      = conn_p->bin_p; /* Protocol state       */
+    char                  name[STACK_WIRE_MAX_NAME + 1]; /* Stack name        */
+    stack_cmd_reg_slot_t *slot_p     = NULL;     /* Slot for named stack      */
+    stack_t              *stack_p    = NULL;     /* Stack to work on          */
+    stack_err_e           err        = STACK_E_OK; /* Operation return code   */
+    const void           *entry_p    = NULL;     /* Entry to return           */
+    size_t                entry_size = 0;        /* Size of entry             */
+    uint64_t             *size_p     = NULL;     /* Stack size to return      */
+    uint32_t              hash       = 0;        /* Hash of name              */
+    unsigned int          owner      = 0;        /* Worker that owns stack    */
+
+    /*
+     * Make room for the response before looking at any entries, since
+     * sending the collected responses changes the stack being popped.
+     */
+    if ((STACK_CMD_BIN_MAX_RSPS == bin_p->num_rsps) &&
+        (! stack_cmd_bin_settle(conn_p))) {
+        return (false);
+    }
+
+    stack_p = conn_p->sess.stack_p;
+    owner = conn_p->sess.stack_worker;
+    if (req_p->name_size > 0) {
+        memcpy(name, name_p, req_p->name_size);
+        name[req_p->name_size] = '\0';
+        hash = stack_cmd_reg_hash(name);
+        owner = stack_cmd_reg_owner(hash);
+    }
+    if (stack_cmd_session_move(&(conn_p->sess), owner)) {
+        return (false);
+    }
+    if (req_p->name_size > 0) {
+        slot_p = stack_cmd_reg_get(stack_cmd_session_reg(&(conn_p->sess)),
+                                   name, hash,
+                                   (STACK_WIRE_OP_PUSH == req_p->op));
+        stack_p = (NULL != slot_p) ? slot_p->stack_p : NULL;
+    }
+
+    switch (req_p->op) {
+    case STACK_WIRE_OP_PUSH:
+        if (NULL == stack_p) {
+            err = ((req_p->name_size > 0) &&
+                   (! stack_cmd_journal_name_fits(name))) ?
+                  STACK_E_INVALID : STACK_E_NOMEM;
+            break;
+        }
+        if (stack_cmd_bin_is_pinned(bin_p, stack_p) &&
+            (! stack_cmd_bin_settle(conn_p))) {
+            return (false);
+        }
+        err = stack_push(stack_p, payload_p, req_p->payload_size);
+        break;
+
+    case STACK_WIRE_OP_POP:
+        if (NULL == stack_p) {
+            err = STACK_E_EMPTY;
+            break;
+        }
+
+        /*
+         * Pops are taken from a walk over the stack, and only one stack at
+         * a time can be walked.
+         */
+        if (stack_p != bin_p->pop_stack_p) {
+            if (((NULL != bin_p->pop_stack_p) ||
+                 stack_cmd_bin_is_pinned(bin_p, stack_p) ||
+                 (STACK_CMD_BIN_MAX_PINS == bin_p->num_pins)) &&
+                (! stack_cmd_bin_settle(conn_p))) {
+                return (false);
+            }
+            bin_p->pop_stack_p = stack_p;
+            stack_iter_init(&(bin_p->pop_iter), stack_p);
+            bin_p->pins[bin_p->num_pins] = stack_p;
+            bin_p->num_pins++;
+        }
+        if (! stack_iter_next(&(bin_p->pop_iter), &entry_p, &entry_size)) {
+            err = STACK_E_EMPTY;
+            break;
+        }
+
+        /*
+         * An entry too large for a response stays on top. Ending the walk
+         * leaves it there for the next pop to find.
+         */
+        if (entry_size > UINT32_MAX) {
+            if (! stack_cmd_bin_settle(conn_p)) {
+                return (false);
+            }
+            err = STACK_E_BUF_OVERFLOW;
+            break;
+        }
+        bin_p->num_pops++;
+        break;
+
+    case STACK_WIRE_OP_PEEK:
+        if (NULL == stack_p) {
+            err = STACK_E_EMPTY;
+            break;
+        }
+        if (((stack_p == bin_p->pop_stack_p) ||
+             ((! stack_cmd_bin_is_pinned(bin_p, stack_p)) &&
+              (STACK_CMD_BIN_MAX_PINS == bin_p->num_pins))) &&
+            (! stack_cmd_bin_settle(conn_p))) {
+            return (false);
+        }
+        err = stack_top_view(stack_p, (void**)&entry_p, &entry_size);
+        if ((! stack_err_e_is_error(err)) && (entry_size > UINT32_MAX)) {
+            err = STACK_E_BUF_OVERFLOW;
+        }
+        if ((! stack_err_e_is_error(err)) &&
+            (! stack_cmd_bin_is_pinned(bin_p, stack_p))) {
+            bin_p->pins[bin_p->num_pins] = stack_p;
+            bin_p->num_pins++;
+        }
+        break;
 
-    out_args_size = sizeof(out_args);
-    err = stack_peek(g_stack_p, out_args, &out_args_size);
-    if (stack_err_e_is_error(err)) {
-        printf("Error: Can't peek: %d(%s)\n",
-               err, stack_err_e_to_string(err));
-    } else {
-        out_args[out_args_size] = '\0';
-        printf("'%s' is at top of stack\n", out_args);
+    case STACK_WIRE_OP_SIZE:
+        size_p = &(bin_p->sizes[bin_p->num_rsps]);
+        *size_p = 0;
+        if (NULL != stack_p) {
+            *size_p = stack_get_num_entries(stack_p);
+            if (stack_p == bin_p->pop_stack_p) {
+                *size_p -= bin_p->num_pops;
+            }
+        }
+        entry_p = size_p;
+        entry_size = sizeof(*size_p);
+        break;
+
+    default:
+        err = STACK_E_INVALID;
+        break;
     }
 
+    stack_cmd_bin_respond(bin_p, req_p->op, err,
+                          stack_err_e_is_error(err) ? NULL : entry_p,
+                          entry_size);
     return (true);
 }
 
 /**
- * Handle 'pop' command.
+ * Prepare to run a block of input from a connection. If input from earlier
+ * blocks is still waiting to be run, the block is added to it.
  *
+ * @param[in,out] conn_p
+ *     Connection the input came from.
+ * @param[in,out] data_pp
+ *     Input. Updated to point at all of the input waiting to be run.
+ * @param[in,out] len_p
+ *     Number of input bytes. Updated to the number waiting to be run.
  * @retval true
- *     Continue processing.
+ *     Input ready to run. The connection's input buffer counts as empty
+ *     until stack_cmd_conn_keep() is called.
  * @retval false
- *     Exit program. 
+ *     Out of memory.
  */
-static bool stack_cmd_pop (__attribute__((unused)) const char* args)
+static bool stack_cmd_conn_gather (stack_cmd_conn_t  *conn_p,
+                                   const char       **data_pp,
+                                   size_t            *len_p)
 {
-    stack_err_e err           = STACK_E_OK;      /* Operation return code     */
-    char        out_args[128] = "";              /* Popped value buffer       */
-    size_t      out_args_size = 0;               /* Popped value buffer size  */
+    char   *in_p    = NULL;                      /* Grown input buffer        */
+    size_t  in_size = 0;                         /* Grown input buffer size   */
 
-    out_args_size = sizeof(out_args);
-    err = stack_pop(g_stack_p, out_args, &out_args_size);
-    if (stack_err_e_is_error(err)) {
-        printf("Error: Can't pop: %d(%s)\n",
-               err, stack_err_e_to_string(err));
-    } else {
-        out_args[out_args_size] = '\0';
-        printf("Popped '%s' off the stack\n", out_args);
+    if (0 == conn_p->in_len) {
+        return (true);
+    }
+
+    if ((conn_p->in_size - conn_p->in_len) < *len_p) {
+        in_size = 2 * (conn_p->in_len + *len_p);
+        in_p = realloc(conn_p->in_p, in_size);
+        if (NULL == in_p) {
+            return (false);
+        }
+        conn_p->in_p = in_p;
+        conn_p->in_size = in_size;
     }
+    if (*len_p > 0) {
+        memcpy(conn_p->in_p + conn_p->in_len, *data_pp, *len_p);
+    }
+    *len_p += conn_p->in_len;
+    *data_pp = conn_p->in_p;
+    conn_p->in_len = 0;
 
     return (true);
 }
 
 /**
- * Handle 'push' command.
+ * Keep input that can't be run yet in a connection's input buffer.
  *
+ * @param[in,out] conn_p
+ *     Connection the input came from.
+ * @param[in] data_p
+ *     Input to keep. May point into the connection's input buffer.
+ * @param[in] len
+ *     Number of input bytes.
  * @retval true
- *     Continue processing.
+ *     Input kept.
  * @retval false
- *     Exit program. 
+ *     Out of memory.
  */
-static bool stack_cmd_push (const char* args)
+static bool stack_cmd_conn_keep (stack_cmd_conn_t *conn_p,
+                                 const char       *data_p,
+                                 size_t            len)
 {
-    stack_err_e err = STACK_E_OK;                /* Operation return code     */
+    char   *in_p    = NULL;                      /* New input buffer          */
+    size_t  in_size = 0;                         /* New input buffer size     */
 
-    err = stack_push(g_stack_p, args, strlen(args));
-    if (stack_err_e_is_error(err)) {
-        printf("Error: Can't push '%s': %d(%s)",
-               args, err, stack_err_e_to_string(err));
-    } else {
-        printf("Pushed '%s' unto the stack\n", args);
+    if (conn_p->in_size < len) {
+        in_size = 2 * len;
+        in_p = malloc(in_size);
+        if (NULL == in_p) {
+            return (false);
+        }
+        memcpy(in_p, data_p, len);
+        free(conn_p->in_p);
+        conn_p->in_p = in_p;
+        conn_p->in_size = in_size;
+    } else if (len > 0) {
+        memmove(conn_p->in_p, data_p, len);
     }
+    conn_p->in_len = len;
 
     return (true);
 }
 
 /**
- * Handle 'quit' command.
+ * Run the complete binary requests in a block of input. A trailing partial
+ * request is kept until the rest of it arrives. The responses are only
+ * collected; stack_cmd_bin_settle() sends them.
  *
+ * @param[in,out] conn_p
+ *     Connection the input came from.
+ * @param[in] data_p
+ *     Input.
+ * @param[in] len
+ *     Number of input bytes.
  * @retval true
- *     Continue processing.
+ *     Continue execution
  * @retval false
- *     Exit program. 
+ *     The connection failed or broke the protocol, or the session must
+ *     move to sess.move_to. In the latter case, the request that needs the
+ *     move and those after it are kept, to be run by that worker.
  */
-static bool stack_cmd_quit (__attribute__((unused)) const char* args)
+static bool stack_cmd_bin_feed (stack_cmd_conn_t *conn_p,
+                                const char       *data_p,
+                                size_t            len)
 {
-    return (false);
+    stack_wire_req_t req;                        /* Current request header    */
+    size_t           req_size = 0;               /* Size of current request   */
+
+    /*
+     * Requests are run straight from the input block, unless the block
+     * completes a request that started in an earlier block.
+     */
+    if (! stack_cmd_conn_gather(conn_p, &data_p, &len)) {
+        return (false);
+    }
+
+    while (len >= sizeof(req)) {
+        memcpy(&req, data_p, sizeof(req));
+        if ((req.payload_size > STACK_WIRE_MAX_PAYLOAD) ||
+            (req.name_size > STACK_WIRE_MAX_NAME) || (0 != req.reserved)) {
+            return (false);
+        }
+        req_size = sizeof(req) + req.name_size + req.payload_size;
+        if (len < req_size) {
+            break;
+        }
+        if (NULL != memchr(data_p + sizeof(req), '\0', req.name_size)) {
+            return (false);
+        }
+        if (! stack_cmd_bin_run(conn_p, &req, data_p + sizeof(req),
+                                data_p + sizeof(req) + req.name_size)) {
+            if ((conn_p->sess.move_to >= 0) &&
+                (! stack_cmd_conn_keep(conn_p, data_p, len))) {
+                conn_p->sess.move_to = -1;
+            }
+            return (false);
+        }
+        data_p += req_size;
+        len -= req_size;
+    }
+
+    return (stack_cmd_conn_keep(conn_p, data_p, len));
 }
 
 /**
- * Handle 'show' command.
+ * Run the complete text lines in a block of input, after any line and
+ * input left over from before the session moved.
  *
+ * @param[in,out] conn_p
+ *     Connection the input came from.
+ * @param[in] data_p
+ *     Input.
+ * @param[in] len
+ *     Number of input bytes.
  * @retval true
- *     Continue procesing.
+ *     Continue execution
  * @retval false
- *     Exit program. 
+ *     End session, or move it to sess.move_to. In the latter case, the
+ *     line that needs the move and the input after it are kept, to be run
+ *     by that worker.
  */
-static bool stack_cmd_show (__attribute__((unused)) const char* args)
+static bool stack_cmd_text_feed (stack_cmd_conn_t *conn_p,
+                                 const char       *data_p,
+                                 size_t            len)
 {
-    stack_print(g_stack_p);
+    stack_cmd_session_t *sess_p = &(conn_p->sess); /* Connection session      */
+    size_t               used   = 0;             /* Bytes used                */
+
+    if (! stack_cmd_conn_gather(conn_p, &data_p, &len)) {
+        return (false);
+    }
+
+    /*
+     * A session that moves stops at the line that needs the move. The
+     * input after that line is kept and the line itself stays ready in the
+     * session, and both are run once the move is done. If the input can't
+     * be kept, the session ends instead.
+     */
+    if (sess_p->is_line_ready) {
+        if (! stack_cmd_session_run_line(sess_p)) {
+            if ((sess_p->move_to >= 0) &&
+                (! stack_cmd_conn_keep(conn_p, data_p, len))) {
+                sess_p->move_to = -1;
+            }
+            return (false);
+        }
+        if ((NULL != sess_p->prompt_p) && (! conn_p->is_eof)) {
+            stack_cmd_out_printf(&(sess_p->out), "%s", sess_p->prompt_p);
+        }
+    }
+    if (! stack_cmd_session_feed(sess_p, data_p, len, &used)) {
+        if ((sess_p->move_to >= 0) &&
+            (! stack_cmd_conn_keep(conn_p, data_p + used, len - used))) {
+            sess_p->move_to = -1;
+        }
+        return (false);
+    }
+    if (conn_p->is_eof) {
+        return (stack_cmd_session_finish(sess_p));
+    }
+
     return (true);
 }
 
 /**
- * Handle 'size' command.
+ * Run a block of input from a connection in the protocol it speaks,
+ * choosing the protocol from the first byte if it isn't yet known.
  *
+ * @param[in,out] conn_p
+ *     Connection the input came from.
+ * @param[in] data_p
+ *     Input.
+ * @param[in] len
+ *     Number of input bytes. 0 to just run input left over from before
+ *     the session moved, or, at the end of input, a trailing partial line.
  * @retval true
- *     Continue processing.
+ *     Continue execution
  * @retval false
- *     Exit program. 
+ *     End session, or move it to sess.move_to. For the binary protocol,
+ *     the connection may also have failed or broken the protocol.
  */
-static bool stack_cmd_size (__attribute__((unused)) const char* args)
+static bool stack_cmd_conn_feed (stack_cmd_conn_t *conn_p,
+                                 const char       *data_p,
+                                 size_t            len)
 {
-    printf("There are %lu entries in the stack.\n",
-           stack_get_num_entries(g_stack_p));
+    if ((STACK_CMD_PROTO_UNKNOWN == conn_p->proto) && (len > 0)) {
+        conn_p->proto = STACK_CMD_PROTO_TEXT;
+        if (STACK_WIRE_HELLO == (unsigned char)data_p[0]) {
+            conn_p->bin_p = calloc(1, sizeof(*(conn_p->bin_p)));
+            if (NULL == conn_p->bin_p) {
+                return (false);
+            }
+            conn_p->proto = STACK_CMD_PROTO_BINARY;
+            data_p++;
+            len--;
+        }
+    }
 
-    return (true);
+    switch (conn_p->proto) {
+    case STACK_CMD_PROTO_TEXT:
+        return (stack_cmd_text_feed(conn_p, data_p, len));
+    case STACK_CMD_PROTO_BINARY:
+        return ((stack_cmd_bin_feed(conn_p, data_p, len)) &&
+                (stack_cmd_bin_settle(conn_p)));
+    default:
+        return (true);
+    }
 }
 
 /**
- * Supported commands for interactive parser.
+ * Close a connection and end its session.
+ *
+ * @param[in] worker_p
+ *     Worker running the connection.
+ * @param[in] conn_p
+ *     Connection to close. It is freed.
  */
-static stack_cmd_command_t g_stack_cmd_commands[] =
+static void stack_cmd_conn_close (stack_cmd_worker_t *worker_p,
+                                  stack_cmd_conn_t   *conn_p)
 {
-    { "help", NULL,    "Show this message",          stack_cmd_help },
-    { "peek", NULL,    "Look at top entry of stack", stack_cmd_peek },
-    { "pop",  NULL,    "Remove top entry of stack",  stack_cmd_pop },
-    { "push", "<val>", "Add <val> to stack",         stack_cmd_push },
-    { "quit", NULL,    "End program",                stack_cmd_quit },
-    { "show", NULL,    "Display stack",              stack_cmd_show },
-    { "size", NULL,    "Display stack size",         stack_cmd_size },
-};
+    if (NULL != conn_p->bin_p) {
+        /*
+         * Drop any entries popped by responses that will never be sent.
+         */
+        conn_p->bin_p->num_iov = 0;
+        (void)stack_cmd_bin_settle(conn_p);
+        free(conn_p->bin_p);
+    }
+    (void)epoll_ctl(worker_p->ep_fd, EPOLL_CTL_DEL, conn_p->fd, NULL);
+    (void)close(conn_p->fd);
+    stack_cmd_session_fini(&(conn_p->sess));
+    free(conn_p->in_p);
+    free(conn_p);
+}
 
 /**
- * Number of commands supported by parser.
+ * Hand a connection over to the worker its session has to move to.
+ *
+ * @param[in] worker_p
+ *     Worker running the connection.
+ * @param[in] conn_p
+ *     Connection to move. It is closed if its collected binary responses
+ *     can't be sent.
  */
-#define STACK_CMD_NUM_COMMANDS \
-            (sizeof(g_stack_cmd_commands) / sizeof(stack_cmd_command_t))
+static void stack_cmd_conn_move (stack_cmd_worker_t *worker_p,
+                                 stack_cmd_conn_t   *conn_p)
+{
+    stack_cmd_worker_t *dst_p = NULL;            /* Worker to move to         */
+    uint64_t            one   = 1;               /* eventfd increment         */
 
-/**
- * Command 'name' field header.
- */
-#define STACK_CMD_HDR_NAME "Command"
+    /*
+     * Collected responses point into stacks of this worker, which the
+     * destination worker mustn't touch.
+     */
+    if ((NULL != conn_p->bin_p) && (! stack_cmd_bin_settle(conn_p))) {
+        stack_cmd_conn_close(worker_p, conn_p);
+        return;
+    }
+    (void)epoll_ctl(worker_p->ep_fd, EPOLL_CTL_DEL, conn_p->fd, NULL);
+    conn_p->events = 0;
+
+    dst_p = &(g_stack_cmd_workers[conn_p->sess.move_to]);
+    conn_p->sess.worker = dst_p->index;
+    conn_p->sess.move_to = -1;
+
+    (void)pthread_mutex_lock(&(dst_p->inbox_lock));
+    conn_p->next_p = dst_p->inbox_p;
+    dst_p->inbox_p = conn_p;
+    (void)pthread_mutex_unlock(&(dst_p->inbox_lock));
+    (void)write(dst_p->wake_fd, &one, sizeof(one));
+}
 
 /**
- * Command 'help' field header.
+ * Update the events a connection is registered for, to match what it is
+ * waiting for.
+ *
+ * @param[in] worker_p
+ *     Worker running the connection.
+ * @param[in,out] conn_p
+ *     Connection.
+ * @retval true
+ *     Events updated.
+ * @retval false
+ *     epoll failed.
  */
-#define STACK_CMD_HDR_HELP "Description"
+static bool stack_cmd_conn_watch (stack_cmd_worker_t *worker_p,
+                                  stack_cmd_conn_t   *conn_p)
+{
+    struct epoll_event event;                    /* Events to wait for        */
+    size_t             pending = 0;              /* Output not yet sent       */
+    int                op      = EPOLL_CTL_MOD;  /* epoll operation           */
+
+    pending = stack_cmd_out_pending(&(conn_p->sess.out));
+    memset(&event, 0, sizeof(event));
+    event.data.ptr = conn_p;
+    if ((! conn_p->is_closing) && (pending < STACK_CMD_OUT_HIGH_WATER)) {
+        event.events |= EPOLLIN;
+    }
+    if (pending > 0) {
+        event.events |= EPOLLOUT;
+    }
 
+    if (event.events == conn_p->events) {
+        return (true);
+    }
+    if (0 == conn_p->events) {
+        op = EPOLL_CTL_ADD;
+    }
+    conn_p->events = event.events;
+    return (0 == epoll_ctl(worker_p->ep_fd, op, conn_p->fd, &event));
+}
 
 /**
- * Print help message to STDOUT.
+ * Handle events on a connection: run the commands it has sent and send
+ * back as much of their output as it will take.
+ *
+ * @param[in] worker_p
+ *     Worker running the connection.
+ * @param[in] conn_p
+ *     Connection. It is freed if it is closed.
+ * @param[in] events
+ *     Events that occurred, or 0 if the connection just moved to the
+ *     worker.
  */
-static bool stack_cmd_help (__attribute__((unused)) const char* args)
+static void stack_cmd_conn_handle (stack_cmd_worker_t *worker_p,
+                                   stack_cmd_conn_t   *conn_p,
+                                   uint32_t            events)
 {
-    unsigned int         i,j          = 0;       /* Loop index counter        */
-    size_t               max_name_len = 0;       /* Maximum command name size */
-    size_t               max_help_len = 0;       /* Maximum help string size  */
-    stack_cmd_command_t *command_p    = NULL;    /* Current command           */
-    size_t               cmd_name_len = 0;       /* Current command name size */
-    size_t               cmd_help_len = 0;       /* Current help string size  */
+    stack_cmd_session_t *sess_p      = &(conn_p->sess); /* Connection session */
+    ssize_t              len         = 0;        /* Bytes read                */
+    bool                 is_continue = true;     /* Keep session going?       */
 
     /*
-     * Determine column sizes.
+     * A connection that just moved first runs what it moved for.
      */
-    max_name_len = strlen(STACK_CMD_HDR_NAME);
-    max_help_len = strlen(STACK_CMD_HDR_HELP);
-    for (i = 0; i < STACK_CMD_NUM_COMMANDS; i++) {
-        command_p = &(g_stack_cmd_commands[i]);
-
-        cmd_name_len = strlen(command_p->name);
-        if (NULL != command_p->args) {
-            cmd_name_len += 1 + strlen(command_p->args);
-        }
-        if (cmd_name_len > max_name_len) {
-            max_name_len = cmd_name_len;
-        }
-
-        cmd_help_len = strlen(command_p->help);
-        if (cmd_help_len > max_help_len) {
-            max_help_len = cmd_help_len;
-        }
+    if (0 == events) {
+        is_continue = stack_cmd_conn_feed(conn_p, NULL, 0);
     }
 
     /*
-     * Print header, which will be of the form:
-     *
-     * Command      Description
-     * ===========  ==============
+     * Read and run commands until the socket has no more, or until there
+     * is too much output waiting for the client to take.
      */
-    printf(STACK_CMD_HDR_NAME "  ");
-    cmd_name_len = strlen(STACK_CMD_HDR_NAME);
-    for (i = 0; i < (max_name_len - cmd_name_len); i++) {
-        putchar(' ');
+    if ((is_continue) &&
+        (0 != (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) &&
+        (0 != (conn_p->events & EPOLLIN))) {
+        while ((is_continue) && (stack_cmd_out_pending(&(sess_p->out)) <
+                                                   STACK_CMD_OUT_HIGH_WATER)) {
+            len = read(conn_p->fd, worker_p->in_buf, sizeof(worker_p->in_buf));
+            if (len < 0) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                if ((EAGAIN == errno) || (EWOULDBLOCK == errno)) {
+                    break;
+                }
+                stack_cmd_conn_close(worker_p, conn_p);
+                return;
+            }
+            if (0 == len) {
+                conn_p->is_eof = true;
+                is_continue = stack_cmd_conn_feed(conn_p, NULL, 0);
+                break;
+            }
+            is_continue = stack_cmd_conn_feed(conn_p, worker_p->in_buf, len);
+        }
     }
-    printf(STACK_CMD_HDR_HELP "\n");
-    for (i = 0; i < max_name_len; i++) {
-        putchar('=');
+
+    if ((! is_continue) && (sess_p->move_to >= 0)) {
+        stack_cmd_conn_move(worker_p, conn_p);
+        return;
     }
-    printf("  ");
-    for (i = 0; i < max_help_len; i++) {
-        putchar('=');
+    if ((! is_continue) || (conn_p->is_eof)) {
+        conn_p->is_closing = true;
     }
-    printf("\n");
 
-    /*
-     * Print commands.
-     */
-    for (i = 0; i < STACK_CMD_NUM_COMMANDS; i++) {
-        command_p = &(g_stack_cmd_commands[i]);
+    if ((sess_p->out.is_failed) ||
+        (! stack_cmd_out_send(&(sess_p->out), conn_p->fd)) ||
+        ((conn_p->is_closing) && (0 == stack_cmd_out_pending(&(sess_p->out))))
+        || (! stack_cmd_conn_watch(worker_p, conn_p))) {
+        stack_cmd_conn_close(worker_p, conn_p);
+    }
+}
 
-        printf("%s", command_p->name);
-        cmd_name_len = strlen(command_p->name);
-        if (NULL != command_p->args) {
-            printf(" %s", command_p->args);
-            cmd_name_len += 1 + strlen(command_p->args);
+/**
+ * Accept all pending connections.
+ *
+ * @param[in] worker_p
+ *     Worker to run the connections.
+ */
+static void stack_cmd_conn_accept (stack_cmd_worker_t *worker_p)
+{
+    stack_cmd_conn_t *conn_p = NULL;             /* New connection            */
+    int               fd     = -1;               /* New connection socket     */
+
+    for (;;) {
+        fd = accept(worker_p->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if ((EAGAIN != errno) && (EWOULDBLOCK != errno) &&
+                (EINTR != errno)) {
+                fprintf(stderr, "Can't accept connection: %s\n",
+                        strerror(errno));
+            }
+            if (EINTR == errno) {
+                continue;
+            }
+            return;
         }
-        for (j = 0; j < (max_name_len - cmd_name_len); j++) {
-            putchar(' ');
+
+        conn_p = calloc(1, sizeof(*conn_p));
+        if ((NULL == conn_p) ||
+            (0 != fcntl(fd, F_SETFL, O_NONBLOCK)) ||
+            (0 != fcntl(fd, F_SETFD, FD_CLOEXEC))) {
+            free(conn_p);
+            (void)close(fd);
+            continue;
         }
+        conn_p->fd = fd;
+        conn_p->proto = STACK_CMD_PROTO_UNKNOWN;
+        stack_cmd_session_init(&(conn_p->sess), worker_p->index, NULL);
 
-        printf("  %s\n", command_p->help);
+        if (! stack_cmd_conn_watch(worker_p, conn_p)) {
+            stack_cmd_session_fini(&(conn_p->sess));
+            free(conn_p);
+            (void)close(fd);
+        }
     }
+}
 
-    return (true);
+/**
+ * Pick up the connections moved to a worker.
+ *
+ * @param[in] worker_p
+ *     Worker to pick up connections.
+ */
+static void stack_cmd_worker_wake (stack_cmd_worker_t *worker_p)
+{
+    stack_cmd_conn_t *conn_p = NULL;             /* Current connection        */
+    stack_cmd_conn_t *next_p = NULL;             /* Next connection           */
+    uint64_t          count  = 0;                /* eventfd counter           */
+
+    (void)read(worker_p->wake_fd, &count, sizeof(count));
+
+    (void)pthread_mutex_lock(&(worker_p->inbox_lock));
+    conn_p = worker_p->inbox_p;
+    worker_p->inbox_p = NULL;
+    (void)pthread_mutex_unlock(&(worker_p->inbox_lock));
+
+    for (; NULL != conn_p; conn_p = next_p) {
+        next_p = conn_p->next_p;
+        stack_cmd_conn_handle(worker_p, conn_p, 0);
+    }
 }
 
 /**
- * Parse next line.
+ * Run a worker's event loop. Only returns on error.
  *
- * @retval true
- *     Continue execution
- * @retval false
- *     End program.
+ * @param[in] arg_p
+ *     Worker.
+ * @returns
+ *     NULL
  */
-static bool stack_cmd_parse_line (void)
+static void *stack_cmd_worker_main (void *arg_p)
 {
-    bool match[STACK_CMD_NUM_COMMANDS];          /* Command match status      */
-    int  c        = EOF;                         /* Current character         */
-    char cmd[128] = "";                          /* Command string so far     */
-    unsigned int  cmd_pos  = 0;                          /* Position in command string*/
-    int  num_matches = 0;                        /* # Matching commands so far*/
-    stack_cmd_command_t *command_p    = NULL;    /* Current command           */
-    char args[128] = "";                         /* Argument string           */
-    unsigned int args_pos = 0;                          /* Position in argument str  */
-    bool is_continue = true;                     /* Continue to next line?    */
-    unsigned int i = 0;                          /* Loop index counter        */
+    stack_cmd_worker_t *worker_p   = arg_p;      /* Worker                    */
+    struct epoll_event  events[STACK_CMD_MAX_EVENTS]; /* Events that occurred */
+    int                 num_events = 0;          /* Number of events          */
+    int                 timeout_ms = -1;         /* Longest wait for events   */
+    int                 i          = 0;          /* Loop index counter        */
 
     /*
-     * Strip initial whitespace
+     * With journaled stacks, wake up at least once per flush interval, so
+     * that the journals of idle stacks are flushed too.
      */
+    if ((NULL != g_stack_cmd_journal_dir_p) && (0 != g_stack_cmd_sync_ms)) {
+        timeout_ms = g_stack_cmd_sync_ms;
+    }
+
     for (;;) {
-        c = getchar();
-        if (EOF == c) {
-           /*
-            * No more input.
-            */
-           return (false);
-        } else if ('\n' == c) {
-           /*
-            * Ignore blank lines.
-            */
-           return (true);
-        } else if (('\t' != c) && (' ' != c)) {
-           /*
-            * We have reached the end of the whitespace. Start main processing.
-            */
-           break;
-        }
-    }
-
-    /*
-     * Start by treating all possible commands as matches.
-     * We will eliminate possiblities with each input character.
-     */
-    memset(match, true, sizeof(match));
-    num_matches = STACK_CMD_NUM_COMMANDS;
-    cmd_pos = 0;    
-    for (;;) {
-        /*
-         * Truncate command if we run out of buffer space to store it,
-         * otherwise add next character to command and see update the
-         * match list.
-         */
-        if (cmd_pos < sizeof(cmd)) {
-            cmd[cmd_pos] = c;
-
-            if (num_matches > 0) {
-                for (i = 0; i < STACK_CMD_NUM_COMMANDS; i++) {
-                    if (match[i]) {
-                        command_p = &(g_stack_cmd_commands[i]);
-                        if ((cmd_pos >= (strlen(command_p->name))) ||
-                            (toupper(command_p->name[cmd_pos]) != toupper(c))) {
-                            match[i] = false;
-                            num_matches--;
-                        }
-                    }
-                }
+        num_events = epoll_wait(worker_p->ep_fd, events, STACK_CMD_MAX_EVENTS,
+                                timeout_ms);
+        if (timeout_ms >= 0) {
+            stack_cmd_worker_sync(worker_p, false);
+        }
+        if (num_events < 0) {
+            if (EINTR == errno) {
+                continue;
             }
+            fprintf(stderr, "Can't wait for events: %s\n", strerror(errno));
+            break;
         }
 
-        /*
-         * Continue until we reach end of command word.
-         */
-        cmd_pos++;
-        c = getchar();
-        if ((EOF == c) || ('\n' == c) || (' ' == c) || ('\t' == c)) { 
-            cmd[cmd_pos] = '\0';
-            break;
+        for (i = 0; i < num_events; i++) {
+            if (NULL == events[i].data.ptr) {
+                stack_cmd_conn_accept(worker_p);
+            } else if (worker_p == events[i].data.ptr) {
+                stack_cmd_worker_wake(worker_p);
+            } else {
+                stack_cmd_conn_handle(worker_p, events[i].data.ptr,
+                                      events[i].events);
+            }
         }
     }
 
-    /*
-     * Populate argument list from remaining characters on line, after
-     * first stripping out any whitespace between the command and
-     * first argument.
-     */
-    while ((' ' == c) || ('\t' == c)) {
-        c = getchar();
+    return (NULL);
+}
+
+/**
+ * Serve sessions to clients connecting to a Unix domain socket. Only
+ * returns on error.
+ *
+ * Every worker waits for connections on the listening socket and runs
+ * the ones it accepts, until they have to move to another worker.
+ *
+ * @param[in] path_p
+ *     Path to create socket at. A stale socket at the path is replaced.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_cmd_serve (const char *path_p)
+{
+    struct sockaddr_un  addr;                    /* Socket address            */
+    struct stat         st;                      /* Existing file at path     */
+    struct epoll_event  event;                   /* Event to wait for         */
+    stack_cmd_worker_t *worker_p   = NULL;       /* Current worker            */
+    int                 listen_fd  = -1;         /* Listening socket          */
+    unsigned int        num_run    = 0;          /* Number of workers running */
+    unsigned int        i          = 0;          /* Loop index counter        */
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path_p) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path '%s' is too long\n", path_p);
+        return (-1);
+    }
+    strcpy(addr.sun_path, path_p);
+    if ((0 == lstat(path_p, &st)) && S_ISSOCK(st.st_mode)) {
+        (void)unlink(path_p);
     }
-    args_pos = 0;
-    while ((c != '\n') && (c != EOF)) {
-        /*
-         * Truncate argument if we run out of buffer space to store it.
-         * Otherwise, add the next character to the argument.
-         */
-        if (args_pos < sizeof(args)) {
-            args[args_pos] = c;
-            args_pos++;
-        }
 
-        c = getchar();
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if ((listen_fd < 0) ||
+        (0 != bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))) ||
+        (0 != listen(listen_fd, STACK_CMD_LISTEN_BACKLOG))) {
+        fprintf(stderr, "Can't listen on '%s': %s\n", path_p, strerror(errno));
+        if (listen_fd >= 0) {
+            (void)close(listen_fd);
+        }
+        return (-1);
     }
-    args[args_pos] = '\0';
 
-    if (0 == num_matches) {
-        printf("Unknown command '%s'. Type HELP for command list.\n", cmd);
-    } else if (1 == num_matches) {
-        for (i = 0; i < STACK_CMD_NUM_COMMANDS; i++) {
-            if (match[i]) {
-                command_p = &(g_stack_cmd_commands[i]);
-                is_continue = command_p->cb(args);
-                break;
-            }
+    /*
+     * The listening socket is registered with no data pointer and the
+     * wake-up eventfd with the worker itself, which tells their events apart
+     * from those of connections. Only one worker is woken per connection.
+     */
+    for (i = 0; i < g_stack_cmd_num_workers; i++) {
+        worker_p = &(g_stack_cmd_workers[i]);
+        worker_p->listen_fd = listen_fd;
+        worker_p->ep_fd = epoll_create1(EPOLL_CLOEXEC);
+        worker_p->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if ((worker_p->ep_fd < 0) || (worker_p->wake_fd < 0)) {
+            break;
+        }
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.ptr = NULL;
+        if (0 != epoll_ctl(worker_p->ep_fd, EPOLL_CTL_ADD, listen_fd, &event)) {
+            break;
+        }
+        event.events = EPOLLIN;
+        event.data.ptr = worker_p;
+        if (0 != epoll_ctl(worker_p->ep_fd, EPOLL_CTL_ADD, worker_p->wake_fd,
+                           &event)) {
+            break;
         }
+    }
+    if (i < g_stack_cmd_num_workers) {
+        fprintf(stderr, "Can't create event loop: %s\n", strerror(errno));
     } else {
         /*
-         * Multiple matches. 
+         * Worker 0 runs on this thread.
          */
-        printf("Incomplete command '%s'. Type HELP for command list.\n", cmd);
+        for (num_run = 1; num_run < g_stack_cmd_num_workers; num_run++) {
+            worker_p = &(g_stack_cmd_workers[num_run]);
+            if (0 != pthread_create(&(worker_p->thread), NULL,
+                                    stack_cmd_worker_main, worker_p)) {
+                fprintf(stderr, "Can't start worker %u\n", num_run);
+                break;
+            }
+        }
+        if (num_run == g_stack_cmd_num_workers) {
+            (void)stack_cmd_worker_main(&(g_stack_cmd_workers[0]));
+        }
+        for (i = 1; i < num_run; i++) {
+            (void)pthread_join(g_stack_cmd_workers[i].thread, NULL);
+        }
     }
 
-    if ((!is_continue) || (EOF == c)) {
-        return (false);
+    for (i = 0; i < g_stack_cmd_num_workers; i++) {
+        worker_p = &(g_stack_cmd_workers[i]);
+        if (worker_p->ep_fd >= 0) {
+            (void)close(worker_p->ep_fd);
+        }
+        if (worker_p->wake_fd >= 0) {
+            (void)close(worker_p->wake_fd);
+        }
     }
-    return (true);
+    (void)close(listen_fd);
+    return (-1);
+}
+
+/**
+ * Print usage message to STDERR.
+ *
+ * @param[in] prog_p
+ *     Name the program was run as.
+ */
+static void stack_cmd_usage (const char *prog_p)
+{
+    fprintf(stderr, "Usage: %s [<journal options>] [-f <script>]\n"
+                    "       %s [<journal options>] -l <socket path> "
+                    "[-t <threads>]\n"
+                    "Journal options: -j <dir> [-s <ops>] [-i <ms>]\n",
+            prog_p, prog_p);
 }
 
 /**
  * Command line interface.
  *
  * @param argc
- *     Number of arguments. Currently ignored.
+ *     Number of arguments.
  * @param argv
- *     Argument list. Currently ignored.
+ *     Argument list. See the file description for the options.
  * @retval 0
  *     Successful completion.
  * @retval -1
  *     An error occurred.
  */
-int main (__attribute__((unused)) int argc,
-          __attribute__((unused)) char* argv[])
+int main (int argc, char* argv[])
 {
+    static const struct option long_options[] = {
+        { "file",     required_argument, NULL, 'f' },
+        { "sync-ms",  required_argument, NULL, 'i' },
+        { "journal",  required_argument, NULL, 'j' },
+        { "listen",   required_argument, NULL, 'l' },
+        { "sync-ops", required_argument, NULL, 's' },
+        { "threads",  required_argument, NULL, 't' },
+        { NULL,       0,                 NULL, 0   }
+    };
+    const char          *script_p    = NULL;     /* Script to run, if any     */
+    const char          *listen_p    = NULL;     /* Socket to serve, if any   */
+    char                *end_p       = NULL;     /* End of number option      */
+    unsigned long        num_workers = 1;        /* Number of server threads  */
+    unsigned long        sync_ms     = 0;        /* Flush interval option     */
+    bool                 is_batch    = false;    /* Leave out prompts?        */
+    int                  opt         = 0;        /* Current option            */
+    int                  fd          = STDIN_FILENO; /* Command input         */
+    int                  rc          = 0;        /* Exit status               */
+    stack_cmd_session_t  sess;                   /* Shell session             */
+
+    while (-1 != (opt = getopt_long(argc, argv, "f:i:j:l:s:t:", long_options,
+                                    NULL))) {
+        switch (opt) {
+        case 'f':
+            script_p = optarg;
+            break;
+        case 'i':
+            errno = 0;
+            sync_ms = strtoul(optarg, &end_p, 0);
+            if (('\0' != *end_p) || (0 != errno) || (sync_ms > INT_MAX)) {
+                fprintf(stderr, "Sync interval must be 0 to %d ms\n",
+                        INT_MAX);
+                return (-1);
+            }
+            g_stack_cmd_sync_ms = sync_ms;
+            break;
+        case 'j':
+            g_stack_cmd_journal_dir_p = optarg;
+            break;
+        case 's':
+            errno = 0;
+            g_stack_cmd_sync_ops = strtoul(optarg, &end_p, 0);
+            if (('\0' != *end_p) || (0 != errno)) {
+                fprintf(stderr, "Sync operations must be a number\n");
+                return (-1);
+            }
+            break;
+        case 'l':
+            listen_p = optarg;
+            break;
+        case 't':
+            num_workers = strtoul(optarg, &end_p, 0);
+            if (('\0' != *end_p) || (0 == num_workers) ||
+                (num_workers > STACK_CMD_MAX_WORKERS)) {
+                fprintf(stderr, "Threads must be 1 to %d\n",
+                        STACK_CMD_MAX_WORKERS);
+                return (-1);
+            }
+            break;
+        default:
+            stack_cmd_usage(argv[0]);
+            return (-1);
+        }
+    }
+    if ((optind < argc) || ((NULL != script_p) && (NULL != listen_p)) ||
+        ((NULL == listen_p) && (1 != num_workers))) {
+        stack_cmd_usage(argv[0]);
+        return (-1);
+    }
+
+    if (! stack_cmd_trie_init()) {
+        fprintf(stderr, "Can't build command table.\n");
+        return (-1);
+    }
+    stack_cmd_codec_init();
+    if ((NULL != g_stack_cmd_journal_dir_p) &&
+        (0 != mkdir(g_stack_cmd_journal_dir_p, 0777)) && (EEXIST != errno)) {
+        fprintf(stderr, "Can't create journal directory '%s': %s\n",
+                g_stack_cmd_journal_dir_p, strerror(errno));
+        return (-1);
+    }
+
     /*
-     * Allocate a new stack.
+     * Allocate the default stack, and recover any journaled stacks.
      */
-    g_stack_p = stack_alloc();
-    if (NULL == g_stack_p) {
+    if (! stack_cmd_workers_init(num_workers)) {
         printf("Sorry, I can't create a stack for you.");
+        stack_cmd_workers_fini();
+        return (-1);
+    }
+    if ((NULL != g_stack_cmd_journal_dir_p) && (! stack_cmd_journal_recover())) {
+        stack_cmd_workers_fini();
         return (-1);
     }
 
+    if (NULL != listen_p) {
+        rc = stack_cmd_serve(listen_p);
+        stack_cmd_workers_fini();
+        return (rc);
+    }
+
     /*
-     * Give welcome message then continue processing lines until done.
+     * Commands come from a script, a pipe or a terminal. Only a person at
+     * a terminal needs to be prompted.
      */
-    (void)stack_cmd_help(NULL);
-    for (;;) {
-        printf("> ");
-        
-	if (! stack_cmd_parse_line()) {
-           break;
+    if (NULL != script_p) {
+        fd = open(script_p, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Can't open script '%s': %s\n",
+                    script_p, strerror(errno));
+            stack_cmd_workers_fini();
+            return (-1);
         }
     }
+    is_batch = (! isatty(fd));
+    if (is_batch) {
+        (void)setvbuf(stdout, NULL, _IOFBF, STACK_CMD_OUT_BUF_SIZE);
+    }
+
+    /*
+     * Give welcome message then continue processing lines until done.
+     */
+    stack_cmd_session_init(&sess, 0, is_batch ? NULL : "> ");
+    if (! is_batch) {
+        (void)stack_cmd_help(&sess, NULL);
+        stack_cmd_out_printf(&(sess.out), "%s", sess.prompt_p);
+    }
+    stack_cmd_run(&sess, fd);
+    stack_cmd_session_fini(&sess);
 
     /*
-     * Free stack
+     * Free stacks
      */
-    stack_free(g_stack_p);
+    stack_cmd_workers_fini();
+    if (NULL != script_p) {
+        (void)close(fd);
+    }
+    (void)fflush(stdout);
 
-    return (0);
+    return (rc);
 }
@@ -0,0 +1,920 @@
+/**
+ * @file
+ * Load generator for the stack server.
+ *
+ * This command opens many connections to a "stack_cmd --listen" server,
+ * sends each of them a stream of push and pop requests in the pipelined
+ * binary protocol of include/stack_wire.h, and reports the throughput and
+ * latency percentiles it measured. It is meant for sizing server
+ * deployments and for catching performance regressions in the server's
+ * protocol path.
+ *
+ * @par Usage
+ * <code>
+ *     stack_load [-c <connections>] [-n <requests>] [-d <depth>]
+ *                [-s <value size>] [-p <push percent>] [-k <stacks>]
+ *                <socket path>
+ * <endcode>
+ *
+ * <ul>
+ *   <li><b>-c</b>, <b>--connections</b> -- Number of connections, each run
+ *       by its own thread. Default 8.
+ *   <li><b>-n</b>, <b>--requests</b> -- Number of requests sent on each
+ *       connection. Default 100000.
+ *   <li><b>-d</b>, <b>--depth</b> -- Pipelining depth: the most requests a
+ *       connection has waiting for a response. 1 waits for each response
+ *       before sending the next request. Default 16.
+ *   <li><b>-s</b>, <b>--value-size</b> -- Size of each pushed value in
+ *       bytes. Default 16.
+ *   <li><b>-p</b>, <b>--push-percent</b> -- Percentage of requests that are
+ *       pushes; the rest are pops. Default 50.
+ *   <li><b>-k</b>, <b>--stacks</b> -- Number of named stacks the
+ *       connections are spread over, "load.0", "load.1", and so on.
+ *       Default one per connection. Fewer stacks than connections makes
+ *       connections contend for the same stacks.
+ * </ul>
+ *
+ * Latency is measured per request, from when the request is queued to be
+ * sent until its response has been read, so with deep pipelines it
+ * includes time spent waiting behind earlier requests. Pushes to a full
+ * stack and pops from an empty stack are counted separately; any other
+ * error response, or a lost connection, makes the command fail.
+ *
+ * @par Design
+ * Each connection is non-blocking and run by one thread with poll(2), so
+ * that requests can be sent while responses are read and neither side of
+ * the connection can stall the other. Requests are generated straight into
+ * the send buffer and responses are parsed straight out of the receive
+ * buffer. The push or pop choice for each request comes from a small
+ * per-connection pseudo-random generator, so runs are repeatable.
+ * Latencies are recorded in an array per connection and sorted together
+ * at the end.
+ *
+ * @author     Matthew Balint, mjbalint@gmail.com
+ * @date       November 2014
+ * @copyright
+ *     Copyright (c) 2014 by Matthew Balint.
+ *
+ *     This file is part of https://github.com/mjbalint/stack
+ *
+ *     https://github.com/mjbalint/stack is free software: you can
+ *     redistribute it and/or modify it under the terms of the
+ *     GNU Lesser Public License as published by the
+ *     Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     https://github.com/mjbalint/stack is distributed in the hope that it
+ *     will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *     warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *     See the GNU Lesser Public License for more details.
+ *
+ *     You should have received a copy of the GNU Lesser Public License
+ *     along with https://github.com/mjbalint/stack.  If not,
+ *     see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../include/stack.h"
+#include "../include/stack_wire.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Default number of connections.
+ */
+#define STACK_LOAD_DEFAULT_CONNS 8
+
+/**
+ * Default number of requests per connection.
+ */
+#define STACK_LOAD_DEFAULT_REQS 100000
+
+/**
+ * Default pipelining depth.
+ */
+#define STACK_LOAD_DEFAULT_DEPTH 16
+
+/**
+ * Default size of pushed values.
+ */
+#define STACK_LOAD_DEFAULT_VALUE_SIZE 16
+
+/**
+ * Default percentage of requests that are pushes.
+ */
+#define STACK_LOAD_DEFAULT_PUSH_PERCENT 50
+
+/**
+ * Most connections that can be opened.
+ */
+#define STACK_LOAD_MAX_CONNS 4096
+
+/**
+ * Deepest pipeline allowed.
+ */
+#define STACK_LOAD_MAX_DEPTH 65536
+
+/**
+ * Size of the receive buffer of each connection.
+ */
+#define STACK_LOAD_RECV_SIZE 65536
+
+/**
+ * Longest stack name used, including the terminating '\0'.
+ */
+#define STACK_LOAD_NAME_MAX 32
+
+/**
+ * Settings of a load run.
+ */
+typedef struct {
+    /**
+     * Server socket path.
+     */
+    const char *path_p;
+    /**
+     * Number of connections.
+     */
+    unsigned long num_conns;
+    /**
+     * Requests per connection.
+     */
+    unsigned long num_reqs;
+    /**
+     * Pipelining depth.
+     */
+    unsigned long depth;
+    /**
+     * Size of pushed values.
+     */
+    unsigned long value_size;
+    /**
+     * Percentage of requests that are pushes.
+     */
+    unsigned long push_percent;
+    /**
+     * Number of named stacks.
+     */
+    unsigned long num_stacks;
+} stack_load_config_t;
+
+/**
+ * State and results of one connection.
+ */
+typedef struct {
+    /**
+     * Run settings.
+     */
+    const stack_load_config_t *config_p;
+    /**
+     * Connection number.
+     */
+    unsigned int index;
+    /**
+     * Thread running connection.
+     */
+    pthread_t thread;
+    /**
+     * Connection socket.
+     */
+    int fd;
+    /**
+     * Pseudo-random state.
+     */
+    uint32_t rand;
+    /**
+     * Name of stack used.
+     */
+    char name[STACK_LOAD_NAME_MAX];
+    /**
+     * Length of name.
+     */
+    size_t name_size;
+    /**
+     * Operation of each pending request, by request number modulo depth.
+     */
+    uint8_t *ops_p;
+    /**
+     * Time each pending request was queued.
+     */
+    uint64_t *stamps_p;
+    /**
+     * Latency of each request.
+     */
+    uint64_t *lat_p;
+    /**
+     * Requests not yet sent.
+     */
+    char *send_p;
+    /**
+     * Size of send buffer.
+     */
+    size_t send_size;
+    /**
+     * Bytes in send buffer.
+     */
+    size_t send_len;
+    /**
+     * Bytes already sent.
+     */
+    size_t send_pos;
+    /**
+     * Responses not yet accounted for.
+     */
+    char *recv_p;
+    /**
+     * Bytes in receive buffer.
+     */
+    size_t recv_len;
+    /**
+     * Requests queued.
+     */
+    unsigned long num_sent;
+    /**
+     * Responses read.
+     */
+    unsigned long num_done;
+    /**
+     * Pushes answered.
+     */
+    unsigned long num_pushes;
+    /**
+     * Pops answered.
+     */
+    unsigned long num_pops;
+    /**
+     * Pushes to a full stack.
+     */
+    unsigned long num_full;
+    /**
+     * Pops from an empty stack.
+     */
+    unsigned long num_empty;
+    /**
+     * Other error responses.
+     */
+    unsigned long num_errors;
+    /**
+     * Set if the connection failed.
+     */
+    bool is_failed;
+} stack_load_conn_t;
+
+/**
+ * Get the current time.
+ *
+ * @returns
+ *     Monotonic time in nanoseconds.
+ */
+static inline uint64_t stack_load_now (void)
+{
+    struct timespec ts;                          /* Current time              */
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec);
+}
+
+/**
+ * Get the next pseudo-random number of a connection, using a xorshift
+ * generator.
+ *
+ * @param[in,out] conn_p
+ *     Connection.
+ * @returns
+ *     Pseudo-random number.
+ */
+static inline uint32_t stack_load_rand (stack_load_conn_t *conn_p)
+{
+    uint32_t x = conn_p->rand;                   /* Generator state           */
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    conn_p->rand = x;
+    return (x);
+}
+
+/**
+ * Connect to the server and select the binary protocol.
+ *
+ * @param[in,out] conn_p
+ *     Connection. Its socket is set on success.
+ * @retval true
+ *     Connected.
+ * @retval false
+ *     An error occurred. A message is printed.
+ */
+static bool stack_load_connect (stack_load_conn_t *conn_p)
+{
+    struct sockaddr_un addr;                     /* Server address            */
+    char               hello = STACK_WIRE_HELLO; /* Protocol selector         */
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, conn_p->config_p->path_p,
+            sizeof(addr.sun_path) - 1);
+
+    conn_p->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((conn_p->fd < 0) ||
+        (0 != connect(conn_p->fd, (struct sockaddr*)&addr, sizeof(addr))) ||
+        (1 != send(conn_p->fd, &hello, 1, MSG_NOSIGNAL)) ||
+        (0 != fcntl(conn_p->fd, F_SETFL, O_NONBLOCK))) {
+        fprintf(stderr, "Connection %u: Can't connect to '%s': %s\n",
+                conn_p->index, conn_p->config_p->path_p, strerror(errno));
+        return (false);
+    }
+
+    return (true);
+}
+
+/**
+ * Queue requests until the pipeline is full or all requests are queued.
+ *
+ * @param[in,out] conn_p
+ *     Connection.
+ */
+static void stack_load_fill (stack_load_conn_t *conn_p)
+{
+    const stack_load_config_t *config_p = conn_p->config_p; /* Settings      */
+    stack_wire_req_t           req;              /* Request header            */
+    uint64_t                   now      = 0;     /* Time requests are queued  */
+    char                      *req_p    = NULL;  /* Request in send buffer    */
+    unsigned long              slot     = 0;     /* Pending request slot      */
+
+    /*
+     * Whatever was already sent is dropped, so the buffer never needs to
+     * hold more than one full pipeline.
+     */
+    if (conn_p->send_pos == conn_p->send_len) {
+        conn_p->send_pos = 0;
+        conn_p->send_len = 0;
+    }
+
+    now = stack_load_now();
+    memset(&req, 0, sizeof(req));
+    req.name_size = conn_p->name_size;
+    while ((conn_p->num_sent < config_p->num_reqs) &&
+           ((conn_p->num_sent - conn_p->num_done) < config_p->depth)) {
+        req.op = STACK_WIRE_OP_POP;
+        req.payload_size = 0;
+        if ((stack_load_rand(conn_p) % 100) < config_p->push_percent) {
+            req.op = STACK_WIRE_OP_PUSH;
+            req.payload_size = config_p->value_size;
+        }
+        if ((conn_p->send_size - conn_p->send_len) <
+            (sizeof(req) + req.name_size + req.payload_size)) {
+            break;
+        }
+
+        req_p = conn_p->send_p + conn_p->send_len;
+        memcpy(req_p, &req, sizeof(req));
+        memcpy(req_p + sizeof(req), conn_p->name, req.name_size);
+        memset(req_p + sizeof(req) + req.name_size, 'v', req.payload_size);
+        conn_p->send_len += sizeof(req) + req.name_size + req.payload_size;
+
+        slot = conn_p->num_sent % config_p->depth;
+        conn_p->ops_p[slot] = req.op;
+        conn_p->stamps_p[slot] = now;
+        conn_p->num_sent++;
+    }
+}
+
+/**
+ * Account for the complete responses in the receive buffer. A trailing
+ * partial response is kept until the rest of it arrives.
+ *
+ * @param[in,out] conn_p
+ *     Connection.
+ * @retval true
+ *     Responses accounted for.
+ * @retval false
+ *     The server broke the protocol. A message is printed.
+ */
+static bool stack_load_parse (stack_load_conn_t *conn_p)
+{
+    const stack_load_config_t *config_p = conn_p->config_p; /* Settings      */
+    stack_wire_rsp_t           rsp;              /* Response header           */
+    const char                *data_p   = conn_p->recv_p; /* Next response   */
+    size_t                     len      = conn_p->recv_len; /* Bytes left    */
+    uint64_t                   now      = 0;     /* Time responses are read   */
+    unsigned long              slot     = 0;     /* Pending request slot      */
+
+    now = stack_load_now();
+    while (len >= sizeof(rsp)) {
+        memcpy(&rsp, data_p, sizeof(rsp));
+        if (len < (sizeof(rsp) + rsp.payload_size)) {
+            if ((sizeof(rsp) + rsp.payload_size) > STACK_LOAD_RECV_SIZE) {
+                fprintf(stderr, "Connection %u: Response too large\n",
+                        conn_p->index);
+                return (false);
+            }
+            break;
+        }
+        slot = conn_p->num_done % config_p->depth;
+        if ((conn_p->num_done == conn_p->num_sent) ||
+            (rsp.op != conn_p->ops_p[slot])) {
+            fprintf(stderr, "Connection %u: Unexpected response\n",
+                    conn_p->index);
+            return (false);
+        }
+
+        if (STACK_WIRE_OP_PUSH == rsp.op) {
+            conn_p->num_pushes++;
+            if (STACK_E_FULL == rsp.err) {
+                conn_p->num_full++;
+            } else if (STACK_E_OK != rsp.err) {
+                conn_p->num_errors++;
+            }
+        } else {
+            conn_p->num_pops++;
+            if (STACK_E_EMPTY == rsp.err) {
+                conn_p->num_empty++;
+            } else if (STACK_E_OK != rsp.err) {
+                conn_p->num_errors++;
+            }
+        }
+        conn_p->lat_p[conn_p->num_done] = now - conn_p->stamps_p[slot];
+        conn_p->num_done++;
+
+        data_p += sizeof(rsp) + rsp.payload_size;
+        len -= sizeof(rsp) + rsp.payload_size;
+    }
+
+    memmove(conn_p->recv_p, data_p, len);
+    conn_p->recv_len = len;
+    return (true);
+}
+
+/**
+ * Send queued requests and read responses until both sides of the
+ * connection would block.
+ *
+ * @param[in,out] conn_p
+ *     Connection.
+ * @param[in] revents
+ *     Events that occurred on the socket.
+ * @retval true
+ *     Continue running the connection.
+ * @retval false
+ *     The connection failed. A message is printed.
+ */
+static bool stack_load_io (stack_load_conn_t *conn_p, short revents)
+{
+    ssize_t len = 0;                             /* Bytes sent or read        */
+
+    if ((0 != (revents & POLLOUT)) && (conn_p->send_pos < conn_p->send_len)) {
+        len = send(conn_p->fd, conn_p->send_p + conn_p->send_pos,
+                   conn_p->send_len - conn_p->send_pos, MSG_NOSIGNAL);
+        if (len > 0) {
+            conn_p->send_pos += len;
+        } else if ((EAGAIN != errno) && (EWOULDBLOCK != errno) &&
+                   (EINTR != errno)) {
+            fprintf(stderr, "Connection %u: Can't send: %s\n",
+                    conn_p->index, strerror(errno));
+            return (false);
+        }
+    }
+
+    if (0 != (revents & (POLLIN | POLLHUP | POLLERR))) {
+        len = read(conn_p->fd, conn_p->recv_p + conn_p->recv_len,
+                   STACK_LOAD_RECV_SIZE - conn_p->recv_len);
+        if (0 == len) {
+            fprintf(stderr, "Connection %u: Server closed connection\n",
+                    conn_p->index);
+            return (false);
+        }
+        if (len < 0) {
+            if ((EAGAIN != errno) && (EWOULDBLOCK != errno) &&
+                (EINTR != errno)) {
+                fprintf(stderr, "Connection %u: Can't read: %s\n",
+                        conn_p->index, strerror(errno));
+                return (false);
+            }
+            len = 0;
+        }
+        conn_p->recv_len += len;
+        return (stack_load_parse(conn_p));
+    }
+
+    return (true);
+}
+
+/**
+ * Run one connection's share of the load.
+ *
+ * @param[in] arg_p
+ *     Connection.
+ * @returns
+ *     NULL
+ */
+static void *stack_load_conn_main (void *arg_p)
+{
+    stack_load_conn_t *conn_p = arg_p;           /* Connection to run         */
+    struct pollfd      pfd;                      /* Events to wait for        */
+
+    conn_p->is_failed = true;
+    if (! stack_load_connect(conn_p)) {
+        return (NULL);
+    }
+
+    while (conn_p->num_done < conn_p->config_p->num_reqs) {
+        stack_load_fill(conn_p);
+
+        pfd.fd = conn_p->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (conn_p->send_pos < conn_p->send_len) {
+            pfd.events |= POLLOUT;
+        }
+        if (poll(&pfd, 1, -1) < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            fprintf(stderr, "Connection %u: Can't poll: %s\n",
+                    conn_p->index, strerror(errno));
+            return (NULL);
+        }
+        if (! stack_load_io(conn_p, pfd.revents)) {
+            return (NULL);
+        }
+    }
+
+    conn_p->is_failed = false;
+    return (NULL);
+}
+
+/**
+ * Compare two latencies for qsort().
+ *
+ * @param[in] a_p
+ *     First latency.
+ * @param[in] b_p
+ *     Second latency.
+ * @returns
+ *     Less than, equal to or greater than 0 as the first latency is less
+ *     than, equal to or greater than the second.
+ */
+static int stack_load_lat_cmp (const void *a_p, const void *b_p)
+{
+    uint64_t a = *(const uint64_t*)a_p;          /* First latency             */
+    uint64_t b = *(const uint64_t*)b_p;          /* Second latency            */
+
+    return ((a > b) - (a < b));
+}
+
+/**
+ * Get a percentile of sorted latencies.
+ *
+ * @param[in] lat_p
+ *     Latencies, in ascending order.
+ * @param[in] num_lats
+ *     Number of latencies. Must not be 0.
+ * @param[in] percentile
+ *     Percentile to get, 0 to 100.
+ * @returns
+ *     Latency in microseconds.
+ */
+static double stack_load_percentile (const uint64_t *lat_p,
+                                     size_t          num_lats,
+                                     double          percentile)
+{
+    size_t index = 0;                            /* Index of percentile       */
+
+    index = (size_t)((percentile / 100.0) * (double)(num_lats - 1) + 0.5);
+    return ((double)lat_p[index] / 1000.0);
+}
+
+/**
+ * Print the results of a run.
+ *
+ * @param[in] config_p
+ *     Run settings.
+ * @param[in] conns_p
+ *     Connections, all of which completed.
+ * @param[in] elapsed
+ *     Wall-clock time of the run in nanoseconds.
+ * @retval 0
+ *     Results printed.
+ * @retval -1
+ *     Out of memory.
+ */
+static int stack_load_report (const stack_load_config_t *config_p,
+                              const stack_load_conn_t   *conns_p,
+                              uint64_t                   elapsed)
+{
+    uint64_t      *lat_p      = NULL;            /* All latencies             */
+    size_t         num_lats   = 0;               /* Number of latencies       */
+    unsigned long  num_pushes = 0;               /* Pushes answered           */
+    unsigned long  num_pops   = 0;               /* Pops answered             */
+    unsigned long  num_full   = 0;               /* Pushes to a full stack    */
+    unsigned long  num_empty  = 0;               /* Pops from an empty stack  */
+    double         seconds    = 0.0;             /* Elapsed time in seconds   */
+    unsigned long  i          = 0;               /* Loop index counter        */
+
+    num_lats = config_p->num_conns * config_p->num_reqs;
+    lat_p = malloc(num_lats * sizeof(*lat_p));
+    if (NULL == lat_p) {
+        fprintf(stderr, "Can't allocate memory for latencies\n");
+        return (-1);
+    }
+    for (i = 0; i < config_p->num_conns; i++) {
+        memcpy(lat_p + (i * config_p->num_reqs), conns_p[i].lat_p,
+               config_p->num_reqs * sizeof(*lat_p));
+        num_pushes += conns_p[i].num_pushes;
+        num_pops += conns_p[i].num_pops;
+        num_full += conns_p[i].num_full;
+        num_empty += conns_p[i].num_empty;
+    }
+    qsort(lat_p, num_lats, sizeof(*lat_p), stack_load_lat_cmp);
+
+    seconds = (double)elapsed / 1e9;
+    printf("Connections:  %lu, depth %lu, %lu stacks, %lu byte values\n",
+           config_p->num_conns, config_p->depth, config_p->num_stacks,
+           config_p->value_size);
+    printf("Requests:     %zu in %.3f s, %.0f requests/s\n",
+           num_lats, seconds, (double)num_lats / seconds);
+    printf("Pushes:       %lu (%lu to a full stack)\n", num_pushes, num_full);
+    printf("Pops:         %lu (%lu from an empty stack)\n",
+           num_pops, num_empty);
+    printf("Latency (us): min %.1f, p50 %.1f, p90 %.1f, p99 %.1f, "
+           "p99.9 %.1f, max %.1f\n",
+           stack_load_percentile(lat_p, num_lats, 0.0),
+           stack_load_percentile(lat_p, num_lats, 50.0),
+           stack_load_percentile(lat_p, num_lats, 90.0),
+           stack_load_percentile(lat_p, num_lats, 99.0),
+           stack_load_percentile(lat_p, num_lats, 99.9),
+           stack_load_percentile(lat_p, num_lats, 100.0));
+
+    free(lat_p);
+    return (0);
+}
+
+/**
+ * Allocate the buffers of a connection.
+ *
+ * @param[in,out] conn_p
+ *     Connection, with its settings and index set.
+ * @retval true
+ *     Buffers allocated.
+ * @retval false
+ *     Out of memory.
+ */
+static bool stack_load_conn_init (stack_load_conn_t *conn_p)
+{
+    const stack_load_config_t *config_p = conn_p->config_p; /* Settings      */
+
+    conn_p->fd = -1;
+    conn_p->rand = 2463534242U + conn_p->index;
+    conn_p->name_size = snprintf(conn_p->name, sizeof(conn_p->name),
+                                 "load.%lu",
+                                 conn_p->index % config_p->num_stacks);
+    conn_p->send_size = config_p->depth *
+                  (sizeof(stack_wire_req_t) + conn_p->name_size +
+                   config_p->value_size);
+    conn_p->ops_p = malloc(config_p->depth * sizeof(*(conn_p->ops_p)));
+    conn_p->stamps_p = malloc(config_p->depth *
+                              sizeof(*(conn_p->stamps_p)));
+    conn_p->lat_p = malloc(config_p->num_reqs * sizeof(*(conn_p->lat_p)));
+    conn_p->send_p = malloc(conn_p->send_size);
+    conn_p->recv_p = malloc(STACK_LOAD_RECV_SIZE);
+
+    return ((NULL != conn_p->ops_p) && (NULL != conn_p->stamps_p) &&
+            (NULL != conn_p->lat_p) && (NULL != conn_p->send_p) &&
+            (NULL != conn_p->recv_p));
+}
+
+/**
+ * Close a connection and free its buffers.
+ *
+ * @param[in,out] conn_p
+ *     Connection.
+ */
+static void stack_load_conn_fini (stack_load_conn_t *conn_p)
+{
+    if (conn_p->fd >= 0) {
+        (void)close(conn_p->fd);
+    }
+    free(conn_p->ops_p);
+    free(conn_p->stamps_p);
+    free(conn_p->lat_p);
+    free(conn_p->send_p);
+    free(conn_p->recv_p);
+}
+
+/**
+ * Parse a numeric option.
+ *
+ * @param[in] name_p
+ *     Option name, for the error message.
+ * @param[in] arg_p
+ *     Option argument.
+ * @param[in] min
+ *     Smallest value allowed.
+ * @param[in] max
+ *     Largest value allowed.
+ * @param[out] value_p
+ *     Updated with the value.
+ * @retval true
+ *     Value parsed.
+ * @retval false
+ *     Value is not a number in range. A message is printed.
+ */
+static bool stack_load_parse_num (const char    *name_p,
+                                  const char    *arg_p,
+                                  unsigned long  min,
+                                  unsigned long  max,
+                                  unsigned long *value_p)
+{
+    char *end_p = NULL;                          /* End of number             */
+
+    errno = 0;
+    *value_p = strtoul(arg_p, &end_p, 0);
+    if ((0 != errno) || (end_p == arg_p) || ('\0' != *end_p) ||
+        (*value_p < min) || (*value_p > max)) {
+        fprintf(stderr, "%s must be %lu to %lu\n", name_p, min, max);
+        return (false);
+    }
+    return (true);
+}
+
+/**
+ * Print usage message to STDERR.
+ *
+ * @param[in] prog_p
+ *     Name the program was run as.
+ */
+static void stack_load_usage (const char *prog_p)
+{
+    fprintf(stderr, "Usage: %s [-c <connections>] [-n <requests>] "
+                    "[-d <depth>]\n"
+                    "       %*s [-s <value size>] [-p <push percent>] "
+                    "[-k <stacks>]\n"
+                    "       %*s <socket path>\n",
+            prog_p, (int)strlen(prog_p), "", (int)strlen(prog_p), "");
+}
+
+/**
+ * Command line interface.
+ *
+ * @param argc
+ *     Number of arguments.
+ * @param argv
+ *     Argument list. See the file description for the options.
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+int main (int argc, char* argv[])
+{
+    static const struct option long_options[] = {
+        { "connections",  required_argument, NULL, 'c' },
+        { "requests",     required_argument, NULL, 'n' },
+        { "depth",        required_argument, NULL, 'd' },
+        { "value-size",   required_argument, NULL, 's' },
+        { "push-percent", required_argument, NULL, 'p' },
+        { "stacks",       required_argument, NULL, 'k' },
+        { NULL,           0,                 NULL, 0   }
+    };
+    stack_load_config_t  config;                 /* Run settings              */
+    stack_load_conn_t   *conns_p   = NULL;       /* Connections               */
+    uint64_t             start     = 0;          /* Start time of run         */
+    uint64_t             elapsed   = 0;          /* Duration of run           */
+    unsigned long        num_init  = 0;          /* Connections set up        */
+    unsigned long        num_run   = 0;          /* Connection threads run    */
+    unsigned long        i         = 0;          /* Loop index counter        */
+    bool                 is_ok     = true;       /* Options valid?            */
+    int                  opt       = 0;          /* Current option            */
+    int                  rc        = 0;          /* Exit status               */
+
+    memset(&config, 0, sizeof(config));
+    config.num_conns = STACK_LOAD_DEFAULT_CONNS;
+    config.num_reqs = STACK_LOAD_DEFAULT_REQS;
+    config.depth = STACK_LOAD_DEFAULT_DEPTH;
+    config.value_size = STACK_LOAD_DEFAULT_VALUE_SIZE;
+    config.push_percent = STACK_LOAD_DEFAULT_PUSH_PERCENT;
+
+    while ((is_ok) &&
+           (-1 != (opt = getopt_long(argc, argv, "c:n:d:s:p:k:", long_options,
+                                     NULL)))) {
+        switch (opt) {
+        case 'c':
+            is_ok = stack_load_parse_num("Connections", optarg, 1,
+                                         STACK_LOAD_MAX_CONNS,
+                                         &config.num_conns);
+            break;
+        case 'n':
+            is_ok = stack_load_parse_num("Requests", optarg, 1,
+                                         100000000UL, &config.num_reqs);
+            break;
+        case 'd':
+            is_ok = stack_load_parse_num("Depth", optarg, 1,
+                                         STACK_LOAD_MAX_DEPTH, &config.depth);
+            break;
+        case 's':
+            is_ok = stack_load_parse_num("Value size", optarg, 0,
+                                         STACK_WIRE_MAX_PAYLOAD,
+                                         &config.value_size);
+            break;
+        case 'p':
+            is_ok = stack_load_parse_num("Push percent", optarg, 0, 100,
+                                         &config.push_percent);
+            break;
+        case 'k':
+            is_ok = stack_load_parse_num("Stacks", optarg, 1,
+                                         STACK_LOAD_MAX_CONNS,
+                                         &config.num_stacks);
+            break;
+        default:
+            stack_load_usage(argv[0]);
+            return (-1);
+        }
+    }
+    if (! is_ok) {
+        return (-1);
+    }
+    if ((optind + 1) != argc) {
+        stack_load_usage(argv[0]);
+        return (-1);
+    }
+    config.path_p = argv[optind];
+    if (0 == config.num_stacks) {
+        config.num_stacks = config.num_conns;
+    }
+    if ((sizeof(stack_wire_rsp_t) + config.value_size) >
+        STACK_LOAD_RECV_SIZE) {
+        /*
+         * A popped value must fit in the receive buffer.
+         */
+        fprintf(stderr, "Value size must be at most %zu\n",
+                STACK_LOAD_RECV_SIZE - sizeof(stack_wire_rsp_t));
+        return (-1);
+    }
+
+    conns_p = calloc(config.num_conns, sizeof(*conns_p));
+    if (NULL == conns_p) {
+        fprintf(stderr, "Can't allocate connections\n");
+        return (-1);
+    }
+    for (num_init = 0; num_init < config.num_conns; num_init++) {
+        conns_p[num_init].config_p = &config;
+        conns_p[num_init].index = num_init;
+        if (! stack_load_conn_init(&(conns_p[num_init]))) {
+            fprintf(stderr, "Can't allocate connection buffers\n");
+            num_init++;
+            rc = -1;
+            break;
+        }
+    }
+
+    /*
+     * Run all connections at once, timing from the first start to the
+     * last finish.
+     */
+    if (0 == rc) {
+        start = stack_load_now();
+        for (num_run = 0; num_run < config.num_conns; num_run++) {
+            if (0 != pthread_create(&(conns_p[num_run].thread), NULL,
+                                    stack_load_conn_main,
+                                    &(conns_p[num_run]))) {
+                fprintf(stderr, "Can't start connection %lu\n", num_run);
+                rc = -1;
+                break;
+            }
+        }
+        for (i = 0; i < num_run; i++) {
+            (void)pthread_join(conns_p[i].thread, NULL);
+            if (conns_p[i].is_failed) {
+                rc = -1;
+            }
+        }
+        elapsed = stack_load_now() - start;
+    }
+
+    if (0 == rc) {
+        rc = stack_load_report(&config, conns_p, elapsed);
+    }
+    for (i = 0; i < config.num_conns; i++) {
+        if (conns_p[i].num_errors > 0) {
+            fprintf(stderr, "Connection %lu: %lu error responses\n",
+                    i, conns_p[i].num_errors);
+            rc = -1;
+        }
+    }
+
+    for (i = 0; i < num_init; i++) {
+        stack_load_conn_fini(&(conns_p[i]));
+    }
+    free(conns_p);
+    return (rc);
+}
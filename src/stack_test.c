@@ -27,8 +27,2738 @@
  */
 
 #include "../include/stack.h"
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Test stack_peek_range().
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_peek_range (void)
+{
+    stack_t       *stack_p    = NULL;            /* Stack to manipulate       */
+    stack_err_e    err        = STACK_E_OK;      /* Operation return code     */
+    unsigned char  entry[64];                    /* Entry to push             */
+    unsigned char  out[8];                       /* Peeked range              */
+    size_t         out_size   = 0;               /* Size of peeked range      */
+    unsigned int   i          = 0;               /* Loop index counter        */
+
+    stack_p = stack_alloc();
+    if (NULL == stack_p) {
+        printf("Error: Peek range: Can't init stack\n");
+        return (-1);
+    }
+
+    /*
+     * Push two entries so that we can look below the top.
+     */
+    for (i = 0; i < sizeof(entry); i++) {
+        entry[i] = (unsigned char)i;
+    }
+    err = stack_push(stack_p, entry, sizeof(entry));
+    if (stack_err_e_is_error(err)) {
+        printf("Error: Peek range: Can't push: %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+    err = stack_push(stack_p, "top", 3);
+    if (stack_err_e_is_error(err)) {
+        printf("Error: Peek range: Can't push: %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+
+    /*
+     * A slice of a large entry fits into a small buffer.
+     */
+    out_size = sizeof(out);
+    err = stack_peek_range(stack_p, 1, 16, out, &out_size);
+    if (stack_err_e_is_error(err) || (out_size != sizeof(out)) ||
+        (out[0] != 16) || (out[7] != 23)) {
+        printf("Error: Peek range: Bad slice: %d(%s) size %lu\n",
+               err, stack_err_e_to_string(err), out_size);
+        return (-1);
+    }
+
+    /*
+     * Ranges are clipped at the end of the entry.
+     */
+    out_size = sizeof(out);
+    err = stack_peek_range(stack_p, 0, 1, out, &out_size);
+    if (stack_err_e_is_error(err) || (out_size != 2) ||
+        (0 != memcmp(out, "op", 2))) {
+        printf("Error: Peek range: Bad clipped slice: %d(%s) size %lu\n",
+               err, stack_err_e_to_string(err), out_size);
+        return (-1);
+    }
+
+    out_size = sizeof(out);
+    err = stack_peek_range(stack_p, 0, 4, out, &out_size);
+    if (STACK_E_INVALID != err) {
+        printf("Error: Peek range: Offset past end gave %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+
+    out_size = sizeof(out);
+    err = stack_peek_range(stack_p, 2, 0, out, &out_size);
+    if (STACK_E_EMPTY != err) {
+        printf("Error: Peek range: Depth past bottom gave %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+
+    stack_free(stack_p);
+
+    return (0);
+}
+
+/**
+ * Pop an entry and compare it with the expected value.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @param[in] expected_p
+ *     Expected entry, as a string without the terminating NUL.
+ * @retval 0
+ *     Popped entry matches.
+ * @retval -1
+ *     An error occurred or the entry does not match.
+ */
+static int stack_test_pop_expect (stack_t *stack_p, const char *expected_p)
+{
+    stack_err_e err           = STACK_E_OK;      /* Operation return code     */
+    char        out[512]      = "";              /* Popped value buffer       */
+    size_t      out_size      = 0;               /* Popped value size         */
+
+    out_size = sizeof(out);
+    err = stack_pop(stack_p, out, &out_size);
+    if (stack_err_e_is_error(err)) {
+        printf("Error: Can't pop '%s': %d(%s)\n",
+               expected_p, err, stack_err_e_to_string(err));
+        return (-1);
+    }
+    if ((out_size != strlen(expected_p)) ||
+        (0 != memcmp(out, expected_p, out_size))) {
+        printf("Error: Popped '%.*s' but expected '%s'\n",
+               (int)out_size, out, expected_p);
+        return (-1);
+    }
+
+    return (0);
+}
+
+/**
+ * Size of the entries that stack_test_copy_push() pushes, big enough that
+ * copying one takes more room than a new stack's buffer has left.
+ */
+#define STACK_TEST_COPY_SIZE 600
+
+/**
+ * Push an entry of #STACK_TEST_COPY_SIZE bytes with a known pattern.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @retval 0
+ *     Entry pushed.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_copy_push (stack_t *stack_p)
+{
+    unsigned char entry[STACK_TEST_COPY_SIZE];   /* Entry to push             */
+    size_t        i = 0;                         /* Loop index counter        */
+
+    for (i = 0; i < sizeof(entry); i++) {
+        entry[i] = (unsigned char)(i * 7);
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, entry, sizeof(entry)))) {
+        printf("Error: Can't push patterned entry\n");
+        return (-1);
+    }
+
+    return (0);
+}
+
+/**
+ * Pop entries and check that each is the one stack_test_copy_push()
+ * pushes.
+ *
+ * @param[in] stack_p
+ *     Stack to update.
+ * @param[in] num_entries
+ *     Number of entries to pop.
+ * @retval 0
+ *     Popped entries match.
+ * @retval -1
+ *     An error occurred or an entry does not match.
+ */
+static int stack_test_copy_expect (stack_t *stack_p, size_t num_entries)
+{
+    unsigned char out[STACK_TEST_COPY_SIZE + 1]; /* Popped entry              */
+    size_t        out_size = 0;                  /* Size of popped entry      */
+    size_t        i        = 0;                  /* Loop index counter        */
+    size_t        j        = 0;                  /* Byte index counter        */
+
+    for (i = 0; i < num_entries; i++) {
+        out_size = sizeof(out);
+        if (stack_err_e_is_error(stack_pop(stack_p, out, &out_size)) ||
+            (STACK_TEST_COPY_SIZE != out_size)) {
+            printf("Error: Can't pop patterned entry %zu\n", i);
+            return (-1);
+        }
+        for (j = 0; j < out_size; j++) {
+            if (out[j] != (unsigned char)(j * 7)) {
+                printf("Error: Patterned entry %zu corrupted at byte %zu\n",
+                       i, j);
+                return (-1);
+            }
+        }
+    }
+
+    return (0);
+}
+
+/**
+ * Test the in-place stack machine operations.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_stack_ops (void)
+{
+    stack_t     *stack_p      = NULL;            /* Stack to manipulate       */
+    stack_err_e  err          = STACK_E_OK;      /* Operation return code     */
+    char         big[300];                       /* Entry too big to bounce   */
+    char        *top_p        = NULL;            /* Mutable top entry         */
+    size_t       top_size     = 0;               /* Size of top entry         */
+
+    stack_p = stack_alloc();
+    if (NULL == stack_p) {
+        printf("Error: Stack ops: Can't init stack\n");
+        return (-1);
+    }
+
+    /*
+     * ( a bb ccc -- bb ccc a ) then ( -- bb a ccc )
+     */
+    if (stack_err_e_is_error(stack_push(stack_p, "a", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "bb", 2)) ||
+        stack_err_e_is_error(stack_push(stack_p, "ccc", 3)) ||
+        stack_err_e_is_error(stack_rot(stack_p)) ||
+        stack_err_e_is_error(stack_swap(stack_p)) ||
+        stack_err_e_is_error(stack_over(stack_p)) ||
+        stack_err_e_is_error(stack_dup(stack_p))) {
+        printf("Error: Stack ops: Can't shuffle entries\n");
+        return (-1);
+    }
+    if ((0 != stack_test_pop_expect(stack_p, "a")) ||
+        (0 != stack_test_pop_expect(stack_p, "a")) ||
+        (0 != stack_test_pop_expect(stack_p, "ccc")) ||
+        (0 != stack_test_pop_expect(stack_p, "a")) ||
+        (0 != stack_test_pop_expect(stack_p, "bb"))) {
+        return (-1);
+    }
+
+    /*
+     * Entries too large for the bounce buffer take the reversal path.
+     */
+    memset(big, 'x', sizeof(big));
+    big[sizeof(big) - 1] = '\0';
+    if (stack_err_e_is_error(stack_push(stack_p, big, strlen(big))) ||
+        stack_err_e_is_error(stack_push(stack_p, "bottom", 6)) ||
+        stack_err_e_is_error(stack_swap(stack_p))) {
+        printf("Error: Stack ops: Can't swap large entry\n");
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_swap(stack_p)) ||
+        stack_err_e_is_error(stack_swap(stack_p))) {
+        printf("Error: Stack ops: Can't swap back\n");
+        return (-1);
+    }
+    if ((0 != stack_test_pop_expect(stack_p, big)) ||
+        (0 != stack_test_pop_expect(stack_p, "bottom"))) {
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, big, strlen(big))) ||
+        stack_err_e_is_error(stack_push(stack_p, big + 20, strlen(big + 20))) ||
+        stack_err_e_is_error(stack_swap(stack_p)) ||
+        (0 != stack_test_pop_expect(stack_p, big)) ||
+        (0 != stack_test_pop_expect(stack_p, big + 20))) {
+        printf("Error: Stack ops: Can't swap two large entries\n");
+        return (-1);
+    }
+
+    /*
+     * Read-modify-write through the top view, then resize the top entry.
+     */
+    if (stack_err_e_is_error(stack_push(stack_p, "keep", 4)) ||
+        stack_err_e_is_error(stack_push(stack_p, "abc", 3)) ||
+        stack_err_e_is_error(stack_top_view(stack_p, (void **)&top_p,
+                                            &top_size)) ||
+        (3 != top_size)) {
+        printf("Error: Stack ops: Can't view top entry\n");
+        return (-1);
+    }
+    top_p[0] = 'A';
+    if (0 != stack_test_pop_expect(stack_p, "Abc")) {
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, "abc", 3)) ||
+        stack_err_e_is_error(stack_replace_top(stack_p, "longer", 6)) ||
+        (0 != stack_test_pop_expect(stack_p, "longer"))) {
+        printf("Error: Stack ops: Can't replace top entry\n");
+        return (-1);
+    }
+
+    /*
+     * Drop several entries at once.
+     */
+    if (stack_err_e_is_error(stack_push(stack_p, "1", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "2", 1))) {
+        printf("Error: Stack ops: Can't push\n");
+        return (-1);
+    }
+    err = stack_drop(stack_p, 4);
+    if (STACK_E_EMPTY != err) {
+        printf("Error: Stack ops: Dropping too many gave %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_drop(stack_p, 2)) ||
+        (1 != stack_get_num_entries(stack_p)) ||
+        (0 != stack_test_pop_expect(stack_p, "keep"))) {
+        printf("Error: Stack ops: Can't drop entries\n");
+        return (-1);
+    }
+
+    err = stack_swap(stack_p);
+    if (STACK_E_EMPTY != err) {
+        printf("Error: Stack ops: Swap on empty stack gave %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+
+    stack_free(stack_p);
+
+    return (0);
+}
+
+/**
+ * Test moving entries between stacks.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_transfer (void)
+{
+    stack_t     *src_p        = NULL;            /* Stack to take from        */
+    stack_t     *dst_p        = NULL;            /* Stack to add to           */
+    stack_err_e  err          = STACK_E_OK;      /* Operation return code     */
+
+    src_p = stack_alloc();
+    dst_p = stack_alloc();
+    if ((NULL == src_p) || (NULL == dst_p)) {
+        printf("Error: Transfer: Can't init stacks\n");
+        return (-1);
+    }
+
+    if (stack_err_e_is_error(stack_push(dst_p, "d0", 2)) ||
+        stack_err_e_is_error(stack_push(src_p, "s0", 2)) ||
+        stack_err_e_is_error(stack_push(src_p, "s1", 2)) ||
+        stack_err_e_is_error(stack_push(src_p, "s2", 2))) {
+        printf("Error: Transfer: Can't push\n");
+        return (-1);
+    }
+
+    err = stack_transfer(src_p, dst_p, 4);
+    if ((STACK_E_EMPTY != err) || (3 != stack_get_num_entries(src_p))) {
+        printf("Error: Transfer: Moving too many gave %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+
+    /*
+     * Move the top two entries, then the rest.
+     */
+    if (stack_err_e_is_error(stack_transfer(src_p, dst_p, 2)) ||
+        (1 != stack_get_num_entries(src_p)) ||
+        (3 != stack_get_num_entries(dst_p))) {
+        printf("Error: Transfer: Can't move entries\n");
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_concat(dst_p, src_p)) ||
+        (! stack_is_empty(src_p)) ||
+        (4 != stack_get_num_entries(dst_p))) {
+        printf("Error: Transfer: Can't concatenate stacks\n");
+        return (-1);
+    }
+    if ((0 != stack_test_pop_expect(dst_p, "s0")) ||
+        (0 != stack_test_pop_expect(dst_p, "s2")) ||
+        (0 != stack_test_pop_expect(dst_p, "s1")) ||
+        (0 != stack_test_pop_expect(dst_p, "d0"))) {
+        return (-1);
+    }
+
+    stack_free(src_p);
+    stack_free(dst_p);
+
+    return (0);
+}
+
+/**
+ * Test draining a stack into a single buffer.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_drain (void)
+{
+    static const char *values[] = { "one", "two", "three" };
+    stack_t     *stack_p      = NULL;            /* Stack to manipulate       */
+    stack_err_e  err          = STACK_E_OK;      /* Operation return code     */
+    stack_order_e order       = STACK_ORDER_TOP_FIRST; /* Export order        */
+    unsigned char buf[256];                      /* Exported records          */
+    size_t       buf_size     = 0;               /* Size of exported records  */
+    size_t       pos          = 0;               /* Next record offset        */
+    const void  *entry_p      = NULL;            /* Exported entry            */
+    size_t       entry_size   = 0;               /* Exported entry size       */
+    size_t       expected     = 0;               /* Expected value index      */
+    unsigned int i            = 0;               /* Loop index counter        */
+    unsigned int j            = 0;               /* Loop index counter        */
+
+    stack_p = stack_alloc();
+    if (NULL == stack_p) {
+        printf("Error: Drain: Can't init stack\n");
+        return (-1);
+    }
+
+    for (i = 0; i < 2; i++) {
+        order = (0 == i) ? STACK_ORDER_TOP_FIRST : STACK_ORDER_BOTTOM_FIRST;
+        for (j = 0; j < 3; j++) {
+            err = stack_push(stack_p, values[j], strlen(values[j]));
+            if (stack_err_e_is_error(err)) {
+                printf("Error: Drain: Can't push: %d(%s)\n",
+                       err, stack_err_e_to_string(err));
+                return (-1);
+            }
+        }
+
+        buf_size = 4;
+        err = stack_drain(stack_p, buf, &buf_size, order);
+        if ((STACK_E_BUF_OVERFLOW != err) ||
+            (buf_size != (3 * sizeof(size_t)) + 11) ||
+            (3 != stack_get_num_entries(stack_p))) {
+            printf("Error: Drain: Small buffer gave %d(%s) size %lu\n",
+                   err, stack_err_e_to_string(err), buf_size);
+            return (-1);
+        }
+
+        buf_size = sizeof(buf);
+        err = stack_drain(stack_p, buf, &buf_size, order);
+        if (stack_err_e_is_error(err) || (! stack_is_empty(stack_p))) {
+            printf("Error: Drain: Can't drain: %d(%s)\n",
+                   err, stack_err_e_to_string(err));
+            return (-1);
+        }
+
+        pos = 0;
+        for (j = 0; j < 3; j++) {
+            expected = (STACK_ORDER_TOP_FIRST == order) ? (2 - j) : j;
+            if ((! stack_drain_next(buf, buf_size, &pos,
+                                    &entry_p, &entry_size)) ||
+                (entry_size != strlen(values[expected])) ||
+                (0 != memcmp(entry_p, values[expected], entry_size))) {
+                printf("Error: Drain: Record %u in order %d is wrong\n",
+                       j, order);
+                return (-1);
+            }
+        }
+        if (stack_drain_next(buf, buf_size, &pos, &entry_p, &entry_size)) {
+            printf("Error: Drain: Extra record in order %d\n", order);
+            return (-1);
+        }
+    }
+
+    stack_free(stack_p);
+
+    return (0);
+}
+
+/**
+ * Largest entry pushed by the drop-oldest test.
+ */
+#define STACK_TEST_MAX_ENTRY 40
+
+/**
+ * Maximum number of entries tracked by the drop-oldest test.
+ */
+#define STACK_TEST_MAX_MODEL 256
+
+/**
+ * Expected contents of a stack, bottom entry first.
+ */
+typedef struct stack_test_model_ {
+    /**
+     * Number of entries.
+     */
+    size_t num_entries;
+    /**
+     * Size of each entry.
+     */
+    size_t sizes[STACK_TEST_MAX_MODEL];
+    /**
+     * Data of each entry.
+     */
+    unsigned char data[STACK_TEST_MAX_MODEL][STACK_TEST_MAX_ENTRY];
+} stack_test_model_t;
+
+/**
+ * Compare a stack against its expected contents. Entries that are missing
+ * from the bottom of the stack are assumed to have been evicted and are
+ * removed from the model.
+ *
+ * @param[in] stack_p
+ *     Stack to check.
+ * @param[in,out] model_p
+ *     Expected contents.
+ * @retval 0
+ *     Stack holds the newest entries of the model, in order.
+ * @retval -1
+ *     Stack does not match the model.
+ */
+static int stack_test_model_check (stack_t *stack_p,
+                                   stack_test_model_t *model_p)
+{
+    unsigned char out[STACK_TEST_MAX_ENTRY];     /* Peeked entry              */
+    size_t        out_size    = 0;               /* Size of peeked entry      */
+    size_t        num_entries = 0;               /* # of entries in stack     */
+    size_t        model_pos   = 0;               /* Matching model entry      */
+    size_t        i           = 0;               /* Loop index counter        */
+
+    num_entries = stack_get_num_entries(stack_p);
+    if (num_entries > model_p->num_entries) {
+        printf("Error: Model: %lu entries but expected at most %lu\n",
+               num_entries, model_p->num_entries);
+        return (-1);
+    }
+
+    for (i = 0; i < num_entries; i++) {
+        model_pos = model_p->num_entries - 1 - i;
+        out_size = sizeof(out);
+        if (stack_err_e_is_error(stack_peek_range(stack_p, i, 0,
+                                                  out, &out_size)) ||
+            (out_size != model_p->sizes[model_pos]) ||
+            (0 != memcmp(out, model_p->data[model_pos], out_size))) {
+            printf("Error: Model: Entry at depth %lu does not match\n", i);
+            return (-1);
+        }
+    }
+
+    /*
+     * Forget evicted entries.
+     */
+    model_pos = model_p->num_entries - num_entries;
+    memmove(model_p->sizes, model_p->sizes + model_pos,
+            num_entries * sizeof(model_p->sizes[0]));
+    memmove(model_p->data, model_p->data + model_pos,
+            num_entries * sizeof(model_p->data[0]));
+    model_p->num_entries = num_entries;
+
+    return (0);
+}
+
+/**
+ * Test stacks that drop their oldest entries when full.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_drop_oldest (void)
+{
+    static stack_test_model_t model;             /* Expected contents         */
+    stack_t      *stack_p      = NULL;           /* Stack to manipulate       */
+    stack_t      *other_p      = NULL;           /* Transfer destination      */
+    stack_err_e   err          = STACK_E_OK;     /* Operation return code     */
+    unsigned char buf[512];                      /* Drained records           */
+    size_t        buf_size     = 0;              /* Size of drained records   */
+    size_t        pos          = 0;              /* Next record offset        */
+    const void   *entry_p      = NULL;           /* Drained entry             */
+    size_t        entry_size   = 0;              /* Drained entry size        */
+    size_t        num_entries  = 0;              /* # of entries in stack     */
+    size_t        top          = 0;              /* Model top entry index     */
+    unsigned int  op           = 0;              /* Operation to run          */
+    unsigned int  i            = 0;              /* Loop index counter        */
+    unsigned int  j            = 0;              /* Loop index counter        */
+
+    /*
+     * Without the flag, the limits are reported as errors.
+     */
+    stack_p = stack_alloc_custom(2, 4, STACK_DEFAULT_ENTRY_SIZE, 64);
+    if (NULL == stack_p) {
+        printf("Error: Drop oldest: Can't init stack\n");
+        return (-1);
+    }
+    if ((STACK_E_INVALID != stack_push(stack_p, "12345", 5)) ||
+        stack_err_e_is_error(stack_push(stack_p, "1", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "2", 1)) ||
+        (STACK_E_FULL != stack_push(stack_p, "3", 1))) {
+        printf("Error: Drop oldest: Plain stack ignored its limits\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    /*
+     * Entry limit: the bottom entries go first.
+     */
+    stack_p = stack_alloc_bounded(3, STACK_MAX_SIZE_NONE);
+    if (NULL == stack_p) {
+        printf("Error: Drop oldest: Can't init stack\n");
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, "1", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "2", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "3", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "4", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "5", 1)) ||
+        (3 != stack_get_num_entries(stack_p))) {
+        printf("Error: Drop oldest: Can't push past entry limit\n");
+        return (-1);
+    }
+    if ((0 != stack_test_pop_expect(stack_p, "5")) ||
+        (0 != stack_test_pop_expect(stack_p, "4")) ||
+        (0 != stack_test_pop_expect(stack_p, "3")) ||
+        (! stack_is_empty(stack_p))) {
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    /*
+     * Size limit: run a long random mix of operations against a small
+     * buffer so that it wraps many times, checking after each step that
+     * the stack holds the newest entries in order.
+     */
+    srand(1);
+    stack_p = stack_alloc_bounded(STACK_MAX_ENTRIES_NONE, 200);
+    other_p = stack_alloc();
+    if ((NULL == stack_p) || (NULL == other_p)) {
+        printf("Error: Drop oldest: Can't init stacks\n");
+        return (-1);
+    }
+    memset(&model, 0, sizeof(model));
+    for (i = 0; i < 20000; i++) {
+        op = rand() % 100;
+        top = model.num_entries - 1;
+        num_entries = stack_get_num_entries(stack_p);
+
+        if ((op < 60) || (0 == num_entries)) {
+            model.sizes[model.num_entries] = rand() % STACK_TEST_MAX_ENTRY;
+            for (j = 0; j < model.sizes[model.num_entries]; j++) {
+                model.data[model.num_entries][j] = (unsigned char)(i + j);
+            }
+            err = stack_push(stack_p, model.data[model.num_entries],
+                             model.sizes[model.num_entries]);
+            model.num_entries++;
+        } else if (op < 80) {
+            err = stack_drop(stack_p, 1);
+            model.num_entries--;
+        } else if ((op < 85) && (num_entries >= 2)) {
+            err = stack_swap(stack_p);
+            memcpy(buf, model.data[top], STACK_TEST_MAX_ENTRY);
+            memcpy(model.data[top], model.data[top - 1],
+                   STACK_TEST_MAX_ENTRY);
+            memcpy(model.data[top - 1], buf, STACK_TEST_MAX_ENTRY);
+            entry_size = model.sizes[top];
+            model.sizes[top] = model.sizes[top - 1];
+            model.sizes[top - 1] = entry_size;
+        } else if (op < 90) {
+            err = stack_dup(stack_p);
+            model.sizes[top + 1] = model.sizes[top];
+            memcpy(model.data[top + 1], model.data[top],
+                   STACK_TEST_MAX_ENTRY);
+            model.num_entries++;
+        } else if (op < 95) {
+            /*
+             * Move the top entries out to a plain stack and back again.
+             */
+            j = (num_entries >= 2) ? 2 : 1;
+            err = stack_transfer(stack_p, other_p, j);
+            if (! stack_err_e_is_error(err)) {
+                err = stack_transfer(other_p, stack_p, j);
+            }
+        } else {
+            /*
+             * Drain everything and push it back.
+             */
+            buf_size = sizeof(buf);
+            if (0 == (i % 2)) {
+                err = stack_drain(stack_p, buf, &buf_size,
+                                  STACK_ORDER_BOTTOM_FIRST);
+                pos = 0;
+                while (! stack_err_e_is_error(err) &&
+                       stack_drain_next(buf, buf_size, &pos,
+                                        &entry_p, &entry_size)) {
+                    err = stack_push(stack_p, entry_p, entry_size);
+                }
+            } else {
+                err = stack_drain(stack_p, buf, &buf_size,
+                                  STACK_ORDER_TOP_FIRST);
+                for (j = num_entries; (j > 0) && ! stack_err_e_is_error(err);
+                     j--) {
+                    pos = 0;
+                    for (top = 0; top < j; top++) {
+                        (void)stack_drain_next(buf, buf_size, &pos,
+                                               &entry_p, &entry_size);
+                    }
+                    err = stack_push(stack_p, entry_p, entry_size);
+                }
+            }
+        }
+
+        if (stack_err_e_is_error(err)) {
+            printf("Error: Drop oldest: Step %u op %u failed: %d(%s)\n",
+                   i, op, err, stack_err_e_to_string(err));
+            return (-1);
+        }
+        if (0 != stack_test_model_check(stack_p, &model)) {
+            printf("Error: Drop oldest: Step %u op %u broke stack\n", i, op);
+            return (-1);
+        }
+    }
+
+    stack_free(stack_p);
+    stack_free(other_p);
+
+    return (0);
+}
+
+/**
+ * Test stacks that share one buffer.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_arena (void)
+{
+    stack_arena_t *arena_p     = NULL;           /* Arena to manipulate       */
+    stack_t       *stacks[3];                    /* Stacks of the arena       */
+    stack_err_e    err         = STACK_E_OK;     /* Operation return code     */
+    char           val[32];                      /* Value to push             */
+    unsigned int   num_pushed  = 0;              /* # of entries on stack 0   */
+    unsigned int   i           = 0;              /* Loop index counter        */
+
+    arena_p = stack_arena_alloc(3, 600);
+    if (NULL == arena_p) {
+        printf("Error: Arena: Can't init arena\n");
+        return (-1);
+    }
+    for (i = 0; i < 3; i++) {
+        stacks[i] = stack_arena_get_stack(arena_p, i);
+        if (NULL == stacks[i]) {
+            printf("Error: Arena: Can't get stack %u\n", i);
+            return (-1);
+        }
+    }
+    if (NULL != stack_arena_get_stack(arena_p, 3)) {
+        printf("Error: Arena: Got stack past the end\n");
+        return (-1);
+    }
+
+    if (stack_err_e_is_error(stack_push(stacks[0], "zero", 4)) ||
+        stack_err_e_is_error(stack_push(stacks[1], "one", 3)) ||
+        stack_err_e_is_error(stack_push(stacks[2], "two", 3))) {
+        printf("Error: Arena: Can't push\n");
+        return (-1);
+    }
+
+    /*
+     * The middle stack can grow well past a third of the arena by taking
+     * space from its neighbors.
+     */
+    for (;;) {
+        snprintf(val, sizeof(val), "%015u", num_pushed);
+        err = stack_push(stacks[1], val, strlen(val));
+        if (STACK_E_FULL == err) {
+            break;
+        }
+        if (stack_err_e_is_error(err)) {
+            printf("Error: Arena: Push #%u failed: %d(%s)\n",
+                   num_pushed, err, stack_err_e_to_string(err));
+            return (-1);
+        }
+        num_pushed++;
+    }
+    if (num_pushed < 20) {
+        printf("Error: Arena: Only %u entries fit\n", num_pushed);
+        return (-1);
+    }
+
+    /*
+     * Everything is still intact and in order.
+     */
+    for (i = num_pushed; i > 0; i--) {
+        snprintf(val, sizeof(val), "%015u", i - 1);
+        if (0 != stack_test_pop_expect(stacks[1], val)) {
+            return (-1);
+        }
+    }
+    if ((0 != stack_test_pop_expect(stacks[0], "zero")) ||
+        (0 != stack_test_pop_expect(stacks[1], "one")) ||
+        (0 != stack_test_pop_expect(stacks[2], "two"))) {
+        return (-1);
+    }
+
+    stack_arena_free(arena_p);
+
+    /*
+     * Copying an entry that needs more room than its stack's share moves
+     * the entries of every stack, the source included.
+     */
+    arena_p = stack_arena_alloc(2, 2048);
+    if (NULL != arena_p) {
+        stacks[0] = stack_arena_get_stack(arena_p, 0);
+        stacks[1] = stack_arena_get_stack(arena_p, 1);
+    }
+    if ((NULL == arena_p) || (NULL == stacks[0]) || (NULL == stacks[1]) ||
+        stack_err_e_is_error(stack_push(stacks[1], "zz", 2)) ||
+        (0 != stack_test_copy_push(stacks[0])) ||
+        stack_err_e_is_error(stack_dup(stacks[0])) ||
+        stack_err_e_is_error(stack_push(stacks[0], "x", 1)) ||
+        stack_err_e_is_error(stack_over(stacks[0]))) {
+        printf("Error: Arena: Can't copy entries\n");
+        return (-1);
+    }
+    if ((0 != stack_test_copy_expect(stacks[0], 1)) ||
+        (0 != stack_test_pop_expect(stacks[0], "x")) ||
+        (0 != stack_test_copy_expect(stacks[0], 2)) ||
+        (0 != stack_test_pop_expect(stacks[1], "zz"))) {
+        return (-1);
+    }
+
+    stack_arena_free(arena_p);
+
+    return (0);
+}
+
+/**
+ * Test stacks in shared memory.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_shm (void)
+{
+    stack_t      *stack_p     = NULL;            /* Creator's handle          */
+    stack_t      *other_p     = NULL;            /* Second handle             */
+    stack_t      *private_p   = NULL;            /* Process-private stack     */
+    stack_err_e   err         = STACK_E_OK;      /* Operation return code     */
+    char          name[64];                      /* Shared memory name        */
+    void         *view_p      = NULL;            /* Top entry in segment      */
+    size_t        view_size   = 0;               /* Size of top entry         */
+
+    snprintf(name, sizeof(name), "/stack_test.%d", (int)getpid());
+    stack_p = stack_open_shm(name, 256, STACK_SHM_CREATE | STACK_SHM_EXCL);
+    if (NULL == stack_p) {
+        printf("Error: Shm: Can't create stack\n");
+        return (-1);
+    }
+    if (NULL != stack_open_shm(name, 256, STACK_SHM_CREATE | STACK_SHM_EXCL)) {
+        printf("Error: Shm: Created stack twice\n");
+        return (-1);
+    }
+    other_p = stack_open_shm(name, STACK_MAX_SIZE_NONE, 0);
+    if (NULL == other_p) {
+        printf("Error: Shm: Can't open stack\n");
+        return (-1);
+    }
+
+    /*
+     * Both handles see the same entries.
+     */
+    if (stack_err_e_is_error(stack_push(stack_p, "one", 3)) ||
+        stack_err_e_is_error(stack_push(other_p, "two", 3))) {
+        printf("Error: Shm: Can't push\n");
+        return (-1);
+    }
+    if (2 != stack_get_num_entries(stack_p)) {
+        printf("Error: Shm: %lu entries but expected 2\n",
+               stack_get_num_entries(stack_p));
+        return (-1);
+    }
+    err = stack_top_view(stack_p, &view_p, &view_size);
+    if (stack_err_e_is_error(err) || (3 != view_size) ||
+        (0 != memcmp(view_p, "two", 3))) {
+        printf("Error: Shm: Bad top view: %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+
+    /*
+     * A third handle has yet another mapping of the segment.
+     */
+    private_p = stack_open_shm(name, STACK_MAX_SIZE_NONE, STACK_SHM_CREATE);
+    if ((NULL == private_p) ||
+        stack_err_e_is_error(stack_push(private_p, "third", 5))) {
+        printf("Error: Shm: Can't push through third handle\n");
+        return (-1);
+    }
+    stack_free(private_p);
+    if (0 != stack_test_pop_expect(other_p, "third")) {
+        return (-1);
+    }
+
+    /*
+     * Entries move between shared and private stacks, but two handles for
+     * one segment are the same stack.
+     */
+    private_p = stack_alloc();
+    if (NULL == private_p) {
+        printf("Error: Shm: Can't init stack\n");
+        return (-1);
+    }
+    err = stack_transfer(stack_p, other_p, 1);
+    if (STACK_E_INVALID != err) {
+        printf("Error: Shm: Transfer to self returned %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+    err = stack_transfer(stack_p, private_p, 1);
+    if (stack_err_e_is_error(err)) {
+        printf("Error: Shm: Can't transfer: %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+    if ((0 != stack_test_pop_expect(private_p, "two")) ||
+        (0 != stack_test_pop_expect(other_p, "one"))) {
+        return (-1);
+    }
+    stack_free(private_p);
+
+    stack_free(other_p);
+    stack_free(stack_p);
+    if (stack_err_e_is_error(stack_unlink_shm(name))) {
+        printf("Error: Shm: Can't unlink stack\n");
+        return (-1);
+    }
+    if (NULL != stack_open_shm(name, STACK_MAX_SIZE_NONE, 0)) {
+        printf("Error: Shm: Opened unlinked stack\n");
+        return (-1);
+    }
+
+    return (0);
+}
+
+/**
+ * Delay used by the helper threads of stack_test_wait(), in nanoseconds.
+ */
+#define STACK_TEST_WAIT_DELAY_NS 20000000
+
+/**
+ * Helper thread for stack_test_wait() that pushes an entry after a delay.
+ *
+ * @param[in] arg_p
+ *     Stack to push onto.
+ * @returns
+ *     NULL
+ */
+static void* stack_test_wait_producer (void *arg_p)
+{
+    struct timespec delay = {0, STACK_TEST_WAIT_DELAY_NS}; /* Sleep time    */
+
+    (void)nanosleep(&delay, NULL);
+    (void)stack_push((stack_t *)arg_p, "late", 4);
+
+    return (NULL);
+}
+
+/**
+ * Helper thread for stack_test_wait() that drops an entry after a delay.
+ *
+ * @param[in] arg_p
+ *     Stack to drop from.
+ * @returns
+ *     NULL
+ */
+static void* stack_test_wait_consumer (void *arg_p)
+{
+    struct timespec delay = {0, STACK_TEST_WAIT_DELAY_NS}; /* Sleep time    */
+
+    (void)nanosleep(&delay, NULL);
+    (void)stack_drop((stack_t *)arg_p, 1);
+
+    return (NULL);
+}
+
+/**
+ * Test stack_pop_wait() and stack_push_wait().
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_wait (void)
+{
+    stack_t      *stack_p   = NULL;              /* Stack to manipulate       */
+    stack_err_e   err       = STACK_E_OK;        /* Operation return code     */
+    pthread_t     thread;                        /* Helper thread             */
+    char          val[8];                        /* Popped value              */
+    size_t        val_size  = 0;                 /* Size of popped value      */
+
+    /*
+     * Only stacks with a lock support waiting.
+     */
+    stack_p = stack_alloc();
+    if (NULL == stack_p) {
+        printf("Error: Wait: Can't init stack\n");
+        return (-1);
+    }
+    val_size = sizeof(val);
+    err = stack_pop_wait(stack_p, val, &val_size, 0);
+    if (STACK_E_INVALID != err) {
+        printf("Error: Wait: Unsynchronized pop returned %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    stack_p = stack_alloc_flags(2, STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE, STACK_FLAG_SYNC);
+    if (NULL == stack_p) {
+        printf("Error: Wait: Can't init synchronized stack\n");
+        return (-1);
+    }
+    val_size = sizeof(val);
+    err = stack_pop_wait(stack_p, val, &val_size, 10);
+    if (STACK_E_TIMEOUT != err) {
+        printf("Error: Wait: Pop from empty stack returned %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+
+    /*
+     * A consumer sleeps until a producer pushes.
+     */
+    if (0 != pthread_create(&thread, NULL, stack_test_wait_producer,
+                            stack_p)) {
+        printf("Error: Wait: Can't start producer\n");
+        return (-1);
+    }
+    val_size = sizeof(val);
+    err = stack_pop_wait(stack_p, val, &val_size, STACK_WAIT_FOREVER);
+    (void)pthread_join(thread, NULL);
+    if (stack_err_e_is_error(err) || (4 != val_size) ||
+        (0 != memcmp(val, "late", 4))) {
+        printf("Error: Wait: Waiting pop returned %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+
+    /*
+     * A producer sleeps until a consumer makes room.
+     */
+    if (stack_err_e_is_error(stack_push(stack_p, "a", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "b", 1))) {
+        printf("Error: Wait: Can't push\n");
+        return (-1);
+    }
+    err = stack_push_wait(stack_p, "c", 1, 0);
+    if (STACK_E_TIMEOUT != err) {
+        printf("Error: Wait: Push onto full stack returned %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+    if (0 != pthread_create(&thread, NULL, stack_test_wait_consumer,
+                            stack_p)) {
+        printf("Error: Wait: Can't start consumer\n");
+        return (-1);
+    }
+    err = stack_push_wait(stack_p, "c", 1, STACK_WAIT_FOREVER);
+    (void)pthread_join(thread, NULL);
+    if (stack_err_e_is_error(err)) {
+        printf("Error: Wait: Waiting push returned %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        return (-1);
+    }
+    if ((0 != stack_test_pop_expect(stack_p, "c")) ||
+        (0 != stack_test_pop_expect(stack_p, "a"))) {
+        return (-1);
+    }
+
+    stack_free(stack_p);
+
+    return (0);
+}
+
+/**
+ * Determine whether a descriptor is readable right now.
+ *
+ * @param[in] fd
+ *     Descriptor to check.
+ * @retval true
+ *     Descriptor is readable.
+ * @retval false
+ *     Descriptor is not readable.
+ */
+static bool stack_test_is_readable (int fd)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};         /* Descriptor to poll        */
+
+    return ((1 == poll(&pfd, 1, 0)) && (0 != (pfd.revents & POLLIN)));
+}
+
+/**
+ * Test stack_get_event_fd().
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_event_fd (void)
+{
+    stack_t      *stack_p   = NULL;              /* Stack to manipulate       */
+    int           fd        = -1;                /* Readiness descriptor      */
+    size_t        buf_size  = 0;                 /* Drain buffer size         */
+    unsigned char buf[64];                       /* Drained records           */
+
+    stack_p = stack_alloc();
+    if (NULL == stack_p) {
+        printf("Error: Event fd: Can't init stack\n");
+        return (-1);
+    }
+    if (-1 != stack_get_event_fd(stack_p, 0)) {
+        printf("Error: Event fd: Accepted threshold 0\n");
+        return (-1);
+    }
+
+    /*
+     * With a high-watermark of 2, only the second entry makes the
+     * descriptor readable.
+     */
+    fd = stack_get_event_fd(stack_p, 2);
+    if (fd < 0) {
+        printf("Error: Event fd: Can't get descriptor\n");
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, "a", 1)) ||
+        stack_test_is_readable(fd)) {
+        printf("Error: Event fd: Readable below threshold\n");
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, "b", 1)) ||
+        (! stack_test_is_readable(fd))) {
+        printf("Error: Event fd: Not readable at threshold\n");
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_drop(stack_p, 1)) ||
+        stack_test_is_readable(fd)) {
+        printf("Error: Event fd: Still readable after pop\n");
+        return (-1);
+    }
+
+    /*
+     * Lowering the threshold takes effect immediately.
+     */
+    if ((fd != stack_get_event_fd(stack_p, STACK_EVENT_NOT_EMPTY)) ||
+        (! stack_test_is_readable(fd))) {
+        printf("Error: Event fd: Not readable for non-empty stack\n");
+        return (-1);
+    }
+    buf_size = sizeof(buf);
+    if (stack_err_e_is_error(stack_drain(stack_p, buf, &buf_size,
+                                         STACK_ORDER_TOP_FIRST)) ||
+        stack_test_is_readable(fd)) {
+        printf("Error: Event fd: Readable after drain\n");
+        return (-1);
+    }
+
+    stack_free(stack_p);
+
+    return (0);
+}
+
+/**
+ * Number of producer threads in stack_test_mpsc().
+ */
+#define STACK_TEST_MPSC_PRODUCERS 4
+
+/**
+ * Number of entries pushed by each producer thread in stack_test_mpsc().
+ */
+#define STACK_TEST_MPSC_PUSHES 2500
+
+/**
+ * Producer thread for stack_test_mpsc().
+ */
+typedef struct {
+    /**
+     * Stack to push onto.
+     */
+    stack_t *stack_p;
+    /**
+     * Producer number, stored in the upper bits of each value.
+     */
+    unsigned int id;
+    /**
+     * Number of failed pushes.
+     */
+    unsigned int num_errors;
+} stack_test_mpsc_producer_t;
+
+/**
+ * Producer thread body for stack_test_mpsc().
+ *
+ * @param[in,out] arg_p
+ *     Producer description.
+ * @returns
+ *     NULL
+ */
+static void* stack_test_mpsc_producer (void *arg_p)
+{
+    stack_test_mpsc_producer_t *producer_p = arg_p; /* Producer description */
+    unsigned int                val        = 0;  /* Value to push            */
+    unsigned int                i          = 0;  /* Loop index counter       */
+
+    for (i = 0; i < STACK_TEST_MPSC_PUSHES; i++) {
+        val = (producer_p->id << 16) | i;
+        if (stack_err_e_is_error(stack_push(producer_p->stack_p,
+                                            &val, sizeof(val)))) {
+            producer_p->num_errors++;
+        }
+    }
+
+    return (NULL);
+}
+
+/**
+ * Test stack iterators and lock-free multi-producer stacks.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_mpsc (void)
+{
+    stack_t                    *stack_p   = NULL; /* Stack to manipulate     */
+    stack_batch_t              *batch_p   = NULL; /* Detached entries        */
+    stack_iter_t                iter;            /* Walk over entries        */
+    const void                 *entry_p   = NULL; /* Current entry           */
+    size_t                      entry_size = 0;  /* Size of current entry    */
+    stack_test_mpsc_producer_t  producers[STACK_TEST_MPSC_PRODUCERS];
+    pthread_t                   threads[STACK_TEST_MPSC_PRODUCERS];
+    unsigned int                last[STACK_TEST_MPSC_PRODUCERS];
+    unsigned int                val       = 0;   /* Current value            */
+    unsigned int                id        = 0;   /* Producer of value        */
+    unsigned int                num_seen  = 0;   /* Values consumed          */
+    unsigned int                num_bad   = 0;   /* Values out of order      */
+    unsigned int                i         = 0;   /* Loop index counter       */
+
+    /*
+     * Walk an ordinary stack from the top down.
+     */
+    stack_p = stack_alloc();
+    if (NULL == stack_p) {
+        printf("Error: MPSC: Can't init stack\n");
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, "a", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "bb", 2)) ||
+        stack_err_e_is_error(stack_push(stack_p, "ccc", 3))) {
+        printf("Error: MPSC: Can't push\n");
+        return (-1);
+    }
+    stack_iter_init(&iter, stack_p);
+    for (i = 3; stack_iter_next(&iter, &entry_p, &entry_size); i--) {
+        if ((i != entry_size) ||
+            ((int)('a' + i - 1) != *(const char *)entry_p)) {
+            printf("Error: MPSC: Walk returned wrong entry\n");
+            return (-1);
+        }
+    }
+    if (0 != i) {
+        printf("Error: MPSC: Walk missed %u entries\n", i);
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    if ((NULL != stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                   STACK_MAX_ENTRY_SIZE_NONE,
+                                   STACK_DEFAULT_ENTRY_SIZE,
+                                   STACK_MAX_SIZE_NONE,
+                                   STACK_FLAG_MPSC | STACK_FLAG_SYNC)) ||
+        (NULL != stack_open_shm("/stack_test_mpsc", 4096,
+                                STACK_FLAG_MPSC | STACK_SHM_CREATE))) {
+        printf("Error: MPSC: Accepted conflicting flags\n");
+        return (-1);
+    }
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_MPSC);
+    if (NULL == stack_p) {
+        printf("Error: MPSC: Can't init MPSC stack\n");
+        return (-1);
+    }
+
+    /*
+     * Single-threaded use.
+     */
+    if (stack_err_e_is_error(stack_push(stack_p, "x", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "y", 1)) ||
+        (2 != stack_get_num_entries(stack_p)) ||
+        (STACK_E_INVALID != stack_dup(stack_p))) {
+        printf("Error: MPSC: Bad single-threaded behavior\n");
+        return (-1);
+    }
+    if (0 != stack_test_pop_expect(stack_p, "y")) {
+        return (-1);
+    }
+    batch_p = stack_take_all(stack_p);
+    stack_batch_iter_init(&iter, batch_p);
+    if ((! stack_iter_next(&iter, &entry_p, &entry_size)) ||
+        (1 != entry_size) || ('x' != *(const char *)entry_p) ||
+        stack_iter_next(&iter, &entry_p, &entry_size) ||
+        (! stack_is_empty(stack_p))) {
+        printf("Error: MPSC: Bad batch\n");
+        return (-1);
+    }
+    stack_batch_free(batch_p);
+
+    /*
+     * Several producers push while the consumer takes batches. Within a
+     * batch, each producer's values must appear newest first, and every
+     * value must be consumed exactly once.
+     */
+    for (i = 0; i < STACK_TEST_MPSC_PRODUCERS; i++) {
+        producers[i].stack_p = stack_p;
+        producers[i].id = i;
+        producers[i].num_errors = 0;
+        last[i] = 0;
+        if (0 != pthread_create(&(threads[i]), NULL,
+                                stack_test_mpsc_producer, &(producers[i]))) {
+            printf("Error: MPSC: Can't start producer %u\n", i);
+            return (-1);
+        }
+    }
+    while (num_seen < (STACK_TEST_MPSC_PRODUCERS * STACK_TEST_MPSC_PUSHES)) {
+        batch_p = stack_take_all(stack_p);
+        for (i = 0; i < STACK_TEST_MPSC_PRODUCERS; i++) {
+            last[i] = (unsigned int)-1;
+        }
+        stack_batch_iter_init(&iter, batch_p);
+        while (stack_iter_next(&iter, &entry_p, &entry_size)) {
+            memcpy(&val, entry_p, sizeof(val));
+            id = val >> 16;
+            if ((sizeof(val) != entry_size) ||
+                (id >= STACK_TEST_MPSC_PRODUCERS) ||
+                ((val & 0xFFFF) >= last[id])) {
+                num_bad++;
+                break;
+            }
+            last[id] = val & 0xFFFF;
+            num_seen++;
+        }
+        stack_batch_free(batch_p);
+        if (num_bad > 0) {
+            break;
+        }
+    }
+    for (i = 0; i < STACK_TEST_MPSC_PRODUCERS; i++) {
+        (void)pthread_join(threads[i], NULL);
+        num_bad += producers[i].num_errors;
+    }
+    if ((num_bad > 0) || (! stack_is_empty(stack_p))) {
+        printf("Error: MPSC: %u bad values, %lu left over\n",
+               num_bad, stack_get_num_entries(stack_p));
+        return (-1);
+    }
+
+    stack_free(stack_p);
+
+    return (0);
+}
+
+/**
+ * Number of entries pushed by the owner thread in stack_test_snapshot().
+ */
+#define STACK_TEST_SNAPSHOT_PUSHES 20000
+
+/**
+ * Check the entries of a snapshot.
+ *
+ * @param[in] snapshot_p
+ *     Snapshot to walk.
+ * @param[in] expected_p
+ *     Expected entries from the top down, each followed by a ','.
+ * @retval 0
+ *     Snapshot holds the expected entries.
+ * @retval -1
+ *     It does not.
+ */
+static int stack_test_snapshot_expect (const stack_snapshot_t *snapshot_p,
+                                       const char *expected_p)
+{
+    stack_iter_t  iter;                          /* Walk over entries         */
+    const void   *entry_p    = NULL;             /* Current entry             */
+    size_t        entry_size = 0;                /* Size of current entry     */
+    char          out[128]   = "";               /* Entries seen so far       */
+    size_t        out_size   = 0;                /* Length of out             */
+
+    stack_snapshot_iter_init(&iter, snapshot_p);
+    while (stack_iter_next(&iter, &entry_p, &entry_size)) {
+        if ((out_size + entry_size + 2) > sizeof(out)) {
+            break;
+        }
+        memcpy(out + out_size, entry_p, entry_size);
+        out_size += entry_size;
+        out[out_size++] = ',';
+        out[out_size] = '\0';
+    }
+    if (0 != strcmp(out, expected_p)) {
+        printf("Error: Snapshot holds '%s' but expected '%s'\n",
+               out, expected_p);
+        return (-1);
+    }
+
+    return (0);
+}
+
+/**
+ * Owner thread for stack_test_snapshot().
+ */
+typedef struct {
+    /**
+     * Stack to update.
+     */
+    stack_t *stack_p;
+    /**
+     * Has the owner finished? Updated atomically.
+     */
+    bool is_done;
+    /**
+     * Did an operation fail?
+     */
+    bool is_failed;
+} stack_test_snapshot_owner_t;
+
+/**
+ * Owner thread body for stack_test_snapshot(). Pushes increasing values
+ * and occasionally replaces or pops them, so that the entries of the
+ * stack always decrease from the top down.
+ *
+ * @param[in,out] arg_p
+ *     Owner description.
+ * @returns
+ *     NULL
+ */
+static void* stack_test_snapshot_owner (void *arg_p)
+{
+    stack_test_snapshot_owner_t *owner_p = arg_p; /* Owner description   */
+    unsigned int                 val     = 0;    /* Value to push             */
+    unsigned int                 i       = 0;    /* Loop index counter        */
+
+    for (i = 1; i <= STACK_TEST_SNAPSHOT_PUSHES; i++) {
+        val = 2 * i;
+        if (stack_err_e_is_error(stack_push(owner_p->stack_p,
+                                            &val, sizeof(val)))) {
+            owner_p->is_failed = true;
+            break;
+        }
+        if (0 == (i % 4)) {
+            val++;
+            if (stack_err_e_is_error(stack_replace_top(owner_p->stack_p,
+                                                       &val, sizeof(val)))) {
+                owner_p->is_failed = true;
+                break;
+            }
+        }
+        if (0 == (i % 3)) {
+            (void)stack_drop(owner_p->stack_p,
+                             (stack_get_num_entries(owner_p->stack_p) < 32) ?
+                                 2 : 3);
+        }
+    }
+    __atomic_store_n(&(owner_p->is_done), true, __ATOMIC_RELEASE);
+
+    return (NULL);
+}
+
+/**
+ * Test snapshots taken while the stack is being changed.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_snapshot (void)
+{
+    stack_t          *stack_p    = NULL;         /* Stack to manipulate       */
+    stack_t          *other_p    = NULL;         /* Stack to transfer from    */
+    stack_snapshot_t *old_p      = NULL;         /* Earlier snapshot          */
+    stack_snapshot_t *new_p      = NULL;         /* Later snapshot            */
+    stack_iter_t      iter;                      /* Walk over entries         */
+    const void       *entry_p    = NULL;         /* Current entry             */
+    size_t            entry_size = 0;            /* Size of current entry     */
+    void             *view_p     = NULL;         /* Top entry in place        */
+    stack_test_snapshot_owner_t owner;           /* Owner thread state        */
+    pthread_t         thread;                    /* Owner thread              */
+    bool              is_done    = false;        /* Owner finished?           */
+    unsigned int      val        = 0;            /* Current value             */
+    unsigned int      prev       = 0;            /* Value above current one   */
+    size_t            count      = 0;            /* Entries walked            */
+    unsigned int      num_bad    = 0;            /* Inconsistent snapshots    */
+    unsigned int      num_taken  = 0;            /* Snapshots taken           */
+
+    if (NULL != stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                  STACK_MAX_ENTRY_SIZE_NONE,
+                                  STACK_DEFAULT_ENTRY_SIZE,
+                                  STACK_MAX_SIZE_NONE,
+                                  STACK_FLAG_SNAPSHOT |
+                                      STACK_FLAG_DROP_OLDEST)) {
+        printf("Error: Snapshot: Accepted conflicting flags\n");
+        return (-1);
+    }
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_SNAPSHOT);
+    if (NULL == stack_p) {
+        printf("Error: Snapshot: Can't init stack\n");
+        return (-1);
+    }
+    if (NULL != stack_snapshot_take(NULL)) {
+        printf("Error: Snapshot: Took snapshot of invalid stack\n");
+        return (-1);
+    }
+
+    /*
+     * Snapshots keep their entries however the stack changes afterwards,
+     * and even after it is freed.
+     */
+    if (stack_err_e_is_error(stack_push(stack_p, "a", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "bb", 2))) {
+        printf("Error: Snapshot: Can't push\n");
+        return (-1);
+    }
+    old_p = stack_snapshot_take(stack_p);
+    if ((0 != stack_test_pop_expect(stack_p, "bb")) ||
+        stack_err_e_is_error(stack_push(stack_p, "cc", 2)) ||
+        stack_err_e_is_error(stack_replace_top(stack_p, "dd", 2)) ||
+        stack_err_e_is_error(stack_push(stack_p, "e", 1)) ||
+        stack_err_e_is_error(stack_swap(stack_p))) {
+        printf("Error: Snapshot: Can't change stack\n");
+        return (-1);
+    }
+    new_p = stack_snapshot_take(stack_p);
+    if ((2 != stack_snapshot_get_num_entries(old_p)) ||
+        (3 != stack_snapshot_get_num_entries(new_p)) ||
+        (STACK_E_INVALID != stack_top_view(stack_p, &view_p, &entry_size))) {
+        printf("Error: Snapshot: Bad snapshot state\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+    if ((0 != stack_test_snapshot_expect(old_p, "bb,a,")) ||
+        (0 != stack_test_snapshot_expect(new_p, "dd,e,a,"))) {
+        return (-1);
+    }
+    stack_snapshot_free(old_p);
+    stack_snapshot_free(new_p);
+
+    /*
+     * A copy of an entry that a snapshot shares is taken from the shared
+     * chunk as the stack moves to a new one.
+     */
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_SNAPSHOT);
+    if ((NULL == stack_p) ||
+        stack_err_e_is_error(stack_push(stack_p, "f", 1)) ||
+        (NULL == (old_p = stack_snapshot_take(stack_p))) ||
+        stack_err_e_is_error(stack_dup(stack_p))) {
+        printf("Error: Snapshot: Can't copy shared entry\n");
+        return (-1);
+    }
+    stack_snapshot_free(old_p);
+    if ((0 != stack_test_pop_expect(stack_p, "f")) ||
+        (0 != stack_test_pop_expect(stack_p, "f"))) {
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    /*
+     * Entries moved one at a time, here from a stack with a different
+     * entry layout, go around the chunk that a snapshot shares.
+     */
+    other_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_DROP_OLDEST);
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_SNAPSHOT);
+    if ((NULL == other_p) || (NULL == stack_p) ||
+        stack_err_e_is_error(stack_push(other_p, "h", 1)) ||
+        stack_err_e_is_error(stack_push(other_p, "ii", 2)) ||
+        stack_err_e_is_error(stack_push(stack_p, "g", 1)) ||
+        (NULL == (old_p = stack_snapshot_take(stack_p))) ||
+        stack_err_e_is_error(stack_transfer(other_p, stack_p, 2))) {
+        printf("Error: Snapshot: Can't transfer onto shared chunk\n");
+        return (-1);
+    }
+    new_p = stack_snapshot_take(stack_p);
+    if ((NULL == new_p) ||
+        (0 != stack_test_snapshot_expect(old_p, "g,")) ||
+        (0 != stack_test_snapshot_expect(new_p, "ii,h,g,"))) {
+        return (-1);
+    }
+    stack_snapshot_free(old_p);
+    stack_snapshot_free(new_p);
+    stack_free(other_p);
+    stack_free(stack_p);
+
+    /*
+     * Snapshots taken while another thread changes the stack must each
+     * show a state the stack was in.
+     */
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_SNAPSHOT);
+    if (NULL == stack_p) {
+        printf("Error: Snapshot: Can't init stack\n");
+        return (-1);
+    }
+    owner.stack_p = stack_p;
+    owner.is_done = false;
+    owner.is_failed = false;
+    if (0 != pthread_create(&thread, NULL,
+                            stack_test_snapshot_owner, &owner)) {
+        printf("Error: Snapshot: Can't start owner\n");
+        return (-1);
+    }
+    do {
+        is_done = __atomic_load_n(&(owner.is_done), __ATOMIC_ACQUIRE);
+        new_p = stack_snapshot_take(stack_p);
+        if (NULL == new_p) {
+            num_bad++;
+            break;
+        }
+        num_taken++;
+        count = 0;
+        prev = (unsigned int)-1;
+        stack_snapshot_iter_init(&iter, new_p);
+        while (stack_iter_next(&iter, &entry_p, &entry_size)) {
+            memcpy(&val, entry_p, sizeof(val));
+            if ((sizeof(val) != entry_size) || (val >= prev)) {
+                num_bad++;
+                break;
+            }
+            prev = val;
+            count++;
+        }
+        if (count != stack_snapshot_get_num_entries(new_p)) {
+            num_bad++;
+        }
+        stack_snapshot_free(new_p);
+    } while ((! is_done) && (num_bad == 0));
+    (void)pthread_join(thread, NULL);
+    if (owner.is_failed || (num_bad > 0)) {
+        printf("Error: Snapshot: %u of %u snapshots inconsistent\n",
+               num_bad, num_taken);
+        return (-1);
+    }
+
+    stack_free(stack_p);
+
+    return (0);
+}
+
+/**
+ * Number of operations made by the writer thread in
+ * stack_test_single_writer().
+ */
+#define STACK_TEST_SINGLE_WRITER_OPS 50000
+
+/**
+ * Writer thread for stack_test_single_writer().
+ */
+typedef struct {
+    /**
+     * Stack to update.
+     */
+    stack_t *stack_p;
+    /**
+     * Has the writer finished? Updated atomically.
+     */
+    bool is_done;
+    /**
+     * Did an operation fail?
+     */
+    bool is_failed;
+} stack_test_single_writer_t;
+
+/**
+ * Writer thread body for stack_test_single_writer(). Every entry it
+ * pushes consists of as many bytes as its value, and the stack never
+ * holds more than 8 entries.
+ *
+ * @param[in,out] arg_p
+ *     Writer description.
+ * @returns
+ *     NULL
+ */
+static void* stack_test_single_writer_thread (void *arg_p)
+{
+    stack_test_single_writer_t *writer_p = arg_p; /* Writer description  */
+    unsigned char               entry[64];       /* Entry to push             */
+    size_t                      entry_size = 0;  /* Size of entry             */
+    unsigned int                i          = 0;  /* Loop index counter        */
+    stack_err_e                 err        = STACK_E_OK; /* Return code       */
+
+    for (i = 0; i < STACK_TEST_SINGLE_WRITER_OPS; i++) {
+        entry_size = 1 + (i % (sizeof(entry) - 1));
+        memset(entry, (int)entry_size, entry_size);
+        if (stack_get_num_entries(writer_p->stack_p) >= 8) {
+            err = stack_drop(writer_p->stack_p, 3);
+        } else if (0 == (i % 5)) {
+            err = stack_replace_top(writer_p->stack_p, entry, entry_size);
+            if (STACK_E_EMPTY == err) {
+                err = STACK_E_OK;
+            }
+        } else {
+            err = stack_push(writer_p->stack_p, entry, entry_size);
+        }
+        if (stack_err_e_is_error(err)) {
+            writer_p->is_failed = true;
+            break;
+        }
+    }
+    __atomic_store_n(&(writer_p->is_done), true, __ATOMIC_RELEASE);
+
+    return (NULL);
+}
+
+/**
+ * Test lock-free reads of a single-writer stack.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_single_writer (void)
+{
+    stack_t                    *stack_p    = NULL; /* Stack to read       */
+    stack_test_single_writer_t  writer;          /* Writer thread state       */
+    pthread_t                   thread;          /* Writer thread             */
+    unsigned char               entry[64];       /* Peeked entry              */
+    size_t                      entry_size = 0;  /* Size of peeked entry      */
+    size_t                      i          = 0;  /* Loop index counter        */
+    bool                        is_done    = false; /* Writer finished?       */
+    unsigned int                num_bad    = 0;  /* Inconsistent reads        */
+    stack_err_e                 err        = STACK_E_OK; /* Return code       */
+
+    if (NULL != stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                  STACK_MAX_ENTRY_SIZE_NONE,
+                                  STACK_DEFAULT_ENTRY_SIZE,
+                                  STACK_MAX_SIZE_NONE,
+                                  STACK_FLAG_SINGLE_WRITER |
+                                      STACK_FLAG_SYNC)) {
+        printf("Error: Single writer: Accepted conflicting flags\n");
+        return (-1);
+    }
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_SINGLE_WRITER);
+    if (NULL == stack_p) {
+        printf("Error: Single writer: Can't init stack\n");
+        return (-1);
+    }
+
+    entry_size = sizeof(entry);
+    if ((STACK_E_EMPTY != stack_peek(stack_p, entry, &entry_size)) ||
+        stack_err_e_is_error(stack_push(stack_p, "abc", 3))) {
+        printf("Error: Single writer: Bad empty stack\n");
+        return (-1);
+    }
+    entry_size = 2;
+    if (STACK_E_BUF_OVERFLOW != stack_peek(stack_p, entry, &entry_size)) {
+        printf("Error: Single writer: Missed overflow\n");
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_peek(stack_p, NULL, &entry_size)) ||
+        (3 != entry_size) ||
+        (1 != stack_get_num_entries(stack_p)) ||
+        (0 != stack_test_pop_expect(stack_p, "abc"))) {
+        printf("Error: Single writer: Bad peek\n");
+        return (-1);
+    }
+
+    /*
+     * Read the stack as fast as possible while another thread changes it.
+     * Every read must see a complete entry.
+     */
+    writer.stack_p = stack_p;
+    writer.is_done = false;
+    writer.is_failed = false;
+    if (0 != pthread_create(&thread, NULL,
+                            stack_test_single_writer_thread, &writer)) {
+        printf("Error: Single writer: Can't start writer\n");
+        return (-1);
+    }
+    while ((! is_done) && (0 == num_bad)) {
+        is_done = __atomic_load_n(&(writer.is_done), __ATOMIC_ACQUIRE);
+        if (stack_get_num_entries(stack_p) > 8) {
+            num_bad++;
+        }
+        entry_size = sizeof(entry);
+        err = stack_peek(stack_p, entry, &entry_size);
+        if (STACK_E_EMPTY == err) {
+            continue;
+        }
+        if (stack_err_e_is_error(err)) {
+            num_bad++;
+            break;
+        }
+        for (i = 0; i < entry_size; i++) {
+            if (entry[i] != entry_size) {
+                num_bad++;
+                break;
+            }
+        }
+    }
+    (void)pthread_join(thread, NULL);
+    if (writer.is_failed || (num_bad > 0)) {
+        printf("Error: Single writer: %u inconsistent reads\n", num_bad);
+        return (-1);
+    }
+
+    stack_free(stack_p);
+
+    return (0);
+}
+
+/**
+ * Number of entries pushed by stack_test_grow(), enough to grow the
+ * buffer several times.
+ */
+#define STACK_TEST_GROW_ENTRIES 200
+
+/**
+ * Test growing stacks and stack_push_reserve().
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_grow (void)
+{
+    stack_t       *stack_p    = NULL;            /* Stack to manipulate       */
+    stack_t       *mpsc_p     = NULL;            /* Stack without a buffer    */
+    unsigned char *entry_p    = NULL;            /* Reserved entry            */
+    unsigned char  out[512];                     /* Popped entry              */
+    size_t         out_size   = 0;               /* Size of popped entry      */
+    size_t         entry_size = 0;               /* Size of current entry     */
+    size_t         i          = 0;               /* Loop index counter        */
+    size_t         j          = 0;               /* Byte index counter        */
+
+    if ((NULL != stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                   STACK_MAX_ENTRY_SIZE_NONE,
+                                   STACK_DEFAULT_ENTRY_SIZE,
+                                   STACK_MAX_SIZE_NONE,
+                                   STACK_FLAG_GROW | STACK_FLAG_DROP_OLDEST)) ||
+        (NULL != stack_open_shm("/stack_test_grow", 4096,
+                                STACK_FLAG_GROW | STACK_SHM_CREATE))) {
+        printf("Error: Grow: Accepted bad flags\n");
+        return (-1);
+    }
+
+    /*
+     * Entries of growing sizes, filled in place, must come back intact
+     * however many times the buffer moved.
+     */
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_GROW);
+    if (NULL == stack_p) {
+        printf("Error: Grow: Can't init stack\n");
+        return (-1);
+    }
+    for (i = 0; i < STACK_TEST_GROW_ENTRIES; i++) {
+        entry_size = 2 * i;
+        if (stack_err_e_is_error(stack_push_reserve(stack_p, entry_size,
+                                                    (void **)&entry_p))) {
+            printf("Error: Grow: Can't reserve entry %zu\n", i);
+            return (-1);
+        }
+        for (j = 0; j < entry_size; j++) {
+            entry_p[j] = (unsigned char)(i + j);
+        }
+    }
+    for (i = STACK_TEST_GROW_ENTRIES; i > 0; i--) {
+        out_size = sizeof(out);
+        if (stack_err_e_is_error(stack_pop(stack_p, out, &out_size)) ||
+            (out_size != (2 * (i - 1)))) {
+            printf("Error: Grow: Can't pop entry %zu\n", i - 1);
+            return (-1);
+        }
+        for (j = 0; j < out_size; j++) {
+            if (out[j] != (unsigned char)((i - 1) + j)) {
+                printf("Error: Grow: Entry %zu corrupted\n", i - 1);
+                return (-1);
+            }
+        }
+    }
+    stack_free(stack_p);
+
+    /*
+     * A maximum size still caps a growing stack.
+     */
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                4096,
+                                STACK_FLAG_GROW);
+    if (NULL == stack_p) {
+        printf("Error: Grow: Can't init bounded stack\n");
+        return (-1);
+    }
+    if ((STACK_E_FULL != stack_push_reserve(stack_p, 4096,
+                                            (void **)&entry_p)) ||
+        stack_err_e_is_error(stack_push_reserve(stack_p, 3000,
+                                                (void **)&entry_p)) ||
+        (STACK_E_FULL != stack_push(stack_p, out, 1100)) ||
+        stack_err_e_is_error(stack_push(stack_p, out, 500)) ||
+        (2 != stack_get_num_entries(stack_p))) {
+        printf("Error: Grow: Maximum size not enforced\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    /*
+     * Copies of an entry that don't fit grow the buffer that the entry is
+     * copied from.
+     */
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_GROW);
+    if ((NULL == stack_p) || (0 != stack_test_copy_push(stack_p)) ||
+        stack_err_e_is_error(stack_dup(stack_p)) ||
+        stack_err_e_is_error(stack_push(stack_p, "x", 1)) ||
+        stack_err_e_is_error(stack_over(stack_p))) {
+        printf("Error: Grow: Can't copy entries\n");
+        return (-1);
+    }
+    if ((0 != stack_test_copy_expect(stack_p, 1)) ||
+        (0 != stack_test_pop_expect(stack_p, "x")) ||
+        (0 != stack_test_copy_expect(stack_p, 2))) {
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    mpsc_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                               STACK_MAX_ENTRY_SIZE_NONE,
+                               STACK_DEFAULT_ENTRY_SIZE,
+                               STACK_MAX_SIZE_NONE,
+                               STACK_FLAG_MPSC);
+    if ((NULL == mpsc_p) ||
+        (STACK_E_INVALID != stack_push_reserve(mpsc_p, 8,
+                                               (void **)&entry_p))) {
+        printf("Error: Grow: Reserved entry in MPSC stack\n");
+        return (-1);
+    }
+    stack_free(mpsc_p);
+
+    /*
+     * Nor can an entry be reserved where others could read it unfilled.
+     */
+    for (i = 0; i < 3; i++) {
+        if (2 == i) {
+            stack_p = stack_open_shm("/stack_test_reserve", 4096,
+                                     STACK_SHM_CREATE);
+        } else {
+            stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                        STACK_MAX_ENTRY_SIZE_NONE,
+                                        STACK_DEFAULT_ENTRY_SIZE,
+                                        STACK_MAX_SIZE_NONE,
+                                        (0 == i) ? STACK_FLAG_SINGLE_WRITER :
+                                                   STACK_FLAG_SYNC);
+        }
+        if ((NULL == stack_p) ||
+            (STACK_E_INVALID != stack_push_reserve(stack_p, 8,
+                                                   (void **)&entry_p))) {
+            printf("Error: Grow: Reserved entry in shared stack %zu\n", i);
+            return (-1);
+        }
+        stack_free(stack_p);
+    }
+    (void)stack_unlink_shm("/stack_test_reserve");
+
+    return (0);
+}
+
+/**
+ * Number of entries pushed at once by stack_test_push_multi().
+ */
+#define STACK_TEST_MULTI_ENTRIES 1000
+
+/**
+ * Test stack_push_multi().
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_push_multi (void)
+{
+    static const void *entries[STACK_TEST_MULTI_ENTRIES]; /* Entries to push */
+    static size_t      sizes[STACK_TEST_MULTI_ENTRIES];   /* Entry sizes     */
+    stack_t           *stack_p    = NULL;        /* Stack to manipulate       */
+    const char        *words[]    = { "alpha", "", "gamma" }; /* Entries      */
+    char               out[16];                  /* Popped entry              */
+    size_t             out_size   = 0;           /* Size of popped entry      */
+    size_t             i          = 0;           /* Loop index counter        */
+
+    for (i = 0; i < 3; i++) {
+        entries[i] = words[i];
+        sizes[i] = strlen(words[i]);
+    }
+
+    /*
+     * All of the entries go on in array order, or none of them.
+     */
+    stack_p = stack_alloc_custom(4, STACK_MAX_ENTRY_SIZE_NONE,
+                                 STACK_DEFAULT_ENTRY_SIZE,
+                                 STACK_MAX_SIZE_NONE);
+    if (NULL == stack_p) {
+        printf("Error: Push multi: Can't init stack\n");
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, "base", 4)) ||
+        stack_err_e_is_error(stack_push_multi(stack_p, entries, sizes, 3)) ||
+        (4 != stack_get_num_entries(stack_p))) {
+        printf("Error: Push multi: Can't push entries\n");
+        return (-1);
+    }
+    for (i = 3; i > 0; i--) {
+        out_size = sizeof(out);
+        if (stack_err_e_is_error(stack_pop(stack_p, out, &out_size)) ||
+            (out_size != sizes[i - 1]) ||
+            (0 != memcmp(out, words[i - 1], out_size))) {
+            printf("Error: Push multi: Entry %zu not popped in order\n",
+                   i - 1);
+            return (-1);
+        }
+    }
+    if (stack_err_e_is_error(stack_push_multi(stack_p, entries, sizes, 3)) ||
+        (STACK_E_FULL != stack_push_multi(stack_p, entries, sizes, 1)) ||
+        stack_err_e_is_error(stack_drop(stack_p, 3))) {
+        printf("Error: Push multi: Exceeded maximum entries\n");
+        return (-1);
+    }
+    sizes[1] = 1;
+    entries[1] = NULL;
+    if ((STACK_E_INVALID != stack_push_multi(stack_p, entries, sizes, 2)) ||
+        (1 != stack_get_num_entries(stack_p))) {
+        printf("Error: Push multi: Accepted bad entry\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    /*
+     * A fixed-size stack is left unchanged if not everything fits, while a
+     * growing stack makes room for everything at once.
+     */
+    for (i = 0; i < STACK_TEST_MULTI_ENTRIES; i++) {
+        entries[i] = words[0];
+        sizes[i] = strlen(words[0]);
+    }
+    stack_p = stack_alloc();
+    if ((NULL == stack_p) ||
+        (STACK_E_FULL != stack_push_multi(stack_p, entries, sizes,
+                                          STACK_TEST_MULTI_ENTRIES)) ||
+        (0 != stack_get_num_entries(stack_p))) {
+        printf("Error: Push multi: Overfilled fixed-size stack\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_GROW);
+    if ((NULL == stack_p) ||
+        stack_err_e_is_error(stack_push_multi(stack_p, entries, sizes,
+                                              STACK_TEST_MULTI_ENTRIES)) ||
+        (STACK_TEST_MULTI_ENTRIES != stack_get_num_entries(stack_p)) ||
+        stack_err_e_is_error(stack_drop(stack_p,
+                                        STACK_TEST_MULTI_ENTRIES - 1))) {
+        printf("Error: Push multi: Can't fill growing stack\n");
+        return (-1);
+    }
+    out_size = sizeof(out);
+    if (stack_err_e_is_error(stack_pop(stack_p, out, &out_size)) ||
+        (out_size != sizes[0]) || (0 != memcmp(out, words[0], out_size))) {
+        printf("Error: Push multi: Bottom entry corrupted\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    /*
+     * A drop-oldest stack keeps the newest entries.
+     */
+    stack_p = stack_alloc_flags(2, STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_DROP_OLDEST);
+    if ((NULL == stack_p) ||
+        stack_err_e_is_error(stack_push_multi(stack_p, entries, sizes, 5)) ||
+        (2 != stack_get_num_entries(stack_p))) {
+        printf("Error: Push multi: Drop-oldest stack not bounded\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    return (0);
+}
+
+/**
+ * Test the counters of #STACK_FLAG_STATS stacks.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_stats (void)
+{
+    stack_t       *stack_p  = NULL;              /* Stack to manipulate       */
+    stack_stats_t  stats;                        /* Stack counters            */
+    unsigned char  data[300];                    /* Entry data                */
+    size_t         out_size = 0;                 /* Size of popped entry      */
+    void          *view_p   = NULL;              /* Top entry in stack        */
+
+    memset(data, 0, sizeof(data));
+    stack_p = stack_alloc();
+    if ((NULL == stack_p) ||
+        (STACK_E_INVALID != stack_get_stats(stack_p, &stats)) ||
+        (STACK_E_INVALID != stack_reset_stats(stack_p))) {
+        printf("Error: Stats: Plain stack has counters\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_STATS | STACK_FLAG_GROW);
+    if (NULL == stack_p) {
+        printf("Error: Stats: Can't init stack\n");
+        return (-1);
+    }
+
+    /*
+     * Sizes 0, 1, 3 and 300 land in buckets 0, 1, 2 and 9. Growing the
+     * buffer for the last entry moves the entries already in it, so more
+     * bytes are copied than were pushed and popped.
+     */
+    out_size = sizeof(data);
+    if (stack_err_e_is_error(stack_push(stack_p, data, 0)) ||
+        stack_err_e_is_error(stack_push(stack_p, data, 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, data, 3)) ||
+        stack_err_e_is_error(stack_push(stack_p, data, 300)) ||
+        stack_err_e_is_error(stack_push(stack_p, data, 300)) ||
+        stack_err_e_is_error(stack_push(stack_p, data, 300)) ||
+        stack_err_e_is_error(stack_push(stack_p, data, 300)) ||
+        stack_err_e_is_error(stack_top_view(stack_p, &view_p, &out_size)) ||
+        stack_err_e_is_error(stack_pop(stack_p, data, &out_size)) ||
+        stack_err_e_is_error(stack_drop(stack_p, 2)) ||
+        stack_err_e_is_error(stack_get_stats(stack_p, &stats))) {
+        printf("Error: Stats: Can't run operations\n");
+        return (-1);
+    }
+    if ((7 != stats.num_pushes) || (3 != stats.num_pops) ||
+        (1 != stats.num_peeks) || (7 != stats.max_entries) ||
+        (((7 * sizeof(size_t)) + 1204) != stats.max_used_size) ||
+        (1 != stats.sizes[0]) || (1 != stats.sizes[1]) ||
+        (1 != stats.sizes[2]) || (4 != stats.sizes[9]) ||
+        (stats.bytes_copied < 1504)) {
+        printf("Error: Stats: Wrong counters\n");
+        return (-1);
+    }
+
+    /*
+     * After a reset, the high-water marks start from what is left.
+     */
+    if (stack_err_e_is_error(stack_reset_stats(stack_p)) ||
+        stack_err_e_is_error(stack_get_stats(stack_p, &stats)) ||
+        (0 != stats.num_pushes) || (0 != stats.bytes_copied) ||
+        (4 != stats.max_entries)) {
+        printf("Error: Stats: Counters not reset\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    if ((NULL != stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                   STACK_MAX_ENTRY_SIZE_NONE,
+                                   STACK_DEFAULT_ENTRY_SIZE,
+                                   STACK_MAX_SIZE_NONE,
+                                   STACK_FLAG_STATS | STACK_FLAG_MPSC)) ||
+        (NULL != stack_open_shm("/stack_test_stats", 4096,
+                                STACK_FLAG_STATS | STACK_SHM_CREATE))) {
+        printf("Error: Stats: Accepted bad flags\n");
+        return (-1);
+    }
+
+    return (0);
+}
+
+/**
+ * Open a growable stack with a journal, recovering whatever the journal
+ * holds.
+ *
+ * @param[in] path_p
+ *     Path of journal, without suffix.
+ * @returns
+ *     Journaled stack, or NULL if an error occurred.
+ */
+static stack_t *stack_test_journal_open (const char *path_p)
+{
+    stack_t     *stack_p = NULL;                 /* Journaled stack           */
+    stack_err_e  err     = STACK_E_OK;           /* Operation return code     */
+
+    stack_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                                STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE,
+                                STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_GROW);
+    if (NULL == stack_p) {
+        printf("Error: Journal: Can't init stack\n");
+        return (NULL);
+    }
+    err = stack_journal_open(stack_p, path_p, 0, 0);
+    if (stack_err_e_is_error(err)) {
+        printf("Error: Journal: Can't open journal: %d(%s)\n",
+               err, stack_err_e_to_string(err));
+        stack_free(stack_p);
+        return (NULL);
+    }
+
+    return (stack_p);
+}
+
+/**
+ * Check the entries of a stack without changing it.
+ *
+ * @param[in] stack_p
+ *     Stack to check.
+ * @param[in] expected_p
+ *     Expected entries, one character each, from the top down.
+ * @retval 0
+ *     Entries match.
+ * @retval -1
+ *     Entries don't match.
+ */
+static int stack_test_journal_expect (stack_t *stack_p, const char *expected_p)
+{
+    stack_iter_t  iter;                          /* Walk over entries         */
+    const void   *entry_p    = NULL;             /* Current entry             */
+    size_t        entry_size = 0;                /* Size of current entry     */
+    size_t        i          = 0;                /* Loop index counter        */
+
+    stack_iter_init(&iter, stack_p);
+    for (i = 0; stack_iter_next(&iter, &entry_p, &entry_size); i++) {
+        if ((i >= strlen(expected_p)) || (1 != entry_size) ||
+            (expected_p[i] != *(const char *)entry_p)) {
+            break;
+        }
+    }
+    if ((i != strlen(expected_p)) ||
+        (strlen(expected_p) != stack_get_num_entries(stack_p))) {
+        printf("Error: Journal: Recovered entry %zu wrong, expected '%s'\n",
+               i, expected_p);
+        return (-1);
+    }
+
+    return (0);
+}
+
+/**
+ * Test journaled stacks and their recovery.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_journal (void)
+{
+    stack_t      *stack_p   = NULL;              /* Journaled stack           */
+    stack_t      *other_p   = NULL;              /* Unsupported stack         */
+    char          path[64];                      /* Journal path              */
+    char          file[80];                      /* Journal or snapshot file  */
+    const void   *entries[] = { "e", "f" };      /* Entries to push together  */
+    size_t        sizes[]   = { 1, 1 };          /* Sizes of those entries    */
+    void         *entry_p   = NULL;              /* Reserved entry            */
+    FILE         *file_p    = NULL;              /* Journal to damage         */
+
+    snprintf(path, sizeof(path), "/tmp/stack_test_journal.%d", (int)getpid());
+    snprintf(file, sizeof(file), "%s.journal", path);
+    (void)unlink(file);
+    snprintf(file, sizeof(file), "%s.snap", path);
+    (void)unlink(file);
+
+    /*
+     * Every kind of change is journaled: pushes, pops, entries moved or
+     * rewritten in place, and entries filled after they were reserved.
+     */
+    stack_p = stack_test_journal_open(path);
+    if (NULL == stack_p) {
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, "a", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "b", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "c", 1)) ||
+        stack_err_e_is_error(stack_push(stack_p, "d", 1)) ||
+        (0 != stack_test_pop_expect(stack_p, "d")) ||
+        stack_err_e_is_error(stack_swap(stack_p)) ||
+        stack_err_e_is_error(stack_replace_top(stack_p, "B", 1)) ||
+        stack_err_e_is_error(stack_push_multi(stack_p, entries, sizes, 2)) ||
+        stack_err_e_is_error(stack_push_reserve(stack_p, 1, &entry_p))) {
+        printf("Error: Journal: Can't run operations\n");
+        return (-1);
+    }
+    *(char *)entry_p = 'g';
+    if (stack_err_e_is_error(stack_drop(stack_p, 1)) ||
+        stack_err_e_is_error(stack_push_reserve(stack_p, 1, &entry_p))) {
+        printf("Error: Journal: Can't run operations\n");
+        return (-1);
+    }
+    *(char *)entry_p = 'h';
+    stack_free(stack_p);
+
+    stack_p = stack_test_journal_open(path);
+    if ((NULL == stack_p) ||
+        (0 != stack_test_journal_expect(stack_p, "hfeBca"))) {
+        return (-1);
+    }
+
+    /*
+     * Recovery replays the journal onto the last checkpoint.
+     */
+    if (stack_err_e_is_error(stack_journal_checkpoint(stack_p)) ||
+        stack_err_e_is_error(stack_push(stack_p, "i", 1)) ||
+        stack_err_e_is_error(stack_drop(stack_p, 2)) ||
+        stack_err_e_is_error(stack_push(stack_p, "j", 1)) ||
+        stack_err_e_is_error(stack_journal_sync(stack_p))) {
+        printf("Error: Journal: Can't checkpoint\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+    stack_p = stack_test_journal_open(path);
+    if ((NULL == stack_p) ||
+        (0 != stack_test_journal_expect(stack_p, "jfeBca"))) {
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    /*
+     * A torn record at the end of the journal is cut off, and records
+     * appended later are still found.
+     */
+    snprintf(file, sizeof(file), "%s.journal", path);
+    file_p = fopen(file, "ab");
+    if ((NULL == file_p) || (1 != fwrite("\x01\x00\x00", 3, 1, file_p)) ||
+        (0 != fclose(file_p))) {
+        printf("Error: Journal: Can't damage journal\n");
+        return (-1);
+    }
+    stack_p = stack_test_journal_open(path);
+    if ((NULL == stack_p) ||
+        (0 != stack_test_journal_expect(stack_p, "jfeBca"))) {
+        return (-1);
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, "k", 1))) {
+        printf("Error: Journal: Can't push after recovery\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+    stack_p = stack_test_journal_open(path);
+    if ((NULL == stack_p) ||
+        (0 != stack_test_journal_expect(stack_p, "kjfeBca"))) {
+        return (-1);
+    }
+
+    /*
+     * A stack gets one journal, and only when it is empty.
+     */
+    other_p = stack_alloc_flags(4, STACK_MAX_ENTRY_SIZE_NONE,
+                                STACK_DEFAULT_ENTRY_SIZE, STACK_MAX_SIZE_NONE,
+                                STACK_FLAG_DROP_OLDEST);
+    if ((STACK_E_INVALID != stack_journal_open(stack_p, path, 0, 0)) ||
+        (NULL == other_p) ||
+        (STACK_E_INVALID != stack_journal_open(other_p, path, 0, 0)) ||
+        (STACK_E_INVALID != stack_journal_sync(other_p)) ||
+        (STACK_E_INVALID != stack_journal_checkpoint(other_p))) {
+        printf("Error: Journal: Accepted bad stack\n");
+        return (-1);
+    }
+    stack_free(other_p);
+    stack_free(stack_p);
+
+    (void)unlink(file);
+    snprintf(file, sizeof(file), "%s.snap", path);
+    (void)unlink(file);
+
+    return (0);
+}
+
+/**
+ * Get the size of a file.
+ *
+ * @param[in] file_p
+ *     Path of file.
+ * @returns
+ *     Size of file in bytes, or 0 if it can't be found.
+ */
+static size_t stack_test_file_size (const char *file_p)
+{
+    struct stat st;                              /* File status               */
+
+    if (0 != stat(file_p, &st)) {
+        return (0);
+    }
+    return (st.st_size);
+}
+
+/**
+ * Test delta checkpoints of journaled stacks, and rebuilding stacks from
+ * their files.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_journal_delta (void)
+{
+    stack_t    *stack_p   = NULL;                /* Journaled stack           */
+    stack_t    *copy_p    = NULL;                /* Rebuilt stack             */
+    char        path[64];                        /* Journal path              */
+    char        file[80];                        /* Snapshot file             */
+    char        journal[80];                     /* Journal file              */
+    char        expected[32];                    /* Expected entries          */
+    char        entry[2]  = { 0, 0 };            /* Entry to push             */
+    size_t      full_size = 0;                   /* Size of full snapshot     */
+    size_t      size      = 0;                   /* Size of snapshot file     */
+    FILE       *file_p    = NULL;                /* Snapshot to damage        */
+    int         i         = 0;                   /* Loop index counter        */
+
+    snprintf(path, sizeof(path), "/tmp/stack_test_delta.%d", (int)getpid());
+    snprintf(journal, sizeof(journal), "%s.journal", path);
+    (void)unlink(journal);
+    snprintf(file, sizeof(file), "%s.snap", path);
+    (void)unlink(file);
+
+    /*
+     * The first checkpoint has no snapshot to add a delta to.
+     */
+    stack_p = stack_test_journal_open(path);
+    if (NULL == stack_p) {
+        return (-1);
+    }
+    for (i = 0; i < 26; i++) {
+        entry[0] = 'A' + i;
+        if (stack_err_e_is_error(stack_push(stack_p, entry, 1))) {
+            printf("Error: Journal delta: Can't push\n");
+            return (-1);
+        }
+    }
+    if (stack_err_e_is_error(stack_journal_checkpoint_delta(stack_p))) {
+        printf("Error: Journal delta: Can't checkpoint\n");
+        return (-1);
+    }
+    full_size = stack_test_file_size(file);
+
+    /*
+     * Later deltas only hold the entries above the untouched bottom ones.
+     */
+    if (stack_err_e_is_error(stack_drop(stack_p, 2)) ||
+        stack_err_e_is_error(stack_push(stack_p, "y", 1)) ||
+        stack_err_e_is_error(stack_journal_checkpoint_delta(stack_p)) ||
+        stack_err_e_is_error(stack_push(stack_p, "z", 1)) ||
+        stack_err_e_is_error(stack_journal_checkpoint_delta(stack_p)) ||
+        stack_err_e_is_error(stack_push(stack_p, "1", 1))) {
+        printf("Error: Journal delta: Can't checkpoint deltas\n");
+        return (-1);
+    }
+    size = stack_test_file_size(file);
+    if ((0 == full_size) || (size <= full_size) ||
+        ((size - full_size) >= (full_size / 2))) {
+        printf("Error: Journal delta: Snapshot file grew from %zu to %zu "
+               "bytes\n", full_size, size);
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    strcpy(expected, "1zyXWVUTSRQPONMLKJIHGFEDCBA");
+    stack_p = stack_test_journal_open(path);
+    if ((NULL == stack_p) ||
+        (0 != stack_test_journal_expect(stack_p, expected))) {
+        return (-1);
+    }
+
+    /*
+     * A copy can be rebuilt from the files without journaling it.
+     */
+    copy_p = stack_alloc_flags(STACK_MAX_ENTRIES_NONE,
+                               STACK_MAX_ENTRY_SIZE_NONE,
+                               STACK_DEFAULT_ENTRY_SIZE, STACK_MAX_SIZE_NONE,
+                               STACK_FLAG_GROW);
+    if ((NULL == copy_p) ||
+        stack_err_e_is_error(stack_journal_restore(copy_p, path)) ||
+        (0 != stack_test_journal_expect(copy_p, expected)) ||
+        (STACK_E_INVALID != stack_journal_sync(copy_p)) ||
+        (STACK_E_INVALID != stack_journal_restore(copy_p, path)) ||
+        (STACK_E_INVALID != stack_journal_restore(stack_p, path)) ||
+        (STACK_E_INVALID != stack_journal_checkpoint_delta(copy_p))) {
+        printf("Error: Journal delta: Bad restore\n");
+        return (-1);
+    }
+    stack_free(copy_p);
+    stack_free(stack_p);
+
+    /*
+     * A torn delta at the end of the snapshot file is ignored, and
+     * overwritten by the next one.
+     */
+    file_p = fopen(file, "ab");
+    if ((NULL == file_p) || (1 != fwrite("\x03\x00\x00", 3, 1, file_p)) ||
+        (0 != fclose(file_p))) {
+        printf("Error: Journal delta: Can't damage snapshot\n");
+        return (-1);
+    }
+    stack_p = stack_test_journal_open(path);
+    if ((NULL == stack_p) ||
+        (0 != stack_test_journal_expect(stack_p, expected)) ||
+        stack_err_e_is_error(stack_push(stack_p, "2", 1)) ||
+        stack_err_e_is_error(stack_journal_checkpoint_delta(stack_p))) {
+        printf("Error: Journal delta: Can't checkpoint after recovery\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+    strcpy(expected, "21zyXWVUTSRQPONMLKJIHGFEDCBA");
+    stack_p = stack_test_journal_open(path);
+    if ((NULL == stack_p) ||
+        (0 != stack_test_journal_expect(stack_p, expected))) {
+        return (-1);
+    }
+
+    /*
+     * Once nearly everything has changed, a full snapshot is smaller.
+     */
+    if (stack_err_e_is_error(stack_drop(stack_p, 28)) ||
+        stack_err_e_is_error(stack_push(stack_p, "q", 1)) ||
+        stack_err_e_is_error(stack_journal_checkpoint_delta(stack_p))) {
+        printf("Error: Journal delta: Can't checkpoint\n");
+        return (-1);
+    }
+    stack_free(stack_p);
+    if (stack_test_file_size(file) >= full_size) {
+        printf("Error: Journal delta: Didn't write a full snapshot\n");
+        return (-1);
+    }
+    stack_p = stack_test_journal_open(path);
+    if ((NULL == stack_p) || (0 != stack_test_journal_expect(stack_p, "q"))) {
+        return (-1);
+    }
+    stack_free(stack_p);
+
+    (void)unlink(journal);
+    (void)unlink(file);
+
+    return (0);
+}
+
+/**
+ * Size of the large entry printed by stack_test_print_to(), more than
+ * fits in the formatting buffer at once.
+ */
+#define STACK_TEST_PRINT_BIG_SIZE 100000
+
+/**
+ * Test printing stacks in each format.
+ *
+ * @retval 0
+ *     Successful completion.
+ * @retval -1
+ *     An error occurred.
+ */
+static int stack_test_print_to (void)
+{
+    stack_t        *stack_p  = NULL;             /* Stack to print            */
+    FILE           *stream_p = NULL;             /* Stream to print to        */
+    char           *out_p    = NULL;             /* Printed text              */
+    size_t          out_size = 0;                /* Length of printed text    */
+    unsigned char  *big_p    = NULL;             /* Large entry               */
+    const char     *data_p   = NULL;             /* Printed data of entry     */
+    size_t          i        = 0;                /* Loop index counter        */
+    int             rc       = 0;                /* Test result               */
+
+    stack_p = stack_alloc_custom(STACK_MAX_ENTRIES_NONE,
+                                 STACK_MAX_ENTRY_SIZE_NONE,
+                                 STACK_DEFAULT_ENTRY_SIZE,
+                                 2 * STACK_TEST_PRINT_BIG_SIZE);
+    big_p = malloc(STACK_TEST_PRINT_BIG_SIZE);
+    if ((NULL == stack_p) || (NULL == big_p)) {
+        printf("Error: Print: Can't init stack\n");
+        return (-1);
+    }
+    for (i = 0; i < STACK_TEST_PRINT_BIG_SIZE; i++) {
+        big_p[i] = (unsigned char)i;
+    }
+    if (stack_err_e_is_error(stack_push(stack_p, big_p,
+                                        STACK_TEST_PRINT_BIG_SIZE)) ||
+        stack_err_e_is_error(stack_push(stack_p, "a\"b\n\x7f", 5))) {
+        printf("Error: Print: Can't push\n");
+        return (-1);
+    }
+    if (STACK_E_INVALID != stack_print_to(stack_p, stdout,
+                                          (stack_print_format_e)99)) {
+        printf("Error: Print: Accepted bad format\n");
+        return (-1);
+    }
+
+    /*
+     * Hex output of the large entry must cross several buffer flushes
+     * intact.
+     */
+    stream_p = open_memstream(&out_p, &out_size);
+    if ((NULL == stream_p) ||
+        stack_err_e_is_error(stack_print_to(stack_p, stream_p,
+                                            STACK_PRINT_HEX))) {
+        printf("Error: Print: Can't print hex\n");
+        return (-1);
+    }
+    (void)fclose(stream_p);
+    data_p = strstr(out_p, "size=100000 data=");
+    if ((NULL == data_p) || (NULL == strstr(out_p, "data=61:22:62:0A:7F>"))) {
+        printf("Error: Print: Bad hex output\n");
+        rc = -1;
+    } else {
+        data_p += strlen("size=100000 data=");
+        for (i = 0; (0 == rc) && (i < STACK_TEST_PRINT_BIG_SIZE); i++) {
+            if ((data_p[3 * i] != "0123456789ABCDEF"[(i & 0xFF) >> 4]) ||
+                (data_p[(3 * i) + 1] != "0123456789ABCDEF"[i & 0x0F]) ||
+                (data_p[(3 * i) + 2] !=
+                 ((i + 1 < STACK_TEST_PRINT_BIG_SIZE) ? ':' : '>'))) {
+                printf("Error: Print: Bad hex output at byte %lu\n", i);
+                rc = -1;
+            }
+        }
+    }
+    free(out_p);
+    out_p = NULL;
+
+    stream_p = open_memstream(&out_p, &out_size);
+    if ((NULL == stream_p) ||
+        stack_err_e_is_error(stack_print_to(stack_p, stream_p,
+                                            STACK_PRINT_ESCAPED))) {
+        printf("Error: Print: Can't print escaped\n");
+        return (-1);
+    }
+    (void)fclose(stream_p);
+    if (NULL == strstr(out_p, "size=5 data=\"a\\\"b\\n\\x7F\">")) {
+        printf("Error: Print: Bad escaped output\n");
+        rc = -1;
+    }
+    free(out_p);
+    out_p = NULL;
+
+    stream_p = open_memstream(&out_p, &out_size);
+    if ((NULL == stream_p) ||
+        stack_err_e_is_error(stack_print_to(stack_p, stream_p,
+                                            STACK_PRINT_JSON))) {
+        printf("Error: Print: Can't print JSON\n");
+        return (-1);
+    }
+    (void)fclose(stream_p);
+    if ((NULL == strstr(out_p, "\"entries\":2,")) ||
+        (NULL == strstr(out_p, "\"size\":5,\"data\":\"6122620A7F\"},\n")) ||
+        (0 != strcmp(out_p + out_size - 4, "\n]}\n"))) {
+        printf("Error: Print: Bad JSON output\n");
+        rc = -1;
+    }
+    free(out_p);
+    out_p = NULL;
+
+    /*
+     * Hex digits that follow a \x escape are escaped too, so that they
+     * can't be read as part of it.
+     */
+    stream_p = open_memstream(&out_p, &out_size);
+    if (stack_err_e_is_error(stack_push(stack_p, "\x01" "ag\x02" "7", 5)) ||
+        (NULL == stream_p) ||
+        stack_err_e_is_error(stack_print_to(stack_p, stream_p,
+                                            STACK_PRINT_ESCAPED))) {
+        printf("Error: Print: Can't print escaped hex digits\n");
+        return (-1);
+    }
+    (void)fclose(stream_p);
+    if (NULL == strstr(out_p, "size=5 data=\"\\x01\\x61g\\x02\\x37\">")) {
+        printf("Error: Print: Bad escaped hex digits\n");
+        rc = -1;
+    }
+    free(out_p);
+
+    free(big_p);
+    stack_free(stack_p);
+
+    return (rc);
+}
 
 /**
  * Command line interface.
@@ -130,5 +2860,63 @@ int main (__attribute__((unused)) int argc,
         return (-1);
     }
 
+    /*
+     * Exercise the remaining operations.
+     */
+    if (0 != stack_test_peek_range()) {
+        return (-1);
+    }
+    if (0 != stack_test_stack_ops()) {
+        return (-1);
+    }
+    if (0 != stack_test_transfer()) {
+        return (-1);
+    }
+    if (0 != stack_test_drain()) {
+        return (-1);
+    }
+    if (0 != stack_test_drop_oldest()) {
+        return (-1);
+    }
+    if (0 != stack_test_arena()) {
+        return (-1);
+    }
+    if (0 != stack_test_shm()) {
+        return (-1);
+    }
+    if (0 != stack_test_wait()) {
+        return (-1);
+    }
+    if (0 != stack_test_event_fd()) {
+        return (-1);
+    }
+    if (0 != stack_test_mpsc()) {
+        return (-1);
+    }
+    if (0 != stack_test_snapshot()) {
+        return (-1);
+    }
+    if (0 != stack_test_single_writer()) {
+        return (-1);
+    }
+    if (0 != stack_test_print_to()) {
+        return (-1);
+    }
+    if (0 != stack_test_grow()) {
+        return (-1);
+    }
+    if (0 != stack_test_push_multi()) {
+        return (-1);
+    }
+    if (0 != stack_test_stats()) {
+        return (-1);
+    }
+    if (0 != stack_test_journal()) {
+        return (-1);
+    }
+    if (0 != stack_test_journal_delta()) {
+        return (-1);
+    }
+
     return (0);
 }